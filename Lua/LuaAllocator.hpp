@@ -0,0 +1,119 @@
+#pragma once
+#include "lua/lua.hpp"
+#include "lua/lauxlib.hpp"
+
+#include <stdint.h>
+
+namespace Lua {
+
+	/// <summary>
+	/// Enum representing the memory allocator used by a <see cref="LuaState"/>.
+	/// </summary>
+	public enum class LuaAllocator : int {
+
+		/// <summary>
+		/// The system allocator (<c>realloc</c> and <c>free</c>).
+		/// </summary>
+		System = 0,
+
+		/// <summary>
+		/// A per-state size-class pool. Small blocks are carved from pages and recycled through free lists; all memory is released when the state is closed.
+		/// </summary>
+		Pool = 1,
+
+	};
+
+	/// <summary>
+	/// Struct representing the statistics of a state created with the <see cref="LuaAllocator::Pool"/> allocator.
+	/// </summary>
+	public value class LuaPoolStats {
+	public:
+
+		/// <summary>
+		/// Get the amount of pages obtained from the system.
+		/// </summary>
+		property uint64_t Pages {
+			uint64_t get() { return this->uPages; }
+		}
+
+		/// <summary>
+		/// Get the total size, in bytes, of the pages obtained from the system.
+		/// </summary>
+		property uint64_t PageBytes {
+			uint64_t get() { return this->uPageBytes; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes in pooled blocks currently in use, rounded up to their size classes.
+		/// </summary>
+		property uint64_t UsedBytes {
+			uint64_t get() { return this->uUsed; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes requested for the pooled blocks currently in use.
+		/// </summary>
+		property uint64_t RequestedBytes {
+			uint64_t get() { return this->uRequested; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes in free pooled blocks.
+		/// </summary>
+		property uint64_t FreeBytes {
+			uint64_t get() { return this->uFree; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes in blocks too large for the pool, served by the system allocator.
+		/// </summary>
+		property uint64_t LargeBytes {
+			uint64_t get() { return this->uLarge; }
+		}
+
+		/// <summary>
+		/// Get the amount of blocks too large for the pool.
+		/// </summary>
+		property uint64_t LargeBlocks {
+			uint64_t get() { return this->uLargeCount; }
+		}
+
+		/// <summary>
+		/// Get the fraction of pooled memory lost to rounding blocks up to their size classes.
+		/// </summary>
+		property double InternalFragmentation {
+			double get() { return this->uUsed == 0 ? 0.0 : static_cast<double>(this->uUsed - this->uRequested) / static_cast<double>(this->uUsed); }
+		}
+
+		/// <summary>
+		/// Get the fraction of carved pooled memory sitting in free lists.
+		/// </summary>
+		property double ExternalFragmentation {
+			double get() { return (this->uUsed + this->uFree) == 0 ? 0.0 : static_cast<double>(this->uFree) / static_cast<double>(this->uUsed + this->uFree); }
+		}
+
+	internal:
+
+		LuaPoolStats(const luaL_PoolStats& s) {
+			this->uPages = s.pages;
+			this->uPageBytes = s.pagebytes;
+			this->uUsed = s.used;
+			this->uRequested = s.requested;
+			this->uFree = s.free;
+			this->uLarge = s.large;
+			this->uLargeCount = s.nlarge;
+		}
+
+	private:
+
+		uint64_t uPages;
+		uint64_t uPageBytes;
+		uint64_t uUsed;
+		uint64_t uRequested;
+		uint64_t uFree;
+		uint64_t uLarge;
+		uint64_t uLargeCount;
+
+	};
+
+}
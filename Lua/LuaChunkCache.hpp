@@ -0,0 +1,71 @@
+#pragma once
+#include "lua/lua.hpp"
+
+#include <stdint.h>
+
+namespace Lua {
+
+	/// <summary>
+	/// Struct representing the statistics of the process-wide cache of compiled chunks (see <see cref="LuaState::ConfigureChunkCache"/>).
+	/// </summary>
+	public value class LuaChunkCacheStats {
+	public:
+
+		/// <summary>
+		/// Get the memory budget, in bytes, of the cache; 0 if the cache is disabled.
+		/// </summary>
+		property uint64_t Budget {
+			uint64_t get() { return this->uBudget; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes held by the cached chunks.
+		/// </summary>
+		property uint64_t Size {
+			uint64_t get() { return this->uSize; }
+		}
+
+		/// <summary>
+		/// Get the amount of chunks in the cache.
+		/// </summary>
+		property uint64_t Count {
+			uint64_t get() { return this->uCount; }
+		}
+
+		/// <summary>
+		/// Get the amount of loads served without compiling, by any state.
+		/// </summary>
+		property uint64_t Hits {
+			uint64_t get() { return this->uHits; }
+		}
+
+		/// <summary>
+		/// Get the amount of loads that had to compile their chunk.
+		/// </summary>
+		property uint64_t Misses {
+			uint64_t get() { return this->uMisses; }
+		}
+
+	internal:
+
+		static LuaChunkCacheStats Query() {
+			LuaChunkCacheStats stats;
+			stats.uBudget = lua_chunkcacheinfo(LUA_CCBUDGET);
+			stats.uSize = lua_chunkcacheinfo(LUA_CCSIZE);
+			stats.uCount = lua_chunkcacheinfo(LUA_CCCOUNT);
+			stats.uHits = lua_chunkcacheinfo(LUA_CCHITS);
+			stats.uMisses = lua_chunkcacheinfo(LUA_CCMISSES);
+			return stats;
+		}
+
+	private:
+
+		uint64_t uBudget;
+		uint64_t uSize;
+		uint64_t uCount;
+		uint64_t uHits;
+		uint64_t uMisses;
+
+	};
+
+}
@@ -0,0 +1,227 @@
+#pragma once
+#include "lua/lua.hpp"
+
+#include <stdint.h>
+
+namespace Lua {
+
+	/// <summary>
+	/// Enum representing the phases of a garbage-collection cycle, as reported by the collector telemetry.
+	/// </summary>
+	public enum class GarbageCollectPhase : int {
+
+		/// <summary>
+		/// Restarting a cycle and incrementally marking reachable objects.
+		/// </summary>
+		Propagate = LUA_GCPHPROPAGATE,
+
+		/// <summary>
+		/// The atomic (stop-the-world) part of marking, including weak table clearing.
+		/// </summary>
+		Atomic = LUA_GCPHATOMIC,
+
+		/// <summary>
+		/// Sweeping dead objects and freeing their memory.
+		/// </summary>
+		Sweep = LUA_GCPHSWEEP,
+
+		/// <summary>
+		/// Running <c>__gc</c> metamethods of collected objects.
+		/// </summary>
+		Finalize = LUA_GCPHFINALIZE,
+
+	};
+
+	/// <summary>
+	/// Struct representing one stretch of garbage-collector work done in a single phase.
+	/// </summary>
+	public value class GarbageCollectRecord {
+	public:
+
+		/// <summary>
+		/// Get the sequence number of the record. Sequence numbers increase by one for each record.
+		/// </summary>
+		property uint64_t Sequence {
+			uint64_t get() { return this->uSequence; }
+		}
+
+		/// <summary>
+		/// Get the collection cycle the record belongs to.
+		/// </summary>
+		property uint64_t Cycle {
+			uint64_t get() { return this->uCycle; }
+		}
+
+		/// <summary>
+		/// Get the phase the collector was working in.
+		/// </summary>
+		property GarbageCollectPhase Phase {
+			GarbageCollectPhase get() { return this->ePhase; }
+		}
+
+		/// <summary>
+		/// Get if the work was part of a young (minor) generational collection.
+		/// </summary>
+		property bool IsMinor {
+			bool get() { return this->bMinor; }
+		}
+
+		/// <summary>
+		/// Get the monotonic clock value, in nanoseconds, at which the work started.
+		/// </summary>
+		property uint64_t StartNanoseconds {
+			uint64_t get() { return this->uStart; }
+		}
+
+		/// <summary>
+		/// Get the duration of the work in nanoseconds.
+		/// </summary>
+		property uint64_t DurationNanoseconds {
+			uint64_t get() { return this->uDuration; }
+		}
+
+		/// <summary>
+		/// Get the duration of the work.
+		/// </summary>
+		property System::TimeSpan Duration {
+			System::TimeSpan get() { return System::TimeSpan::FromTicks(static_cast<int64_t>(this->uDuration / 100)); }
+		}
+
+		/// <summary>
+		/// Get the amount of objects traversed by the marker.
+		/// </summary>
+		property uint64_t Marked {
+			uint64_t get() { return this->uMarked; }
+		}
+
+		/// <summary>
+		/// Get the amount of objects visited by the sweeper.
+		/// </summary>
+		property uint64_t Swept {
+			uint64_t get() { return this->uSwept; }
+		}
+
+		/// <summary>
+		/// Get the amount of finalizers that were called.
+		/// </summary>
+		property uint64_t Finalized {
+			uint64_t get() { return this->uFinalized; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes released, not offset by any memory allocated meanwhile (for example by finalizers).
+		/// </summary>
+		property uint64_t BytesFreed {
+			uint64_t get() { return this->uFreed; }
+		}
+
+	internal:
+
+		GarbageCollectRecord(const lua_GCStat& s) {
+			this->uSequence = s.seq;
+			this->uCycle = s.cycle;
+			this->ePhase = static_cast<GarbageCollectPhase>(s.phase);
+			this->bMinor = s.minor != 0;
+			this->uStart = s.start;
+			this->uDuration = s.duration;
+			this->uMarked = s.marked;
+			this->uSwept = s.swept;
+			this->uFinalized = s.finalized;
+			this->uFreed = s.freed;
+		}
+
+	private:
+
+		uint64_t uSequence;
+		uint64_t uCycle;
+		GarbageCollectPhase ePhase;
+		bool bMinor;
+		uint64_t uStart;
+		uint64_t uDuration;
+		uint64_t uMarked;
+		uint64_t uSwept;
+		uint64_t uFinalized;
+		uint64_t uFreed;
+
+	};
+
+	/// <summary>
+	/// Struct representing the accumulated garbage-collector telemetry of a single phase.
+	/// </summary>
+	public value class GarbageCollectPhaseTotal {
+	public:
+
+		/// <summary>
+		/// Get the amount of records accumulated.
+		/// </summary>
+		property uint64_t Count {
+			uint64_t get() { return this->uCount; }
+		}
+
+		/// <summary>
+		/// Get the total time spent in the phase.
+		/// </summary>
+		property System::TimeSpan Duration {
+			System::TimeSpan get() { return System::TimeSpan::FromTicks(static_cast<int64_t>(this->uDuration / 100)); }
+		}
+
+		/// <summary>
+		/// Get the longest single stretch of work spent in the phase.
+		/// </summary>
+		property System::TimeSpan MaxDuration {
+			System::TimeSpan get() { return System::TimeSpan::FromTicks(static_cast<int64_t>(this->uMaxDuration / 100)); }
+		}
+
+		/// <summary>
+		/// Get the amount of objects traversed by the marker.
+		/// </summary>
+		property uint64_t Marked {
+			uint64_t get() { return this->uMarked; }
+		}
+
+		/// <summary>
+		/// Get the amount of objects visited by the sweeper.
+		/// </summary>
+		property uint64_t Swept {
+			uint64_t get() { return this->uSwept; }
+		}
+
+		/// <summary>
+		/// Get the amount of finalizers that were called.
+		/// </summary>
+		property uint64_t Finalized {
+			uint64_t get() { return this->uFinalized; }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes released.
+		/// </summary>
+		property uint64_t BytesFreed {
+			uint64_t get() { return this->uFreed; }
+		}
+
+	internal:
+
+		GarbageCollectPhaseTotal(const lua_GCPhaseTotal& t) {
+			this->uCount = t.count;
+			this->uDuration = t.duration;
+			this->uMaxDuration = t.maxduration;
+			this->uMarked = t.marked;
+			this->uSwept = t.swept;
+			this->uFinalized = t.finalized;
+			this->uFreed = t.freed;
+		}
+
+	private:
+
+		uint64_t uCount;
+		uint64_t uDuration;
+		uint64_t uMaxDuration;
+		uint64_t uMarked;
+		uint64_t uSwept;
+		uint64_t uFinalized;
+		uint64_t uFreed;
+
+	};
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "lua/lua.hpp"
+
+namespace Lua {
+
+	/// <summary>
+	/// Enum representing the value reported for each allocation site by <see cref="LuaState::DumpHeapProfile"/>.
+	/// </summary>
+	public enum class HeapProfileMode : int {
+
+		/// <summary>
+		/// The estimated amount of bytes held by objects that are still alive.
+		/// </summary>
+		InUseBytes = LUA_HPINUSE,
+
+		/// <summary>
+		/// The estimated amount of objects that are still alive.
+		/// </summary>
+		InUseObjects = LUA_HPINUSEOBJS,
+
+		/// <summary>
+		/// The estimated amount of bytes allocated since the profiler was started.
+		/// </summary>
+		AllocatedBytes = LUA_HPALLOC,
+
+		/// <summary>
+		/// The estimated amount of allocations since the profiler was started.
+		/// </summary>
+		AllocatedObjects = LUA_HPALLOCOBJS,
+
+		/// <summary>
+		/// The estimated amount of bytes held by objects that survived at least one garbage-collection cycle.
+		/// </summary>
+		SurvivedBytes = LUA_HPSURVIVED,
+
+	};
+
+}
@@ -29,7 +29,9 @@ namespace Lua {
 
 		Package = 512,
 
-		All = Base | Coroutine | Table | IO | OS | String | UTF8 | Math | Debug | Package
+		Scheduler = 1024,
+
+		All = Base | Coroutine | Table | IO | OS | String | UTF8 | Math | Debug | Package | Scheduler
 
 	};
 
@@ -235,13 +235,13 @@ int csharp_invoke_luahandle(lua_State* L) {
 	// Grab delegate information
 	CSharpClosure* p = static_cast<CSharpClosure*>(lua_touserdata(L, lua_upvalueindex(1)));
 
-	try {
+	// Result of the delegate
+	int result;
 
-		// Create
-		int result = p->invoke(L);
+	try {
 
-		// Invoke and return
-		return result;
+		// Invoke
+		result = p->invoke(L);
 
 	} catch (System::Exception^ ex) {
 
@@ -262,6 +262,14 @@ int csharp_invoke_luahandle(lua_State* L) {
 
 	}
 
+	// Suspend the coroutine until the host completes the call; yields unwind the stack, so this must be done outside the try block
+	if (result == Lua::LuaState::Pending) {
+		return luaL_pending(L, NULL, 0);
+	}
+
+	// Return
+	return result;
+
 }
 
 void Lua::LuaMarshal::CreateCSharpLuaFunction(lua_State* L, LuaFunctionDelegate^ delegate) {
@@ -5,7 +5,9 @@
 #include "LuaException.hpp"
 #include "CLIMacros.hpp"
 #include <stdlib.h>
+#include <string>
 #include <vector>
+#include <vcclr.h>
 
 using namespace System::Runtime::InteropServices;
 
@@ -34,8 +36,8 @@ Lua::CallResult Lua::LuaState::LoadString(System::String^ lStr) {
 	// Grab C++ string
 	__UnmanagedString(strPtr, lStr, pLStr);
 
-	// Invoke
-	int result = luaL_loadstring(this->pState, pLStr);
+	// Invoke (through the chunk cache)
+	int result = lua_loadcached(this->pState, pLStr, strlen(pLStr), pLStr);
 
 	// Free unmanaged string
 	__UnmangedFreeString(strPtr);
@@ -61,23 +63,13 @@ Lua::CallResult Lua::LuaState::LoadFile(System::String^ filepath) {
 
 }
 
-Lua::CallResult Lua::LuaState::LoadStream(System::IO::Stream^ stream, System::String^ chunkname) {
-
-	// Grab C++ chunk name string
-	__UnmanagedString(strPtr, chunkname, pLStr);
-
-	// Create reader
-	auto reader = gcnew System::IO::BinaryReader(stream);
+Lua::CallResult Lua::LuaState::LoadMapped(System::String^ filepath) {
 
-	// Handle bytes
-	array<unsigned  char>^ data = reader->ReadBytes(static_cast<int>(stream->Length));
-
-	// Grab pinned ptr
-	pin_ptr<unsigned char> pinnedPtr = &data[0];
-	const char* pData = reinterpret_cast<const char*>(pinnedPtr);
+	// Grab C++ string
+	__UnmanagedString(strPtr, filepath, pLStr);
 
-	// Invoke load
-	int result = luaL_loadbuffer(this->pState, pData, static_cast<int>(stream->Length), pLStr);
+	// Invoke
+	int result = luaL_loadmapped(this->pState, pLStr, NULL);
 
 	// Free unmanaged string
 	__UnmangedFreeString(strPtr);
@@ -87,44 +79,85 @@ Lua::CallResult Lua::LuaState::LoadStream(System::IO::Stream^ stream, System::St
 
 }
 
-#pragma managed(push, off)
-struct csharp_dumpbuffer {
-	unsigned char* data;
-	size_t size;
+struct csharp_streamreader {
+	gcroot<System::IO::Stream^> stream;
+	gcroot<array<unsigned char>^> buffer;
+	gcroot<System::Exception^> error;
 };
-#pragma managed(pop)
 
-const char* csharp_luadumpreader(lua_State* L, void* data, size_t* sz) {
+size_t csharp_luastreamfill(void* ud, char* buff, size_t size) {
 
-	// Get buffer
-	csharp_dumpbuffer* buf = static_cast<csharp_dumpbuffer*>(data);
+	// Get reader
+	csharp_streamreader* reader = static_cast<csharp_streamreader*>(ud);
+	array<unsigned char>^ data = reader->buffer;
 
-	// Make space for data
-	char* result = new char[buf->size];
+	try {
 
-	// Copy from buffer
-	memcpy_s(result, buf->size, buf->data, buf->size);
-	
-	// Return result
-	return result;
+		// Read next piece (0 at the end of the stream)
+		int n = reader->stream->Read(data, 0, static_cast<int>(size < static_cast<size_t>(data->Length) ? size : data->Length));
+
+		// Copy to the buffer of the Lua reader
+		if (n > 0)
+			Marshal::Copy(data, 0, System::IntPtr(buff), n);
+
+		// Return amount read
+		return static_cast<size_t>(n);
+
+	} catch (System::Exception^ ex) {
+
+		// Keep error for LoadStream and end the chunk
+		reader->error = ex;
+		return 0;
+
+	}
 
 }
 
-Lua::CallResult Lua::LuaState::Load(array<unsigned char>^ buffer, System::String^ chunkname) {
+Lua::CallResult Lua::LuaState::LoadStream(System::IO::Stream^ stream, System::String^ chunkname) {
 
 	// Grab C++ chunk name string
 	__UnmanagedString(strPtr, chunkname, pLStr);
 
-	// Get pinned
-	pin_ptr<unsigned char> pinnedPtr = &buffer[0];
-
-	// Grab a pointer
-	csharp_dumpbuffer buf{};
-	buf.data = static_cast<unsigned char*>(pinnedPtr);
-	buf.size = buffer->Length;
+	// Create reader (the stream is read in pieces, so it need not be seekable)
+	csharp_streamreader reader;
+	reader.stream = stream;
+	reader.buffer = gcnew array<unsigned char>(static_cast<int>(LUAL_FILLSIZE));
 
 	// Invoke load
-	int result = lua_load(this->pState, csharp_luadumpreader, static_cast<void*>(&buf), pLStr, 0);
+	int result = luaL_loadfill(this->pState, csharp_luastreamfill, &reader, pLStr, NULL);
+
+	// Free unmanaged string
+	__UnmangedFreeString(strPtr);
+
+	// Replace result of an incomplete chunk by the read error
+	System::Exception^ error = reader.error;
+	if (error != nullptr) {
+		lua_pop(this->pState, 1);
+		System::String^ message = System::String::Format("cannot read {0}: {1}", chunkname, error->Message);
+		__UnmanagedString(errPtr, message, pErr);
+		lua_pushstring(this->pState, pErr);
+		__UnmangedFreeString(errPtr);
+		return CallResult::FileError;
+	}
+
+	// Return if success
+	return static_cast<CallResult>(result);
+
+}
+
+Lua::CallResult Lua::LuaState::Load(array<unsigned char>^ buffer, System::String^ chunkname) {
+
+	// Grab C++ chunk name string
+	__UnmanagedString(strPtr, chunkname, pLStr);
+
+	// Get pinned (an empty buffer has no first element to pin)
+	pin_ptr<unsigned char> pinnedPtr = nullptr;
+	if (buffer->Length > 0)
+		pinnedPtr = &buffer[0];
+
+	// Invoke load, reading the pinned bytes in place
+	const char* data = reinterpret_cast<const char*>(static_cast<unsigned char*>(pinnedPtr));
+	int result = luaL_loadbufferx(this->pState, data, static_cast<size_t>(buffer->Length), pLStr, nullptr);
 
 	// Free unmanaged string
 	__UnmangedFreeString(strPtr);
@@ -134,13 +167,31 @@ Lua::CallResult Lua::LuaState::Load(array<unsigned char>^ buffer, System::String
 
 }
 
+Lua::CallResult Lua::LuaState::LoadBundle(array<unsigned char>^ bundle) {
+
+	// Get pinned (an empty buffer has no first element to pin)
+	pin_ptr<unsigned char> pinnedPtr = nullptr;
+	if (bundle->Length > 0)
+		pinnedPtr = &bundle[0];
+
+	// Invoke load, reading the pinned bytes in place
+	const char* data = reinterpret_cast<const char*>(static_cast<unsigned char*>(pinnedPtr));
+	int result = lua_loadbundle(this->pState, data, static_cast<size_t>(bundle->Length));
+
+	// Return if success
+	return static_cast<CallResult>(result);
+
+}
+
 Lua::CallResult Lua::LuaState::DoString(System::String^ lStr) {
 
 	// Grab C++ string
 	__UnmanagedString(strPtr, lStr, pLStr);
 
-	// Invoke
-	int result = luaL_dostring(this->pState, pLStr);
+	// Load (through the chunk cache) and run
+	int result = lua_loadcached(this->pState, pLStr, strlen(pLStr), pLStr);
+	if (result == LUA_OK)
+		result = lua_pcall(this->pState, 0, LUA_MULTRET, 0);
 
 	// Free unmanaged string
 	__UnmangedFreeString(strPtr);
@@ -384,55 +435,186 @@ Lua::CallResult Lua::LuaState::PCall(int argc, int retc, int errfunc) {
 }
 
 int Lua::LuaState::GC(GarbageCollectWhat what, int data) {
-	return lua_gc(this->pState, static_cast<int>(what), data);
+	// Pad with zeros for the options reading more than one argument (zero keeps the current values)
+	return lua_gc(this->pState, static_cast<int>(what), data, 0, 0);
 }
 
-void Lua::LuaState::Error() {
-	lua_error(this->pState);
+Lua::GarbageCollectMode Lua::LuaState::GCGenerational(int minorMul, int majorMul) {
+	return static_cast<GarbageCollectMode>(lua_gc(this->pState, LUA_GCGEN, minorMul, majorMul));
 }
 
-int Lua::LuaState::Yield(int results) {
-	return lua_yield(this->pState, results);
+Lua::GarbageCollectMode Lua::LuaState::GCIncremental(int pause, int stepMul, int stepSize) {
+	return static_cast<GarbageCollectMode>(lua_gc(this->pState, LUA_GCINC, pause, stepMul, stepSize));
 }
 
-void Lua::LuaState::Concat(int n) {
-	lua_concat(this->pState, n);
+int Lua::LuaState::GCAdaptive(int survivalThreshold) {
+	return lua_gc(this->pState, LUA_GCADAPT, survivalThreshold);
 }
 
-Lua::LuaState^ Lua::LuaState::NewState() {
-	return NewState(LuaLib::All);
+void Lua::LuaState::GCBackgroundFree::set(bool value) {
+
+	// Pool allocator is single-threaded
+	luaL_PoolStats stats;
+	if (value && luaL_poolstats(this->pState, &stats))
+		throw gcnew System::InvalidOperationException("Background freeing requires a thread-safe allocator.");
+
+	// Start or stop the background thread
+	lua_gc(this->pState, LUA_GCBGFREE, value ? 1 : 0);
+	if (value && lua_gc(this->pState, LUA_GCBGFREE, -1) != 1)
+		throw gcnew System::InvalidOperationException("Failed to start the background freeing thread.");
+
 }
 
-int csharp_luadumpwriter(lua_State* L, const void* P, size_t sz, void* up) {
+void Lua::LuaState::GCMarkThreads::set(int value) {
 
-	// Grab uffer
-	csharp_dumpbuffer* buf = static_cast<csharp_dumpbuffer*>(up);
+	// Validate
+	if (value < 1)
+		throw gcnew System::ArgumentOutOfRangeException("value");
 
-	// Reintrepret data
-	const unsigned char* data = reinterpret_cast<const unsigned char*>(static_cast<const char*>(P));
-	
-	// Grab new content
-	unsigned char* content = new unsigned char[buf->size + sz];
-	
-	// Fill existing content
-	if (buf->data) {
-		memcpy_s(content, buf->size + sz, buf->data, buf->size);
-		delete buf->data;
+	// Start or stop the marking threads
+	lua_gc(this->pState, LUA_GCPARMARK, value);
+	if (value > 1 && lua_gc(this->pState, LUA_GCPARMARK, -1) == 1 && System::Environment::ProcessorCount > 1)
+		throw gcnew System::InvalidOperationException("Failed to start the marking threads.");
+
+}
+
+int Lua::LuaState::RunFinalizers(int max, System::TimeSpan budget) {
+
+	// Convert budget to nanoseconds (one tick is 100 nanoseconds)
+	int64_t ticks = budget.Ticks;
+	lua_Unsigned ns = ticks > 0 ? static_cast<lua_Unsigned>(ticks) * 100 : 0;
+
+	// Run them
+	int count = lua_runfinalizers(this->pState, max, ns);
+	if (count < 0)
+		throw gcnew LuaRuntimeException("Cannot run finalizers from within a finalizer.");
+
+	return count;
+
+}
+
+bool Lua::LuaState::GCStep(System::TimeSpan budget, uint64_t% work) {
+
+	// Convert budget to nanoseconds (one tick is 100 nanoseconds)
+	int64_t ticks = budget.Ticks;
+	lua_Unsigned ns = ticks > 0 ? static_cast<lua_Unsigned>(ticks) * 100 : 0;
+
+	// Do the steps
+	lua_Unsigned done = 0;
+	int result = lua_gcsteptime(this->pState, ns, &done);
+	work = done;
+
+	// Return if the cycle finished
+	return result > 0;
+
+}
+
+bool Lua::LuaState::GetPoolStats(LuaPoolStats% stats) {
+
+	// Query allocator
+	luaL_PoolStats st;
+	if (!luaL_poolstats(this->pState, &st)) {
+		stats = LuaPoolStats();
+		return false;
 	}
 
-	// Add our own
-	memcpy_s(content + buf->size, sz, data, sz);
+	// Convert
+	stats = LuaPoolStats(st);
+	return true;
+
+}
+
+int Lua::LuaState::StartHeapProfiler(int period) {
+
+	// Validate
+	if (period <= 0)
+		throw gcnew System::ArgumentOutOfRangeException("period");
+
+	// Start
+	int previous = lua_heapprof(this->pState, period);
+	if (previous < 0)
+		throw gcnew System::OutOfMemoryException("Failed to start the heap profiler.");
 
-	// Update
-	buf->data = content;
-	buf->size += sz;
+	return previous;
+
+}
+
+int csharp_heapprofwriter(lua_State* L, const void* P, size_t sz, void* up) {
+
+	// Append to profile
+	static_cast<std::string*>(up)->append(static_cast<const char*>(P), sz);
 
 	// Return 0 (OK)
 	return LUA_OK;
 
 }
 
+System::String^ Lua::LuaState::DumpHeapProfile(HeapProfileMode mode) {
+
+	// Collect profile
+	std::string profile;
+	if (lua_heapprofdump(this->pState, csharp_heapprofwriter, &profile, static_cast<int>(mode)) != LUA_OK)
+		return nullptr;
+
+	// Convert
+	return gcnew System::String(profile.c_str(), 0, static_cast<int>(profile.size()));
+
+}
+
+array<Lua::GarbageCollectRecord>^ Lua::LuaState::GCRecords() {
+
+	// Copy native records
+	std::vector<lua_GCStat> recs(GCRecordCapacity);
+	int count = lua_gcstats(this->pState, recs.data(), GCRecordCapacity, NULL);
+
+	// Convert to managed records
+	auto result = gcnew array<GarbageCollectRecord>(count);
+	for (int i = 0; i < count; i++) {
+		result[i] = GarbageCollectRecord(recs[i]);
+	}
+
+	// Return records
+	return result;
+
+}
+
+Lua::GarbageCollectPhaseTotal Lua::LuaState::GCPhaseTotal(GarbageCollectPhase phase) {
+
+	// Verify phase
+	int p = static_cast<int>(phase);
+	if (p < 0 || p >= LUA_GCPHASES)
+		throw gcnew System::ArgumentOutOfRangeException("phase");
+
+	// Copy totals
+	lua_GCPhaseTotal totals[LUA_GCPHASES];
+	lua_gcstats(this->pState, NULL, 0, totals);
+
+	// Return requested phase
+	return GarbageCollectPhaseTotal(totals[p]);
+
+}
+
+void Lua::LuaState::Error() {
+	lua_error(this->pState);
+}
+
+int Lua::LuaState::Yield(int results) {
+	return lua_yield(this->pState, results);
+}
+
+void Lua::LuaState::Concat(int n) {
+	lua_concat(this->pState, n);
+}
+
+Lua::LuaState^ Lua::LuaState::NewState() {
+	return NewState(LuaLib::All);
+}
+
 Lua::CallResult Lua::LuaState::Dump([System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% buffer) {
+	return this->Dump(buffer, false, false);
+}
+
+Lua::CallResult Lua::LuaState::Dump([System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% buffer, bool strip, bool aligned) {
 	
 	// Verify not C/C# function
 	if (lua_iscfunction(this->pState, -1))
@@ -442,34 +624,128 @@ Lua::CallResult Lua::LuaState::Dump([System::Runtime::InteropServices::OutAttrib
 	if (!lua_isfunction(this->pState, -1))
 		throw gcnew LuaTypeExpectedException(static_cast<LuaType>(lua_type(this->pState, -1)), LuaType::Function);
 
-	csharp_dumpbuffer dmpBuf{};
-	int result = lua_dump(this->pState, csharp_luadumpwriter, &dmpBuf, 0);
-	if (result != LUA_OK)
+	// Dump into a growable buffer, starting on the stack (small functions never touch the heap)
+	char arena[LUAL_BUFFERSIZE];
+	luaL_DumpBuffer dmpBuf;
+	luaL_dumpinit(&dmpBuf, arena, sizeof(arena));
+	int result = lua_dumpx(this->pState, luaL_dumpwriter, &dmpBuf, strip ? 1 : 0, aligned ? 1 : 0);
+	if (result != LUA_OK) {
+		luaL_dumpfree(&dmpBuf);
 		return static_cast<CallResult>(result);
+	}
+
+	// Verify it fits in a managed array
+	if (dmpBuf.n > static_cast<size_t>(System::Int32::MaxValue)) {
+		luaL_dumpfree(&dmpBuf);
+		return CallResult::MemoryError;
+	}
 
 	// Create buffer
-	buffer = gcnew array<unsigned char>(static_cast<int>(dmpBuf.size));
+	buffer = gcnew array<unsigned char>(static_cast<int>(dmpBuf.n));
 
-	// Copy contents
-	System::Runtime::InteropServices::Marshal::Copy(System::IntPtr(dmpBuf.data), buffer, 0, static_cast<int>(dmpBuf.size));
+	// Copy contents (the only copy of the dumped bytes)
+	System::Runtime::InteropServices::Marshal::Copy(System::IntPtr(dmpBuf.b), buffer, 0, static_cast<int>(dmpBuf.n));
 
 	// Free
-	delete dmpBuf.data;
+	luaL_dumpfree(&dmpBuf);
 
 	// Return OK
 	return CallResult::Ok;
 
 }
 
+Lua::CallResult Lua::LuaState::CompileBundle(array<System::String^>^ names, array<System::String^>^ sources, int threads, bool strip,
+	[System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% bundle) {
+
+	// Validate
+	if (names->Length != sources->Length)
+		throw gcnew System::ArgumentException("There must be one source for each module name.", "sources");
+
+	// Grab C++ strings of all modules (the compiling threads read them directly)
+	int n = names->Length;
+	array<System::IntPtr>^ strPtrs = gcnew array<System::IntPtr>(2 * n);
+	lua_Source* pSources = new lua_Source[n > 0 ? n : 1];
+	for (int i = 0; i < n; i++) {
+		strPtrs[2 * i] = Marshal::StringToHGlobalAnsi(names[i]);
+		strPtrs[2 * i + 1] = Marshal::StringToHGlobalAnsi(sources[i]);
+		pSources[i].name = static_cast<const char*>(strPtrs[2 * i].ToPointer());
+		pSources[i].buff = static_cast<const char*>(strPtrs[2 * i + 1].ToPointer());
+		pSources[i].size = strlen(pSources[i].buff);
+		pSources[i].chunkname = nullptr;
+	}
+
+	// Compile and merge into a growable buffer
+	luaL_DumpBuffer dmpBuf;
+	luaL_dumpinit(&dmpBuf, nullptr, 0);
+	int result = lua_compilebundle(this->pState, pSources, n, threads, strip ? 1 : 0, luaL_dumpwriter, &dmpBuf);
+
+	// Free unmanaged strings
+	for (int i = 0; i < 2 * n; i++)
+		__UnmangedFreeString(strPtrs[i]);
+	delete[] pSources;
+
+	// Verify it fits in a managed array
+	if (result == LUA_OK && dmpBuf.n > static_cast<size_t>(System::Int32::MaxValue))
+		result = LUA_ERRMEM;
+
+	// Copy contents
+	if (result == LUA_OK) {
+		bundle = gcnew array<unsigned char>(static_cast<int>(dmpBuf.n));
+		System::Runtime::InteropServices::Marshal::Copy(System::IntPtr(dmpBuf.b), bundle, 0, static_cast<int>(dmpBuf.n));
+	}
+
+	// Free
+	luaL_dumpfree(&dmpBuf);
+
+	// Return result
+	return static_cast<CallResult>(result);
+
+}
+
+void Lua::LuaState::ConfigureChunkCache(uint64_t budget, System::String^ directory) {
+
+	// Configure without a directory
+	if (directory == nullptr) {
+		lua_chunkcache(static_cast<size_t>(budget), nullptr);
+		return;
+	}
+
+	// Validate
+	if (!System::IO::Directory::Exists(directory))
+		throw gcnew System::IO::DirectoryNotFoundException(directory);
+
+	// Grab C++ string
+	__UnmanagedString(strPtr, directory, pDir);
+
+	// Configure
+	int result = lua_chunkcache(static_cast<size_t>(budget), pDir);
+
+	// Free unmanaged string
+	__UnmangedFreeString(strPtr);
+
+	// Check
+	if (!result)
+		throw gcnew System::OutOfMemoryException("Failed to configure the chunk cache.");
+
+}
+
 int csharp_luapanic(lua_State* L) {
 	throw gcnew Lua::LuaRuntimeException(Lua::LuaMarshal::MarshalStackValue(L, -1)->ToString());
 	return 0;
 }
 
 Lua::LuaState^ Lua::LuaState::NewState(LuaLib libraries) {
+	return NewState(libraries, LuaAllocator::System);
+}
+
+Lua::LuaState^ Lua::LuaState::NewState(LuaLib libraries, LuaAllocator allocator) {
+	return NewState(libraries, allocator, 0);
+}
+
+Lua::LuaState^ Lua::LuaState::NewState(LuaLib libraries, LuaAllocator allocator, uint64_t memoryLimit) {
 
 	// Create new lua state
-	lua_State* pState = luaL_newstate();
+	lua_State* pState = allocator == LuaAllocator::Pool ? luaL_newstatepool() : luaL_newstate();
 	if (!pState) {
 		throw gcnew System::Exception("Failed to create new lua state");
 	}
@@ -517,15 +793,44 @@ Lua::LuaState^ Lua::LuaState::NewState(LuaLib libraries) {
 			if (libraries.HasFlag(LuaLib::String) && !luaopen_string(pState))
 				throw gcnew System::Exception("Failed to load string library");
 
+			// Load libraries
+			if (libraries.HasFlag(LuaLib::Scheduler) && !luaopen_sched(pState))
+				throw gcnew System::Exception("Failed to load scheduler library");
+
 		}
 
 	}
 
+	// Apply memory limit once the libraries are loaded
+	lua_setmemlimit(pState, static_cast<size_t>(memoryLimit));
+
 	// Return the new state
 	return gcnew LuaState(pState, true);
 
 }
 
+Lua::LuaState^ Lua::LuaState::Clone() {
+
+	// Copy this state
+	int top = lua_gettop(this->pState);
+	lua_State* pClone = luaL_clonestate(this->pState);
+	if (!pClone) {
+		if (lua_gettop(this->pState) > top) { // A __clone metamethod failed
+			System::String^ err = this->GetString(-1);
+			lua_settop(this->pState, top);
+			throw gcnew System::InvalidOperationException(System::String::Format("Failed to clone lua state: {0}", err));
+		}
+		throw gcnew System::InvalidOperationException("Failed to clone lua state (out of memory, or the state has running or suspended coroutines)");
+	}
+
+	// Set panic
+	lua_atpanic(pClone, csharp_luapanic);
+
+	// Return the clone
+	return gcnew LuaState(pClone, true);
+
+}
+
 void Lua::LuaState::pop_generic_safe(lua_State* L, int amount) {
 	lua_pop(L, amount);
 }
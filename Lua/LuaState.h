@@ -5,6 +5,11 @@
 #include "LuaType.h"
 #include "LuaTable.h"
 #include "LuaLib.hpp"
+#include "LuaGCStats.hpp"
+#include "LuaAllocator.hpp"
+#include "LuaHeapProfile.hpp"
+#include "LuaChunkCache.hpp"
+#include "LuaWaker.hpp"
 
 #include <stdint.h>
 
@@ -45,6 +50,11 @@ namespace Lua {
 		/// </summary>
 		ErrorHandler = LUA_ERRERR,
 
+		/// <summary>
+		/// A file could not be opened or read.
+		/// </summary>
+		FileError = LUA_ERRFILE,
+
 	};
 
 	/// <summary>
@@ -91,7 +101,79 @@ namespace Lua {
 		/// <summary>
 		/// Sets data as the new value for the step multiplier of the collector. The function returns the previous value of the step multiplier
 		/// </summary>
-		SetStepMul = LUA_GCSETSTEPMUL
+		SetStepMul = LUA_GCSETSTEPMUL,
+
+		/// <summary>
+		/// Returns 1 if the collector is running (i.e. not stopped); Otherwise 0.
+		/// </summary>
+		IsRunning = LUA_GCISRUNNING,
+
+		/// <summary>
+		/// Changes the collector to generational mode with data as the minor multiplier (0 keeps the current value). The function returns the
+		/// previous mode.
+		/// </summary>
+		Generational = LUA_GCGEN,
+
+		/// <summary>
+		/// Changes the collector to incremental mode with data as the pause (0 keeps the current value). The function returns the previous mode.
+		/// </summary>
+		Incremental = LUA_GCINC,
+
+		/// <summary>
+		/// Performs incremental steps of garbage collection until data microseconds have elapsed or the cycle finishes. The function returns 1 if the
+		/// steps finished a garbage-collection cycle.
+		/// </summary>
+		StepTime = LUA_GCSTEPTIME,
+
+		/// <summary>
+		/// Enables adaptive mode selection with data as the minor-collection survival threshold in percent (negative uses the default, 0 disables it).
+		/// The function returns the previous threshold (0 if it was disabled).
+		/// </summary>
+		Adaptive = LUA_GCADAPT,
+
+		/// <summary>
+		/// Returns the current collector mode.
+		/// </summary>
+		Mode = LUA_GCMODE
+
+	};
+
+	/// <summary>
+	/// Represents the modes the garbage collector can run in.
+	/// </summary>
+	public enum class GarbageCollectMode : int {
+
+		/// <summary>
+		/// Incremental mode, where each cycle does a full mark and sweep in small steps interleaved with the program.
+		/// </summary>
+		Incremental = LUA_GCINC,
+
+		/// <summary>
+		/// Generational mode, where frequent minor collections traverse only recently created objects.
+		/// </summary>
+		Generational = LUA_GCGEN
+
+	};
+
+	/// <summary>
+	/// Represents the modes of the process-wide cache of module path searches (see <see cref="LuaState::PathCache"/>).
+	/// </summary>
+	public enum class PathCacheMode : int {
+
+		/// <summary>
+		/// Every search probes the file system.
+		/// </summary>
+		Off = LUA_PATHCACHEOFF,
+
+		/// <summary>
+		/// Results are kept until the cache is cleared, so files created or removed later are not seen.
+		/// </summary>
+		On = LUA_PATHCACHEON,
+
+		/// <summary>
+		/// Results are kept until a directory searched for them changes (only on Linux; elsewhere the same as <see cref="PathCacheMode::On"/>).
+		/// </summary>
+		Watch = LUA_PATHCACHEWATCH
 
 	};
 
@@ -108,6 +190,9 @@ namespace Lua {
 		/// <summary>
 		/// Load a string of Lua code.
 		/// </summary>
+		/// <remarks>
+		/// Goes through the process-wide cache of compiled chunks when enabled (see <see cref="LuaState::ConfigureChunkCache"/>).
+		/// </remarks>
 		/// <param name="lStr">The lua code string to load.</param>
 		/// <returns>If string was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
 		CallResult LoadString(System::String^ lStr);
@@ -119,6 +204,18 @@ namespace Lua {
 		/// <returns>If file was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
 		CallResult LoadFile(System::String^ filepath);
 
+		/// <summary>
+		/// Load a file containing precompiled Lua code by mapping it in memory.
+		/// </summary>
+		/// <remarks>
+		/// Chunks dumped in the aligned layout (see <see cref="LuaState::Dump"/>) run their code in place from the mapped file,
+		/// which is shared by every state and process loading it and stays mapped while any of its functions is alive; other chunks are loaded as usual.
+		/// The file must not be modified while mapped.
+		/// </remarks>
+		/// <param name="filepath">The path to the file to load.</param>
+		/// <returns>If file was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
+		CallResult LoadMapped(System::String^ filepath);
+
 		/// <summary>
 		/// Loads a stream containing Lua code.
 		/// </summary>
@@ -131,22 +228,42 @@ namespace Lua {
 		/// <summary>
 		/// Loads a stream containing Lua code.
 		/// </summary>
+		/// <remarks>
+		/// The stream is read in pieces of <c>LUAL_FILLSIZE</c> bytes as the chunk is parsed, so it need not be seekable and is never held in memory
+		/// as a whole. If reading fails, the result is <see cref="CallResult::FileError"/> and the error message is pushed.
+		/// </remarks>
 		/// <param name="stream">The stream to load Lua code from.</param>
 		/// <param name="chunkname">The name of the chunk.</param>
 		/// <returns>If stream was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
 		CallResult LoadStream(System::IO::Stream^ stream, System::String^ chunkname);
 
 		/// <summary>
-		/// 
+		/// Loads a chunk, text or binary (see <see cref="LuaState::Dump"/>), from a buffer without running it.
 		/// </summary>
-		/// <param name="buffer"></param>
-		/// <param name="chunkname"></param>
-		/// <returns></returns>
+		/// <remarks>
+		/// The buffer is pinned and read in place while loading; it is not copied.
+		/// </remarks>
+		/// <param name="buffer">The buffer containing the chunk.</param>
+		/// <param name="chunkname">The name of the chunk.</param>
+		/// <returns>If buffer was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
 		CallResult Load(array<unsigned char>^ buffer, System::String^ chunkname);
 
+		/// <summary>
+		/// Loads every module of a bundle made by <see cref="LuaState::CompileBundle"/> and pushes a table with their main functions, indexed by module name.
+		/// </summary>
+		/// <remarks>
+		/// The modules are loaded in one pass and none of them is run. If any fails to load, only the error message is pushed.
+		/// </remarks>
+		/// <param name="bundle">The buffer containing the bundle.</param>
+		/// <returns>If bundle was successfully loaded, <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
+		CallResult LoadBundle(array<unsigned char>^ bundle);
+
 		/// <summary>
 		/// Load and run a string of Lua code.
 		/// </summary>
+		/// <remarks>
+		/// Goes through the process-wide cache of compiled chunks when enabled (see <see cref="LuaState::ConfigureChunkCache"/>).
+		/// </remarks>
 		/// <param name="lStr">The lua code string to execute.</param>
 		/// <returns>if string was successfully loaded and exectured <see cref="CallResult::Ok"/>; Otherwise <see cref="CallResult"/> error description</returns>
 		CallResult DoString(System::String^ lStr);
@@ -537,6 +654,306 @@ namespace Lua {
 			return this->GC(what, 0);
 		}
 
+		/// <summary>
+		/// Performs incremental garbage-collection steps until <paramref name="budget"/> has elapsed or the current cycle finishes.
+		/// </summary>
+		/// <remarks>
+		/// The budget is checked between units of collector work, so a step may overrun it by a few microseconds. In generational mode a single
+		/// minor (or major) collection is performed regardless of the budget.
+		/// </remarks>
+		/// <param name="budget">The maximum time to spend collecting.</param>
+		/// <param name="work">The amount of collector work units performed.</param>
+		/// <returns>True if the steps finished a garbage-collection cycle; Otherwise false (also when the collector is stopped).</returns>
+		bool GCStep(System::TimeSpan budget, [System::Runtime::InteropServices::OutAttribute] uint64_t% work);
+
+		/// <summary>
+		/// Performs incremental garbage-collection steps until <paramref name="budget"/> has elapsed or the current cycle finishes.
+		/// </summary>
+		/// <param name="budget">The maximum time to spend collecting.</param>
+		/// <returns>True if the steps finished a garbage-collection cycle; Otherwise false.</returns>
+		bool GCStep(System::TimeSpan budget) {
+			uint64_t work;
+			return this->GCStep(budget, work);
+		}
+
+		/// <summary>
+		/// Changes the collector to generational mode.
+		/// </summary>
+		/// <param name="minorMul">The frequency of minor collections, as a percentage of memory growth since the last collection (0 keeps the current value).</param>
+		/// <param name="majorMul">The memory growth, in percent, since the last major collection that triggers a major collection (0 keeps the current value).</param>
+		/// <returns>The previous mode of the collector.</returns>
+		GarbageCollectMode GCGenerational(int minorMul, int majorMul);
+
+		/// <summary>
+		/// Changes the collector to incremental mode.
+		/// </summary>
+		/// <param name="pause">How long the collector waits before starting a new cycle, in percent of memory in use (0 keeps the current value).</param>
+		/// <param name="stepMul">The speed of the collector relative to memory allocation (0 keeps the current value).</param>
+		/// <param name="stepSize">The log2 of the size of each incremental step in bytes (0 keeps the current value).</param>
+		/// <returns>The previous mode of the collector.</returns>
+		GarbageCollectMode GCIncremental(int pause, int stepMul, int stepSize);
+
+		/// <summary>
+		/// Enables or disables adaptive selection of the collector mode.
+		/// </summary>
+		/// <remarks>
+		/// While enabled, the collector periodically tries generational mode and returns to incremental mode when the smoothed survival rate of
+		/// minor collections exceeds <paramref name="survivalThreshold"/> percent or major collections become frequent. Workloads that mostly
+		/// allocate short-lived objects end up in generational mode.
+		/// </remarks>
+		/// <param name="survivalThreshold">The survival threshold in percent; A negative value uses the default threshold and 0 disables the policy.</param>
+		/// <returns>The previous threshold, or 0 if the policy was disabled.</returns>
+		int GCAdaptive(int survivalThreshold);
+
+		/// <summary>
+		/// Get the current mode of the garbage collector.
+		/// </summary>
+		property GarbageCollectMode GCMode {
+			GarbageCollectMode get() { return static_cast<GarbageCollectMode>(lua_gc(this->pState, LUA_GCMODE)); }
+		}
+
+		/// <summary>
+		/// Get or set whether memory released by the garbage collector is freed on a background thread.
+		/// </summary>
+		/// <remarks>
+		/// Dead objects are handed to the background thread in batches through a bounded queue, so that freeing large heaps overlaps with script
+		/// execution. When the background thread falls behind, the collector frees the batches itself. Not available for states created with
+		/// <see cref="LuaAllocator::Pool"/>, as the pool allocator is not thread safe.
+		/// </remarks>
+		property bool GCBackgroundFree {
+			bool get() { return lua_gc(this->pState, LUA_GCBGFREE, -1) == 1; }
+			void set(bool value);
+		}
+
+		/// <summary>
+		/// Get or set the number of threads marking live objects in full garbage collections; 1 means serial marking.
+		/// </summary>
+		/// <remarks>
+		/// Only full collections of large heaps are marked in parallel; incremental steps are always serial. The value is capped at the number of
+		/// processors, so reading it back tells the actual amount of threads in use.
+		/// </remarks>
+		property int GCMarkThreads {
+			int get() { return lua_gc(this->pState, LUA_GCPARMARK, -1); }
+			void set(int value);
+		}
+
+		/// <summary>
+		/// Get or set whether finalizers (<c>__gc</c> metamethods) are queued until <see cref="LuaState::RunFinalizers"/> is called.
+		/// </summary>
+		/// <remarks>
+		/// By default the collector calls finalizers during its steps, which adds their cost to whatever allocation triggered the step. In queue
+		/// mode, objects to be finalized are kept alive in a queue and the host decides when to finalize them. Pending finalizers still run when
+		/// the state is closed.
+		/// </remarks>
+		property bool GCFinalizerQueue {
+			bool get() { return lua_gc(this->pState, LUA_GCFINQUEUE, -1) == 1; }
+			void set(bool value) { lua_gc(this->pState, LUA_GCFINQUEUE, value ? 1 : 0); }
+		}
+
+		/// <summary>
+		/// Get the amount of objects waiting for their finalizer to be called.
+		/// </summary>
+		property int PendingFinalizers {
+			int get() { return lua_gc(this->pState, LUA_GCFINPENDING); }
+		}
+
+		/// <summary>
+		/// Calls pending finalizers until <paramref name="max"/> have been called or <paramref name="budget"/> has elapsed.
+		/// </summary>
+		/// <remarks>
+		/// The clock is checked after each finalizer, so a slow finalizer can overrun the budget.
+		/// </remarks>
+		/// <param name="max">The maximum amount of finalizers to call; 0 for no limit.</param>
+		/// <param name="budget">The maximum time to spend calling finalizers; <see cref="System::TimeSpan::Zero"/> for no limit.</param>
+		/// <returns>The amount of finalizers called.</returns>
+		int RunFinalizers(int max, System::TimeSpan budget);
+
+		/// <summary>
+		/// Calls up to <paramref name="max"/> pending finalizers.
+		/// </summary>
+		/// <param name="max">The maximum amount of finalizers to call; 0 for no limit.</param>
+		/// <returns>The amount of finalizers called.</returns>
+		int RunFinalizers(int max) {
+			return this->RunFinalizers(max, System::TimeSpan::Zero);
+		}
+
+		/// <summary>
+		/// Calls all pending finalizers.
+		/// </summary>
+		/// <returns>The amount of finalizers called.</returns>
+		int RunFinalizers() {
+			return this->RunFinalizers(0, System::TimeSpan::Zero);
+		}
+
+		/// <summary>
+		/// Get the amount of bytes in use by objects of the specified type.
+		/// </summary>
+		/// <remarks>
+		/// Tables include their array and hash parts, functions include closures, upvalues and prototype headers, and threads include their stacks.
+		/// The value is kept up to date by the allocator, so the query is constant time.
+		/// </remarks>
+		/// <param name="type">The type of objects to query.</param>
+		/// <returns>The amount of bytes in use; 0 for types that are not collectable.</returns>
+		uint64_t MemoryUsage(LuaType type) {
+			return lua_memusage(this->pState, static_cast<int>(type));
+		}
+
+		/// <summary>
+		/// Get the total amount of bytes in use by the state.
+		/// </summary>
+		property uint64_t MemoryInUse {
+			uint64_t get() { return lua_memusage(this->pState, LUA_TNONE); }
+		}
+
+		/// <summary>
+		/// Get or set the hard limit, in bytes, for the memory used by the state; 0 means no limit.
+		/// </summary>
+		/// <remarks>
+		/// An allocation that would exceed the limit triggers an emergency collection and, if still exceeding it, raises a memory error
+		/// (<see cref="CallResult::MemoryError"/> in protected calls).
+		/// </remarks>
+		property uint64_t MemoryLimit {
+			uint64_t get() { return lua_getmemlimit(this->pState); }
+			void set(uint64_t value) { lua_setmemlimit(this->pState, static_cast<size_t>(value)); }
+		}
+
+		/// <summary>
+		/// Get or set whether functions loaded by the state share their code with equal functions loaded by other states.
+		/// </summary>
+		/// <remarks>
+		/// The instructions and line information of shared functions are kept once per process, outside the memory of any state, and released with
+		/// the last function using them. Constants and the remaining debug information stay with each state. Only functions loaded after the
+		/// property is set are shared.
+		/// </remarks>
+		property bool ShareCode {
+			bool get() { return lua_sharecode(this->pState, -1) == 1; }
+			void set(bool value) { lua_sharecode(this->pState, value ? 1 : 0); }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes of code shared among all states of the process (see <see cref="LuaState::ShareCode"/>).
+		/// </summary>
+		static property uint64_t SharedCodeBytes {
+			uint64_t get() { return lua_sharecodeinfo(LUA_SCBYTES); }
+		}
+
+		/// <summary>
+		/// Get the amount of bytes the states of the process would use on top of <see cref="LuaState::SharedCodeBytes"/> if code was not shared.
+		/// </summary>
+		static property uint64_t SharedCodeSavedBytes {
+			uint64_t get() { return lua_sharecodeinfo(LUA_SCSAVED); }
+		}
+
+		/// <summary>
+		/// Get or set whether text chunks loaded by the state compile the body of a nested function only when the first closure is made from it.
+		/// </summary>
+		/// <remarks>
+		/// Functions defined directly by a chunk are still compiled when it loads, as running the chunk makes all of them; the functions they
+		/// define are only skimmed, which makes loading modules whose functions are rarely used faster and lighter. A syntax error in a skimmed
+		/// body is raised as a runtime error by the code making its closure. Dumping a function compiles all of its bodies first.
+		/// </remarks>
+		property bool LazyCompile {
+			bool get() { return lua_lazyparse(this->pState, -1) == 1; }
+			void set(bool value) { lua_lazyparse(this->pState, value ? 1 : 0); }
+		}
+
+		/// <summary>
+		/// Get or set the maximum amount of dead coroutine threads the state keeps for reuse by new coroutines (32 by default).
+		/// </summary>
+		/// <remarks>
+		/// A coroutine made from a kept thread reuses its stack and call information, saving all of its allocations. Threads whose stack grew
+		/// beyond <see cref="ThreadStackSize"/> are freed rather than kept. Setting 0 frees the kept threads and disables reuse.
+		/// </remarks>
+		property int ThreadPoolSize {
+			int get() { return lua_threadpool(this->pState, -1); }
+			void set(int value) { lua_threadpool(this->pState, value < 0 ? 0 : value); }
+		}
+
+		/// <summary>
+		/// Get or set the initial amount of stack slots of new coroutine threads.
+		/// </summary>
+		/// <remarks>
+		/// States running many coroutines with shallow call chains may lower it to save memory; the stack of a thread still grows as needed.
+		/// The value is clamped to the range the interpreter supports, and changing it frees the threads kept for reuse.
+		/// </remarks>
+		property int ThreadStackSize {
+			int get() { return lua_threadstack(this->pState, -1); }
+			void set(int value) { lua_threadstack(this->pState, value < 0 ? 0 : value); }
+		}
+
+		/// <summary>
+		/// Gets a handle with which any thread can wake the tasks of the scheduler of the state (the <c>sched</c> library).
+		/// </summary>
+		/// <remarks>
+		/// The first call creates the operating system event of the scheduler. While a handle is alive, <c>sched.run</c> keeps blocking for wakeups when only waiting tasks are left. Dispose the handle to release it.
+		/// </remarks>
+		/// <returns>The handle, or <see langword="null"/> if the scheduler library is not open or the handle cannot be created.</returns>
+		LuaWaker^ GetWaker() {
+			luaL_Waker* w = luaL_getwaker(this->pState);
+			return w ? gcnew LuaWaker(w) : nullptr;
+		}
+
+		/// <summary>
+		/// Get the id of the task of the scheduler running in the state, or 0 if the state is not running a task.
+		/// </summary>
+		property int64_t CurrentTask {
+			int64_t get() { return luaL_currenttask(this->pState); }
+		}
+
+		/// <summary>
+		/// Starts the heap profiler, or changes its sampling period if already running.
+		/// </summary>
+		/// <remarks>
+		/// The profiler records the Lua call stack of one allocation out of every <paramref name="period"/> (on average) and follows sampled objects
+		/// until they are collected. Large periods keep the overhead negligible; a period of 1 records every allocation.
+		/// </remarks>
+		/// <param name="period">The mean number of allocations between samples.</param>
+		/// <returns>The previous period, or 0 if the profiler was not running.</returns>
+		int StartHeapProfiler(int period);
+
+		/// <summary>
+		/// Stops the heap profiler and discards its samples.
+		/// </summary>
+		void StopHeapProfiler() {
+			lua_heapprof(this->pState, 0);
+		}
+
+		/// <summary>
+		/// Get the heap profile collected so far in collapsed-stack format.
+		/// </summary>
+		/// <remarks>
+		/// Each line holds the frames of one allocation site, outermost first and separated by ';' (Lua frames as <c>chunk:line</c>, C and C# frames as
+		/// <c>[C]</c>), followed by the type allocated (<c>[block]</c> for array parts, stacks and other buffers), a space and the estimated value.
+		/// The format is understood by common flame-graph tools.
+		/// </remarks>
+		/// <param name="mode">The value to report for each site.</param>
+		/// <returns>The collapsed stacks, or <see langword="null"/> if the profiler is not running.</returns>
+		System::String^ DumpHeapProfile(HeapProfileMode mode);
+
+		/// <summary>
+		/// Get the statistics of the pool allocator of the state.
+		/// </summary>
+		/// <param name="stats">The allocator statistics.</param>
+		/// <returns>True if the state was created with <see cref="LuaAllocator::Pool"/>; Otherwise false.</returns>
+		bool GetPoolStats([System::Runtime::InteropServices::OutAttribute] LuaPoolStats% stats);
+
+		/// <summary>
+		/// Get the most recent garbage-collector telemetry records, oldest first.
+		/// </summary>
+		/// <remarks>
+		/// The collector keeps a limited history (<see cref="LuaState::GCRecordCapacity"/> records). Use <see cref="GarbageCollectRecord::Sequence"/>
+		/// to skip records already seen by a previous call.
+		/// </remarks>
+		/// <returns>The recorded stretches of collector work.</returns>
+		array<GarbageCollectRecord>^ GCRecords();
+
+		/// <summary>
+		/// Get the accumulated garbage-collector telemetry of the specified phase.
+		/// </summary>
+		/// <param name="phase">The phase to get totals of.</param>
+		/// <returns>The accumulated telemetry of the phase since the state was created.</returns>
+		GarbageCollectPhaseTotal GCPhaseTotal(GarbageCollectPhase phase);
+
 		/// <summary>
 		/// Generates an error for the Lua runtime, taking the top stack value as the error message.
 		/// </summary>
@@ -576,6 +993,38 @@ namespace Lua {
 		/// <exception cref="LuaTypeExpectedException"/>
 		CallResult Dump([System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% buffer);
 
+		/// <summary>
+		/// Dumps a function as a binary chunk, optionally stripped of debug information and in the aligned layout used in place by <see cref="LuaState::LoadMapped"/>.
+		/// </summary>
+		/// <remarks>
+		/// The function is not popped from the stack. Chunks in the aligned layout can be loaded by any method.
+		/// </remarks>
+		/// <param name="buffer">The binary output containing the Lua opcode instructions for the specified function.</param>
+		/// <param name="strip">Whether to leave out debug information.</param>
+		/// <param name="aligned">Whether to use the aligned layout.</param>
+		/// <returns>A <see cref="CallResult"/> describing the result of the call.</returns>
+		/// <exception cref="LuaRuntimeException"/>
+		/// <exception cref="LuaTypeExpectedException"/>
+		CallResult Dump([System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% buffer, bool strip, bool aligned);
+
+		/// <summary>
+		/// Compiles a set of modules on a pool of native threads and merges them into a bundle of precompiled modules (see <see cref="LuaState::LoadBundle"/>).
+		/// </summary>
+		/// <remarks>
+		/// Each thread compiles in a private scratch state, so the state itself is left untouched unless there is an error, in which case the error
+		/// message of the first module that failed is pushed. Modules are dumped in the aligned layout, so a bundle written to a file and mapped in memory
+		/// runs their code in place.
+		/// </remarks>
+		/// <param name="names">The names of the modules.</param>
+		/// <param name="sources">The source code of each module.</param>
+		/// <param name="threads">The amount of threads to compile with; 0 for one per processor.</param>
+		/// <param name="strip">Whether to leave out debug information.</param>
+		/// <param name="bundle">The binary output containing the bundle.</param>
+		/// <returns>A <see cref="CallResult"/> describing the result of the call.</returns>
+		/// <exception cref="System::ArgumentException"/>
+		CallResult CompileBundle(array<System::String^>^ names, array<System::String^>^ sources, int threads, bool strip,
+			[System::Runtime::InteropServices::OutAttribute] array<unsigned char>^% bundle);
+
 	public:
 
 		/// <summary>
@@ -603,11 +1052,114 @@ namespace Lua {
 		/// <returns>A new <see cref="LuaState"/> instance.</returns>
 		static LuaState^ NewState(LuaLib libraries);
 
+		/// <summary>
+		/// Create a new Lua state with all the specified libraries loaded, using the specified memory allocator.
+		/// </summary>
+		/// <param name="libraries">The standard libraries to load.</param>
+		/// <param name="allocator">The allocator managing the memory of the state.</param>
+		/// <returns>A new <see cref="LuaState"/> instance.</returns>
+		static LuaState^ NewState(LuaLib libraries, LuaAllocator allocator);
+
+		/// <summary>
+		/// Create a new Lua state with all the specified libraries loaded, using the specified memory allocator and a hard memory limit.
+		/// </summary>
+		/// <param name="libraries">The standard libraries to load.</param>
+		/// <param name="allocator">The allocator managing the memory of the state.</param>
+		/// <param name="memoryLimit">The maximum amount of bytes the state may use; 0 for no limit. See <see cref="LuaState::MemoryLimit"/>.</param>
+		/// <returns>A new <see cref="LuaState"/> instance.</returns>
+		static LuaState^ NewState(LuaLib libraries, LuaAllocator allocator, uint64_t memoryLimit);
+
+		/// <summary>
+		/// Create a new Lua state holding a copy of everything this state can reach from its registry: loaded libraries and modules, globals and their functions.
+		/// </summary>
+		/// <remarks>
+		/// Cloning a state prepared once (libraries opened, bootstrap code run) is much faster than creating and preparing each state, as nothing is compiled
+		/// or run again. The clone uses the same kind of allocator and the same collector settings and memory limit as this state. Files opened by this state
+		/// are closed in the clone (the standard files stay open), and the state must not have running or suspended coroutines. If a <c>__clone</c> metamethod
+		/// fails, no clone is made.
+		/// </remarks>
+		/// <returns>A new <see cref="LuaState"/> instance.</returns>
+		/// <exception cref="System::InvalidOperationException"/>
+		LuaState^ Clone();
+
+		/// <summary>
+		/// Enables, resizes or disables the process-wide cache of compiled chunks used by <see cref="LuaState::LoadString"/> and <see cref="LuaState::DoString"/>.
+		/// </summary>
+		/// <remarks>
+		/// Chunks are identified by their source text and name. Each state keeps the functions it compiled, so loading the same code again only
+		/// creates a new closure; other states load the precompiled form kept by the process-wide cache. The least recently used chunks are dropped
+		/// to stay within <paramref name="budget"/>, which does not count towards the memory of any state.
+		/// </remarks>
+		/// <param name="budget">The maximum amount of bytes held by the cache; 0 disables the cache and empties it.</param>
+		static void ConfigureChunkCache(uint64_t budget) {
+			ConfigureChunkCache(budget, nullptr);
+		}
+
+		/// <summary>
+		/// Enables, resizes or disables the process-wide cache of compiled chunks, keeping chunks also as files in the specified directory.
+		/// </summary>
+		/// <remarks>
+		/// Chunk files outlive the process, so later processes skip compiling. Precompiled code is not verified when loaded, so the directory must
+		/// only be writable by trusted processes.
+		/// </remarks>
+		/// <param name="budget">The maximum amount of bytes held in memory by the cache; 0 disables the cache and empties it.</param>
+		/// <param name="directory">The existing directory for chunk files; <see langword="null"/> to keep chunks in memory only.</param>
+		static void ConfigureChunkCache(uint64_t budget, System::String^ directory);
+
+		/// <summary>
+		/// Drops all chunks from the process-wide cache of compiled chunks. Chunk files and the functions kept by each state are not affected.
+		/// </summary>
+		static void ClearChunkCache() {
+			lua_chunkcacheclear();
+		}
+
+		/// <summary>
+		/// Get the statistics of the process-wide cache of compiled chunks.
+		/// </summary>
+		static property LuaChunkCacheStats ChunkCacheStats {
+			LuaChunkCacheStats get() { return LuaChunkCacheStats::Query(); }
+		}
+
+		/// <summary>
+		/// Get or set the mode of the process-wide cache of the module path searches done by <c>require</c> and <c>package.searchpath</c>.
+		/// </summary>
+		/// <remarks>
+		/// Searches are identified by the path and the module name, and their results, including failures, are shared by all states.
+		/// Searches in paths with relative templates, such as the default <c>./?.lua</c>, depend on the current directory and are never cached.
+		/// Changing the mode empties the cache.
+		/// </remarks>
+		static property PathCacheMode PathCache {
+			PathCacheMode get() { return static_cast<PathCacheMode>(luaL_pathcache(-1)); }
+			void set(PathCacheMode value) { luaL_pathcache(static_cast<int>(value)); }
+		}
+
+		/// <summary>
+		/// Drops all results from the process-wide cache of module path searches, so that the next searches probe the file system again.
+		/// </summary>
+		static void ClearPathCache() {
+			luaL_pathcacheclear();
+		}
+
 		/// <summary>
 		/// Option for multiple returns in calls to <see cref="LuaState::Call"/> and <see cref="LuaState::PCall"/>.
 		/// </summary>
 		literal int MultiReturn = LUA_MULTRET;
 
+		/// <summary>
+		/// The maximum amount of records returned by <see cref="LuaState::GCRecords"/>.
+		/// </summary>
+		literal int GCRecordCapacity = LUAI_GCSTATSIZE;
+
+		/// <summary>
+		/// Value returned by a C# function whose results are not ready yet, suspending the coroutine that called it until the host completes the call.
+		/// </summary>
+		/// <remarks>
+		/// In a task of the scheduler (<c>sched.spawn</c>), the host completes the call by waking the task (see <see cref="CurrentTask"/> and
+		/// <see cref="LuaWaker::Wake"/>), and the value of the wakeup is the result of the call. In any other coroutine, the values passed to the
+		/// resume that continues it are the results. The function must not return it outside a coroutine, or from a call that cannot yield.
+		/// </remarks>
+		literal int Pending = -1;
+
 	private:
 
 		lua_State* pState;
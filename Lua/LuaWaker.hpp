@@ -0,0 +1,56 @@
+#pragma once
+#include "lua/lualib.hpp"
+
+#include <stdint.h>
+
+namespace Lua {
+
+	/// <summary>
+	/// Class representing a handle to the scheduler of a state (see <see cref="LuaState::GetWaker"/>), with which any thread can wake its tasks.
+	/// </summary>
+	/// <remarks>
+	/// The handle stays valid after the state is closed; wakeups are then ignored.
+	/// </remarks>
+	public ref class LuaWaker sealed {
+
+	public:
+
+		/// <summary>
+		/// Wakes a task of the scheduler, making its <c>sched.wait</c> return <paramref name="value"/>; a task that is not waiting yet gets the value when it next waits.
+		/// </summary>
+		/// <remarks>
+		/// Safe to call from any thread. Wakeups are taken in batches by the next iteration of <c>sched.run</c>.
+		/// </remarks>
+		/// <param name="task">The id of the task, as returned by <c>sched.spawn</c>.</param>
+		/// <param name="value">The value to return from <c>sched.wait</c>.</param>
+		/// <returns>True if the wakeup was posted; false if the state is closed or out of memory.</returns>
+		bool Wake(int64_t task, int64_t value) {
+			if (!this->pWaker)
+				throw gcnew System::ObjectDisposedException("LuaWaker");
+			return luaL_wake(this->pWaker, task, value) != 0;
+		}
+
+		~LuaWaker() {
+			this->!LuaWaker();
+		}
+
+		!LuaWaker() {
+			if (this->pWaker) {
+				luaL_releasewaker(this->pWaker);
+				this->pWaker = nullptr;
+			}
+		}
+
+	internal:
+
+		LuaWaker(luaL_Waker* w) {
+			this->pWaker = w;
+		}
+
+	private:
+
+		luaL_Waker* pWaker;
+
+	};
+
+}
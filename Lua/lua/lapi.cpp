@@ -21,8 +21,12 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcfree.hpp"
+#include "lgcpar.hpp"
 #include "lmem.hpp"
+#include "lmemprof.hpp"
 #include "lobject.hpp"
+#include "lshare.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
 #include "ltable.hpp"
@@ -1104,20 +1108,33 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
       setobj(L, f->upvals[0]->v, gt);
       luaC_barrier(L, f->upvals[0], gt);
     }
+    if (G(L)->sharecode)
+      luaF_share(L, f->p);  /* use shared copies of its code */
   }
   lua_unlock(L);
   return status;
 }
 
 
-LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
+/*
+** Dump the function on the top of the stack; with 'aligned', in the
+** layout whose code can be used in place (see 'lua_mapfile').
+*/
+LUA_API int lua_dumpx (lua_State *L, lua_Writer writer, void *data,
+                       int strip, int aligned) {
   int status;
   TValue *o;
   lua_lock(L);
   api_checknelems(L, 1);
   o = s2v(L->top - 1);
-  if (isLfunction(o))
-    status = luaU_dump(L, getproto(o), writer, data, strip);
+  if (isLfunction(o)) {
+    status = luaD_compileall(L, getproto(o));  /* no lazy bodies in dumps */
+    if (status == LUA_OK)
+      status = luaU_dump(L, getproto(s2v(L->top - 1)), writer, data,
+                         strip, aligned);
+    else
+      L->top--;  /* remove error message */
+  }
   else
     status = 1;
   lua_unlock(L);
@@ -1125,6 +1142,11 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
+  return lua_dumpx(L, writer, data, strip, 0);
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1183,6 +1205,16 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
         res = 1;  /* signal it */
       break;
     }
+    case LUA_GCSTEPTIME: {
+      int data = va_arg(argp, int);  /* budget in microseconds */
+      lu_byte oldstp = g->gcstp;
+      lua_Unsigned budget;
+      g->gcstp = 0;  /* allow GC to run (GCSTPGC must be zero here) */
+      budget = (data > 0) ? l_castS2U(data) * 1000u : 0;
+      res = luaC_steptime(L, budget, NULL);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
     case LUA_GCSETPAUSE: {
       int data = va_arg(argp, int);
       res = getgcparam(g->gcpause);
@@ -1224,6 +1256,46 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCADAPT: {
+      int survival = va_arg(argp, int);
+      res = g->gcadapt;
+      if (survival < 0)  /* enable with default threshold? */
+        survival = LUAI_GCADAPTSURVIVAL;
+      g->gcadapt = cast_byte((survival < 100) ? survival : 100);
+      luaC_adaptreset(g);
+      break;
+    }
+    case LUA_GCMODE: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      break;
+    }
+    case LUA_GCBGFREE: {  /* allocator must be thread safe */
+      int on = va_arg(argp, int);
+      res = (g->bgfree != NULL);
+      if (on > 0)
+        luaC_bgfreestart(L);
+      else if (on == 0)
+        luaC_bgfreestop(g);
+      break;
+    }
+    case LUA_GCPARMARK: {  /* threads marking full collections */
+      int nthreads = va_arg(argp, int);
+      res = luaC_parmarkthreads(g);
+      if (nthreads >= 0)
+        luaC_parmarkstart(L, nthreads);
+      break;
+    }
+    case LUA_GCFINQUEUE: {  /* finalizers wait for 'lua_runfinalizers'? */
+      int queue = va_arg(argp, int);
+      res = g->gcfinqueue;
+      if (queue >= 0)
+        g->gcfinqueue = (queue != 0);
+      break;
+    }
+    case LUA_GCFINPENDING: {
+      res = (g->gcnfin < INT_MAX) ? cast_int(g->gcnfin) : INT_MAX;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1233,6 +1305,219 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 
 
 
+/*
+** Time-budgeted collector step; 'budget' is in nanoseconds. Returns 1
+** if the step finished a cycle and -1 if the collector is in a
+** finalizer (where it cannot run).
+*/
+LUA_API int lua_gcsteptime (lua_State *L, lua_Unsigned budget,
+                            lua_Unsigned *work) {
+  global_State *g = G(L);
+  lu_mem w = 0;
+  int res;
+  lu_byte oldstp;
+  lua_lock(L);
+  if (g->gcstp & GCSTPGC) {  /* internal stop? */
+    lua_unlock(L);
+    return -1;
+  }
+  oldstp = g->gcstp;
+  g->gcstp = 0;  /* allow GC to run (GCSTPGC must be zero here) */
+  res = luaC_steptime(L, budget, &w);
+  g->gcstp = oldstp;  /* restore previous state */
+  lua_unlock(L);
+  if (work)
+    *work = cast(lua_Unsigned, w);
+  return res;
+}
+
+
+/*
+** Run pending finalizers, at most 'max' of them (all if 'max' <= 0) and
+** for about 'budget' nanoseconds (no limit if 0). Returns the number of
+** finalizers called, or -1 if called from a finalizer.
+*/
+LUA_API int lua_runfinalizers (lua_State *L, int max, lua_Unsigned budget) {
+  int res;
+  lua_lock(L);
+  if (G(L)->gcstp & GCSTPGC) {  /* inside a finalizer? */
+    lua_unlock(L);
+    return -1;
+  }
+  res = luaC_runfinalizers(L, max, budget);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Collector telemetry; see 'luaC_statcopy'.
+*/
+LUA_API int lua_gcstats (lua_State *L, lua_GCStat *recs, int n,
+                         lua_GCPhaseTotal *totals) {
+  int res;
+  lua_lock(L);
+  res = luaC_statcopy(G(L), recs, n, totals);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Sets a hard limit (in bytes, 0 for none) for the memory used by the
+** state and returns the previous one. Allocations that would exceed it
+** fail after an emergency collection, raising a memory error.
+*/
+LUA_API size_t lua_setmemlimit (lua_State *L, size_t limit) {
+  global_State *g = G(L);
+  size_t old;
+  lua_lock(L);
+  old = cast_sizet(g->memlimit);
+  g->memlimit = cast(lu_mem, limit);
+  lua_unlock(L);
+  return old;
+}
+
+
+LUA_API size_t lua_getmemlimit (lua_State *L) {
+  return cast_sizet(G(L)->memlimit);
+}
+
+
+/*
+** Memory used by objects of basic type 'type', or by the whole state
+** when 'type' is LUA_TNONE. Functions include closures, upvalues and
+** prototype headers (but not bytecode and debug information); threads
+** include their stacks and CallInfo lists; tables include their array
+** and hash parts.
+*/
+LUA_API size_t lua_memusage (lua_State *L, int type) {
+  global_State *g = G(L);
+  l_mem res;
+  lua_lock(L);
+  if (type == LUA_TNONE)
+    res = cast(l_mem, gettotalbytes(g));
+  else if (type == LUA_TFUNCTION)
+    res = g->typebytes[LUA_TFUNCTION] + g->typebytes[LUA_TUPVAL] +
+          g->typebytes[LUA_TPROTO];
+  else if (0 <= type && type < LUA_NUMTYPES)
+    res = g->typebytes[type];
+  else
+    res = 0;
+  lua_unlock(L);
+  return (res > 0) ? cast_sizet(res) : 0;
+}
+
+
+/*
+** Start the heap profiler sampling on average one allocation out of
+** every 'period' (or change its period, keeping what it has collected);
+** a non-positive period stops it and discards its data. Returns the
+** previous period (0 if it was off) or -1 if it could not start.
+*/
+LUA_API int lua_heapprof (lua_State *L, int period) {
+  int res;
+  lua_lock(L);
+  res = luaM_profstart(L, period);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set whether functions loaded from now on share their code with equal
+** functions loaded by other states (if 'on' is negative, only query).
+** Returns the previous setting.
+*/
+LUA_API int lua_sharecode (lua_State *L, int on) {
+  int res;
+  lua_lock(L);
+  res = G(L)->sharecode;
+  if (on >= 0)
+    G(L)->sharecode = cast_byte(on > 0);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set whether text chunks loaded from now on compile the bodies of
+** functions nested in other functions only when the first closure is
+** made from each one (if 'on' is negative, only query). Syntax errors
+** in those bodies are then raised by the code making the closure.
+** Returns the previous setting.
+*/
+LUA_API int lua_lazyparse (lua_State *L, int on) {
+  int res;
+  lua_lock(L);
+  res = G(L)->lazyparse;
+  if (on >= 0)
+    G(L)->lazyparse = cast_byte(on > 0);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set the maximum number of dead threads that the state keeps for
+** reuse by 'lua_newthread' (0 keeps none; if 'n' is negative, only
+** query). Returns the previous maximum.
+*/
+LUA_API int lua_threadpool (lua_State *L, int n) {
+  int res;
+  lua_lock(L);
+  res = G(L)->maxthreadpool;
+  if (n >= 0) {
+    G(L)->maxthreadpool = n;
+    luaE_trimthreadpool(L, n);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set the initial stack size, in slots, of the threads created from now
+** on; it must leave room for the first call, so it is at least
+** LUA_MINSTACK + 1 (if 'size' is negative, only query). Changing it
+** empties the pool of dead threads. Returns the previous size.
+*/
+LUA_API int lua_threadstack (lua_State *L, int size) {
+  int res;
+  lua_lock(L);
+  res = G(L)->threadstack;
+  if (size >= 0) {
+    if (size <= LUA_MINSTACK)
+      size = LUA_MINSTACK + 1;
+    else if (size > LUAI_MAXSTACK)
+      size = LUAI_MAXSTACK;
+    if (size != res) {
+      G(L)->threadstack = size;
+      luaE_trimthreadpool(L, 0);  /* kept stacks have the old size */
+    }
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Write the heap profile as "collapsed stacks": one line per allocation
+** site with its frames (outermost first, separated by ';', ending with
+** the type allocated) and its value for 'mode', estimated from the
+** samples. Returns -1 if the profiler is off.
+*/
+LUA_API int lua_heapprofdump (lua_State *L, lua_Writer writer, void *data,
+                              int mode) {
+  int status;
+  lua_lock(L);
+  status = luaM_profdump(L, writer, data, mode);
+  lua_unlock(L);
+  return status;
+}
+
+
+
 /*
 ** miscellaneous functions
 */
@@ -643,6 +643,66 @@ LUALIB_API char *luaL_buffinitsize (lua_State *L, luaL_Buffer *B, size_t sz) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Dump buffers
+** =======================================================
+*/
+
+LUALIB_API void luaL_dumpinit (luaL_DumpBuffer *B, void *arena, size_t size) {
+  B->arena = B->b = (arena != NULL) ? (char *)arena : NULL;
+  B->size = (arena != NULL) ? size : 0;
+  B->n = 0;
+}
+
+
+/*
+** Writer for 'lua_dump' appending to the dump buffer 'ud'. The buffer
+** at least doubles when it grows, so dumping a chunk costs time linear
+** in its size. Fails with LUA_ERRMEM, which 'lua_dump' returns.
+*/
+LUALIB_API int luaL_dumpwriter (lua_State *L, const void *p, size_t sz,
+                                void *ud) {
+  luaL_DumpBuffer *B = (luaL_DumpBuffer *)ud;
+  (void)L;
+  if (B->size - B->n < sz) {  /* not enough space? */
+    size_t newsize = B->size * 2;  /* double buffer size */
+    char *newbuff;
+    if (l_unlikely(MAX_SIZET - sz < B->n))  /* overflow in (n + sz)? */
+      return LUA_ERRMEM;
+    if (newsize < B->n + sz)  /* double is not big enough? */
+      newsize = B->n + sz;
+    if (newsize < LUAL_BUFFERSIZE)
+      newsize = LUAL_BUFFERSIZE;
+    if (B->b == B->arena) {  /* still in the caller's memory? */
+      newbuff = (char *)malloc(newsize);
+      if (newbuff != NULL && B->n > 0)
+        memcpy(newbuff, B->b, B->n);
+    }
+    else
+      newbuff = (char *)realloc(B->b, newsize);
+    if (l_unlikely(newbuff == NULL))
+      return LUA_ERRMEM;
+    B->b = newbuff;
+    B->size = newsize;
+  }
+  if (sz > 0) {
+    memcpy(B->b + B->n, p, sz);
+    B->n += sz;
+  }
+  return 0;
+}
+
+
+LUALIB_API void luaL_dumpfree (luaL_DumpBuffer *B) {
+  if (B->b != B->arena)
+    free(B->b);
+  luaL_dumpinit(B, B->arena, 0);
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Reference system
@@ -809,6 +869,27 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
 }
 
 
+/*
+** Loads file 'filename' from an image (see 'lua_mapfile'): binary chunks
+** dumped in the aligned layout ('lua_dumpx') use their code in place, so
+** the file is neither read nor copied.
+*/
+LUALIB_API int luaL_loadmapped (lua_State *L, const char *filename,
+                                              const char *mode) {
+  size_t size;
+  int status;
+  const char *image;
+  int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  lua_pushfstring(L, "@%s", filename);
+  image = lua_mapfile(filename, &size);
+  if (image == NULL) return errfile(L, "map", fnameindex);
+  status = luaL_loadbufferx(L, image, size, lua_tostring(L, -1), mode);
+  lua_unmapfile(image);  /* loaded functions keep their own references */
+  lua_remove(L, fnameindex);
+  return status;
+}
+
+
 typedef struct LoadS {
   const char *s;
   size_t size;
@@ -834,6 +915,39 @@ LUALIB_API int luaL_loadbufferx (lua_State *L, const char *buff, size_t size,
 }
 
 
+typedef struct LoadFill {
+  luaL_Fill fill;  /* function that reads the next piece */
+  void *ud;  /* its data */
+  char *buff;  /* buffer reused for every piece */
+} LoadFill;
+
+
+static const char *getFill (lua_State *L, void *ud, size_t *size) {
+  LoadFill *lf = (LoadFill *)ud;
+  (void)L;  /* not used */
+  *size = (*lf->fill)(lf->ud, lf->buff, LUAL_FILLSIZE);
+  return (*size > 0) ? lf->buff : NULL;
+}
+
+
+/*
+** Loads a chunk read in pieces of up to LUAL_FILLSIZE bytes by 'fill',
+** which returns 0 at the end of the input. (Read errors must be checked
+** by the caller, as in 'luaL_loadfilex'.)
+*/
+LUALIB_API int luaL_loadfill (lua_State *L, luaL_Fill fill, void *ud,
+                              const char *name, const char *mode) {
+  LoadFill lf;
+  int status;
+  lf.fill = fill;
+  lf.ud = ud;
+  lf.buff = (char *)lua_newuserdatauv(L, LUAL_FILLSIZE, 0);
+  status = lua_load(L, getFill, &lf, name, mode);
+  lua_remove(L, -2);  /* remove buffer */
+  return status;
+}
+
+
 LUALIB_API int luaL_loadstring (lua_State *L, const char *s) {
   return luaL_loadbuffer(L, s, strlen(s), s);
 }
@@ -1095,6 +1209,261 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** {======================================================
+** Pool allocator
+** =======================================================
+*/
+
+/*
+** Blocks up to POOLMAXSIZE bytes are rounded up to a multiple of
+** POOLGRAIN and carved from pages holding blocks of a single size
+** class. Freed blocks go to the free list of their class and are never
+** returned to the system individually; all pages are released together
+** when the last block of the state is freed (in 'lua_close'). A state
+** is only used by one thread at a time, so the lists need no locks.
+** The allocator relies on Lua always passing the real size of a block
+** being freed or resized ('osize'), which identifies its class.
+*/
+
+#define POOLGRAIN	16  /* class granularity (and block alignment) */
+#define POOLMAXSIZE	(POOLGRAIN * LUAL_POOLCLASSES)
+
+/* class of a block of 'sz' bytes (0 < sz <= POOLMAXSIZE) */
+#define poolclass(sz)	(((sz) - 1) / POOLGRAIN)
+
+/* size of blocks of class 'c' */
+#define classsize(c)	(((size_t)(c) + 1) * POOLGRAIN)
+
+
+typedef struct PoolPage {
+  struct PoolPage *next;  /* list of all pages */
+} PoolPage;
+
+/* space at the start of a page (keeps blocks aligned) */
+#define PAGEHEAD  \
+	(((sizeof(PoolPage) + POOLGRAIN - 1) / POOLGRAIN) * POOLGRAIN)
+
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;  /* next free block of the same class */
+} PoolBlock;
+
+
+typedef struct PoolClass {
+  PoolBlock *free;  /* list of free blocks */
+  char *top;  /* first unused byte of the current page */
+  char *limit;  /* end of the current page */
+  size_t nused;  /* blocks in use */
+  size_t nfree;  /* blocks in 'free' */
+} PoolClass;
+
+
+typedef struct Pool {
+  PoolClass cls[LUAL_POOLCLASSES];
+  PoolPage *pages;  /* all pages */
+  size_t npages;
+  size_t requested;  /* bytes requested for blocks in use from pages */
+  size_t large;  /* bytes in blocks from the system allocator */
+  size_t nlarge;  /* number of those blocks */
+  size_t nblocks;  /* total number of blocks in use */
+  int *released;  /* set when the pool is released (during creation) */
+} Pool;
+
+
+static void poolrelease (Pool *p) {
+  PoolPage *pg = p->pages;
+  while (pg != NULL) {
+    PoolPage *next = pg->next;
+    free(pg);
+    pg = next;
+  }
+  if (p->released)
+    *p->released = 1;
+  free(p);
+}
+
+
+/*
+** Get a new block of 'sz' bytes.
+*/
+static void *poolget (Pool *p, size_t sz) {
+  void *b;
+  if (sz > POOLMAXSIZE) {
+    b = malloc(sz);
+    if (b == NULL) return NULL;
+    p->large += sz;
+    p->nlarge++;
+  }
+  else {
+    PoolClass *c = &p->cls[poolclass(sz)];
+    size_t csize = classsize(poolclass(sz));
+    if (c->free != NULL) {  /* reuse a free block? */
+      b = c->free;
+      c->free = c->free->next;
+      c->nfree--;
+    }
+    else {
+      if (c->top + csize > c->limit) {  /* current page is exhausted? */
+        PoolPage *pg = (PoolPage *)malloc(LUAL_POOLPAGESIZE);
+        if (pg == NULL) return NULL;
+        pg->next = p->pages;
+        p->pages = pg;
+        p->npages++;
+        /* the tail of the previous page (less than a block) is lost */
+        c->top = (char *)pg + PAGEHEAD;
+        c->limit = (char *)pg + LUAL_POOLPAGESIZE;
+      }
+      b = c->top;
+      c->top += csize;
+    }
+    c->nused++;
+    p->requested += sz;
+  }
+  p->nblocks++;
+  return b;
+}
+
+
+/*
+** Free block 'b' of 'sz' bytes. Returns true if it was the last block
+** in use, in which case the pool itself is gone.
+*/
+static int poolput (Pool *p, void *b, size_t sz) {
+  if (sz > POOLMAXSIZE) {
+    free(b);
+    p->large -= sz;
+    p->nlarge--;
+  }
+  else {
+    PoolClass *c = &p->cls[poolclass(sz)];
+    PoolBlock *fb = (PoolBlock *)b;
+    fb->next = c->free;
+    c->free = fb;
+    c->nfree++;
+    c->nused--;
+    p->requested -= sz;
+  }
+  if (--p->nblocks == 0) {  /* state is gone? */
+    poolrelease(p);
+    return 1;
+  }
+  return 0;
+}
+
+
+static void *l_poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is just a type tag */
+  if (nsize == 0) {
+    if (ptr != NULL)
+      poolput(p, ptr, osize);
+    return NULL;
+  }
+  else if (ptr == NULL)
+    return poolget(p, nsize);
+  else if (osize > POOLMAXSIZE && nsize > POOLMAXSIZE) {  /* both large? */
+    void *nb = realloc(ptr, nsize);
+    if (nb != NULL)
+      p->large = p->large - osize + nsize;
+    return nb;
+  }
+  else if (osize <= POOLMAXSIZE && nsize <= POOLMAXSIZE &&
+           poolclass(osize) == poolclass(nsize)) {  /* same class? */
+    p->requested = p->requested - osize + nsize;
+    return ptr;
+  }
+  else {  /* move block to another class (or between pool and system) */
+    void *nb = poolget(p, nsize);
+    if (nb == NULL)
+      return NULL;
+    memcpy(nb, ptr, (osize < nsize) ? osize : nsize);
+    poolput(p, ptr, osize);  /* cannot be the last block ('nb' is alive) */
+    return nb;
+  }
+}
+
+
+/*
+** Creates a new state (or a clone of state 'from', if not NULL) whose
+** memory is managed by a pool allocator.
+*/
+static lua_State *newpoolstate (lua_State *from) {
+  int released = 0;
+  lua_State *L;
+  Pool *p = (Pool *)calloc(1, sizeof(Pool));
+  if (p == NULL)
+    return NULL;
+  p->released = &released;
+  if (from == NULL)
+    L = lua_newstate(l_poolalloc, p);
+  else
+    L = lua_clonestate(from, l_poolalloc, p);
+  if (l_likely(L)) {
+    p->released = NULL;
+    lua_atpanic(L, &panic);
+    lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
+  }
+  else if (!released)  /* failed before allocating anything? */
+    poolrelease(p);
+  return L;
+}
+
+
+LUALIB_API lua_State *luaL_newstatepool (void) {
+  return newpoolstate(NULL);
+}
+
+
+/*
+** Creates a clone of state 'from' (see 'lua_clonestate'). The clone
+** uses a pool allocator if 'from' uses one, and the default allocator
+** otherwise.
+*/
+LUALIB_API lua_State *luaL_clonestate (lua_State *from) {
+  void *ud;
+  lua_State *L;
+  if (lua_getallocf(from, &ud) == l_poolalloc)
+    return newpoolstate(from);
+  L = lua_clonestate(from, l_alloc, NULL);
+  if (l_likely(L)) {
+    lua_atpanic(L, &panic);
+    lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
+  }
+  return L;
+}
+
+
+/*
+** Fills 'stats' with the statistics of the pool allocator of state 'L'.
+** Returns 0 (and leaves 'stats' untouched) if 'L' does not use it.
+*/
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *stats) {
+  void *ud;
+  Pool *p;
+  int i;
+  if (lua_getallocf(L, &ud) != l_poolalloc)
+    return 0;
+  p = (Pool *)ud;
+  stats->pages = p->npages;
+  stats->pagebytes = p->npages * LUAL_POOLPAGESIZE;
+  stats->used = stats->free = 0;
+  for (i = 0; i < LUAL_POOLCLASSES; i++) {
+    stats->classused[i] = p->cls[i].nused;
+    stats->classfree[i] = p->cls[i].nfree;
+    stats->used += p->cls[i].nused * classsize(i);
+    stats->free += p->cls[i].nfree * classsize(i);
+  }
+  stats->requested = p->requested;
+  stats->large = p->large;
+  stats->nlarge = p->nlarge;
+  return 1;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
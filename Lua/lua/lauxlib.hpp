@@ -91,14 +91,28 @@ LUALIB_API void (luaL_unref) (lua_State *L, int t, int ref);
 
 LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
                                                const char *mode);
+LUALIB_API int (luaL_loadmapped) (lua_State *L, const char *filename,
+                                  const char *mode);
 
 #define luaL_loadfile(L,f)	luaL_loadfilex(L,f,NULL)
 
+/* reads up to 'size' bytes into 'buff'; returns how many (0 at the end) */
+typedef size_t (*luaL_Fill) (void *ud, char *buff, size_t size);
+
+/* size of the buffer of 'luaL_loadfill' */
+#if !defined(LUAL_FILLSIZE)
+#define LUAL_FILLSIZE	((size_t)1 << 16)
+#endif
+
+LUALIB_API int (luaL_loadfill) (lua_State *L, luaL_Fill fill, void *ud,
+                                const char *name, const char *mode);
+
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *from);
 
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
@@ -226,6 +240,33 @@ LUALIB_API char *(luaL_buffinitsize) (lua_State *L, luaL_Buffer *B, size_t sz);
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Dump buffers: memory outside Lua for binary chunks
+** =======================================================
+*/
+
+/*
+** A dump buffer collects the output of 'lua_dump' (through
+** 'luaL_dumpwriter'), growing geometrically. It starts in 'arena',
+** memory given by the caller, if any; it moves to the heap only if
+** that is not enough.
+*/
+typedef struct luaL_DumpBuffer {
+  char *b;  /* contents */
+  size_t n;  /* number of bytes in 'b' */
+  size_t size;  /* size of 'b' */
+  char *arena;  /* initial memory given by the caller (never freed) */
+} luaL_DumpBuffer;
+
+LUALIB_API void (luaL_dumpinit) (luaL_DumpBuffer *B, void *arena, size_t size);
+LUALIB_API int (luaL_dumpwriter) (lua_State *L, const void *p, size_t sz,
+                                  void *ud);
+LUALIB_API void (luaL_dumpfree) (luaL_DumpBuffer *B);
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -274,6 +315,38 @@ typedef struct luaL_Stream {
 /* }================================================================== */
 
 
+/*
+** {======================================================
+** Pool allocator
+** =======================================================
+*/
+
+/*
+** Statistics of a state created by 'luaL_newstatepool'. Blocks up to
+** LUAL_POOLCLASSES * 16 bytes are carved from pages of one size class;
+** 'used - requested' is the memory lost to rounding (internal
+** fragmentation) and 'free' is the memory kept in free lists (external
+** fragmentation).
+*/
+typedef struct luaL_PoolStats {
+  size_t pages;  /* pages obtained from the system */
+  size_t pagebytes;  /* total size of those pages */
+  size_t used;  /* bytes in blocks in use (rounded to their classes) */
+  size_t requested;  /* bytes requested for those blocks */
+  size_t free;  /* bytes in free blocks */
+  size_t large;  /* bytes in blocks served by the system allocator */
+  size_t nlarge;  /* number of those blocks */
+  size_t classused[LUAL_POOLCLASSES];  /* blocks in use in each class */
+  size_t classfree[LUAL_POOLCLASSES];  /* free blocks in each class */
+} luaL_PoolStats;
+
+LUALIB_API lua_State *(luaL_newstatepool) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *stats);
+
+/* }====================================================== */
+
+
+
 /*
 ** {============================================================
 ** Compatibility with deprecated conversions
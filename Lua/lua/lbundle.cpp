@@ -0,0 +1,550 @@
+/*
+** $Id: lbundle.c $
+** Bundles of precompiled modules
+** See Copyright Notice in lua.h
+*/
+
+#define lbundle_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "llimits.hpp"
+#include "lthread.hpp"
+#include "lundump.hpp"
+
+
+/*
+** 'lua_compilebundle' compiles many modules at once, on a pool of
+** native threads. Each thread compiles the sources it takes in a
+** private scratch state and keeps the results (in the format of
+** 'lua_dumpx', in the aligned layout) outside Lua; the caller then
+** merges them into a bundle, with an index of the module names, and
+** gives it to a writer. 'lua_loadbundle' loads all modules of a bundle
+** in one pass, and 'lua_bundlefind' finds one of them through the
+** index (for the bundle searcher of 'require'); when the bundle is in
+** an image from 'lua_mapfile', their code is used in place.
+**
+** Layout of a bundle. All integers are 32-bit, in the byte order of
+** the machine (bundles, like binary chunks, belong to one build):
+**   header ('BHeader');
+**   index: 'sizeindex' slots, each 0 (empty) or 1 plus the number of
+**     a module (open addressing, with linear probing from the hash of
+**     the module name);
+**   modules: 'nmodules' entries ('BModule');
+**   names, each followed by a '\0';
+**   code of each module, starting at a multiple of BUNDLEALIGN.
+** Offsets are from the start of the bundle.
+*/
+
+
+/* first bytes of bundles */
+#define BUNDLESIG	"\x1bLuB"
+
+#define BUNDLEFORMAT	0
+
+/* alignment of the code of each module */
+#define BUNDLEALIGN	8
+
+
+typedef struct BHeader {
+  char signature[4];  /* BUNDLESIG (without its '\0') */
+  lu_byte version;  /* LUAC_VERSION */
+  lu_byte format;  /* BUNDLEFORMAT */
+  lu_byte unused[2];
+  l_uint32 nmodules;
+  l_uint32 sizeindex;  /* a power of 2 */
+} BHeader;
+
+
+typedef struct BModule {
+  l_uint32 hash;  /* 'hashname' of the name */
+  l_uint32 name;  /* offset of the name */
+  l_uint32 namelen;
+  l_uint32 code;  /* offset of the code */
+  l_uint32 codelen;
+} BModule;
+
+
+/* hash of a module name (the same in every state and every process) */
+static l_uint32 hashname (const char *s, size_t l) {
+  l_uint32 h = 2166136261u;  /* FNV-1a */
+  size_t i;
+  for (i = 0; i < l; i++)
+    h = (h ^ cast_byte(s[i])) * 16777619u;
+  return h;
+}
+
+
+#define alignup(n)	(((n) + (BUNDLEALIGN - 1)) & ~cast_sizet(BUNDLEALIGN - 1))
+
+
+
+/*
+** {======================================================
+** Compilation
+** =======================================================
+*/
+
+/* result of compiling one source */
+typedef struct Compiled {
+  char *b;  /* code, or error message (NULL if there was no memory) */
+  size_t n;  /* size of 'b' */
+  int status;
+} Compiled;
+
+
+typedef struct Batch {
+  const lua_Source *src;
+  Compiled *out;
+  int n;  /* number of sources */
+  int strip;
+  l_atomic next;  /* next source to be taken by a thread */
+} Batch;
+
+
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (lua_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  (void)L;  /* not used */
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+/* buffer for 'lua_dump' */
+typedef struct DumpB {
+  char *b;
+  size_t n;
+  size_t size;
+} DumpB;
+
+
+static int writeB (lua_State *L, const void *p, size_t sz, void *ud) {
+  DumpB *d = (DumpB *)ud;
+  (void)L;  /* not used */
+  if (sz > d->size - d->n) {  /* grow buffer geometrically */
+    size_t newsize = (d->size > 0) ? d->size * 2 : 1024;
+    char *nb;
+    while (newsize - d->n < sz)
+      newsize *= 2;
+    nb = (char *)realloc(d->b, newsize);
+    if (nb == NULL)
+      return 1;
+    d->b = nb;
+    d->size = newsize;
+  }
+  memcpy(d->b + d->n, p, sz);
+  d->n += sz;
+  return 0;
+}
+
+
+/*
+** Scratch states belong to one thread and never meet the caller's
+** state, so they use 'malloc' directly (the caller's allocator need
+** not be thread-safe).
+*/
+static void *scratchalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud; (void)osize;  /* not used */
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsize);
+}
+
+
+static void compileone (lua_State *S, Batch *bt, int i) {
+  const lua_Source *src = &bt->src[i];
+  Compiled *c = &bt->out[i];
+  const char *chunkname = (src->chunkname != NULL) ? src->chunkname
+                                                   : src->name;
+  LoadS ls;
+  ls.s = src->buff;
+  ls.size = src->size;
+  c->status = lua_load(S, getS, &ls, chunkname, NULL);
+  if (c->status == LUA_OK) {
+    DumpB d = { NULL, 0, 0 };
+    if (lua_dumpx(S, writeB, &d, bt->strip, 1) != 0) {
+      free(d.b);
+      c->status = LUA_ERRMEM;
+    }
+    else {
+      c->b = d.b;
+      c->n = d.n;
+    }
+  }
+  else {  /* keep the error message */
+    size_t l;
+    const char *msg = lua_tolstring(S, -1, &l);
+    c->b = (char *)malloc(l + 1);
+    if (c->b != NULL) {
+      memcpy(c->b, msg, l + 1);
+      c->n = l;
+    }
+  }
+  lua_settop(S, 0);
+}
+
+
+/* take sources from the batch until there are no more */
+static void compileall (Batch *bt) {
+  lua_State *S = NULL;
+  int i;
+  while ((i = cast_int(l_atomicadd(&bt->next, 1))) < bt->n) {
+    if (S == NULL && (S = lua_newstate(scratchalloc, NULL)) == NULL)
+      bt->out[i].status = LUA_ERRMEM;
+    else
+      compileone(S, bt, i);
+  }
+  if (S != NULL)
+    lua_close(S);
+}
+
+
+static l_threadproc(compilemain) {
+  compileall((Batch *)ud);
+  return l_threadret;
+}
+
+
+/*
+** Compile all sources, with 'nthreads' threads counting the caller's.
+** Threads that cannot be created just leave more work for the others.
+*/
+static void compilebatch (Batch *bt, int nthreads) {
+  l_thread *th = NULL;
+  int started = 0;
+  if (nthreads > 1)
+    th = (l_thread *)malloc((nthreads - 1) * sizeof(l_thread));
+  if (th != NULL) {
+    while (started < nthreads - 1 &&
+           l_threadstart(&th[started], compilemain, bt))
+      started++;
+  }
+  compileall(bt);
+  while (started > 0)
+    l_threadjoin(th[--started]);
+  free(th);
+}
+
+
+static void freebatch (Batch *bt) {
+  int i;
+  for (i = 0; i < bt->n; i++)
+    free(bt->out[i].b);
+  free(bt->out);
+}
+
+
+static int batcherror (lua_State *L, Batch *bt) {
+  int i;
+  for (i = 0; i < bt->n; i++) {
+    Compiled *c = &bt->out[i];
+    if (c->status != LUA_OK) {
+      int status = c->status;
+      if (status != LUA_ERRMEM && c->b != NULL)
+        lua_pushlstring(L, c->b, c->n);
+      else {
+        status = LUA_ERRMEM;
+        lua_pushliteral(L, "not enough memory");
+      }
+      return status;
+    }
+  }
+  return LUA_OK;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Writing bundles
+** =======================================================
+*/
+
+/*
+** Build the header, index and module entries of the bundle (followed
+** by the names and the padding before the first code) in one block.
+** Returns NULL and sets '*status' (with a message pushed on 'L') if
+** there is an error.
+*/
+static char *buildhead (lua_State *L, Batch *bt, size_t *headsize,
+                        int *status) {
+  const lua_Source *src = bt->src;
+  int n = bt->n;
+  size_t sizeindex = 1;
+  size_t namesize = 0, total;
+  size_t nameoff, codeoff;
+  l_uint32 *index;
+  BModule *mods;
+  BHeader h;
+  char *head;
+  int i;
+  while (sizeindex < cast_sizet(n) * 2)  /* keep the index half empty */
+    sizeindex *= 2;
+  for (i = 0; i < n; i++)
+    namesize += strlen(src[i].name) + 1;
+  nameoff = sizeof(BHeader) + sizeindex * sizeof(l_uint32)
+                            + n * sizeof(BModule);
+  *headsize = alignup(nameoff + namesize);
+  total = *headsize;
+  for (i = 0; i < n; i++)
+    total = alignup(total) + bt->out[i].n;
+  if (total > 0xFFFFFFFFu) {
+    *status = LUA_ERRRUN;
+    lua_pushliteral(L, "bundle too large");
+    return NULL;
+  }
+  head = (char *)calloc(*headsize, 1);
+  if (head == NULL) {
+    *status = LUA_ERRMEM;
+    lua_pushliteral(L, "not enough memory");
+    return NULL;
+  }
+  memcpy(h.signature, BUNDLESIG, sizeof(h.signature));
+  h.version = LUAC_VERSION;
+  h.format = BUNDLEFORMAT;
+  h.unused[0] = h.unused[1] = 0;
+  h.nmodules = cast(l_uint32, n);
+  h.sizeindex = cast(l_uint32, sizeindex);
+  memcpy(head, &h, sizeof(h));
+  index = (l_uint32 *)(head + sizeof(BHeader));
+  mods = (BModule *)(index + sizeindex);
+  codeoff = *headsize;
+  for (i = 0; i < n; i++) {
+    size_t l = strlen(src[i].name);
+    size_t slot;
+    BModule *m = &mods[i];
+    m->hash = hashname(src[i].name, l);
+    m->name = cast(l_uint32, nameoff);
+    m->namelen = cast(l_uint32, l);
+    m->code = cast(l_uint32, codeoff);
+    m->codelen = cast(l_uint32, bt->out[i].n);
+    memcpy(head + nameoff, src[i].name, l + 1);
+    nameoff += l + 1;
+    codeoff = alignup(codeoff + bt->out[i].n);
+    for (slot = m->hash & (sizeindex - 1); index[slot] != 0;
+         slot = (slot + 1) & (sizeindex - 1)) {
+      const BModule *o = &mods[index[slot] - 1];
+      if (o->hash == m->hash && o->namelen == m->namelen &&
+          memcmp(head + o->name, src[i].name, l) == 0) {
+        free(head);
+        *status = LUA_ERRRUN;
+        lua_pushfstring(L, "duplicate module '%s' in bundle", src[i].name);
+        return NULL;
+      }
+    }
+    index[slot] = cast(l_uint32, i + 1);
+  }
+  return head;
+}
+
+
+static int writebundle (lua_State *L, Batch *bt, lua_Writer writer,
+                        void *data) {
+  static const char zeros[BUNDLEALIGN] = { 0 };
+  size_t pos;
+  int status = LUA_OK;
+  int i;
+  char *head = buildhead(L, bt, &pos, &status);
+  if (head == NULL)
+    return status;
+  if (writer(L, head, pos, data) != 0)
+    status = LUA_ERRRUN;
+  for (i = 0; status == LUA_OK && i < bt->n; i++) {
+    const Compiled *c = &bt->out[i];
+    size_t pad = alignup(pos) - pos;
+    if ((pad > 0 && writer(L, zeros, pad, data) != 0) ||
+        writer(L, c->b, c->n, data) != 0)
+      status = LUA_ERRRUN;
+    pos += pad + c->n;
+  }
+  free(head);
+  if (status != LUA_OK)
+    lua_pushliteral(L, "cannot write bundle");
+  return status;
+}
+
+
+/*
+** Compile the 'n' modules in 'sources' on 'nthreads' threads (0 for
+** one per processor) and give the resulting bundle to 'writer'. Code
+** is stripped of debug information if 'strip' is true. Returns
+** LUA_OK, or an error status with a message on the stack (for errors
+** in the sources, the one of the first source that failed).
+*/
+LUA_API int lua_compilebundle (lua_State *L, const lua_Source *sources,
+                               int n, int nthreads, int strip,
+                               lua_Writer writer, void *data) {
+  Batch bt;
+  int status;
+  bt.src = sources;
+  bt.n = (n > 0) ? n : 0;
+  bt.strip = (strip != 0);
+  bt.next = 0;
+  bt.out = (Compiled *)calloc((bt.n > 0) ? bt.n : 1, sizeof(Compiled));
+  if (bt.out == NULL) {
+    lua_pushliteral(L, "not enough memory");
+    return LUA_ERRMEM;
+  }
+  if (nthreads <= 0)
+    nthreads = l_cpucount();
+  if (nthreads > bt.n)  /* no more threads than sources */
+    nthreads = bt.n;
+  compilebatch(&bt, nthreads);
+  status = batcherror(L, &bt);
+  if (status == LUA_OK)
+    status = writebundle(L, &bt, writer, data);
+  freebatch(&bt);
+  return status;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Reading bundles
+** =======================================================
+*/
+
+/*
+** Check the header and the module entries of a bundle, so that later
+** reads stay inside it. Returns an error message, or NULL if the
+** bundle is good.
+*/
+static const char *checkbundle (const char *buff, size_t size, BHeader *h) {
+  size_t i, tables;
+  if (size < sizeof(BHeader))
+    return "truncated bundle";
+  memcpy(h, buff, sizeof(BHeader));
+  if (memcmp(h->signature, BUNDLESIG, sizeof(h->signature)) != 0)
+    return "not a bundle";
+  if (h->version != LUAC_VERSION || h->format != BUNDLEFORMAT)
+    return "bundle version mismatch";
+  if (h->sizeindex == 0 || (h->sizeindex & (h->sizeindex - 1)) != 0 ||
+      h->sizeindex < h->nmodules)
+    return "bad bundle index";
+  tables = sizeof(BHeader) + cast_sizet(h->sizeindex) * sizeof(l_uint32)
+                           + cast_sizet(h->nmodules) * sizeof(BModule);
+  if (tables > size)
+    return "truncated bundle";
+  for (i = 0; i < h->sizeindex; i++) {
+    l_uint32 slot;
+    memcpy(&slot, buff + sizeof(BHeader) + i * sizeof(l_uint32),
+           sizeof(l_uint32));
+    if (slot > h->nmodules)
+      return "bad bundle index";
+  }
+  for (i = 0; i < h->nmodules; i++) {
+    BModule m;
+    memcpy(&m, buff + tables - (h->nmodules - i) * sizeof(BModule),
+           sizeof(BModule));
+    if (cast_sizet(m.name) + m.namelen >= size ||
+        buff[m.name + m.namelen] != '\0' ||
+        cast_sizet(m.code) + m.codelen > size || m.code % BUNDLEALIGN != 0)
+      return "bad bundle entry";
+  }
+  return NULL;
+}
+
+
+/*
+** Check a bundle before using 'lua_bundlefind' on it. Returns an error
+** message, or NULL if the bundle is good.
+*/
+LUA_API const char *lua_bundlecheck (const char *buff, size_t size) {
+  BHeader h;
+  return checkbundle(buff, size, &h);
+}
+
+
+/*
+** Find module 'name' in a bundle checked by 'lua_bundlecheck', through
+** the index. Returns its code (a binary chunk) and sets '*len' to its
+** size, or returns NULL if the bundle has no such module.
+*/
+LUA_API const char *lua_bundlefind (const char *buff, size_t size,
+                                    const char *name, size_t *len) {
+  BHeader h;
+  const char *index = buff + sizeof(BHeader);
+  const char *modules;
+  size_t l = strlen(name);
+  l_uint32 hash = hashname(name, l);
+  l_uint32 i, n;
+  (void)size;  /* all offsets were checked by 'lua_bundlecheck' */
+  memcpy(&h, buff, sizeof(BHeader));
+  modules = index + h.sizeindex * sizeof(l_uint32);
+  i = hash & (h.sizeindex - 1);
+  for (n = 0; n < h.sizeindex; n++, i = (i + 1) & (h.sizeindex - 1)) {
+    l_uint32 slot;
+    BModule m;
+    memcpy(&slot, index + i * sizeof(l_uint32), sizeof(l_uint32));
+    if (slot == 0)  /* empty slot? */
+      break;  /* module is not in the bundle */
+    memcpy(&m, modules + (slot - 1) * sizeof(BModule), sizeof(BModule));
+    if (m.hash == hash && m.namelen == l &&
+        memcmp(buff + m.name, name, l) == 0) {
+      *len = m.codelen;
+      return buff + m.code;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+** Load all modules of a bundle and push a table with their main
+** functions, indexed by module name. If there is an error, pushes only
+** its message and returns its status.
+*/
+LUA_API int lua_loadbundle (lua_State *L, const char *buff, size_t size) {
+  BHeader h;
+  const char *modules;
+  const char *msg = checkbundle(buff, size, &h);
+  l_uint32 i;
+  if (msg != NULL) {
+    lua_pushstring(L, msg);
+    return LUA_ERRSYNTAX;
+  }
+  modules = buff + sizeof(BHeader) + h.sizeindex * sizeof(l_uint32);
+  lua_createtable(L, 0, cast_int(h.nmodules));
+  for (i = 0; i < h.nmodules; i++) {
+    BModule m;
+    LoadS ls;
+    int status;
+    memcpy(&m, modules + i * sizeof(BModule), sizeof(BModule));
+    lua_pushlstring(L, buff + m.name, m.namelen);
+    ls.s = buff + m.code;
+    ls.size = m.codelen;
+    status = lua_load(L, getS, &ls, lua_tostring(L, -1), "b");
+    if (status != LUA_OK) {
+      lua_replace(L, -3);  /* error message replaces the table */
+      lua_pop(L, 1);  /* remove name */
+      return status;
+    }
+    lua_rawset(L, -3);
+  }
+  return LUA_OK;
+}
+
+/* }====================================================== */
@@ -0,0 +1,674 @@
+/*
+** $Id: lcache.c $
+** Cache of compiled chunks
+** See Copyright Notice in lua.h
+*/
+
+#define lcache_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "lcache.hpp"
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+#include "lthread.hpp"
+#include "lundump.hpp"
+
+
+/*
+** Text chunks loaded with 'lua_loadcached' are cached at two levels.
+** Each state keeps the functions it compiled in a table in the
+** registry, indexed by a hash of the chunk name and source; a hit
+** there only creates a new closure for the cached prototype. Below
+** it, a process-wide cache keeps the precompiled form of recent chunks
+** (in the format of 'lua_dump'), so that other states load them
+** without compiling. The process-wide cache drops the least recently
+** used chunks to stay within its memory budget and, when given a
+** directory, also keeps each chunk in a file named after its hash, so
+** that chunks outlive the process.
+**
+** The process-wide cache belongs to no state, so its memory comes from
+** 'malloc' and is not counted as Lua memory. Chunk files must come
+** from a trusted directory, as precompiled code is not verified.
+*/
+
+
+typedef unsigned long long CHash;
+
+
+typedef struct CChunk {
+  struct CChunk *hnext;  /* next chunk in the same hash chain */
+  struct CChunk *prev, *next;  /* list of chunks, most recently used first */
+  CHash h;
+  size_t namelen;
+  size_t srclen;
+  size_t codelen;
+  int refs;  /* number of loads using the chunk */
+  int dead;  /* true if removed from the cache while in use */
+  char data[1];  /* chunk name, source and precompiled code */
+} CChunk;
+
+
+#define chunkhead(nl,sl)	(offsetof(CChunk, data) + (nl) + (sl))
+#define chunksize(c)	(chunkhead((c)->namelen, (c)->srclen) + (c)->codelen)
+#define chunkcode(c)	((c)->data + (c)->namelen + (c)->srclen)
+
+
+/* first bytes of chunk files */
+#define CFILEMAGIC	"\x1bLCC"
+
+
+static struct ChunkCache {
+  l_smutex lock;  /* protects all fields but the counters */
+  CChunk **hash;
+  size_t sizehash;  /* size of 'hash' (a power of 2, or 0) */
+  size_t nchunks;
+  CChunk *first, *last;  /* list of all chunks */
+  size_t used;  /* total size of the chunks */
+  size_t budget;  /* maximum for 'used'; 0 disables the cache */
+  char *dir;  /* directory of chunk files (NULL if none) */
+  l_atomic on;  /* true when 'budget' is not 0 */
+  l_atomic hits;  /* loads served without compiling */
+  l_atomic misses;  /* loads that compiled their chunk */
+} cache = { L_SMUTEXINIT, NULL, 0, 0, NULL, NULL, 0, 0, NULL, 0, 0, 0 };
+
+
+/*
+** {======================================================
+** Process-wide cache (all functions run with 'cache.lock' held)
+** =======================================================
+*/
+
+#define hashslot(h)	((h) & (cache.sizehash - 1))
+
+
+static void unlinklru (CChunk *c) {
+  if (c->prev != NULL) c->prev->next = c->next;
+  else cache.first = c->next;
+  if (c->next != NULL) c->next->prev = c->prev;
+  else cache.last = c->prev;
+}
+
+
+static void linklru (CChunk *c) {
+  c->prev = NULL;
+  c->next = cache.first;
+  if (cache.first != NULL) cache.first->prev = c;
+  else cache.last = c;
+  cache.first = c;
+}
+
+
+/*
+** Remove chunk 'c' from the cache. It is freed right away unless some
+** load is still using it.
+*/
+static void removechunk (CChunk *c) {
+  CChunk **p = &cache.hash[hashslot(c->h)];
+  while (*p != c)
+    p = &(*p)->hnext;
+  *p = c->hnext;
+  unlinklru(c);
+  cache.nchunks--;
+  cache.used -= chunksize(c);
+  if (c->refs == 0)
+    free(c);
+  else
+    c->dead = 1;  /* last 'release' will free it */
+}
+
+
+/* remove least recently used chunks until 'used' is at most 'limit' */
+static void evict (size_t limit) {
+  while (cache.used > limit)
+    removechunk(cache.last);
+}
+
+
+static CChunk *findchunk (CHash h, const char *name, size_t nl,
+                          const char *s, size_t sl) {
+  CChunk *c;
+  if (cache.sizehash == 0)
+    return NULL;
+  for (c = cache.hash[hashslot(h)]; c != NULL; c = c->hnext) {
+    if (c->h == h && c->namelen == nl && c->srclen == sl &&
+        memcmp(c->data, name, nl) == 0 && memcmp(c->data + nl, s, sl) == 0) {
+      if (c != cache.first) {  /* move it to the front */
+        unlinklru(c);
+        linklru(c);
+      }
+      return c;
+    }
+  }
+  return NULL;
+}
+
+
+static void growhash (void) {
+  size_t i;
+  size_t newsize = (cache.sizehash == 0) ? 64 : cache.sizehash * 2;
+  CChunk **nh = (CChunk **)calloc(newsize, sizeof(CChunk *));
+  if (nh == NULL)
+    return;  /* keep old (longer) chains */
+  for (i = 0; i < cache.sizehash; i++) {
+    CChunk *c = cache.hash[i];
+    while (c != NULL) {
+      CChunk *next = c->hnext;
+      size_t slot = c->h & (newsize - 1);
+      c->hnext = nh[slot];
+      nh[slot] = c;
+      c = next;
+    }
+  }
+  free(cache.hash);
+  cache.hash = nh;
+  cache.sizehash = newsize;
+}
+
+
+/* insert chunk 'c'; returns 0 if it does not fit in the cache */
+static int insertchunk (CChunk *c) {
+  size_t sz = chunksize(c);
+  if (sz > cache.budget)
+    return 0;
+  if (cache.nchunks >= cache.sizehash)
+    growhash();
+  if (cache.sizehash == 0)
+    return 0;  /* no memory for the hash */
+  c->hnext = cache.hash[hashslot(c->h)];
+  cache.hash[hashslot(c->h)] = c;
+  linklru(c);
+  cache.nchunks++;
+  cache.used += sz;
+  evict(cache.budget);  /* 'c' is the newest, so it stays */
+  return 1;
+}
+
+
+/* path of the file for chunks with hash 'h' (NULL if none) */
+static char *chunkpath (CHash h) {
+  size_t sz;
+  char *path;
+  if (cache.dir == NULL)
+    return NULL;
+  sz = strlen(cache.dir) + 24;  /* '/', 16 digits, ".luac" and '\0' */
+  path = (char *)malloc(sz);
+  if (path != NULL)
+    snprintf(path, sz, "%s/%016llx.luac", cache.dir, h);
+  return path;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Chunk references and files
+** =======================================================
+*/
+
+
+/*
+** Add a new chunk 'c' to the cache, unless an equal chunk is already
+** there. Returns the chunk in the cache, or 'c' itself when it does not
+** fit (then it is freed by its 'release'), with one more reference.
+*/
+static CChunk *addchunk (CChunk *c) {
+  CChunk *old;
+  l_locksm(&cache.lock);
+  old = findchunk(c->h, c->data, c->namelen, c->data + c->namelen,
+                  c->srclen);
+  if (old != NULL) {
+    free(c);
+    c = old;
+  }
+  else if (cache.budget == 0 || !insertchunk(c))
+    c->dead = 1;
+  c->refs++;
+  l_unlocksm(&cache.lock);
+  return c;
+}
+
+
+/* drop a reference to 'c'; if 'bad', also remove it from the cache */
+static void release (CChunk *c, int bad) {
+  l_locksm(&cache.lock);
+  if (bad && !c->dead)
+    removechunk(c);
+  if (--c->refs == 0 && c->dead)
+    free(c);
+  l_unlocksm(&cache.lock);
+}
+
+
+/*
+** Read the chunk with hash 'h' from file 'path'. The file holds a mark,
+** the sizes of the name, the source and the code, and then the three of
+** them; it must hold the same name and source (files can be replaced or
+** half written by other processes).
+*/
+static CChunk *readchunk (const char *path, CHash h, const char *name,
+                          size_t nl, const char *s, size_t sl) {
+  char magic[sizeof(CFILEMAGIC) - 1];
+  size_t sizes[3];
+  CChunk *c = NULL;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return NULL;
+  if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+      memcmp(magic, CFILEMAGIC, sizeof(magic)) == 0 &&
+      fread(sizes, sizeof(size_t), 3, f) == 3 &&
+      sizes[0] == nl && sizes[1] == sl && sizes[2] < MAX_SIZE / 2 &&
+      (c = (CChunk *)malloc(chunkhead(nl, sl) + sizes[2])) != NULL) {
+    size_t total = nl + sl + sizes[2];
+    if (fread(c->data, 1, total, f) == total &&
+        memcmp(c->data, name, nl) == 0 && memcmp(c->data + nl, s, sl) == 0) {
+      c->h = h;
+      c->namelen = nl;
+      c->srclen = sl;
+      c->codelen = sizes[2];
+      c->refs = 0;
+      c->dead = 0;
+    }
+    else {
+      free(c);
+      c = NULL;
+    }
+  }
+  fclose(f);
+  return c;
+}
+
+
+static void writechunk (const char *path, const CChunk *c) {
+  size_t sizes[3];
+  size_t total = c->namelen + c->srclen + c->codelen;
+  int ok;
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    return;
+  sizes[0] = c->namelen;
+  sizes[1] = c->srclen;
+  sizes[2] = c->codelen;
+  ok = (fwrite(CFILEMAGIC, 1, sizeof(CFILEMAGIC) - 1, f) ==
+          sizeof(CFILEMAGIC) - 1 &&
+        fwrite(sizes, sizeof(size_t), 3, f) == 3 &&
+        fwrite(c->data, 1, total, f) == total);
+  if (fclose(f) != 0 || !ok)
+    remove(path);  /* do not leave a broken file behind */
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Loading
+** =======================================================
+*/
+
+
+typedef struct CLoad {
+  const char *buff;
+  size_t sz;
+  const char *name;
+  CHash h;
+  int status;  /* result of the load */
+} CLoad;
+
+
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (lua_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  (void)L;  /* not used */
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+static int loadbuff (lua_State *L, const char *buff, size_t sz,
+                     const char *name, const char *mode) {
+  LoadS ls;
+  ls.s = buff;
+  ls.size = sz;
+  return lua_load(L, getS, &ls, name, mode);
+}
+
+
+/* buffer for 'lua_dump' */
+typedef struct DumpB {
+  char *b;
+  size_t n;
+  size_t size;
+} DumpB;
+
+
+static int writeB (lua_State *L, const void *p, size_t sz, void *ud) {
+  DumpB *d = (DumpB *)ud;
+  (void)L;  /* not used */
+  if (sz > d->size - d->n) {  /* grow buffer geometrically */
+    size_t newsize = d->size * 2;
+    char *nb;
+    while (newsize - d->n < sz)
+      newsize *= 2;
+    nb = (char *)realloc(d->b, newsize);
+    if (nb == NULL)
+      return 1;
+    d->b = nb;
+    d->size = newsize;
+  }
+  memcpy(d->b + d->n, p, sz);
+  d->n += sz;
+  return 0;
+}
+
+
+static CHash hashchunk (const char *name, const char *s, size_t l) {
+  CHash h = 14695981039346656037ULL;  /* FNV-1a */
+  size_t i;
+  for (; *name != '\0'; name++)
+    h = (h ^ cast_byte(*name)) * 1099511628211ULL;
+  h *= 1099511628211ULL;  /* hash the '\0' ending the name */
+  for (i = 0; i < l; i++)
+    h = (h ^ cast_byte(s[i])) * 1099511628211ULL;
+  return h;
+}
+
+
+/*
+** Dump the function on the top of the stack, compiled from 'cl', and
+** add it to the process-wide cache (and to the file 'path').
+*/
+static void storechunk (lua_State *L, const CLoad *cl, size_t nl,
+                        const char *path) {
+  DumpB b;
+  CChunk *c;
+  size_t head = chunkhead(nl, cl->sz);
+  b.size = head + 256;
+  b.n = head;  /* name and source go before the code */
+  b.b = (char *)malloc(b.size);
+  if (b.b == NULL)
+    return;
+  if (lua_dump(L, writeB, &b, 0) != 0) {
+    free(b.b);
+    return;
+  }
+  c = (CChunk *)b.b;
+  if (b.n < b.size) {  /* give back unused space */
+    CChunk *nc = (CChunk *)realloc(c, b.n);
+    if (nc != NULL) c = nc;
+  }
+  c->h = cl->h;
+  c->namelen = nl;
+  c->srclen = cl->sz;
+  c->codelen = b.n - head;
+  c->refs = 0;
+  c->dead = 0;
+  memcpy(c->data, cl->name, nl);
+  memcpy(c->data + nl, cl->buff, cl->sz);
+  if (path != NULL)
+    writechunk(path, c);
+  release(addchunk(c), 0);
+}
+
+
+/*
+** Load chunk 'cl' through the process-wide cache: from memory, from its
+** file or, failing both, by compiling it.
+*/
+static int loadshared (lua_State *L, const CLoad *cl) {
+  size_t nl = strlen(cl->name);
+  char *path = NULL;
+  int status;
+  CChunk *c;
+  l_locksm(&cache.lock);
+  c = findchunk(cl->h, cl->name, nl, cl->buff, cl->sz);
+  if (c != NULL)
+    c->refs++;
+  else
+    path = chunkpath(cl->h);
+  l_unlocksm(&cache.lock);
+  if (c == NULL && path != NULL) {
+    c = readchunk(path, cl->h, cl->name, nl, cl->buff, cl->sz);
+    if (c != NULL)
+      c = addchunk(c);
+  }
+  if (c != NULL) {
+    status = loadbuff(L, chunkcode(c), c->codelen, cl->name, "b");
+    release(c, status != LUA_OK);  /* drop code from another build */
+    if (status == LUA_OK) {
+      l_atomicadd(&cache.hits, 1);
+      free(path);
+      return LUA_OK;
+    }
+    lua_pop(L, 1);  /* remove error message; compile it */
+  }
+  l_atomicadd(&cache.misses, 1);
+  status = loadbuff(L, cl->buff, cl->sz, cl->name, "t");
+  if (status == LUA_OK && !G(L)->lazyparse)  /* (a dump compiles all) */
+    storechunk(L, cl, nl, path);
+  free(path);
+  return status;
+}
+
+
+/* push the table of chunks of the state; returns its index */
+static int statetable (lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_CHUNKSKEY) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_createtable(L, 0, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUA_CHUNKSKEY);
+  }
+  return lua_gettop(L);
+}
+
+
+/* check whether the function below the top was compiled from 'name' */
+static int fromchunk (lua_State *L, const char *name) {
+  const TValue *o;
+  int res;
+  lua_lock(L);
+  o = s2v(L->top - 2);
+  res = ttisLclosure(o) && clLvalue(o)->p->source != NULL &&
+        strcmp(getstr(clLvalue(o)->p->source), name) == 0;
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Look for chunk 'cl' in the table 't' of the state, where each entry
+** is a pair {function, source}. If found, leaves the function on the
+** top of the stack.
+*/
+static int getcached (lua_State *L, int t, const CLoad *cl) {
+  if (lua_rawgeti(L, t, l_castU2S(cl->h)) == LUA_TTABLE) {
+    size_t l;
+    const char *s;
+    lua_rawgeti(L, -1, 1);
+    lua_rawgeti(L, -2, 2);
+    s = lua_tolstring(L, -1, &l);
+    if (s != NULL && l == cl->sz && memcmp(s, cl->buff, l) == 0 &&
+        fromchunk(L, cl->name)) {
+      lua_pop(L, 1);  /* remove source */
+      lua_remove(L, -2);  /* remove entry */
+      return 1;
+    }
+    lua_pop(L, 2);
+  }
+  lua_pop(L, 1);
+  return 0;
+}
+
+
+/*
+** Add the function on the top of the stack to the table 't' of the
+** state, emptying it first if it is full.
+*/
+static void setcached (lua_State *L, int t, const CLoad *cl) {
+  lua_Integer k = l_castU2S(cl->h);
+  lua_Integer n;
+  lua_getfield(L, t, "n");
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (n >= LUAI_MAXSTATECHUNKS) {  /* table is full? */
+    lua_createtable(L, 0, 0);  /* start a new one */
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUA_CHUNKSKEY);
+    lua_replace(L, t);
+    n = 0;
+  }
+  if (lua_rawgeti(L, t, k) == LUA_TNIL)  /* not replacing a collision? */
+    n++;
+  lua_pop(L, 1);
+  lua_createtable(L, 2, 0);
+  lua_pushvalue(L, -2);
+  lua_rawseti(L, -2, 1);
+  lua_pushlstring(L, cl->buff, cl->sz);
+  lua_rawseti(L, -2, 2);
+  lua_rawseti(L, t, k);
+  lua_pushinteger(L, n);
+  lua_setfield(L, t, "n");
+}
+
+
+/*
+** Replace the function on the top of the stack by a new closure of the
+** same prototype, with its own upvalues and the global table as its
+** first upvalue (as in 'lua_load').
+*/
+static void newinstance (lua_State *L) {
+  LClosure *cl;
+  Proto *p;
+  lua_lock(L);
+  p = clLvalue(s2v(L->top - 1))->p;
+  cl = luaF_newLclosure(L, p->sizeupvalues);
+  cl->p = p;
+  setclLvalue2s(L, L->top - 1, cl);  /* anchor it */
+  luaF_initupvals(L, cl);
+  if (cl->nupvalues >= 1) {
+    const TValue *gt = &hvalue(&G(L)->l_registry)->array[LUA_RIDX_GLOBALS - 1];
+    setobj(L, cl->upvals[0]->v, gt);
+    luaC_barrier(L, cl->upvals[0], gt);
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
+/*
+** Protected part of 'lua_loadcached' (allocations in the tables may
+** raise memory errors). Returns the function or the error message.
+*/
+static int cachedload (lua_State *L) {
+  CLoad *cl = (CLoad *)lua_touserdata(L, 1);
+  int t = statetable(L);
+  if (getcached(L, t, cl)) {
+    newinstance(L);
+    l_atomicadd(&cache.hits, 1);
+  }
+  else {
+    cl->status = loadshared(L, cl);
+    if (cl->status == LUA_OK)
+      setcached(L, t, cl);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** Load a text chunk like 'lua_load', going through the cache of compiled
+** chunks when it is enabled. Each load gets a new closure, with its own
+** upvalues, even when it shares the prototype with previous loads.
+*/
+LUA_API int lua_loadcached (lua_State *L, const char *buff, size_t sz,
+                            const char *chunkname) {
+  CLoad cl;
+  int status;
+  if (chunkname == NULL) chunkname = "?";
+  if (!l_atomicload(&cache.on) || (sz > 0 && buff[0] == LUA_SIGNATURE[0]))
+    return loadbuff(L, buff, sz, chunkname, NULL);  /* load it directly */
+  cl.buff = buff;
+  cl.sz = sz;
+  cl.name = chunkname;
+  cl.h = hashchunk(chunkname, buff, sz);
+  cl.status = LUA_OK;
+  lua_pushcfunction(L, cachedload);
+  lua_pushlightuserdata(L, &cl);
+  status = lua_pcall(L, 1, 1, 0);
+  return (status != LUA_OK) ? status : cl.status;
+}
+
+
+/*
+** Set the memory budget of the process-wide cache (0 disables the
+** cache and empties it) and the directory of chunk files (NULL for
+** none). Returns 0 if there is no memory to keep the directory name.
+*/
+LUA_API int lua_chunkcache (size_t budget, const char *dir) {
+  char *d = NULL;
+  if (dir != NULL) {
+    size_t l = strlen(dir) + 1;
+    d = (char *)malloc(l);
+    if (d == NULL)
+      return 0;
+    memcpy(d, dir, l);
+  }
+  l_locksm(&cache.lock);
+  free(cache.dir);
+  cache.dir = d;
+  cache.budget = budget;
+  evict(budget);
+  l_atomicstore(&cache.on, budget > 0);
+  l_unlocksm(&cache.lock);
+  return 1;
+}
+
+
+/* empty the process-wide cache (files are kept) */
+LUA_API void lua_chunkcacheclear (void) {
+  l_locksm(&cache.lock);
+  evict(0);
+  l_unlocksm(&cache.lock);
+}
+
+
+LUA_API size_t lua_chunkcacheinfo (int what) {
+  size_t res;
+  l_locksm(&cache.lock);
+  switch (what) {
+    case LUA_CCBUDGET: res = cache.budget; break;
+    case LUA_CCSIZE: res = cache.used; break;
+    case LUA_CCCOUNT: res = cache.nchunks; break;
+    case LUA_CCHITS: res = cast_sizet(l_atomicload(&cache.hits)); break;
+    case LUA_CCMISSES: res = cast_sizet(l_atomicload(&cache.misses)); break;
+    default: res = 0;
+  }
+  l_unlocksm(&cache.lock);
+  return res;
+}
+
@@ -0,0 +1,27 @@
+/*
+** $Id: lcache.h $
+** Cache of compiled chunks
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lcache_h
+#define lcache_h
+
+
+#include "lua.hpp"
+
+
+/* key, in the registry, for the table of chunks compiled by a state */
+#define LUA_CHUNKSKEY	"_CHUNKS"
+
+
+/*
+** Maximum number of chunks kept in the table of each state; when
+** full, the table is emptied (the process-wide cache still has the
+** chunks, so they are loaded again without being compiled).
+*/
+#if !defined(LUAI_MAXSTATECHUNKS)
+#define LUAI_MAXSTATECHUNKS	1024
+#endif
+
+#endif
@@ -0,0 +1,591 @@
+/*
+** $Id: lclone.c $
+** Cloning of states
+** See Copyright Notice in lua.h
+*/
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "ldo.hpp"
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lmem.hpp"
+#include "lobject.hpp"
+#include "lshare.hpp"
+#include "lstate.hpp"
+#include "lstring.hpp"
+#include "ltable.hpp"
+
+
+/*
+** A clone of a state is a new state with a copy of everything the
+** template can reach from its registry and from the metatables of the
+** basic types: the standard libraries, the globals, the loaded modules
+** and whatever else a host prepared before cloning. Building it costs
+** one allocation per object and no compilation and no calls to the
+** functions that opened the libraries, so it is much faster than
+** building the same state from scratch.
+**
+** Objects are copied in two steps. The first time an object is
+** reached, 'getcopy' creates an empty object of the same kind and size
+** and queues the original; later, 'fill' copies the contents of each
+** queued object, translating every reference through the map from
+** originals to copies. So, cycles and shared objects are copied once
+** and the copy never recurses, however deep the graph.
+**
+** Objects that cannot be copied make the clone fail: a coroutine that
+** is running or suspended has C frames and 'CallInfo's that belong to
+** the template (a coroutine that died by an error is copied as a dead
+** one). Memory outside Lua (the contents of a C library
+** handle, a 'FILE', etc.) is not copied: userdata are copied byte by
+** byte, and their metatables can have a '__clone' metamethod, called
+** with each copy once the clone is complete, to fix what needs fixing.
+*/
+
+
+typedef struct Cloner {
+  lua_State *from;  /* template */
+  lua_State *L;  /* main thread of the clone */
+  GCObject **keys;  /* originals (open addressing; NULL is a free slot) */
+  GCObject **vals;  /* copies of the originals in 'keys' */
+  size_t sizemap;  /* size of 'keys' and 'vals' (a power of 2) */
+  size_t nmap;  /* number of objects in the map */
+  GCObject **queue;  /* originals waiting to be filled */
+  size_t nqueue;
+  size_t sizequeue;
+  GCObject **withmt;  /* copies with a metatable */
+  size_t nwithmt;
+  size_t sizewithmt;
+  int nfin;  /* number of copies marked for finalization */
+  Table *pending;  /* '__clone' metamethods and their objects */
+  int npending;
+} Cloner;
+
+
+#define mapslot(C,o)  \
+	cast_sizet((point2uint(o) * 2654435761u) & ((C)->sizemap - 1))
+
+
+/*
+** Grow a vector of pointers (allocated through the allocator of the
+** clone but not counted as Lua memory, as it lives only while cloning).
+*/
+static GCObject **growvector (Cloner *C, GCObject **v, size_t *size) {
+  global_State *g = G(C->L);
+  size_t newsize = (*size == 0) ? 64 : *size * 2;
+  GCObject **nv = cast(GCObject **, (*g->frealloc)(g->ud, v,
+                            *size * sizeof(GCObject *),
+                            newsize * sizeof(GCObject *)));
+  if (nv == NULL)
+    luaD_throw(C->L, LUA_ERRMEM);
+  *size = newsize;
+  return nv;
+}
+
+
+static void freevector (Cloner *C, GCObject **v, size_t size) {
+  global_State *g = G(C->L);
+  if (v != NULL)
+    (*g->frealloc)(g->ud, v, size * sizeof(GCObject *), 0);
+}
+
+
+static void insertmap (Cloner *C, GCObject *o, GCObject *c) {
+  size_t i = mapslot(C, o);
+  while (C->keys[i] != NULL)
+    i = (i + 1) & (C->sizemap - 1);
+  C->keys[i] = o;
+  C->vals[i] = c;
+  C->nmap++;
+}
+
+
+/*
+** 'keys' and 'vals' share one block, 'vals' after 'keys'.
+*/
+static void growmap (Cloner *C) {
+  global_State *g = G(C->L);
+  GCObject **keys = C->keys;
+  GCObject **vals = C->vals;
+  size_t size = C->sizemap;
+  size_t newsize = (size == 0) ? 256 : size * 2;
+  size_t i;
+  GCObject **nk = cast(GCObject **, (*g->frealloc)(g->ud, NULL, 0,
+                            2 * newsize * sizeof(GCObject *)));
+  if (nk == NULL)
+    luaD_throw(C->L, LUA_ERRMEM);
+  memset(nk, 0, newsize * sizeof(GCObject *));
+  C->keys = nk;
+  C->vals = nk + newsize;
+  C->sizemap = newsize;
+  C->nmap = 0;
+  for (i = 0; i < size; i++) {
+    if (keys[i] != NULL)
+      insertmap(C, keys[i], vals[i]);
+  }
+  freevector(C, keys, 2 * size);
+}
+
+
+static void addmap (Cloner *C, GCObject *o, GCObject *c) {
+  if ((C->nmap + 1) * 4 > C->sizemap * 3)  /* more than 3/4 full? */
+    growmap(C);
+  insertmap(C, o, c);
+}
+
+
+static void enqueue (Cloner *C, GCObject *o) {
+  if (C->nqueue >= C->sizequeue)
+    C->queue = growvector(C, C->queue, &C->sizequeue);
+  C->queue[C->nqueue++] = o;
+}
+
+
+/*
+** Add copy 'c' of 'o' to the list of copies with a metatable. The copy
+** is marked for finalization if the original is, whatever its
+** metatable has now ('__gc' may have been set after 'setmetatable', and
+** a resurrected object is finalized only once).
+*/
+static void addmeta (Cloner *C, GCObject *o, GCObject *c) {
+  if (tofinalize(o)) {
+    l_setbit(c->marked, FINALIZEDBIT);
+    C->nfin++;
+  }
+  if (C->nwithmt >= C->sizewithmt)
+    C->withmt = growvector(C, C->withmt, &C->sizewithmt);
+  C->withmt[C->nwithmt++] = c;
+}
+
+
+/*
+** Create an empty copy of 'o' (or a complete one, for objects without
+** references).
+*/
+static GCObject *newcopy (Cloner *C, GCObject *o) {
+  lua_State *L = C->L;
+  switch (o->tt) {
+    case LUA_VSHRSTR: case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      return obj2gco(luaS_newlstr(L, getstr(ts), tsslen(ts)));
+    }
+    case LUA_VTABLE:
+      return obj2gco(luaH_new(L));
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      Udata *nu = luaS_newudata(L, u->len, u->nuvalue);
+      memcpy(getudatamem(nu), getudatamem(u), u->len);
+      return obj2gco(nu);
+    }
+    case LUA_VLCL:
+      return obj2gco(luaF_newLclosure(L, gco2lcl(o)->nupvalues));
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      CClosure *ncl = luaF_newCclosure(L, cl->nupvalues);
+      int i;
+      ncl->f = cl->f;
+      for (i = 0; i < ncl->nupvalues; i++)
+        setnilvalue(&ncl->upvalue[i]);
+      return obj2gco(ncl);
+    }
+    case LUA_VUPVAL: {
+      GCObject *c = luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal));
+      UpVal *uv = gco2upv(c);
+      uv->v = &uv->u.value;  /* copies are always closed */
+      setnilvalue(uv->v);
+      return c;
+    }
+    case LUA_VPROTO:
+      return obj2gco(luaF_newproto(L));
+    case LUA_VTHREAD: {
+      lua_State *th = gco2th(o);
+      lua_State *L1;
+      if (th->status == LUA_YIELD ||
+          (th->status == LUA_OK && th->ci != &th->base_ci))
+        luaD_throw(L, LUA_ERRRUN);  /* suspended or running coroutine */
+      L1 = lua_newthread(L);
+      L->top--;  /* the map will anchor it */
+      return obj2gco(L1);
+    }
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+/*
+** Get the copy of object 'o', creating it if needed.
+*/
+static GCObject *getcopy (Cloner *C, GCObject *o) {
+  size_t i = mapslot(C, o);
+  GCObject *c;
+  while (C->keys[i] != NULL) {
+    if (C->keys[i] == o)
+      return C->vals[i];
+    i = (i + 1) & (C->sizemap - 1);
+  }
+  c = newcopy(C, o);
+  addmap(C, o, c);
+  if (!(o->tt == LUA_VSHRSTR || o->tt == LUA_VLNGSTR))
+    enqueue(C, o);  /* contents still to be copied */
+  return c;
+}
+
+
+#define copyobj(C,o,t)	cast(t *, getcopy(C, obj2gco(o)))
+
+#define copystr(C,ts)	(((ts) == NULL) ? NULL : copyobj(C, ts, TString))
+
+
+static void copyvalue (Cloner *C, TValue *to, const TValue *from) {
+  if (iscollectable(from)) {
+    setgcovalue(C->L, to, getcopy(C, gcvalue(from)));
+  }
+  else
+    *to = *from;  /* (may be an empty slot of an array) */
+}
+
+
+static void filltable (Cloner *C, Table *from, Table *t) {
+  lua_State *L = C->L;
+  unsigned int asize = luaH_realasize(from);
+  unsigned int nsize = allocsizenode(from);
+  unsigned int i;
+  luaH_resize(L, t, asize, nsize);
+  for (i = 0; i < asize; i++)
+    copyvalue(C, &t->array[i], &from->array[i]);
+  for (i = 0; i < nsize; i++) {
+    Node *n = gnode(from, i);
+    if (!isempty(gval(n))) {
+      TValue k, v;
+      /* (not 'getnodekey': its liveness check would use the new state) */
+      k.value_ = n->u.key_val; k.tt_ = n->u.key_tt;
+      copyvalue(C, &k, &k);
+      copyvalue(C, &v, gval(n));
+      luaH_set(L, t, &k, &v);
+    }
+  }
+  if (from->metatable != NULL) {
+    t->metatable = copyobj(C, from->metatable, Table);
+    addmeta(C, obj2gco(from), obj2gco(t));
+  }
+  t->flags = from->flags;
+}
+
+
+static void filludata (Cloner *C, Udata *from, Udata *u) {
+  int i;
+  for (i = 0; i < u->nuvalue; i++)
+    copyvalue(C, &u->uv[i].uv, &from->uv[i].uv);
+  if (from->metatable != NULL) {
+    u->metatable = copyobj(C, from->metatable, Table);
+    addmeta(C, obj2gco(from), obj2gco(u));
+  }
+}
+
+
+/*
+** Copy one of the arrays of a prototype: shared arrays and arrays in an
+** image (see 'lshare.c') are not copied, only referenced once more.
+*/
+#define copyarray(C,from,f,a,n,t,bit,mbit)  \
+  if ((from)->shared & (bit)) { \
+    luaF_shareref((from)->a); \
+    (f)->a = (from)->a; \
+    (f)->shared |= (bit); \
+    (f)->n = (from)->n; \
+  } \
+  else if ((from)->shared & (mbit)) { \
+    luaF_mapref((from)->a); \
+    (f)->a = (from)->a; \
+    (f)->shared |= (mbit); \
+    (f)->n = (from)->n; \
+  } \
+  else if ((from)->n > 0) { \
+    (f)->a = luaM_newvectorchecked(C->L, (from)->n, t); \
+    (f)->n = (from)->n; \
+    memcpy((f)->a, (from)->a, sizeof(t) * cast_sizet((from)->n)); \
+  }
+
+
+static void fillproto (Cloner *C, Proto *from, Proto *f) {
+  lua_State *L = C->L;
+  int i;
+  f->numparams = from->numparams;
+  f->is_vararg = from->is_vararg;
+  f->maxstacksize = from->maxstacksize;
+  f->linedefined = from->linedefined;
+  f->lastlinedefined = from->lastlinedefined;
+  f->source = copystr(C, from->source);
+  f->lazy = copystr(C, from->lazy);
+  copyarray(C, from, f, code, sizecode, Instruction, SHAREDCODE, MAPPEDCODE);
+  copyarray(C, from, f, lineinfo, sizelineinfo, ls_byte, SHAREDLINEINFO,
+            MAPPEDLINEINFO);
+  copyarray(C, from, f, abslineinfo, sizeabslineinfo, AbsLineInfo,
+            SHAREDABSLINE, 0);
+  /* arrays with references are cleared before being filled */
+  if (from->sizek > 0) {
+    f->k = luaM_newvectorchecked(L, from->sizek, TValue);
+    f->sizek = from->sizek;
+    for (i = 0; i < f->sizek; i++) setnilvalue(&f->k[i]);
+    for (i = 0; i < f->sizek; i++) copyvalue(C, &f->k[i], &from->k[i]);
+  }
+  if (from->sizep > 0) {
+    f->p = luaM_newvectorchecked(L, from->sizep, Proto *);
+    f->sizep = from->sizep;
+    for (i = 0; i < f->sizep; i++) f->p[i] = NULL;
+    for (i = 0; i < f->sizep; i++) f->p[i] = copyobj(C, from->p[i], Proto);
+  }
+  if (from->sizeupvalues > 0) {
+    f->upvalues = luaM_newvectorchecked(L, from->sizeupvalues, Upvaldesc);
+    f->sizeupvalues = from->sizeupvalues;
+    memcpy(f->upvalues, from->upvalues,
+           sizeof(Upvaldesc) * cast_sizet(f->sizeupvalues));
+    for (i = 0; i < f->sizeupvalues; i++) f->upvalues[i].name = NULL;
+    for (i = 0; i < f->sizeupvalues; i++)
+      f->upvalues[i].name = copystr(C, from->upvalues[i].name);
+  }
+  if (from->sizelocvars > 0) {
+    f->locvars = luaM_newvectorchecked(L, from->sizelocvars, LocVar);
+    f->sizelocvars = from->sizelocvars;
+    memcpy(f->locvars, from->locvars,
+           sizeof(LocVar) * cast_sizet(f->sizelocvars));
+    for (i = 0; i < f->sizelocvars; i++) f->locvars[i].varname = NULL;
+    for (i = 0; i < f->sizelocvars; i++)
+      f->locvars[i].varname = copystr(C, from->locvars[i].varname);
+  }
+}
+
+
+/*
+** Copy the stack of a coroutine that was not started yet (the function
+** and its arguments) or that has finished (its results). A coroutine
+** that died by an error keeps its frames; the copy gets none of them,
+** only the value on the top, which 'lua_closethread' takes as its
+** error object.
+*/
+static void fillthread (Cloner *C, lua_State *from, lua_State *L1) {
+  StkId o = from->stack + 1;
+  L1->status = from->status;
+  if (from->status != LUA_OK && from->top > o)  /* died by an error? */
+    o = from->top - 1;
+  luaD_checkstack(L1, cast_int(from->top - o));
+  for (; o < from->top; o++) {
+    copyvalue(C, s2v(L1->top), s2v(o));
+    L1->top++;
+  }
+}
+
+
+static void fill (Cloner *C, GCObject *o, GCObject *c) {
+  switch (o->tt) {
+    case LUA_VTABLE:
+      filltable(C, gco2t(o), gco2t(c));
+      break;
+    case LUA_VUSERDATA:
+      filludata(C, gco2u(o), gco2u(c));
+      break;
+    case LUA_VLCL: {
+      LClosure *from = gco2lcl(o);
+      LClosure *cl = gco2lcl(c);
+      int i;
+      cl->p = copyobj(C, from->p, Proto);
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (from->upvals[i] != NULL)
+          cl->upvals[i] = copyobj(C, from->upvals[i], UpVal);
+      }
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *from = gco2ccl(o);
+      CClosure *cl = gco2ccl(c);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        copyvalue(C, &cl->upvalue[i], &from->upvalue[i]);
+      break;
+    }
+    case LUA_VUPVAL:
+      copyvalue(C, gco2upv(c)->v, gco2upv(o)->v);
+      break;
+    case LUA_VPROTO:
+      fillproto(C, gco2p(o), gco2p(c));
+      break;
+    case LUA_VTHREAD:
+      fillthread(C, gco2th(o), gco2th(c));
+      break;
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** Copies marked for finalization (see 'addmeta') are moved to list
+** 'finobj' in one pass, as the collector of the clone has not started
+** yet; '__clone' metamethods are collected to be called at the end.
+*/
+static void checkmeta (Cloner *C) {
+  lua_State *L = C->L;
+  global_State *g = G(L);
+  TString *name = luaS_newliteral(L, "__clone");
+  size_t i;
+  for (i = 0; i < C->nwithmt; i++) {
+    GCObject *o = C->withmt[i];
+    Table *mt = (o->tt == LUA_VTABLE) ? gco2t(o)->metatable
+                                      : gco2u(o)->metatable;
+    const TValue *tm = luaH_getshortstr(mt, name);
+    if (!notm(tm)) {
+      TValue v;
+      setobj(L, &v, tm);
+      luaH_setint(L, C->pending, ++C->npending, &v);
+      setgcovalue(L, &v, o);
+      luaH_setint(L, C->pending, ++C->npending, &v);
+    }
+  }
+  if (C->nfin > 0) {
+    GCObject **p = &g->allgc;
+    lua_assert(g->gcstate == GCSpause && g->gckind == KGC_INC);
+    while (*p != NULL) {
+      GCObject *o = *p;
+      if (tofinalize(o)) {  /* move it to 'finobj' */
+        *p = o->next;
+        o->next = g->finobj;
+        g->finobj = o;
+      }
+      else
+        p = &o->next;
+    }
+  }
+}
+
+
+static void copystate (lua_State *L, void *ud) {
+  Cloner *C = cast(Cloner *, ud);
+  global_State *gf = G(C->from);
+  global_State *g = G(L);
+  int i;
+  C->pending = luaH_new(L);
+  sethvalue2s(L, L->top, C->pending);  /* anchor it */
+  L->top++;
+  growmap(C);
+  if (g->strt.size < gf->strt.size)  /* avoid rehashing while copying */
+    luaS_resize(L, gf->strt.size);
+  /* the registry, globals and main thread of the clone already exist */
+  addmap(C, obj2gco(gf->mainthread), obj2gco(L));
+  addmap(C, gcvalue(&gf->l_registry), gcvalue(&g->l_registry));
+  enqueue(C, gcvalue(&gf->l_registry));
+  if (ttistable(&hvalue(&gf->l_registry)->array[LUA_RIDX_GLOBALS - 1])) {
+    GCObject *gt = gcvalue(&hvalue(&gf->l_registry)->array[LUA_RIDX_GLOBALS - 1]);
+    addmap(C, gt,
+           gcvalue(&hvalue(&g->l_registry)->array[LUA_RIDX_GLOBALS - 1]));
+    enqueue(C, gt);
+  }
+  for (i = 0; i < LUA_NUMTAGS; i++) {
+    if (gf->mt[i] != NULL)
+      g->mt[i] = copyobj(C, gf->mt[i], Table);
+  }
+  while (C->nqueue > 0) {
+    GCObject *o = C->queue[--C->nqueue];
+    fill(C, o, getcopy(C, o));
+  }
+  checkmeta(C);
+}
+
+
+/*
+** The '__clone' metamethod at index 'i' of the list of 'n' pending
+** calls and objects failed, with its error on the top of 'L': push the
+** error message onto 'from' and close the clone. The copies whose
+** metamethod did not run still share memory outside Lua with the
+** template, so they lose their metatables (and so their finalizers)
+** first.
+*/
+static void clonefailed (lua_State *from, lua_State *L, int i, int n) {
+  const char *msg = lua_tostring(L, -1);
+  lua_pushstring(from, (msg != NULL) ? msg : "error in __clone metamethod");
+  lua_settop(L, 1);  /* leave only the list of pending calls */
+  for (; i < n; i += 2) {
+    lua_rawgeti(L, 1, i + 1);
+    lua_pushnil(L);
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+  }
+  lua_close(L);
+}
+
+
+/*
+** Create a new state, with allocator 'f' and 'ud', with a copy of the
+** objects of state 'from'. Returns NULL if there is not enough memory
+** or if 'from' has coroutines that are running or suspended. If a
+** '__clone' metamethod of the clone fails, also returns NULL, after
+** pushing its error message onto the stack of 'from'. 'from' must not
+** be running a collection or be used by other threads while it is
+** cloned.
+*/
+LUA_API lua_State *lua_clonestate (lua_State *from, lua_Alloc f, void *ud) {
+  lua_State *L = lua_newstate(f, ud);
+  global_State *g;
+  global_State *gf = G(from);
+  Cloner C;
+  int status;
+  int i;
+  if (L == NULL)
+    return NULL;
+  g = G(L);
+  lua_lock(from);
+  memset(&C, 0, sizeof(C));
+  C.from = from;
+  C.L = L;
+  g->gcstp |= GCSTPGC;  /* no collections while objects are incomplete */
+  g->gcstopem = 1;
+  status = luaD_rawrunprotected(L, copystate, &C);
+  g->gcstopem = 0;
+  g->gcstp &= ~GCSTPGC;
+  freevector(&C, C.keys, 2 * C.sizemap);
+  freevector(&C, C.queue, C.sizequeue);
+  freevector(&C, C.withmt, C.sizewithmt);
+  if (status != LUA_OK) {
+    lua_unlock(from);
+    lua_close(L);
+    return NULL;
+  }
+  /* copy the settings of the template */
+  memcpy(lua_getextraspace(L), lua_getextraspace(gf->mainthread),
+         LUA_EXTRASPACE);
+  g->panic = gf->panic;
+  g->memlimit = gf->memlimit;
+  g->gcfinqueue = gf->gcfinqueue;
+  g->sharecode = gf->sharecode;
+  g->lazyparse = gf->lazyparse;
+  g->maxthreadpool = gf->maxthreadpool;
+  g->threadstack = gf->threadstack;
+  g->gcpause = gf->gcpause;
+  g->gcstepmul = gf->gcstepmul;
+  g->gcstepsize = gf->gcstepsize;
+  g->genminormul = gf->genminormul;
+  g->genmajormul = gf->genmajormul;
+  g->gcadapt = gf->gcadapt;
+  g->gcstp |= (gf->gcstp & GCSTPUSR);
+  lua_unlock(from);
+  if (gf->gckind == KGC_GEN)
+    luaC_changemode(L, KGC_GEN);
+  /* the clone is complete; call its '__clone' metamethods */
+  for (i = 1; i < C.npending; i += 2) {
+    lua_rawgeti(L, 1, i);
+    lua_rawgeti(L, 1, i + 1);
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      clonefailed(from, L, i, C.npending);
+      return NULL;
+    }
+  }
+  lua_settop(L, 0);
+  return L;
+}
+
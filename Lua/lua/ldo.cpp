@@ -25,6 +25,7 @@
 #include "lobject.hpp"
 #include "lopcodes.hpp"
 #include "lparser.hpp"
+#include "lshare.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
 #include "ltable.hpp"
@@ -206,6 +207,8 @@ int luaD_reallocstack (lua_State *L, int newsize, int raiseerror) {
     setnilvalue(s2v(newstack + i)); /* erase new segment */
   correctstack(L, L->stack, newstack);
   luaM_freearray(L, L->stack, oldsize + EXTRA_STACK);
+  luaE_typebytes(G(L), LUA_TTHREAD,
+                 (cast(l_mem, newsize) - oldsize) * cast(l_mem, sizeof(StackValue)));
   L->stack = newstack;
   L->stack_last = L->stack + newsize;
   return 1;
@@ -984,14 +987,114 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+  p.dyd.skimvar.arr = NULL; p.dyd.skimvar.size = 0;
+  luaZ_initbuffer(L, &p.dyd.body);
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
   luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
   luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
   luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  luaM_freearray(L, p.dyd.skimvar.arr, p.dyd.skimvar.size);
+  luaZ_freebuffer(L, &p.dyd.body);
   decnny(L);
   return status;
 }
 
 
+/*
+** {======================================================
+** Lazy compilation (see 'lparser.c')
+** =======================================================
+*/
+
+struct SLazy {  /* data to 'f_lazy' and 'f_compileall' */
+  Mbuffer buff;  /* dynamic structure used by the scanner */
+  Dyndata dyd;  /* dynamic structures used by the parser */
+  Proto *f;
+  int i;  /* index of the stub in 'f->p' */
+};
+
+
+static void compilestub (lua_State *L, struct SLazy *p, Proto *f, int i) {
+  Proto *np = luaY_lazyparser(L, &p->buff, &p->dyd, f, i);
+  if (G(L)->sharecode)
+    luaF_share(L, np);  /* as 'lua_load' would have done */
+}
+
+
+static void f_lazy (lua_State *L, void *ud) {
+  struct SLazy *p = cast(struct SLazy *, ud);
+  compilestub(L, p, p->f, p->i);
+}
+
+
+static void compileall (lua_State *L, struct SLazy *p, Proto *f) {
+  int i;
+  for (i = 0; i < f->sizep; i++) {
+    if (f->p[i]->lazy != NULL)
+      compilestub(L, p, f, i);
+    compileall(L, p, f->p[i]);
+  }
+}
+
+
+static void f_compileall (lua_State *L, void *ud) {
+  struct SLazy *p = cast(struct SLazy *, ud);
+  compileall(L, p, p->f);
+}
+
+
+static int lazyparse (lua_State *L, Pfunc func, struct SLazy *p) {
+  int status;
+  incnny(L);  /* cannot yield during parsing */
+  p->dyd.actvar.arr = NULL; p->dyd.actvar.size = 0;
+  p->dyd.gt.arr = NULL; p->dyd.gt.size = 0;
+  p->dyd.label.arr = NULL; p->dyd.label.size = 0;
+  p->dyd.skimvar.arr = NULL; p->dyd.skimvar.size = 0;
+  luaZ_initbuffer(L, &p->dyd.body);
+  luaZ_initbuffer(L, &p->buff);
+  status = luaD_pcall(L, func, p, savestack(L, L->top), L->errfunc);
+  luaZ_freebuffer(L, &p->buff);
+  luaM_freearray(L, p->dyd.actvar.arr, p->dyd.actvar.size);
+  luaM_freearray(L, p->dyd.gt.arr, p->dyd.gt.size);
+  luaM_freearray(L, p->dyd.label.arr, p->dyd.label.size);
+  luaM_freearray(L, p->dyd.skimvar.arr, p->dyd.skimvar.size);
+  luaZ_freebuffer(L, &p->dyd.body);
+  decnny(L);
+  return status;
+}
+
+
+/*
+** Compile the body of the stub 'f->p[i]', which the new prototype
+** replaces, to make the first closure of it. Syntax errors in the body
+** are raised as runtime errors of the code making the closure.
+*/
+Proto *luaD_lazyparse (lua_State *L, Proto *f, int i) {
+  struct SLazy p;
+  int status;
+  p.f = f; p.i = i;
+  status = lazyparse(L, f_lazy, &p);
+  if (l_unlikely(status != LUA_OK)) {
+    if (status == LUA_ERRSYNTAX)
+      luaG_errormsg(L);  /* error message is on the top */
+    luaD_throw(L, status);
+  }
+  return f->p[i];
+}
+
+
+/*
+** Compile every stub in 'f' and in the functions nested in it (before
+** dumping 'f'). In case of errors, leaves the message on the top.
+*/
+int luaD_compileall (lua_State *L, Proto *f) {
+  struct SLazy p;
+  p.f = f; p.i = 0;
+  return lazyparse(L, f_compileall, &p);
+}
+
+/* }====================================================== */
+
+
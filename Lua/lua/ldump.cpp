@@ -24,7 +24,9 @@ typedef struct {
   lua_Writer writer;
   void *data;
   int strip;
+  int aligned;  /* true for the aligned layout (see 'LUAC_FORMATALIGNED') */
   int status;
+  size_t offset;  /* bytes dumped so far */
 } DumpState;
 
 
@@ -43,6 +45,18 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+  D->offset += size;
+}
+
+
+/*
+** In the aligned layout, pad the dump so that the next array starts at
+** a multiple of the size of an instruction from the start of the chunk.
+*/
+static void dumpAlign (DumpState *D) {
+  static const Instruction zero = 0;
+  if (D->aligned)
+    dumpBlock(D, &zero, (0u - D->offset) % sizeof(Instruction));
 }
 
 
@@ -99,6 +113,7 @@ static void dumpString (DumpState *D, const TString *s) {
 
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+  dumpAlign(D);
   dumpVector(D, f->code, f->sizecode);
 }
 
@@ -197,7 +212,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 static void dumpHeader (DumpState *D) {
   dumpLiteral(D, LUA_SIGNATURE);
   dumpByte(D, LUAC_VERSION);
-  dumpByte(D, LUAC_FORMAT);
+  dumpByte(D, D->aligned ? LUAC_FORMATALIGNED : LUAC_FORMAT);
   dumpLiteral(D, LUAC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(lua_Integer));
@@ -211,13 +226,15 @@ static void dumpHeader (DumpState *D) {
 ** dump Lua function as precompiled chunk
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+              int strip, int aligned) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.aligned = aligned;
   D.status = 0;
+  D.offset = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
@@ -20,6 +20,7 @@
 #include "lgc.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
+#include "lshare.hpp"
 #include "lstate.hpp"
 
 
@@ -255,21 +256,36 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->shared = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->lazy = NULL;
   return f;
 }
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (f->shared & SHAREDCODE)
+    luaF_unshare(f->code);
+  else if (f->shared & MAPPEDCODE)
+    luaF_unmapref(f->code);
+  else
+    luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
-  luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
+  if (f->shared & SHAREDLINEINFO)
+    luaF_unshare(f->lineinfo);
+  else if (f->shared & MAPPEDLINEINFO)
+    luaF_unmapref(f->lineinfo);
+  else
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  if (f->shared & SHAREDABSLINE)
+    luaF_unshare(f->abslineinfo);
+  else
+    luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
   luaM_free(L, f);
@@ -19,7 +19,10 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcfree.hpp"
+#include "lgcpar.hpp"
 #include "lmem.hpp"
+#include "lmemprof.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
@@ -53,6 +56,27 @@
 #define WORK2MEM	sizeof(TValue)
 
 
+/*
+** Parameters of the adaptive mode selection (see 'adaptstep'): number
+** of generational steps judged (bits in 'gcadhist'), major collections
+** among them that make generational mode lose, range of incremental
+** cycles to wait between attempts, and steps for a generational stint
+** to count as a success.
+*/
+#define ADAPTWINDOW	8
+#define ADAPTMAJORS	3
+#define ADAPTMINWAIT	2
+#define ADAPTMAXWAIT	64
+#define ADAPTLONG	32
+
+
+/*
+** Units of work done by a time-budgeted step between two clock
+** readings. (A sweep step of GCSWEEPMAX objects is about 100 units.)
+*/
+#define GCTIMEWORK	256
+
+
 /*
 ** macro to adjust 'pause': 'pause' is actually used like
 ** 'pause / PAUSEADJ' (value chosen by tests)
@@ -258,10 +282,12 @@ void luaC_fix (lua_State *L, GCObject *o) {
 GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   global_State *g = G(L);
   GCObject *o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
+  luaE_typebytes(g, tt, sz);
   o->marked = luaC_white(g);
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  luaM_profcount(L, g, o, tt, sz);
   return o;
 }
 
@@ -269,6 +295,183 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 
 
 
+/*
+** {======================================================
+** Ephemeron worklist
+** =======================================================
+*/
+
+/*
+** While 'convergeephemerons' runs, each entry "white key -> white value"
+** found in an ephemeron table is recorded in a hash indexed by its key.
+** When 'reallymarkobject' marks one of these keys, the key goes to the
+** 'fired' list, and afterwards only the values of its own entries are
+** marked. So, each entry is examined a constant number of times, instead
+** of once for each pass over all ephemeron tables. The worklist only
+** speeds things up: if it cannot get memory, the usual passes done at
+** the end of 'convergeephemerons' still converge, only slower.
+**
+** Memory for the worklist comes straight from the allocator, without
+** being counted as Lua memory, because the collector cannot run (or
+** raise errors) in the atomic phase.
+*/
+
+/* initial size of the worklist arrays */
+#define EPHMINSIZE	64
+
+
+typedef struct EphEntry {
+  GCObject *key;  /* entry key (NULL after its value was marked) */
+  Node *n;  /* entry in its table */
+  int next;  /* next entry in the same chain (-1 ends the chain) */
+} EphEntry;
+
+
+typedef struct EphWatch {
+  EphEntry *entries;
+  int *chains;  /* first entry of each chain (-1 if none) */
+  GCObject **fired;  /* marked keys whose entries were not visited yet */
+  int nentries;
+  int sizeentries;
+  int sizechains;  /* always a power of 2 (or 0) */
+  int nfired;
+  int sizefired;
+  int failed;  /* true if some allocation failed */
+} EphWatch;
+
+
+#define ephchain(ew,o)  \
+	cast_int((point2uint(o) >> 4) & cast_uint((ew)->sizechains - 1))
+
+
+/*
+** Double the size of an array of the worklist. Returns NULL (keeping
+** the old array) if there is no memory.
+*/
+static void *ephgrow (global_State *g, void *block, int *size, size_t e) {
+  int newsize = (*size == 0) ? EPHMINSIZE : *size * 2;
+  void *nb = (*g->frealloc)(g->ud, block, cast_sizet(*size) * e,
+                                          cast_sizet(newsize) * e);
+  if (nb != NULL)
+    *size = newsize;
+  return nb;
+}
+
+
+/*
+** Double the number of chains and rebuild them (leaving out entries
+** already visited).
+*/
+static int ephrehash (global_State *g, EphWatch *ew) {
+  int i;
+  int *nc = (int *)ephgrow(g, ew->chains, &ew->sizechains, sizeof(int));
+  if (nc == NULL)
+    return 0;
+  ew->chains = nc;
+  for (i = 0; i < ew->sizechains; i++)
+    nc[i] = -1;
+  for (i = 0; i < ew->nentries; i++) {
+    EphEntry *e = &ew->entries[i];
+    if (e->key != NULL) {
+      int c = ephchain(ew, e->key);
+      e->next = nc[c];
+      nc[c] = i;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Record entry 'n' (with white key 'key' and a white value) of an
+** ephemeron table.
+*/
+static void ephadd (global_State *g, GCObject *key, Node *n) {
+  EphWatch *ew = g->ephwatch;
+  EphEntry *e;
+  int c;
+  if (ew->failed)
+    return;
+  if (ew->nentries == ew->sizeentries) {
+    EphEntry *ne = (EphEntry *)ephgrow(g, ew->entries, &ew->sizeentries,
+                                       sizeof(EphEntry));
+    if (ne == NULL) {
+      ew->failed = 1;
+      return;
+    }
+    ew->entries = ne;
+  }
+  if (ew->nentries >= ew->sizechains && !ephrehash(g, ew)) {
+    ew->failed = 1;
+    return;
+  }
+  c = ephchain(ew, key);
+  e = &ew->entries[ew->nentries];
+  e->key = key;
+  e->n = n;
+  e->next = ew->chains[c];
+  ew->chains[c] = ew->nentries++;
+}
+
+
+/*
+** Called by 'reallymarkobject' for each object it marks while the
+** worklist is active: if 'o' is the key of some recorded entry, keep
+** it to visit its entries later. (Visiting them here could recurse
+** through an arbitrarily long chain of entries.)
+*/
+static void ephfire (global_State *g, GCObject *o) {
+  EphWatch *ew = g->ephwatch;
+  int i;
+  if (ew->sizechains == 0)
+    return;  /* no entries */
+  for (i = ew->chains[ephchain(ew, o)]; i >= 0; i = ew->entries[i].next) {
+    if (ew->entries[i].key == o) {  /* 'o' is a pending key? */
+      if (ew->nfired == ew->sizefired) {
+        GCObject **nf = (GCObject **)ephgrow(g, ew->fired, &ew->sizefired,
+                                             sizeof(GCObject *));
+        if (nf == NULL) {
+          ew->failed = 1;  /* final passes will mark its values */
+          return;
+        }
+        ew->fired = nf;
+      }
+      ew->fired[ew->nfired++] = o;
+      return;
+    }
+  }
+}
+
+
+/*
+** Mark the values of all entries with (now marked) key 'k'.
+*/
+static void ephvisit (global_State *g, GCObject *k) {
+  EphWatch *ew = g->ephwatch;
+  int i;
+  for (i = ew->chains[ephchain(ew, k)]; i >= 0; i = ew->entries[i].next) {
+    EphEntry *e = &ew->entries[i];
+    if (e->key == k) {
+      e->key = NULL;  /* entry is done */
+      if (valiswhite(gval(e->n)))
+        reallymarkobject(g, gcvalue(gval(e->n)));
+    }
+  }
+}
+
+
+static void ephfree (global_State *g, EphWatch *ew) {
+  (*g->frealloc)(g->ud, ew->entries,
+                 cast_sizet(ew->sizeentries) * sizeof(EphEntry), 0);
+  (*g->frealloc)(g->ud, ew->chains, cast_sizet(ew->sizechains) * sizeof(int), 0);
+  (*g->frealloc)(g->ud, ew->fired,
+                 cast_sizet(ew->sizefired) * sizeof(GCObject *), 0);
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Mark functions
@@ -289,6 +492,8 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** (only closures can), and a userdata's metatable must be a table.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
+  if (l_unlikely(g->ephwatch != NULL))
+    ephfire(g, o);  /* 'o' may be the key of some ephemeron entry */
   switch (o->tt) {
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
@@ -395,6 +600,7 @@ static void cleargraylists (global_State *g) {
 ** mark root set and reset all gray lists, to start a new collection
 */
 static void restartcollection (global_State *g) {
+  g->gcstats.cycle++;
   cleargraylists(g);
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
@@ -493,8 +699,11 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       clearkey(n);  /* clear its key */
     else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
+      if (valiswhite(gval(n))) {  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
+        if (g->ephwatch != NULL)
+          ephadd(g, gckey(n), n);  /* wait for its key */
+      }
     }
     else if (valiswhite(gval(n))) {  /* value not marked yet? */
       marked = 1;
@@ -572,6 +781,7 @@ static int traverseudata (global_State *g, Udata *u) {
 static int traverseproto (global_State *g, Proto *f) {
   int i;
   markobjectN(g, f->source);
+  markobjectN(g, f->lazy);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
   for (i = 0; i < f->sizeupvalues; i++)  /* mark upvalue names */
@@ -651,6 +861,7 @@ static int traversethread (global_State *g, lua_State *th) {
 */
 static lu_mem propagatemark (global_State *g) {
   GCObject *o = g->gray;
+  g->gcstats.marked++;
   nw2black(o);
   g->gray = *getgclist(o);  /* remove from 'gray' list */
   switch (o->tt) {
@@ -673,16 +884,75 @@ static lu_mem propagateall (global_State *g) {
 }
 
 
+/*
+** Mark everything reachable from the gray list with the threads of the
+** parallel marker, in full collections of large heaps. The marker
+** leaves gray the objects whose traversal changes the collector lists
+** (threads and weak tables); they are traversed here, and whatever they
+** mark goes back to the marker.
+*/
+static void parallelpropagate (global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  if (g->parmark == NULL || g->gckind != KGC_INC ||
+      gettotalbytes(g) < LUAI_PARMARKMIN)
+    return;  /* mark serially */
+  luaC_statphase(g, LUA_GCPHPROPAGATE);
+  g->gcstopem = 1;  /* no emergency collections while collecting */
+  while (g->gray != NULL) {
+    GCObject *deferred = luaC_parmark(g);
+    while (deferred != NULL) {  /* traverse objects left by the marker */
+      GCObject *o = deferred;
+      deferred = *getgclist(o);
+      *getgclist(o) = g->gray;  /* make it the first gray object */
+      g->gray = o;
+      propagatemark(g);
+    }
+  }
+  g->gcstopem = 0;
+}
+
+
+/*
+** Mark values of ephemeron entries until no more entries have a marked
+** key and a white value, using the worklist (see 'ephadd').
+*/
+static void ephworklist (global_State *g) {
+  EphWatch ew;
+  GCObject *w;
+  GCObject *next = g->ephemeron;  /* get ephemeron list */
+  memset(&ew, 0, sizeof(ew));
+  g->ephwatch = &ew;
+  g->ephemeron = NULL;  /* tables may return to this list when traversed */
+  while ((w = next) != NULL) {  /* record entries of all ephemeron tables */
+    Table *h = gco2t(w);
+    next = h->gclist;
+    nw2black(h);
+    traverseephemeron(g, h, 0);
+  }
+  do {
+    propagateall(g);  /* may fire keys and record entries of new tables */
+    while (ew.nfired > 0)
+      ephvisit(g, ew.fired[--ew.nfired]);
+  } while (g->gray != NULL);
+  g->ephwatch = NULL;
+  ephfree(g, &ew);
+}
+
+
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
 ** Repeat until it converges, that is, nothing new is marked. 'dir'
 ** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
-**
+** convergence on chains in the same table. The worklist does most of
+** the marking first, so usually a single pass finds nothing new; the
+** pass still relinks each table into its proper list, and it completes
+** the convergence if the worklist ran out of memory.
 */
 static void convergeephemerons (global_State *g) {
   int changed;
   int dir = 0;
+  if (g->ephemeron != NULL)
+    ephworklist(g);
   do {
     GCObject *w;
     GCObject *next = g->ephemeron;  /* get ephemeron list */
@@ -762,43 +1032,58 @@ static void freeupval (lua_State *L, UpVal *uv) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  luaM_proffree(g, o);
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
+      luaE_typebytes(g, LUA_VPROTO, -cast(l_mem, sizeof(Proto)));
       break;
     case LUA_VUPVAL:
       freeupval(L, gco2upv(o));
+      luaE_typebytes(g, LUA_VUPVAL, -cast(l_mem, sizeof(UpVal)));
       break;
     case LUA_VLCL: {
       LClosure *cl = gco2lcl(o);
-      luaM_freemem(L, cl, sizeLclosure(cl->nupvalues));
+      size_t sz = sizeLclosure(cl->nupvalues);
+      luaM_freemem(L, cl, sz);
+      luaE_typebytes(g, LUA_VLCL, -cast(l_mem, sz));
       break;
     }
     case LUA_VCCL: {
       CClosure *cl = gco2ccl(o);
-      luaM_freemem(L, cl, sizeCclosure(cl->nupvalues));
+      size_t sz = sizeCclosure(cl->nupvalues);
+      luaM_freemem(L, cl, sz);
+      luaE_typebytes(g, LUA_VCCL, -cast(l_mem, sz));
       break;
     }
     case LUA_VTABLE:
       luaH_free(L, gco2t(o));
+      luaE_typebytes(g, LUA_VTABLE, -cast(l_mem, sizeof(Table)));
       break;
     case LUA_VTHREAD:
-      luaE_freethread(L, gco2th(o));
+      luaE_freethread(L, gco2th(o));  /* accounts for itself */
       break;
     case LUA_VUSERDATA: {
       Udata *u = gco2u(o);
-      luaM_freemem(L, o, sizeudata(u->nuvalue, u->len));
+      size_t sz = sizeudata(u->nuvalue, u->len);
+      luaM_freemem(L, o, sz);
+      luaE_typebytes(g, LUA_VUSERDATA, -cast(l_mem, sz));
       break;
     }
     case LUA_VSHRSTR: {
       TString *ts = gco2ts(o);
+      size_t sz = sizelstring(ts->shrlen);
       luaS_remove(L, ts);  /* remove it from hash table */
-      luaM_freemem(L, ts, sizelstring(ts->shrlen));
+      luaM_freemem(L, ts, sz);
+      luaE_typebytes(g, LUA_VSHRSTR, -cast(l_mem, sz));
       break;
     }
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
-      luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
+      size_t sz = sizelstring(ts->u.lnglen);
+      luaM_freemem(L, ts, sz);
+      luaE_typebytes(g, LUA_VLNGSTR, -cast(l_mem, sz));
       break;
     }
     default: lua_assert(0);
@@ -831,6 +1116,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
       p = &curr->next;  /* go to next element */
     }
   }
+  g->gcstats.swept += i;
   if (countout)
     *countout = i;  /* number of elements traversed */
   return (*p == NULL) ? NULL : p;
@@ -879,6 +1165,7 @@ static GCObject *udata2finalize (global_State *g) {
   GCObject *o = g->tobefnz;  /* get first element */
   lua_assert(tofinalize(o));
   g->tobefnz = o->next;  /* remove it from 'tobefnz' list */
+  g->gcnfin--;
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
@@ -903,6 +1190,7 @@ static void GCTM (lua_State *L) {
   lua_assert(!g->gcemergency);
   setgcovalue(L, &v, udata2finalize(g));
   tm = luaT_gettmbyobj(L, &v, TM_GC);
+  g->gcstats.finalized++;
   if (!notm(tm)) {  /* is there a finalizer? */
     int status;
     lu_byte oldah = L->allowhook;
@@ -936,6 +1224,31 @@ static int runafewfinalizers (lua_State *L, int n) {
 }
 
 
+/*
+** Call pending finalizers on behalf of the host, in queue mode (though
+** it works in any mode): up to 'max' of them (all if 'max' <= 0),
+** stopping once 'budget' nanoseconds have elapsed (no limit if 0). The
+** clock is read after each finalizer, so the budget can be overrun by
+** one call. Returns the number of finalizers called.
+*/
+int luaC_runfinalizers (lua_State *L, int max, lua_Unsigned budget) {
+  global_State *g = G(L);
+  lua_Unsigned deadline = luaC_clock() + budget;
+  int n = 0;
+  if (g->tobefnz == NULL)
+    return 0;
+  luaC_statphase(g, LUA_GCPHFINALIZE);
+  while (g->tobefnz && (max <= 0 || n < max)) {
+    GCTM(L);
+    n++;
+    if (budget > 0 && luaC_clock() >= deadline)
+      break;
+  }
+  luaC_statclose(g);
+  return n;
+}
+
+
 /*
 ** call all pending finalizers
 */
@@ -978,6 +1291,7 @@ static void separatetobefnz (global_State *g, int all) {
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
       *lastnext = curr;
       lastnext = &curr->next;
+      g->gcnfin++;
     }
   }
 }
@@ -1054,6 +1368,7 @@ static void sweep2old (lua_State *L, GCObject **p) {
   GCObject *curr;
   global_State *g = G(L);
   while ((curr = *p) != NULL) {
+    g->gcstats.swept++;
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
@@ -1100,6 +1415,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
   int white = luaC_white(g);
   GCObject *curr;
   while ((curr = *p) != limit) {
+    g->gcstats.swept++;
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(!isold(curr) && isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
@@ -1212,8 +1528,10 @@ static void finishgencycle (lua_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
   g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
+  if (!g->gcemergency && !g->gcfinqueue) {
+    luaC_statphase(g, LUA_GCPHFINALIZE);
     callallpendingfinalizers(L);
+  }
 }
 
 
@@ -1226,6 +1544,10 @@ static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
   lua_assert(g->gcstate == GCSpropagate);
+  luaC_statclose(g);
+  g->gcstats.minor = 1;  /* following segments belong to a minor collection */
+  g->gcstats.cycle++;
+  luaC_statphase(g, LUA_GCPHPROPAGATE);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
     g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
@@ -1235,6 +1557,7 @@ static void youngcollection (lua_State *L, global_State *g) {
   atomic(L);
 
   /* sweep nursery and get a pointer to its last live element */
+  luaC_statphase(g, LUA_GCPHSWEEP);
   g->gcstate = GCSswpallgc;
   psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1);
   /* sweep 'survival' */
@@ -1254,6 +1577,8 @@ static void youngcollection (lua_State *L, global_State *g) {
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy);
   finishgencycle(L, g);
+  luaC_statclose(g);
+  g->gcstats.minor = 0;
 }
 
 
@@ -1264,6 +1589,7 @@ static void youngcollection (lua_State *L, global_State *g) {
 ** else is turned black (not in any gray list).
 */
 static void atomic2gen (lua_State *L, global_State *g) {
+  luaC_statphase(g, LUA_GCPHSWEEP);
   cleargraylists(g);
   /* sweep all elements making them old */
   g->gcstate = GCSswpallgc;
@@ -1295,6 +1621,7 @@ static lu_mem entergen (lua_State *L, global_State *g) {
   lu_mem numobjs;
   luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  parallelpropagate(g);
   numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
   atomic2gen(L, g);
   return numobjs;
@@ -1330,6 +1657,8 @@ void luaC_changemode (lua_State *L, int newmode) {
       enterinc(g);  /* entering incremental mode */
   }
   g->lastatomic = 0;
+  luaC_adaptreset(g);  /* adaptive policy restarts from the chosen mode */
+  luaC_statclose(g);
 }
 
 
@@ -1393,6 +1722,31 @@ static void stepgenfull (lua_State *L, global_State *g) {
 }
 
 
+/*
+** Record a generational step for the adaptive mode selection: 'major'
+** tells whether it was a major collection and 'before' is the memory in
+** use before it. For minor collections, the survival rate is the part
+** of the memory created since the previous step that is still in use.
+*/
+static void adaptrecord (global_State *g, int major, lu_mem before) {
+  lu_mem after = gettotalbytes(g);
+  if (!major) {
+    lu_mem base = g->gcadbase;
+    lu_mem created = (before > base) ? before - base : 0;
+    lu_mem kept = (after > base) ? after - base : 0;
+    if (created > 0) {
+      int surv = (kept >= created) ? 100
+                                   : cast_int(kept / (created / 100 + 1));
+      g->gcadsurv = cast_byte((3 * g->gcadsurv + surv) / 4);  /* smooth */
+    }
+  }
+  g->gcadhist = cast_byte((g->gcadhist << 1) | major);
+  if (g->gcadsteps < ADAPTLONG)
+    g->gcadsteps++;
+  g->gcadbase = after;
+}
+
+
 /*
 ** Does a generational "step".
 ** Usually, this means doing a minor collection and setting the debt to
@@ -1413,8 +1767,11 @@ static void stepgenfull (lua_State *L, global_State *g) {
 ** in that case, do a minor collection.
 */
 static void genstep (lua_State *L, global_State *g) {
-  if (g->lastatomic != 0)  /* last collection was a bad one? */
+  lu_mem before = gettotalbytes(g);
+  if (g->lastatomic != 0) {  /* last collection was a bad one? */
     stepgenfull(L, g);  /* do a full step */
+    adaptrecord(g, 1, before);
+  }
   else {
     lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
     lu_mem majorinc = (majorbase / 100) * getgcparam(g->genmajormul);
@@ -1429,11 +1786,13 @@ static void genstep (lua_State *L, global_State *g) {
         g->lastatomic = numobjs;  /* signal that last collection was bad */
         setpause(g);  /* do a long wait for next (major) collection */
       }
+      adaptrecord(g, 1, before);
     }
     else {  /* regular case; do a minor collection */
       youngcollection(L, g);
       setminordebt(g);
       g->GCestimate = majorbase;  /* preserve base value */
+      adaptrecord(g, 0, before);
     }
   }
   lua_assert(isdecGCmodegen(g));
@@ -1442,6 +1801,87 @@ static void genstep (lua_State *L, global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Adaptive mode selection
+** =======================================================
+*/
+
+/*
+** When enabled ('g->gcadapt' != 0), the collector judges generational
+** mode by its last ADAPTWINDOW steps and goes back to incremental mode
+** when minor collections keep too much of the new memory (smoothed
+** survival rate above 'g->gcadapt'%) or when ADAPTMAJORS of those steps
+** were major collections. Object ages are not tracked in incremental
+** mode, so there it simply retries generational mode after 'gcadwait'
+** cycles. Each failed attempt doubles that wait (up to ADAPTMAXWAIT);
+** a stint of at least ADAPTLONG steps resets it.
+*/
+
+static void incstep (lua_State *L, global_State *g);
+
+
+void luaC_adaptreset (global_State *g) {
+  g->gcadsurv = 0;
+  g->gcadhist = 0;
+  g->gcadsteps = 0;
+  g->gcadwait = g->gcadbackoff = ADAPTMINWAIT;
+  g->gcadbase = gettotalbytes(g);
+}
+
+
+/* number of (one) bits in the step history */
+static int majorsinwindow (global_State *g) {
+  int n = 0;
+  unsigned int h = g->gcadhist;
+  for (; h != 0; h &= h - 1)
+    n++;
+  return n;
+}
+
+
+/*
+** Performs a basic step under the adaptive policy.
+*/
+static void adaptstep (lua_State *L, global_State *g) {
+  if (isdecGCmodegen(g)) {
+    genstep(L, g);
+    if (g->gcadsteps >= ADAPTWINDOW &&
+        (g->gcadsurv > g->gcadapt || majorsinwindow(g) >= ADAPTMAJORS)) {
+      /* generational mode is not paying off; go back to incremental */
+      if (g->gcadsteps >= ADAPTLONG)  /* it worked for a while? */
+        g->gcadbackoff = ADAPTMINWAIT;
+      else if (g->gcadbackoff < ADAPTMAXWAIT)
+        g->gcadbackoff *= 2;
+      g->gcadwait = g->gcadbackoff;
+      if (g->gckind == KGC_GEN)
+        enterinc(g);
+      else  /* after a bad collection, already finished in incremental mode */
+        lua_assert(g->gcstate == GCSpause);
+      g->lastatomic = 0;
+      g->GCestimate = gettotalbytes(g);
+      setpause(g);
+    }
+  }
+  else if (g->gcstate == GCSpause && g->gcadwait == 0) {
+    /* try generational mode; entering it collects this cycle */
+    entergen(L, g);
+    setminordebt(g);
+    g->gcadsurv = 0;
+    g->gcadhist = 0;
+    g->gcadsteps = 0;
+    g->gcadbase = gettotalbytes(g);
+  }
+  else {
+    if (g->gcstate == GCSpause)  /* starting a new cycle? */
+      g->gcadwait--;
+    incstep(L, g);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** GC control
@@ -1471,16 +1911,24 @@ static void setpause (global_State *g) {
 
 /*
 ** Enter first sweep phase.
-** The call to 'sweeptolive' makes the pointer point to an object
-** inside the list (instead of to the header), so that the real sweep do
-** not need to skip objects created between "now" and the start of the
-** real sweep.
+** Sweeping up to the first live object makes the pointer point to an
+** object inside the list (instead of to the header), so that the real
+** sweep do not need to skip objects created between "now" and the start
+** of the real sweep. That search is bounded by GCSWEEPMAX dead objects
+** (a list can start with a huge run of garbage); when it gives up, the
+** sweep starts at the header, which only means that objects created in
+** the meantime are visited too (they are not dead, so they survive).
 */
 static void entersweep (lua_State *L) {
   global_State *g = G(L);
+  GCObject **p;
+  int n = 0;
   g->gcstate = GCSswpallgc;
   lua_assert(g->sweepgc == NULL);
-  g->sweepgc = sweeptolive(L, &g->allgc);
+  do {
+    p = sweeplist(L, &g->allgc, 1, NULL);
+  } while (p == &g->allgc && ++n < GCSWEEPMAX);
+  g->sweepgc = p;
 }
 
 
@@ -1523,6 +1971,7 @@ static lu_mem atomic (lua_State *L) {
   g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
+  luaC_statphase(g, LUA_GCPHATOMIC);
   g->gcstate = GCSatomic;
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
@@ -1575,10 +2024,27 @@ static int sweepstep (lua_State *L, global_State *g,
 }
 
 
+/*
+** Telemetry phase of the work done by 'singlestep' in each state.
+*/
+static const lu_byte statephase[] = {
+  LUA_GCPHPROPAGATE,  /* GCSpropagate */
+  LUA_GCPHATOMIC,     /* GCSenteratomic */
+  LUA_GCPHATOMIC,     /* GCSatomic */
+  LUA_GCPHSWEEP,      /* GCSswpallgc */
+  LUA_GCPHSWEEP,      /* GCSswpfinobj */
+  LUA_GCPHSWEEP,      /* GCSswptobefnz */
+  LUA_GCPHSWEEP,      /* GCSswpend */
+  LUA_GCPHFINALIZE,   /* GCScallfin */
+  LUA_GCPHPROPAGATE   /* GCSpause (restart is the start of marking) */
+};
+
+
 static lu_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   lu_mem work;
   lua_assert(!g->gcstopem);  /* collector is not reentrant */
+  luaC_statphase(g, statephase[g->gcstate]);
   g->gcstopem = 1;  /* no emergency collections while collecting */
   switch (g->gcstate) {
     case GCSpause: {
@@ -1621,7 +2087,7 @@ static lu_mem singlestep (lua_State *L) {
       break;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && !g->gcemergency) {
+      if (g->tobefnz && !g->gcemergency && !g->gcfinqueue) {
         g->gcstopem = 0;  /* ok collections during finalizers */
         work = runafewfinalizers(L, GCFINMAX) * GCFINALIZECOST;
       }
@@ -1675,6 +2141,57 @@ static void incstep (lua_State *L, global_State *g) {
   }
 }
 
+/*
+** Performs incremental steps until 'budget' nanoseconds have passed or
+** the current cycle finishes (pause state). The clock is read only after
+** every GCTIMEWORK units of work and at phase changes, so the deadline
+** can be overrun by about one such batch (or by a whole atomic step).
+** The work done is credited to the debt, as in 'incstep'. In
+** generational mode there is no smaller unit than a collection, so it
+** just does one basic generational step. Returns 1 if it finished a
+** cycle; '*pwork' (if not NULL) gets the units of work done.
+*/
+int luaC_steptime (lua_State *L, lua_Unsigned budget, lu_mem *pwork) {
+  global_State *g = G(L);
+  lu_mem work = 0;
+  int done;
+  if (isdecGCmodegen(g)) {
+    luaE_setdebt(g, 0);
+    genstep(L, g);
+    done = 1;
+  }
+  else {
+    int stepmul = (getgcparam(g->gcstepmul) | 1);  /* avoid division by 0 */
+    lua_Unsigned deadline = luaC_clock() + budget;
+    lu_mem checked = 0;  /* work done at last clock reading */
+    lu_byte state = g->gcstate;
+    l_mem debt;
+    for (;;) {
+      work += singlestep(L);
+      if (g->gcstate == GCSpause)
+        break;  /* end of cycle */
+      if (work - checked >= GCTIMEWORK || g->gcstate != state) {
+        if (luaC_clock() >= deadline)
+          break;
+        checked = work;
+        state = g->gcstate;
+      }
+    }
+    done = (g->gcstate == GCSpause);
+    if (done)
+      setpause(g);  /* pause until next cycle */
+    else {
+      debt = (g->GCdebt / WORK2MEM) * stepmul - cast(l_mem, work);
+      luaE_setdebt(g, (debt / stepmul) * WORK2MEM);
+    }
+  }
+  luaC_statclose(g);
+  if (pwork)
+    *pwork = work;
+  return done;
+}
+
+
 /*
 ** performs a basic GC step if collector is running
 */
@@ -1682,10 +2199,14 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   if (gcrunning(g)) {  /* running? */
-    if(isdecGCmodegen(g))
+    if (g->gcadapt)
+      adaptstep(L, g);
+    else if(isdecGCmodegen(g))
       genstep(L, g);
     else
       incstep(L, g);
+    luaC_statclose(g);
+    luaC_bgfreeflush(g, 0);  /* hand what was swept to the worker */
   }
 }
 
@@ -1702,6 +2223,8 @@ static void fullinc (lua_State *L, global_State *g) {
     entersweep(L); /* sweep everything to turn them back to white */
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  parallelpropagate(g);
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
@@ -1719,11 +2242,15 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   g->gcemergency = isemergency;  /* set flag */
+  if (isemergency)
+    luaE_trimthreadpool(L, 0);  /* kept threads are memory to give back */
   if (g->gckind == KGC_INC)
     fullinc(L, g);
   else
     fullgen(L, g);
   g->gcemergency = 0;
+  luaC_statclose(g);
+  luaC_bgfreeflush(g, 0);
 }
 
 /* }====================================================== */
@@ -69,8 +69,8 @@
 
 /*
 ** Layout for bit use in 'marked' field. First three bits are
-** used for object "age" in generational mode. Last bit is used
-** by tests.
+** used for object "age" in generational mode. Last bit marks
+** objects sampled by the heap profiler (and is used by tests).
 */
 #define WHITE0BIT	3  /* object is white (type 0) */
 #define WHITE1BIT	4  /* object is white (type 1) */
@@ -78,6 +78,7 @@
 #define FINALIZEDBIT	6  /* object has been marked for finalization */
 
 #define TESTBIT		7
+#define SAMPLEDBIT	7  /* object was sampled by the heap profiler */
 
 
 
@@ -125,6 +126,13 @@
 #define LUAI_GENMAJORMUL         100
 #define LUAI_GENMINORMUL         20
 
+/*
+** Default threshold for the adaptive mode selection: generational mode
+** is abandoned when minor collections keep more than this percentage of
+** the memory allocated since the previous collection.
+*/
+#define LUAI_GCADAPTSURVIVAL	50
+
 /* wait memory to double before starting new cycle */
 #define LUAI_GCPAUSE    200
 
@@ -187,6 +195,10 @@
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC void luaC_adaptreset (global_State *g);
+LUAI_FUNC int luaC_runfinalizers (lua_State *L, int max, lua_Unsigned budget);
+LUAI_FUNC int luaC_steptime (lua_State *L, lua_Unsigned budget,
+                             lu_mem *pwork);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
@@ -0,0 +1,242 @@
+/*
+** $Id: lgcfree.c $
+** Deferred freeing on a background thread
+** See Copyright Notice in lua.h
+*/
+
+#define lgcfree_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "lgcfree.hpp"
+#include "lstate.hpp"
+#include "lthread.hpp"
+
+
+/*
+** When enabled, blocks released by the collector (and any other call to
+** 'luaM_free_') are not returned to the allocator right away. They are
+** appended to a batch; full batches go to a bounded queue served by a
+** worker thread, which calls the allocator to free them. If the queue
+** is full the mutator frees the batch itself, so pending memory stays
+** bounded and the mutator never blocks on the worker. The allocator
+** must therefore be thread safe.
+**
+** All memory for the queue comes straight from the allocator, without
+** being counted as Lua memory. Batches are preallocated, so deferring a
+** free never allocates.
+*/
+
+
+/*
+** The worker thread is native code even when the library is built
+** with /clr.
+*/
+#if defined(_MANAGED)
+#pragma managed(push, off)
+#endif
+
+
+/* total number of batches: the queue, one for the worker, one being filled */
+#define NBATCHES	(LUAI_BGFREEQUEUE + 2)
+
+
+typedef struct FreeBlock {
+  void *block;
+  size_t size;
+} FreeBlock;
+
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  int n;  /* number of blocks in use */
+  FreeBlock b[LUAI_BGFREEBATCH];
+} FreeBatch;
+
+
+typedef struct BgFree {
+  lua_Alloc frealloc;
+  void *ud;
+  FreeBatch *cur;  /* batch being filled (only used by the mutator) */
+  /* fields below are protected by 'lock' */
+  FreeBatch *spare;  /* empty batches */
+  FreeBatch *head, *tail;  /* queue of full batches */
+  int nqueued;  /* number of batches in the queue */
+  int busy;  /* true while the worker is freeing a batch */
+  int stop;  /* true when the worker must exit */
+  l_mutex lock;
+  l_cond work;  /* signaled when a batch is queued or 'stop' is set */
+  l_cond idle;  /* signaled when the worker runs out of batches */
+  l_thread thread;
+  FreeBatch batches[NBATCHES];
+} BgFree;
+
+
+static void freebatch (BgFree *bf, FreeBatch *fb) {
+  int i;
+  for (i = 0; i < fb->n; i++)
+    (*bf->frealloc)(bf->ud, fb->b[i].block, fb->b[i].size, 0);
+  fb->n = 0;
+}
+
+
+static void worker (BgFree *bf) {
+  l_lockm(&bf->lock);
+  for (;;) {
+    FreeBatch *fb;
+    while (bf->head == NULL && !bf->stop)
+      l_condwait(&bf->work, &bf->lock);
+    if (bf->head == NULL)  /* stopping with an empty queue? */
+      break;
+    fb = bf->head;  /* take first batch */
+    bf->head = fb->next;
+    if (bf->head == NULL)
+      bf->tail = NULL;
+    bf->nqueued--;
+    bf->busy = 1;
+    l_unlockm(&bf->lock);
+    freebatch(bf, fb);  /* free its blocks without holding the lock */
+    l_lockm(&bf->lock);
+    bf->busy = 0;
+    fb->next = bf->spare;
+    bf->spare = fb;
+    if (bf->head == NULL)
+      l_condsignal(&bf->idle);
+  }
+  l_unlockm(&bf->lock);
+}
+
+
+static l_threadproc(threadmain) {
+  worker((BgFree *)ud);
+  return l_threadret;
+}
+
+
+/*
+** Hand the current batch to the worker and get an empty one. When the
+** queue is full, free the batch here instead.
+*/
+static void submit (BgFree *bf) {
+  FreeBatch *fb = bf->cur;
+  l_lockm(&bf->lock);
+  if (bf->nqueued < LUAI_BGFREEQUEUE) {
+    fb->next = NULL;
+    if (bf->tail != NULL)
+      bf->tail->next = fb;
+    else
+      bf->head = fb;
+    bf->tail = fb;
+    bf->nqueued++;
+    bf->cur = bf->spare;  /* there is always a spare batch in this case */
+    bf->spare = bf->spare->next;
+    l_condsignal(&bf->work);
+    l_unlockm(&bf->lock);
+  }
+  else {  /* worker is behind; do the work here */
+    l_unlockm(&bf->lock);
+    freebatch(bf, fb);
+  }
+}
+
+
+#if defined(_MANAGED)
+#pragma managed(pop)
+#endif
+
+
+/*
+** Start deferring frees to a new worker thread. Returns 1 on success
+** (or if already started) and 0 if the thread could not be created.
+*/
+int luaC_bgfreestart (lua_State *L) {
+  global_State *g = G(L);
+  BgFree *bf;
+  int i;
+  if (g->bgfree != NULL)
+    return 1;
+  bf = (BgFree *)(*g->frealloc)(g->ud, NULL, 0, sizeof(BgFree));
+  if (bf == NULL)
+    return 0;
+  memset(bf, 0, sizeof(BgFree));
+  bf->frealloc = g->frealloc;
+  bf->ud = g->ud;
+  bf->cur = &bf->batches[0];
+  for (i = 1; i < NBATCHES; i++) {
+    bf->batches[i].next = bf->spare;
+    bf->spare = &bf->batches[i];
+  }
+  l_mutexinit(&bf->lock);
+  l_condinit(&bf->work);
+  l_condinit(&bf->idle);
+  if (!l_threadstart(&bf->thread, threadmain, bf)) {
+    l_condfree(&bf->idle);
+    l_condfree(&bf->work);
+    l_mutexfree(&bf->lock);
+    (*g->frealloc)(g->ud, bf, sizeof(BgFree), 0);
+    return 0;
+  }
+  g->bgfree = bf;
+  return 1;
+}
+
+
+/*
+** Stop the worker, after it frees everything still pending.
+*/
+void luaC_bgfreestop (global_State *g) {
+  BgFree *bf = g->bgfree;
+  if (bf == NULL)
+    return;
+  g->bgfree = NULL;  /* from now on, free blocks directly */
+  if (bf->cur->n > 0)
+    submit(bf);
+  l_lockm(&bf->lock);
+  bf->stop = 1;
+  l_condsignal(&bf->work);
+  l_unlockm(&bf->lock);
+  l_threadjoin(bf->thread);  /* worker exits after emptying the queue */
+  freebatch(bf, bf->cur);
+  l_condfree(&bf->idle);
+  l_condfree(&bf->work);
+  l_mutexfree(&bf->lock);
+  (*g->frealloc)(g->ud, bf, sizeof(BgFree), 0);
+}
+
+
+void luaC_deferfree (global_State *g, void *block, size_t size) {
+  BgFree *bf = g->bgfree;
+  if (block == NULL)
+    return;
+  if (bf->cur->n == LUAI_BGFREEBATCH)  /* current batch is full? */
+    submit(bf);
+  bf->cur->b[bf->cur->n].block = block;
+  bf->cur->b[bf->cur->n].size = size;
+  bf->cur->n++;
+}
+
+
+/*
+** Hand a partially filled batch to the worker, so that blocks do not
+** stay pending until the next collection. If 'wait', also wait until
+** the worker has freed everything (used when memory is short).
+*/
+void luaC_bgfreeflush (global_State *g, int wait) {
+  BgFree *bf = g->bgfree;
+  if (bf == NULL)
+    return;
+  if (bf->cur->n > 0)
+    submit(bf);
+  if (wait) {
+    l_lockm(&bf->lock);
+    while (bf->head != NULL || bf->busy)
+      l_condwait(&bf->idle, &bf->lock);
+    l_unlockm(&bf->lock);
+  }
+}
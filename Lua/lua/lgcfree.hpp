@@ -0,0 +1,31 @@
+/*
+** $Id: lgcfree.h $
+** Deferred freeing on a background thread
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lgcfree_h
+#define lgcfree_h
+
+
+#include "lobject.hpp"
+#include "lstate.hpp"
+
+
+/* number of blocks handed to the background thread at a time */
+#if !defined(LUAI_BGFREEBATCH)
+#define LUAI_BGFREEBATCH	512
+#endif
+
+/* maximum number of full batches waiting for the background thread */
+#if !defined(LUAI_BGFREEQUEUE)
+#define LUAI_BGFREEQUEUE	32
+#endif
+
+
+LUAI_FUNC int luaC_bgfreestart (lua_State *L);
+LUAI_FUNC void luaC_bgfreestop (global_State *g);
+LUAI_FUNC void luaC_deferfree (global_State *g, void *block, size_t size);
+LUAI_FUNC void luaC_bgfreeflush (global_State *g, int wait);
+
+#endif
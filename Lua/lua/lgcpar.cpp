@@ -0,0 +1,573 @@
+/*
+** $Id: lgcpar.c $
+** Parallel marking for full collections
+** See Copyright Notice in lua.h
+*/
+
+#define lgcpar_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lgcpar.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+#include "ltable.hpp"
+#include "lthread.hpp"
+#include "ltm.hpp"
+
+
+/*
+** The marker drains the gray list with several threads, while the
+** mutator is stopped. Each thread has a work-stealing deque of gray
+** objects (Chase-Lev, with a fixed buffer): it pushes and pops at the
+** bottom and other threads steal from the top. Objects that do not fit
+** in a deque go to a shared overflow list (linked through 'gclist').
+**
+** Colors change atomically: a thread owns an object after turning it
+** from white to gray with a compare-and-swap, so each object is
+** traversed exactly once. Only the owner writes to the object (clearing
+** dead keys) and turns it black.
+**
+** Traversals with side effects on the collector lists stay serial:
+** threads and tables that may be weak are claimed but left gray in a
+** per-worker 'deferred' list, which 'luaC_parmark' returns to the
+** collector.
+**
+** All memory for the marker comes straight from the allocator, without
+** being counted as Lua memory.
+*/
+
+
+/* entries in each deque (must be a power of 2) */
+#define DEQUESIZE	8192
+
+/* maximum number of objects taken from the overflow list at a time */
+#define OVERFLOWTAKE	64
+
+
+#define pmaskcolors	(bitmask(BLACKBIT) | WHITEBITS)
+
+
+/* same as in 'lgc.c' */
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_VTABLE: return &gco2t(o)->gclist;
+    case LUA_VLCL: return &gco2lcl(o)->gclist;
+    case LUA_VCCL: return &gco2ccl(o)->gclist;
+    case LUA_VTHREAD: return &gco2th(o)->gclist;
+    case LUA_VPROTO: return &gco2p(o)->gclist;
+    case LUA_VUSERDATA: return &gco2u(o)->gclist;
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+typedef struct Deque {
+  l_atomic top;  /* next entry to be stolen */
+  l_atomic bottom;  /* next free entry */
+  l_atomicp buff[DEQUESIZE];
+} Deque;
+
+
+typedef struct Worker {
+  struct ParMark *pm;
+  Deque dq;
+  GCObject *deferred;  /* gray objects left for the collector */
+  lu_mem marked;  /* objects traversed */
+  unsigned int rnd;  /* state for choosing victims */
+  l_thread thread;
+} Worker;
+
+
+typedef struct ParMark {
+  global_State *g;
+  int nworkers;  /* number of workers, including the collector thread */
+  Worker *w;
+  l_atomic idle;  /* number of workers looking for work */
+  l_atomic noverflow;  /* number of objects in 'overflow' */
+  l_mutex lock;  /* protects the fields below */
+  GCObject *overflow;
+  lu_mem round;  /* incremented to start each parallel mark */
+  int running;  /* helpers still working in current round */
+  int stop;  /* true when helpers must exit */
+  l_cond start;  /* signaled when a round starts or 'stop' is set */
+  l_cond done;  /* signaled when the last helper finishes a round */
+} ParMark;
+
+
+/*
+** Workers run native code even when the library is built with /clr.
+*/
+#if defined(_MANAGED)
+#pragma managed(push, off)
+#endif
+
+
+/*
+** {======================================================
+** Deques
+** =======================================================
+*/
+
+static void addoverflow (ParMark *pm, GCObject *o) {
+  l_lockm(&pm->lock);
+  *getgclist(o) = pm->overflow;
+  pm->overflow = o;
+  l_atomicadd(&pm->noverflow, 1);
+  l_unlockm(&pm->lock);
+}
+
+
+/* (only called by the owner) */
+static void push (Worker *w, GCObject *o) {
+  long b = w->dq.bottom;
+  long t = l_atomicload(&w->dq.top);
+  if (b - t >= DEQUESIZE)  /* deque is full? */
+    addoverflow(w->pm, o);
+  else {
+    l_atomicstorep(&w->dq.buff[b & (DEQUESIZE - 1)], o);
+    l_atomicstore(&w->dq.bottom, b + 1);
+  }
+}
+
+
+/* (only called by the owner) */
+static GCObject *pop (Worker *w) {
+  GCObject *o = NULL;
+  long b = w->dq.bottom - 1;
+  long t;
+  l_atomicstore(&w->dq.bottom, b);
+  l_fullfence();
+  t = l_atomicload(&w->dq.top);
+  if (t <= b) {  /* not empty? */
+    o = (GCObject *)l_atomicloadp(&w->dq.buff[b & (DEQUESIZE - 1)]);
+    if (t == b) {  /* last entry? race against thieves */
+      if (!l_atomiccas(&w->dq.top, t, t + 1))
+        o = NULL;  /* lost it */
+      l_atomicstore(&w->dq.bottom, b + 1);
+    }
+  }
+  else  /* empty */
+    l_atomicstore(&w->dq.bottom, b + 1);
+  return o;
+}
+
+
+static GCObject *steal (Deque *dq) {
+  long t = l_atomicload(&dq->top);
+  long b;
+  l_fullfence();
+  b = l_atomicload(&dq->bottom);
+  if (t < b) {
+    GCObject *o = (GCObject *)l_atomicloadp(&dq->buff[t & (DEQUESIZE - 1)]);
+    if (l_atomiccas(&dq->top, t, t + 1))
+      return o;
+  }
+  return NULL;
+}
+
+
+/*
+** Find work for an empty worker: take a few objects from the overflow
+** list or steal from another worker.
+*/
+static GCObject *getwork (Worker *w) {
+  ParMark *pm = w->pm;
+  int i, n = pm->nworkers;
+  if (l_atomicload(&pm->noverflow) > 0) {
+    GCObject *o = NULL;
+    l_lockm(&pm->lock);
+    for (i = 0; i < OVERFLOWTAKE && pm->overflow != NULL; i++) {
+      GCObject *ov = pm->overflow;
+      pm->overflow = *getgclist(ov);
+      l_atomicadd(&pm->noverflow, -1);
+      if (o == NULL)
+        o = ov;  /* return the first one */
+      else
+        push(w, ov);  /* own deque is empty, so these fit */
+    }
+    l_unlockm(&pm->lock);
+    if (o != NULL)
+      return o;
+  }
+  w->rnd = w->rnd * 1103515245u + 12345u;
+  for (i = 0; i < n; i++) {
+    Worker *v = &pm->w[(w->rnd + cast_uint(i)) % cast_uint(n)];
+    if (v != w) {
+      GCObject *o = steal(&v->dq);
+      if (o != NULL)
+        return o;
+    }
+  }
+  return NULL;
+}
+
+
+static int haswork (ParMark *pm) {
+  int i;
+  if (l_atomicload(&pm->noverflow) > 0)
+    return 1;
+  for (i = 0; i < pm->nworkers; i++) {
+    Deque *dq = &pm->w[i].dq;
+    if (l_atomicload(&dq->top) < l_atomicload(&dq->bottom))
+      return 1;
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Parallel traversals (mirror the ones in 'lgc.c')
+** =======================================================
+*/
+
+#define pmarkvalue(w,v)	{ if (iscollectable(v)) pmark(w, gcvalue(v)); }
+
+#define pmarkobjectN(w,t)	{ if (t) pmark(w, obj2gco(t)); }
+
+
+/* try to turn 'o' from white to gray; true if this thread did it */
+static int claim (GCObject *o) {
+  for (;;) {
+    lu_byte m = l_atomicload8(&o->marked);
+    if (!(m & WHITEBITS))
+      return 0;  /* already marked (maybe by another thread) */
+    if (l_atomiccas8(&o->marked, m, cast_byte(m & ~pmaskcolors)))
+      return 1;
+  }
+}
+
+
+#define blacken(o)	l_atomicor8(&(o)->marked, bitmask(BLACKBIT))
+
+
+/* same as 'reallymarkobject' */
+static void pmark (Worker *w, GCObject *o) {
+  if (!claim(o))
+    return;
+  switch (o->tt) {
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR: {
+      blacken(o);  /* nothing to visit */
+      break;
+    }
+    case LUA_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (!upisopen(uv))  /* open upvalues are kept gray */
+        blacken(o);
+      pmarkvalue(w, uv->v);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {
+        pmarkobjectN(w, u->metatable);
+        blacken(o);
+        break;
+      }
+    }  /* FALLTHROUGH */
+    default: {
+      push(w, o);  /* to be visited later */
+      break;
+    }
+  }
+}
+
+
+/*
+** Whether a table with metatable 'mt' is known not to be weak: 'mt' has
+** no '__mode' field, as cached in its flags by the collector's serial
+** traversals (see 'gfasttm'). Workers never look into 'mt' itself,
+** which its owner may be changing (clearing dead keys), nor update its
+** flags; these were set by the collector before the round started.
+** Tables whose metatables are not known to lack '__mode' are deferred,
+** and the collector's traversal fills the cache for the next rounds.
+*/
+#define notweak(mt)	((mt)->flags & (1u << TM_MODE))
+
+
+static void ptraversetable (Worker *w, Table *h) {
+  Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+  unsigned int i;
+  unsigned int asize = luaH_realasize(h);
+  pmarkobjectN(w, h->metatable);
+  for (i = 0; i < asize; i++)  /* traverse array part */
+    pmarkvalue(w, &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+    if (isempty(gval(n))) {  /* entry is empty? */
+      if (keyiscollectable(n))
+        setdeadkey(n);  /* clear its key */
+    }
+    else {
+      if (keyiscollectable(n))
+        pmark(w, gckey(n));
+      pmarkvalue(w, gval(n));
+    }
+  }
+}
+
+
+static void ptraverseproto (Worker *w, Proto *f) {
+  int i;
+  pmarkobjectN(w, f->source);
+  pmarkobjectN(w, f->lazy);
+  for (i = 0; i < f->sizek; i++)
+    pmarkvalue(w, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    pmarkobjectN(w, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    pmarkobjectN(w, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    pmarkobjectN(w, f->locvars[i].varname);
+}
+
+
+/*
+** Traverse gray object 'o' and turn it black, or leave it gray in the
+** deferred list.
+*/
+static void ptraverse (Worker *w, GCObject *o) {
+  int i;
+  switch (o->tt) {
+    case LUA_VTABLE: {
+      Table *h = gco2t(o);
+      if (h->metatable != NULL && !notweak(h->metatable))
+        goto defer;
+      ptraversetable(w, h);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      pmarkobjectN(w, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        pmarkvalue(w, &u->uv[i].uv);
+      break;
+    }
+    case LUA_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      pmarkobjectN(w, cl->p);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkobjectN(w, cl->upvals[i]);
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkvalue(w, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_VPROTO: {
+      ptraverseproto(w, gco2p(o));
+      break;
+    }
+    default: goto defer;  /* threads */
+  }
+  blacken(o);
+  w->marked++;
+  return;
+ defer:
+  *getgclist(o) = w->deferred;
+  w->deferred = o;
+}
+
+
+/*
+** Main loop of each worker: traverse objects from its own deque, then
+** look for work elsewhere; finish when all workers are out of work.
+*/
+static void marklocal (Worker *w) {
+  ParMark *pm = w->pm;
+  for (;;) {
+    GCObject *o;
+    while ((o = pop(w)) != NULL || (o = getwork(w)) != NULL)
+      ptraverse(w, o);
+    l_atomicadd(&pm->idle, 1);
+    for (;;) {
+      if (l_atomicload(&pm->idle) == pm->nworkers)
+        return;  /* nobody has work; nobody can create more */
+      if (haswork(pm)) {
+        l_atomicadd(&pm->idle, -1);
+        break;  /* try again */
+      }
+      l_threadyield();
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+static l_threadproc(helpermain) {
+  Worker *w = (Worker *)ud;
+  ParMark *pm = w->pm;
+  lu_mem seen = 0;
+  l_lockm(&pm->lock);
+  for (;;) {
+    while (pm->round == seen && !pm->stop)
+      l_condwait(&pm->start, &pm->lock);
+    if (pm->stop)
+      break;
+    seen = pm->round;
+    l_unlockm(&pm->lock);
+    marklocal(w);
+    l_lockm(&pm->lock);
+    if (--pm->running == 0)
+      l_condsignal(&pm->done);
+  }
+  l_unlockm(&pm->lock);
+  return l_threadret;
+}
+
+
+#if defined(_MANAGED)
+#pragma managed(pop)
+#endif
+
+
+static void freeparmark (global_State *g, ParMark *pm) {
+  l_condfree(&pm->done);
+  l_condfree(&pm->start);
+  l_mutexfree(&pm->lock);
+  (*g->frealloc)(g->ud, pm->w, sizeof(Worker) * cast_sizet(pm->nworkers), 0);
+  (*g->frealloc)(g->ud, pm, sizeof(ParMark), 0);
+}
+
+
+/*
+** Stop the helper threads of the first 'n' workers (all of them, if
+** they all started).
+*/
+static void stophelpers (ParMark *pm, int n) {
+  int i;
+  l_lockm(&pm->lock);
+  pm->stop = 1;
+  l_condbroadcast(&pm->start);
+  l_unlockm(&pm->lock);
+  for (i = 1; i < n; i++)
+    l_threadjoin(pm->w[i].thread);
+}
+
+
+/*
+** Use 'nthreads' threads (the collector's own plus 'nthreads - 1'
+** helpers) to mark full collections. Returns 1 on success and 0 if the
+** helpers could not be created.
+*/
+int luaC_parmarkstart (lua_State *L, int nthreads) {
+  global_State *g = G(L);
+  ParMark *pm;
+  int i;
+  luaC_parmarkstop(g);
+  if (nthreads > l_cpucount())  /* more threads than processors? */
+    nthreads = l_cpucount();  /* extra ones would only get in the way */
+  if (nthreads > LUAI_PARMARKMAX)
+    nthreads = LUAI_PARMARKMAX;
+  if (nthreads <= 1)
+    return 1;  /* serial marking */
+  pm = (ParMark *)(*g->frealloc)(g->ud, NULL, 0, sizeof(ParMark));
+  if (pm == NULL)
+    return 0;
+  memset(pm, 0, sizeof(ParMark));
+  pm->w = (Worker *)(*g->frealloc)(g->ud, NULL, 0,
+                                  sizeof(Worker) * cast_sizet(nthreads));
+  if (pm->w == NULL) {
+    (*g->frealloc)(g->ud, pm, sizeof(ParMark), 0);
+    return 0;
+  }
+  memset(pm->w, 0, sizeof(Worker) * cast_sizet(nthreads));
+  pm->g = g;
+  pm->nworkers = nthreads;
+  l_mutexinit(&pm->lock);
+  l_condinit(&pm->start);
+  l_condinit(&pm->done);
+  for (i = 0; i < nthreads; i++) {
+    pm->w[i].pm = pm;
+    pm->w[i].rnd = cast_uint(i) * 2654435761u + 1u;
+  }
+  for (i = 1; i < nthreads; i++) {  /* worker 0 is the collector */
+    if (!l_threadstart(&pm->w[i].thread, helpermain, &pm->w[i])) {
+      stophelpers(pm, i);
+      freeparmark(g, pm);
+      return 0;
+    }
+  }
+  g->parmark = pm;
+  return 1;
+}
+
+
+void luaC_parmarkstop (global_State *g) {
+  ParMark *pm = g->parmark;
+  if (pm != NULL) {
+    g->parmark = NULL;
+    stophelpers(pm, pm->nworkers);
+    freeparmark(g, pm);
+  }
+}
+
+
+/*
+** Number of threads marking full collections (1 if marking is serial).
+*/
+int luaC_parmarkthreads (global_State *g) {
+  return (g->parmark != NULL) ? g->parmark->nworkers : 1;
+}
+
+
+/*
+** Mark everything reachable from the gray list in parallel, leaving it
+** empty. Returns the list of objects that are still gray (linked through
+** 'gclist') and must be traversed by the collector.
+*/
+GCObject *luaC_parmark (global_State *g) {
+  ParMark *pm = g->parmark;
+  Worker *w0 = &pm->w[0];
+  GCObject *deferred = NULL;
+  int i;
+  lua_assert(pm != NULL && g->gckind == KGC_INC);
+  for (i = 0; i < pm->nworkers; i++) {
+    Worker *w = &pm->w[i];
+    w->dq.top = w->dq.bottom = 0;
+    w->deferred = NULL;
+    w->marked = 0;
+  }
+  pm->idle = 0;
+  while (g->gray != NULL) {  /* move gray list to the collector's deque */
+    GCObject *o = g->gray;
+    g->gray = *getgclist(o);
+    push(w0, o);
+  }
+  l_lockm(&pm->lock);  /* start helpers */
+  pm->round++;
+  pm->running = pm->nworkers - 1;
+  l_condbroadcast(&pm->start);
+  l_unlockm(&pm->lock);
+  marklocal(w0);
+  l_lockm(&pm->lock);  /* wait for helpers to leave the round */
+  while (pm->running > 0)
+    l_condwait(&pm->done, &pm->lock);
+  l_unlockm(&pm->lock);
+  lua_assert(pm->overflow == NULL);
+  for (i = 0; i < pm->nworkers; i++) {  /* collect results */
+    Worker *w = &pm->w[i];
+    while (w->deferred != NULL) {
+      GCObject *o = w->deferred;
+      w->deferred = *getgclist(o);
+      *getgclist(o) = deferred;
+      deferred = o;
+    }
+    g->gcstats.marked += w->marked;
+  }
+  return deferred;
+}
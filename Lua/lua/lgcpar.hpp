@@ -0,0 +1,31 @@
+/*
+** $Id: lgcpar.h $
+** Parallel marking for full collections
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lgcpar_h
+#define lgcpar_h
+
+
+#include "lobject.hpp"
+#include "lstate.hpp"
+
+
+/* heaps smaller than this (in bytes) are always marked serially */
+#if !defined(LUAI_PARMARKMIN)
+#define LUAI_PARMARKMIN		(8 * 1024 * 1024)
+#endif
+
+/* maximum number of marking threads (including the collector's own) */
+#if !defined(LUAI_PARMARKMAX)
+#define LUAI_PARMARKMAX		64
+#endif
+
+
+LUAI_FUNC int luaC_parmarkstart (lua_State *L, int nthreads);
+LUAI_FUNC void luaC_parmarkstop (global_State *g);
+LUAI_FUNC int luaC_parmarkthreads (global_State *g);
+LUAI_FUNC GCObject *luaC_parmark (global_State *g);
+
+#endif
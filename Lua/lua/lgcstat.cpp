@@ -0,0 +1,125 @@
+/*
+** $Id: lgcstat.c $
+** Garbage-collector telemetry
+** See Copyright Notice in lua.h
+*/
+
+#define lgcstat_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "lua.hpp"
+
+#include "lgcstat.hpp"
+#include "lstate.hpp"
+
+
+/*
+** Monotonic clock, in nanoseconds from an unspecified origin.
+*/
+lua_Unsigned luaC_clock (void) {
+#if defined(_WIN32)
+  static LARGE_INTEGER freq;  /* counter ticks per second */
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  /* split the conversion to avoid overflowing 'ticks * 1e9' */
+  return (lua_Unsigned)(now.QuadPart / freq.QuadPart) * 1000000000u +
+         (lua_Unsigned)(now.QuadPart % freq.QuadPart) * 1000000000u /
+             (lua_Unsigned)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Unsigned)ts.tv_sec * 1000000000u + (lua_Unsigned)ts.tv_nsec;
+#endif
+}
+
+
+void luaC_statinit (global_State *g) {
+  GCStats *st = &g->gcstats;
+  memset(st, 0, sizeof(GCStats));
+  st->phase = GCPHNONE;
+}
+
+
+/*
+** Close the open segment (if any), turning it into a record.
+*/
+void luaC_statclose (global_State *g) {
+  GCStats *st = &g->gcstats;
+  if (st->phase != GCPHNONE) {
+    lua_GCStat *r = &st->ring[st->nrecs % LUAI_GCSTATSIZE];
+    lua_GCPhaseTotal *t = &st->totals[st->phase];
+    r->seq = st->nrecs++;
+    r->cycle = st->cycle;
+    r->phase = st->phase;
+    r->minor = st->minor;
+    r->start = st->start;
+    r->duration = luaC_clock() - st->start;
+    r->marked = st->marked - st->smarked;
+    r->swept = st->swept - st->sswept;
+    r->finalized = st->finalized - st->sfinalized;
+    r->freed = st->freed - st->sfreed;
+    t->count++;
+    t->duration += r->duration;
+    if (r->duration > t->maxduration)
+      t->maxduration = r->duration;
+    t->marked += r->marked;
+    t->swept += r->swept;
+    t->finalized += r->finalized;
+    t->freed += r->freed;
+    st->phase = GCPHNONE;
+  }
+}
+
+
+/*
+** Close the open segment and start a new one in phase 'phase'.
+*/
+void luaC_statopen (global_State *g, int phase) {
+  GCStats *st = &g->gcstats;
+  luaC_statclose(g);
+  st->phase = phase;
+  st->start = luaC_clock();
+  st->smarked = st->marked;
+  st->sswept = st->swept;
+  st->sfinalized = st->finalized;
+  st->sfreed = st->freed;
+}
+
+
+/*
+** Copy up to 'n' of the most recent records into 'recs' (oldest first)
+** and, if 'totals' is not NULL, the LUA_GCPHASES phase totals. Returns
+** the number of records copied.
+*/
+int luaC_statcopy (global_State *g, lua_GCStat *recs, int n,
+                   lua_GCPhaseTotal *totals) {
+  GCStats *st = &g->gcstats;
+  lua_Unsigned avail = (st->nrecs < LUAI_GCSTATSIZE) ? st->nrecs
+                                                     : LUAI_GCSTATSIZE;
+  lua_Unsigned first, i;
+  if (recs == NULL || n < 0)
+    n = 0;
+  if ((lua_Unsigned)n > avail)
+    n = cast_int(avail);
+  first = st->nrecs - (lua_Unsigned)n;
+  for (i = 0; i < (lua_Unsigned)n; i++)
+    recs[i] = st->ring[(first + i) % LUAI_GCSTATSIZE];
+  if (totals != NULL)
+    memcpy(totals, st->totals, sizeof(st->totals));
+  return n;
+}
+
@@ -0,0 +1,56 @@
+/*
+** $Id: lgcstat.h $
+** Garbage-collector telemetry
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lgcstat_h
+#define lgcstat_h
+
+
+#include "lua.hpp"
+#include "llimits.hpp"
+
+
+/* no segment open */
+#define GCPHNONE	(-1)
+
+
+/*
+** Telemetry kept by each global state. The collector opens a "segment"
+** whenever it starts working in a phase and closes it when it moves to
+** another phase or returns to the mutator; each closed segment becomes
+** one record in the ring buffer and is added to its phase totals. The
+** clock is only read when segments open and close, so consecutive
+** steps in the same phase cost just a comparison.
+*/
+typedef struct GCStats {
+  lua_GCStat ring[LUAI_GCSTATSIZE];  /* most recent segments */
+  lua_GCPhaseTotal totals[LUA_GCPHASES];  /* per-phase accumulators */
+  lua_Unsigned nrecs;  /* number of records ever written */
+  lua_Unsigned cycle;  /* number of collections started (atomic phases) */
+  lu_mem marked;  /* running count of objects traversed */
+  lu_mem swept;  /* running count of objects visited by sweeps */
+  lu_mem finalized;  /* running count of finalizers called */
+  lu_mem freed;  /* running count of bytes released (see 'luaM_free_') */
+  /* currently open segment */
+  int phase;  /* its phase, or GCPHNONE */
+  lu_byte minor;  /* true while inside a young collection */
+  lua_Unsigned start;  /* clock when it was opened */
+  lu_mem smarked, sswept, sfinalized, sfreed;  /* counters when opened */
+} GCStats;
+
+
+/* switch the open segment to phase 'p' (cheap when already there) */
+#define luaC_statphase(g,p)  \
+	{ if ((g)->gcstats.phase != (p)) luaC_statopen(g, p); }
+
+
+LUAI_FUNC lua_Unsigned luaC_clock (void);
+LUAI_FUNC void luaC_statinit (struct global_State *g);
+LUAI_FUNC void luaC_statopen (struct global_State *g, int phase);
+LUAI_FUNC void luaC_statclose (struct global_State *g);
+LUAI_FUNC int luaC_statcopy (struct global_State *g, lua_GCStat *recs, int n,
+                             lua_GCPhaseTotal *totals);
+
+#endif
@@ -240,6 +240,22 @@ static int f_gc (lua_State *L) {
 }
 
 
+static int io_noclose (lua_State *L);
+
+
+/*
+** In a clone of a state (see 'lua_clonestate'), the handle is a copy of
+** a handle of the template, so the file belongs to the template: only
+** standard files stay open.
+*/
+static int f_clone (lua_State *L) {
+  LStream *p = tolstream(L);
+  if (p->closef != &io_noclose)
+    p->closef = NULL;  /* mark it as closed */
+  return 0;
+}
+
+
 /*
 ** function to close regular files
 */
@@ -776,6 +792,7 @@ static const luaL_Reg metameth[] = {
   {"__index", NULL},  /* place holder */
   {"__gc", f_gc},
   {"__close", f_gc},
+  {"__clone", f_clone},
   {"__tostring", f_tostring},
   {NULL, NULL}
 };
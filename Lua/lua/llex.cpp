@@ -11,6 +11,7 @@
 
 
 #include <locale.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "lua.hpp"
@@ -22,6 +23,7 @@
 #include "llex.hpp"
 #include "lobject.hpp"
 #include "lparser.hpp"
+#include "lsimd.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
 #include "ltable.hpp"
@@ -122,19 +124,23 @@ l_noret luaX_syntaxerror (LexState *ls, const char *msg) {
 
 
 /*
-** Creates a new string and anchors it in scanner's table so that it
-** will not be collected until the end of the compilation; by that time
-** it should be anchored somewhere. It also internalizes long strings,
-** ensuring there is only one copy of each unique string.  The table
-** here is used as a set: the string enters as the key, while its value
-** is irrelevant. We use the string itself as the value only because it
+** Anchors a new string in scanner's table so that it will not be
+** collected until the end of the compilation; by that time it should
+** be anchored somewhere. It also internalizes long strings, ensuring
+** there is only one copy of each unique string.  The table here is
+** used as a set: the string enters as the key, while its value is
+** irrelevant. We use the string itself as the value only because it
 ** is a TValue readly available. Later, the code generation can change
-** this value.
+** this value. Strings anchored recently are remembered in 'anchored',
+** which spares the lookup for names and keys that repeat.
 */
-TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
+static TString *anchorstr (LexState *ls, TString *ts) {
   lua_State *L = ls->L;
-  TString *ts = luaS_newlstr(L, str, l);  /* create new string */
-  const TValue *o = luaH_getstr(ls->h, ts);
+  TString **slot = &ls->anchored[lmod(point2uint(ts) >> 4, LUAI_LEXCACHE)];
+  const TValue *o;
+  if (*slot == ts)  /* seen recently? */
+    return ts;  /* it is already in the table */
+  o = luaH_getstr(ls->h, ts);
   if (!ttisnil(o))  /* string already present? */
     ts = keystrval(nodefromval(o));  /* get saved copy */
   else {  /* not in use yet */
@@ -145,10 +151,17 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     luaC_checkGC(L);
     L->top--;  /* remove string from stack */
   }
+  ls->anchored[lmod(point2uint(ts) >> 4, LUAI_LEXCACHE)] = ts;
   return ts;
 }
 
 
+/* creates a new string and anchors it */
+TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
+  return anchorstr(ls, luaS_newlstr(ls->L, str, l));
+}
+
+
 /*
 ** increment line number and skips newline sequence (any of
 ** \n, \r, \n\r, or \r\n)
@@ -176,6 +189,7 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->lastline = 1;
   ls->source = source;
   ls->envn = luaS_newliteral(L, LUA_ENV);  /* get env name */
+  memset(ls->anchored, 0, sizeof(ls->anchored));
   luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
 }
 
@@ -211,6 +225,189 @@ static int check_next2 (LexState *ls, const char *set) {
 }
 
 
+/*
+** {======================================================
+** Scanning in place
+** When a whole token lies in the block of the stream holding the
+** current character (always the case for chunks loaded from a single
+** buffer), it is scanned right there, with the vector kernels of
+** 'lsimd.c' for its runs; its text goes to 'ls->buff' (for error
+** messages) in a single copy. The current character is the byte just
+** before 'z->p'. The functions here give up when a token may go past
+** the block or needs more than a plain copy (escapes, '\r' in long
+** strings); the usual scanners then read it.
+** =======================================================
+*/
+
+/* the current character and the rest of its block */
+#define blockstart(ls)	((ls)->z->p - 1)
+#define blocklen(ls)	((ls)->z->n + 1)
+
+
+/* skip the 'k' bytes from the current character on (0 < k < blocklen) */
+static void skipblock (LexState *ls, size_t k) {
+  ZIO *z = ls->z;
+  lua_assert(0 < k && k < blocklen(ls));
+  ls->current = cast_uchar(z->p[k - 1]);
+  z->p += k;
+  z->n -= k;
+}
+
+
+static void savebytes (LexState *ls, const char *s, size_t l) {
+  Mbuffer *b = ls->buff;
+  if (luaZ_sizebuffer(b) - luaZ_bufflen(b) < l) {
+    size_t newsize = luaZ_sizebuffer(b);
+    while (newsize - luaZ_bufflen(b) < l) {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    }
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), s, l);
+  luaZ_bufflen(b) += l;
+}
+
+
+/* skip a run of blanks (the current character is one) */
+static void skipblanks (LexState *ls) {
+  const char *s = blockstart(ls);
+  size_t n = blocklen(ls);
+  if (n > 1 && (s[1] == ' ' || s[1] == '\t')) {  /* more than one? */
+    size_t k = luaSIMD_blankspan(s, n);
+    if (k < n) {
+      skipblock(ls, k);
+      return;
+    }
+  }
+  next(ls);
+}
+
+
+/* skip the rest of a short comment, up to the end of its line */
+static int skipcomment (LexState *ls) {
+  size_t n = blocklen(ls);
+  size_t k;
+  if (currIsNewline(ls) || ls->current == EOZ)
+    return 1;
+  k = luaSIMD_breakspan(blockstart(ls), n, "\n\r\n\r");
+  if (k < n) {
+    skipblock(ls, k);
+    return 1;
+  }
+  return 0;
+}
+
+
+/* length of the name at the current character ('blocklen' if longer) */
+static size_t namelength (LexState *ls) {
+  const char *s = blockstart(ls);
+  size_t n = blocklen(ls);
+  size_t k = luaSIMD_namespan(s, n);
+  while (k < n && lislalnum(cast_uchar(s[k])))  /* 'LUA_UCID' letters */
+    k++;
+  return k;
+}
+
+
+/*
+** Length of the numeral at the current character ('blocklen' if
+** longer), following the pattern accepted by 'read_numeral'.
+*/
+static size_t numeralength (LexState *ls) {
+  const char *s = blockstart(ls);
+  size_t n = blocklen(ls);
+  const char *expo = "Ee";
+  size_t k = 1;
+  if (s[0] == '0' && n > 1 && (s[1] == 'x' || s[1] == 'X')) {
+    expo = "Pp";
+    k = 2;
+  }
+  while (k < n) {
+    int c = cast_uchar(s[k]);
+    if (c == expo[0] || c == expo[1]) {  /* exponent mark? */
+      k++;
+      if (k < n && (s[k] == '-' || s[k] == '+'))  /* optional sign */
+        k++;
+    }
+    else if (lisxdigit(c) || c == '.')
+      k++;
+    else break;
+  }
+  if (k < n && lislalpha(cast_uchar(s[k])))  /* touching a letter? */
+    k++;  /* force an error */
+  return k;
+}
+
+
+/* read a short literal string with no escapes */
+static int fastshortstring (LexState *ls, int del, SemInfo *seminfo) {
+  const char *s = blockstart(ls);
+  size_t n = blocklen(ls);
+  char set[4];
+  size_t k;
+  set[0] = cast_char(del); set[1] = '\\'; set[2] = '\n'; set[3] = '\r';
+  k = 1 + luaSIMD_breakspan(s + 1, n - 1, set);
+  if (k + 1 < n && s[k] == del) {  /* closed inside the block? */
+    savebytes(ls, s, k + 1);
+    seminfo->ts = luaX_newstring(ls, s + 1, k - 1);
+    skipblock(ls, k + 1);
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Read a long string or comment whose lines all end with a plain '\n'
+** (the current character is its second opening bracket; see
+** 'read_long_string').
+*/
+static int fastlongstring (LexState *ls, SemInfo *seminfo, size_t sep) {
+  const char *s = blockstart(ls);
+  size_t n = blocklen(ls);
+  size_t first, pos, k;
+  int lines = 0;
+  pos = 1;
+  if (n > 1 && s[1] == '\n') {  /* string starts with a newline? */
+    lines++;
+    pos++;  /* skip it */
+  }
+  first = pos;
+  for (;;) {
+    size_t i = 1;
+    k = pos + luaSIMD_breakspan(s + pos, n - pos, "]\n\r]");
+    if (k >= n || s[k] == '\r')
+      return 0;
+    if (s[k] == '\n') {
+      lines++;
+      pos = k + 1;
+      continue;
+    }
+    while (k + i < n && s[k + i] == '=')
+      i++;
+    if (k + i + 1 >= n)
+      return 0;
+    if (s[k + i] == ']' && i == sep - 1)  /* closing bracket? */
+      break;
+    pos = k + 1;
+  }
+  if (lines >= MAX_INT - ls->linenumber)
+    return 0;  /* let 'inclinenumber' raise the error */
+  ls->linenumber += lines;
+  if (seminfo) {  /* text as 'read_long_string' keeps it */
+    savebytes(ls, s, 1);
+    savebytes(ls, s + first, k + sep - first);
+    seminfo->ts = luaX_newstring(ls, s + first, k - first);
+  }
+  skipblock(ls, k + sep);
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /* LUA_NUMBER */
 /*
 ** This function is quite liberal in what it accepts, as 'luaO_str2num'
@@ -228,19 +425,27 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
   TValue obj;
   const char *expo = "Ee";
   int first = ls->current;
+  size_t k;
   lua_assert(lisdigit(ls->current));
-  save_and_next(ls);
-  if (first == '0' && check_next2(ls, "xX"))  /* hexadecimal? */
-    expo = "Pp";
-  for (;;) {
-    if (check_next2(ls, expo))  /* exponent mark? */
-      check_next2(ls, "-+");  /* optional exponent sign */
-    else if (lisxdigit(ls->current) || ls->current == '.')  /* '%x|%.' */
-      save_and_next(ls);
-    else break;
+  k = numeralength(ls);
+  if (k < blocklen(ls)) {  /* whole numeral in the block? */
+    savebytes(ls, blockstart(ls), k);
+    skipblock(ls, k);
+  }
+  else {
+    save_and_next(ls);
+    if (first == '0' && check_next2(ls, "xX"))  /* hexadecimal? */
+      expo = "Pp";
+    for (;;) {
+      if (check_next2(ls, expo))  /* exponent mark? */
+        check_next2(ls, "-+");  /* optional exponent sign */
+      else if (lisxdigit(ls->current) || ls->current == '.')  /* '%x|%.' */
+        save_and_next(ls);
+      else break;
+    }
+    if (lislalpha(ls->current))  /* is numeral touching a letter? */
+      save_and_next(ls);  /* force an error */
   }
-  if (lislalpha(ls->current))  /* is numeral touching a letter? */
-    save_and_next(ls);  /* force an error */
   save(ls, '\0');
   if (luaO_str2num(luaZ_buffer(ls->buff), &obj) == 0)  /* format error? */
     lexerror(ls, "malformed number", TK_FLT);
@@ -279,6 +484,8 @@ static size_t skip_sep (LexState *ls) {
 
 static void read_long_string (LexState *ls, SemInfo *seminfo, size_t sep) {
   int line = ls->linenumber;  /* initial line (for error message) */
+  if (fastlongstring(ls, seminfo, sep))
+    return;
   save_and_next(ls);  /* skip 2nd '[' */
   if (currIsNewline(ls))  /* string starts with a newline? */
     inclinenumber(ls);  /* skip it */
@@ -451,7 +658,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        skipblanks(ls);
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -469,8 +676,10 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        if (!skipcomment(ls)) {
+          while (!currIsNewline(ls) && ls->current != EOZ)
+            next(ls);  /* skip until end of line (or end of file) */
+        }
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -516,7 +725,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         else return ':';
       }
       case '"': case '\'': {  /* short literal strings */
-        read_string(ls, ls->current, seminfo);
+        if (!fastshortstring(ls, ls->current, seminfo))
+          read_string(ls, ls->current, seminfo);
         return TK_STRING;
       }
       case '.': {  /* '.', '..', '...', or number */
@@ -539,15 +749,23 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
-          do {
-            save_and_next(ls);
-          } while (lislalnum(ls->current));
-          ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
-                                  luaZ_bufflen(ls->buff));
-          seminfo->ts = ts;
-          if (isreserved(ts))  /* reserved word? */
+          size_t k = namelength(ls);
+          if (k < blocklen(ls)) {  /* whole name in the block? */
+            savebytes(ls, blockstart(ls), k);
+            ts = luaS_newlstr(ls->L, blockstart(ls), k);
+            skipblock(ls, k);
+          }
+          else {
+            do {
+              save_and_next(ls);
+            } while (lislalnum(ls->current));
+            ts = luaS_newlstr(ls->L, luaZ_buffer(ls->buff),
+                                     luaZ_bufflen(ls->buff));
+          }
+          if (isreserved(ts))  /* reserved word? (they are never collected) */
             return ts->extra - 1 + FIRST_RESERVED;
           else {
+            seminfo->ts = anchorstr(ls, ts);
             return TK_NAME;
           }
         }
@@ -579,3 +797,119 @@ int luaX_lookahead (LexState *ls) {
   return ls->lookahead.token;
 }
 
+
+
+
+/*
+** {======================================================
+** Source text of tokens (for bodies compiled lazily; see 'lparser.c')
+** =======================================================
+*/
+
+static void addtext (LexState *ls, Mbuffer *b, const char *s, size_t l) {
+  if (luaZ_sizebuffer(b) - luaZ_bufflen(b) < l) {  /* not enough space? */
+    size_t newsize = luaZ_sizebuffer(b) * 2;
+    if (l >= MAX_SIZE/2 || luaZ_bufflen(b) >= MAX_SIZE/2 - l)
+      lexerror(ls, "function body too long", 0);
+    if (newsize < luaZ_bufflen(b) + l)
+      newsize = luaZ_bufflen(b) + l;
+    if (newsize < LUA_MINBUFFER)
+      newsize = LUA_MINBUFFER;
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(luaZ_buffer(b) + luaZ_bufflen(b), s, l);
+  luaZ_bufflen(b) += l;
+}
+
+
+/*
+** Add a string literal, with every byte that is not printable (or that
+** is a quote or a backslash) as a decimal escape, so that the text
+** keeps one line.
+*/
+static void addquoted (LexState *ls, Mbuffer *b, const char *s, size_t l) {
+  addtext(ls, b, "\"", 1);
+  while (l > 0) {
+    size_t n = 0;
+    while (n < l && lisprint(cast_uchar(s[n])) &&
+           s[n] != '"' && s[n] != '\\')
+      n++;
+    addtext(ls, b, s, n);  /* plain run */
+    if (n < l) {
+      char buff[5];
+      int len = l_sprintf(buff, sizeof(buff), "\\%03d", cast_uchar(s[n]));
+      addtext(ls, b, buff, len);
+      n++;
+    }
+    s += n; l -= n;
+  }
+  addtext(ls, b, "\"", 1);
+}
+
+
+/*
+** Add to 'b' source text for the current token, from which the lexer
+** reads back the same token. '*line' is the line where the text of 'b'
+** ends; the token goes to its own line, so that code compiled from 'b'
+** gets the same line information.
+*/
+void luaX_savetoken (LexState *ls, Mbuffer *b, int *line) {
+  char buff[64];  /* enough for any numeral */
+  int len;
+  if (*line < ls->linenumber) {
+    do {
+      addtext(ls, b, "\n", 1);
+    } while (++(*line) < ls->linenumber);
+  }
+  else if (luaZ_bufflen(b) > 0)
+    addtext(ls, b, " ", 1);  /* keep tokens apart */
+  switch (ls->t.token) {
+    case TK_NAME: {
+      TString *ts = ls->t.seminfo.ts;
+      addtext(ls, b, getstr(ts), tsslen(ts));
+      return;
+    }
+    case TK_STRING: {
+      TString *ts = ls->t.seminfo.ts;
+      addquoted(ls, b, getstr(ts), tsslen(ts));
+      return;
+    }
+    case TK_INT: {
+      lua_Integer i = ls->t.seminfo.i;
+      if (i >= 0)
+        len = lua_integer2str(buff, sizeof(buff), i);
+      else  /* hexadecimal numeral that wrapped around */
+        len = l_sprintf(buff, sizeof(buff), "0x%" LUA_INTEGER_FRMLEN "x",
+                        (unsigned LUAI_UACINT)l_castS2U(i));
+      break;
+    }
+    case TK_FLT: {
+      lua_Number r = ls->t.seminfo.r;
+      if (!(r - r == 0)) {  /* infinity? (a numeral is never a NaN) */
+        addtext(ls, b, "1e9999", 6);
+        return;
+      }
+      len = l_sprintf(buff, sizeof(buff), "%" LUA_NUMBER_FRMLEN "a",
+                      (LUAI_UACNUMBER)r);  /* hexadecimal keeps every bit */
+      break;
+    }
+    default: {
+      int token = ls->t.token;
+      if (token < FIRST_RESERVED) {  /* single-byte symbol? */
+        buff[0] = cast_char(token);
+        len = 1;
+      }
+      else {
+        const char *s = luaX_tokens[token - FIRST_RESERVED];
+        lua_assert(token < TK_EOS);
+        addtext(ls, b, s, strlen(s));
+        return;
+      }
+      break;
+    }
+  }
+  addtext(ls, b, buff, len);
+}
+
+/* }====================================================== */
+
@@ -61,6 +61,12 @@ typedef struct Token {
 
 /* state of the lexer plus state of the parser when shared by all
    functions */
+/* size of the cache of strings known to be in the scanner table */
+#if !defined(LUAI_LEXCACHE)
+#define LUAI_LEXCACHE	64
+#endif
+
+
 typedef struct LexState {
   int current;  /* current character (charint) */
   int linenumber;  /* input line counter */
@@ -72,6 +78,7 @@ typedef struct LexState {
   ZIO *z;  /* input stream */
   Mbuffer *buff;  /* buffer for tokens */
   Table *h;  /* to avoid collection/reuse strings */
+  TString *anchored[LUAI_LEXCACHE];  /* strings recently put in 'h' */
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
@@ -86,6 +93,7 @@ LUAI_FUNC void luaX_next (LexState *ls);
 LUAI_FUNC int luaX_lookahead (LexState *ls);
 LUAI_FUNC l_noret luaX_syntaxerror (LexState *ls, const char *s);
 LUAI_FUNC const char *luaX_token2str (LexState *ls, int token);
+LUAI_FUNC void luaX_savetoken (LexState *ls, Mbuffer *b, int *line);
 
 
 #endif
@@ -17,7 +17,9 @@
 #include "ldebug.hpp"
 #include "ldo.hpp"
 #include "lgc.hpp"
+#include "lgcfree.hpp"
 #include "lmem.hpp"
+#include "lmemprof.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
 
@@ -121,6 +123,17 @@ void *luaM_shrinkvector_ (lua_State *L, void *block, int *size,
 /* }================================================================== */
 
 
+/*
+** Check whether growing a block from 'os' to 'ns' bytes would take the
+** state over its memory limit ('g->memlimit', 0 if none). Such requests
+** fail as if the allocator had failed, so they get an emergency
+** collection and then raise a memory error.
+*/
+#define overlimit(g,os,ns)  \
+	((g)->memlimit != 0 && (ns) > (os) &&  \
+	 gettotalbytes(g) + ((ns) - (os)) > (g)->memlimit)
+
+
 l_noret luaM_toobig (lua_State *L) {
   luaG_runerror(L, "memory allocation error: block too big");
 }
@@ -132,8 +145,12 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  (*g->frealloc)(g->ud, block, osize, 0);
+  if (g->bgfree != NULL)  /* freeing in the background? */
+    luaC_deferfree(g, block, osize);
+  else
+    (*g->frealloc)(g->ud, block, osize, 0);
   g->GCdebt -= osize;
+  g->gcstats.freed += osize;
 }
 
 
@@ -150,6 +167,9 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (completestate(g) && !g->gcstopem) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
+    luaC_bgfreeflush(g, 1);  /* ...and make sure it was really freed */
+    if (overlimit(g, (block == NULL) ? 0 : osize, nsize))
+      return NULL;  /* still over the limit */
     return (*g->frealloc)(g->ud, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot free any memory without a full state */
@@ -163,7 +183,10 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   void *newblock;
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  newblock = firsttry(g, block, osize, nsize);
+  if (l_unlikely(overlimit(g, osize, nsize)))
+    newblock = NULL;
+  else
+    newblock = firsttry(g, block, osize, nsize);
   if (l_unlikely(newblock == NULL && nsize > 0)) {
     newblock = tryagain(L, block, osize, nsize);
     if (newblock == NULL)  /* still no memory? */
@@ -171,6 +194,10 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - osize;
+  if (nsize < osize)  /* shrinking or freeing a block? */
+    g->gcstats.freed += osize - nsize;
+  else if (nsize > osize)  /* growing a block? */
+    luaM_profcount(L, g, NULL, 0, nsize - osize);
   return newblock;
 }
 
@@ -189,13 +216,16 @@ void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
     return NULL;  /* that's all */
   else {
     global_State *g = G(L);
-    void *newblock = firsttry(g, NULL, tag, size);
+    void *newblock = l_unlikely(overlimit(g, 0, size))
+                   ? NULL : firsttry(g, NULL, tag, size);
     if (l_unlikely(newblock == NULL)) {
       newblock = tryagain(L, NULL, tag, size);
       if (newblock == NULL)
         luaM_error(L);
     }
     g->GCdebt += size;
+    if (tag == 0)  /* not an object? ('luaC_newobj' samples those) */
+      luaM_profcount(L, g, NULL, 0, size);
     return newblock;
   }
 }
@@ -0,0 +1,484 @@
+/*
+** $Id: lmemprof.c $
+** Sampling heap profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lmemprof_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "ldebug.hpp"
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lmemprof.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+#include "lstring.hpp"
+#include "ltm.hpp"
+
+
+/*
+** The profiler samples on average one allocation out of every 'period'
+** (the exact intervals are randomized so that allocation patterns do
+** not alias with the sampling). For each sample it records the stack
+** of the running thread as a "collapsed" string (root frame first,
+** frames separated by ';', the type of the allocation as the leaf) and
+** accumulates it into a site. Sampled objects get SAMPLEDBIT set and
+** are kept in a table of live samples, so that freeing them updates
+** their site and tells whether they survived a collection.
+**
+** All memory used by the profiler comes straight from the allocator of
+** the state, without being counted as Lua memory, and the profiler
+** never raises errors: if it cannot get memory it just drops samples.
+*/
+
+
+typedef struct MemSite {
+  struct MemSite *next;  /* next site in the same bucket */
+  unsigned int hash;
+  size_t len;  /* length of 'stack' */
+  lu_mem allocs, allocbytes;  /* samples taken */
+  lu_mem live, livebytes;  /* samples still alive */
+  lu_mem survived, survivedbytes;  /* dead samples that survived */
+  lu_mem lsurv;  /* live samples that survived (computed by dumps) */
+  char stack[1];  /* collapsed stack (with '\0') */
+} MemSite;
+
+
+typedef struct MemSample {
+  GCObject *o;  /* sampled object (NULL if slot is empty) */
+  MemSite *site;
+  size_t size;
+  lua_Unsigned cycle;  /* collection counter when it was allocated */
+} MemSample;
+
+
+typedef struct MemProf {
+  int period;  /* mean number of allocations between samples */
+  unsigned int rnd;  /* state for the sampling intervals */
+  MemSite **sites;  /* hash table of sites */
+  int sizesites;
+  int nsites;
+  MemSample *live;  /* open-addressing table of live samples */
+  int sizelive;
+  int nlive;
+} MemProf;
+
+
+#define MINSITES	64
+#define MINLIVE		256
+
+/* size of the buffer holding a collapsed stack */
+#define STACKBUFF	(MEMPROFFRAMES * (LUA_IDSIZE + 16) + 32)
+
+
+static void *profalloc (global_State *g, void *block, size_t os, size_t ns) {
+  return (*g->frealloc)(g->ud, block, os, ns);
+}
+
+
+/*
+** Number of allocations until the next sample: uniform in
+** [1, 2 * period - 1], so the mean is 'period'.
+*/
+static l_mem nextsample (MemProf *mp) {
+  unsigned int x = mp->rnd;  /* xorshift32 */
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  mp->rnd = x;
+  if (mp->period <= 1)
+    return 1;
+  return cast(l_mem, x % (2u * cast_uint(mp->period) - 1u)) + 1;
+}
+
+
+/*
+** Whether a sample allocated at collection counter 'cycle' has already
+** survived a whole collection. Objects allocated during a collection
+** may still die in that same collection, so it takes a later cycle to
+** have gone all the way through (unless the current one is finished).
+*/
+static int survived (global_State *g, lua_Unsigned cycle, int alive) {
+  lua_Unsigned now = g->gcstats.cycle;
+  if (now >= cycle + 2)
+    return 1;
+  else if (now == cycle + 1)  /* one cycle started since its creation */
+    return alive && (g->gcstate == GCSpause || isdecGCmodegen(g));
+  else
+    return 0;
+}
+
+
+/*
+** {======================================================
+** Live samples (open addressing with linear probing)
+** =======================================================
+*/
+
+#define hashptr(p,size)  \
+	cast_int(((point2uint(p) >> 3) * 2654435761u) & cast_uint((size) - 1))
+
+
+static MemSample *findlive (MemProf *mp, GCObject *o) {
+  int i = hashptr(o, mp->sizelive);
+  while (mp->live[i].o != NULL) {
+    if (mp->live[i].o == o)
+      return &mp->live[i];
+    i = (i + 1) & (mp->sizelive - 1);
+  }
+  return NULL;
+}
+
+
+static void insertlive (MemProf *mp, const MemSample *s) {
+  int i = hashptr(s->o, mp->sizelive);
+  while (mp->live[i].o != NULL)
+    i = (i + 1) & (mp->sizelive - 1);
+  mp->live[i] = *s;
+  mp->nlive++;
+}
+
+
+/*
+** Remove entry 'e', moving back following entries of its cluster that
+** would become unreachable.
+*/
+static void removelive (MemProf *mp, MemSample *e) {
+  int mask = mp->sizelive - 1;
+  int i = cast_int(e - mp->live);
+  int j = i;
+  for (;;) {
+    int k;
+    mp->live[i].o = NULL;
+    do {
+      j = (j + 1) & mask;
+      if (mp->live[j].o == NULL) {
+        mp->nlive--;
+        return;
+      }
+      k = hashptr(mp->live[j].o, mp->sizelive);
+      /* keep looking while 'k' lies cyclically in (i, j] */
+    } while ((i <= j) ? (i < k && k <= j) : (i < k || k <= j));
+    mp->live[i] = mp->live[j];
+    i = j;
+  }
+}
+
+
+static int growlive (global_State *g, MemProf *mp) {
+  int oldsize = mp->sizelive;
+  MemSample *old = mp->live;
+  int newsize = (oldsize == 0) ? MINLIVE : oldsize * 2;
+  int i;
+  MemSample *nt = cast(MemSample *,
+      profalloc(g, NULL, 0, cast_sizet(newsize) * sizeof(MemSample)));
+  if (nt == NULL)
+    return 0;
+  for (i = 0; i < newsize; i++)
+    nt[i].o = NULL;
+  mp->live = nt;
+  mp->sizelive = newsize;
+  mp->nlive = 0;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].o != NULL)
+      insertlive(mp, &old[i]);
+  }
+  if (old != NULL)
+    profalloc(g, old, cast_sizet(oldsize) * sizeof(MemSample), 0);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Sites
+** =======================================================
+*/
+
+static int growsites (global_State *g, MemProf *mp) {
+  int oldsize = mp->sizesites;
+  int newsize = (oldsize == 0) ? MINSITES : oldsize * 2;
+  int i;
+  MemSite **nt = cast(MemSite **,
+      profalloc(g, NULL, 0, cast_sizet(newsize) * sizeof(MemSite *)));
+  if (nt == NULL)
+    return 0;
+  for (i = 0; i < newsize; i++)
+    nt[i] = NULL;
+  for (i = 0; i < oldsize; i++) {
+    MemSite *s = mp->sites[i];
+    while (s != NULL) {
+      MemSite *next = s->next;
+      int b = cast_int(s->hash & cast_uint(newsize - 1));
+      s->next = nt[b];
+      nt[b] = s;
+      s = next;
+    }
+  }
+  if (mp->sites != NULL)
+    profalloc(g, mp->sites, cast_sizet(oldsize) * sizeof(MemSite *), 0);
+  mp->sites = nt;
+  mp->sizesites = newsize;
+  return 1;
+}
+
+
+static MemSite *getsite (global_State *g, MemProf *mp, const char *stack,
+                         size_t len) {
+  unsigned int h = luaS_hash(stack, len, 0);
+  MemSite *s;
+  for (s = mp->sites[h & cast_uint(mp->sizesites - 1)]; s; s = s->next) {
+    if (s->hash == h && s->len == len && memcmp(s->stack, stack, len) == 0)
+      return s;
+  }
+  if (mp->nsites >= mp->sizesites && !growsites(g, mp))
+    return NULL;
+  s = cast(MemSite *, profalloc(g, NULL, 0, sizeof(MemSite) + len));
+  if (s == NULL)
+    return NULL;
+  memset(s, 0, sizeof(MemSite));
+  s->hash = h;
+  s->len = len;
+  memcpy(s->stack, stack, len + 1);
+  s->next = mp->sites[h & cast_uint(mp->sizesites - 1)];
+  mp->sites[h & cast_uint(mp->sizesites - 1)] = s;
+  mp->nsites++;
+  return s;
+}
+
+
+static void freesites (global_State *g, MemProf *mp) {
+  int i;
+  for (i = 0; i < mp->sizesites; i++) {
+    MemSite *s = mp->sites[i];
+    while (s != NULL) {
+      MemSite *next = s->next;
+      profalloc(g, s, sizeof(MemSite) + s->len, 0);
+      s = next;
+    }
+  }
+  if (mp->sites != NULL)
+    profalloc(g, mp->sites, cast_sizet(mp->sizesites) * sizeof(MemSite *), 0);
+}
+
+/* }====================================================== */
+
+
+/*
+** Append to 'buff' the frame for 'ci' and return the new end. Chunk
+** names may have line breaks and ';' (e.g., the first line of a string
+** chunk), which would break the format: they become spaces.
+*/
+static char *addframe (char *buff, CallInfo *ci) {
+  if (isLua(ci)) {
+    Proto *p = ci_func(ci)->p;
+    int line = luaG_getfuncline(p, pcRel(ci->u.l.savedpc, p));
+    if (p->source != NULL)
+      luaO_chunkid(buff, getstr(p->source), tsslen(p->source));
+    else
+      strcpy(buff, "?");
+    for (; *buff != '\0'; buff++) {
+      if (*buff == ';' || *buff == '\n' || *buff == '\r')
+        *buff = ' ';
+    }
+    buff += l_sprintf(buff, LUA_IDSIZE, ":%d", line);
+  }
+  else {
+    memcpy(buff, "[C]", 3);
+    buff += 3;
+  }
+  return buff;
+}
+
+
+/*
+** Build the collapsed stack of thread 'L' for an allocation with tag
+** 'tt' (0 for blocks that are not objects) into 'buff'.
+*/
+static size_t collapsestack (lua_State *L, int tt, char *buff) {
+  CallInfo *frames[MEMPROFFRAMES];
+  CallInfo *ci;
+  int n = 0;
+  char *p = buff;
+  for (ci = L->ci; ci != &L->base_ci && n < MEMPROFFRAMES; ci = ci->previous)
+    frames[n++] = ci;
+  if (ci != &L->base_ci) {  /* stack was truncated? */
+    memcpy(p, "...;", 4);
+    p += 4;
+  }
+  while (n-- > 0) {
+    p = addframe(p, frames[n]);
+    *p++ = ';';
+  }
+  if (tt == 0) {
+    memcpy(p, "[block]", 7);
+    p += 7;
+  }
+  else {
+    const char *tn = ttypename(novariant(tt));
+    size_t l = strlen(tn);
+    memcpy(p, tn, l);
+    p += l;
+  }
+  *p = '\0';
+  return cast_sizet(p - buff);
+}
+
+
+int luaM_profstart (lua_State *L, int period) {
+  global_State *g = G(L);
+  MemProf *mp = g->memprof;
+  int old = (mp != NULL) ? mp->period : 0;
+  if (period <= 0) {
+    luaM_profstop(g);
+    return old;
+  }
+  if (mp == NULL) {
+    mp = cast(MemProf *, profalloc(g, NULL, 0, sizeof(MemProf)));
+    if (mp == NULL)
+      return -1;
+    memset(mp, 0, sizeof(MemProf));
+    mp->rnd = (g->seed ^ point2uint(mp)) | 1u;  /* must not be zero */
+    if (!growsites(g, mp) || !growlive(g, mp)) {
+      g->memprof = mp;
+      luaM_profstop(g);
+      return -1;
+    }
+    g->memprof = mp;
+  }
+  mp->period = period;
+  g->profcount = nextsample(mp);
+  return old;
+}
+
+
+void luaM_profstop (global_State *g) {
+  MemProf *mp = g->memprof;
+  g->profcount = MAX_LMEM;  /* never sample */
+  if (mp != NULL) {
+    freesites(g, mp);
+    if (mp->live != NULL)
+      profalloc(g, mp->live, cast_sizet(mp->sizelive) * sizeof(MemSample), 0);
+    profalloc(g, mp, sizeof(MemProf), 0);
+    g->memprof = NULL;
+  }
+}
+
+
+void luaM_profsample (lua_State *L, GCObject *o, int tt, size_t sz) {
+  global_State *g = G(L);
+  MemProf *mp = g->memprof;
+  char buff[STACKBUFF];
+  MemSite *site;
+  if (mp == NULL) {  /* profiler is off? */
+    g->profcount = MAX_LMEM;
+    return;
+  }
+  g->profcount = nextsample(mp);
+  site = getsite(g, mp, buff, collapsestack(L, tt, buff));
+  if (site == NULL)
+    return;  /* no memory; drop sample */
+  site->allocs++;
+  site->allocbytes += sz;
+  if (o != NULL) {  /* track object until it dies */
+    MemSample s;
+    if (2 * (mp->nlive + 1) > mp->sizelive && !growlive(g, mp))
+      return;
+    s.o = o; s.site = site; s.size = sz; s.cycle = g->gcstats.cycle;
+    insertlive(mp, &s);
+    l_setbit(o->marked, SAMPLEDBIT);
+    site->live++;
+    site->livebytes += sz;
+  }
+}
+
+
+void luaM_profdead (global_State *g, GCObject *o) {
+  MemProf *mp = g->memprof;
+  MemSample *s;
+  if (mp == NULL || (s = findlive(mp, o)) == NULL)
+    return;  /* sampled by a previous run of the profiler */
+  s->site->live--;
+  s->site->livebytes -= s->size;
+  if (survived(g, s->cycle, 0)) {
+    s->site->survived++;
+    s->site->survivedbytes += s->size;
+  }
+  removelive(mp, s);
+}
+
+
+/*
+** Value reported for site 's' in 'mode', scaled by the sampling period.
+*/
+static lu_mem sitevalue (MemProf *mp, MemSite *s, int mode) {
+  lu_mem v;
+  switch (mode) {
+    case LUA_HPINUSE: v = s->livebytes; break;
+    case LUA_HPINUSEOBJS: v = s->live; break;
+    case LUA_HPALLOC: v = s->allocbytes; break;
+    case LUA_HPALLOCOBJS: v = s->allocs; break;
+    case LUA_HPSURVIVED: v = s->survivedbytes + s->lsurv; break;
+    default: v = 0; break;
+  }
+  return v * cast(lu_mem, mp->period);
+}
+
+
+/*
+** Add to each site the bytes of its live samples that have already
+** survived a collection.
+*/
+static void livesurvivors (global_State *g, MemProf *mp) {
+  int i;
+  for (i = 0; i < mp->sizesites; i++) {
+    MemSite *s;
+    for (s = mp->sites[i]; s != NULL; s = s->next)
+      s->lsurv = 0;
+  }
+  for (i = 0; i < mp->sizelive; i++) {
+    MemSample *e = &mp->live[i];
+    if (e->o != NULL && survived(g, e->cycle, 1))
+      e->site->lsurv += e->size;
+  }
+}
+
+
+/*
+** Write the profile in collapsed-stack format: one line per site with
+** its stack and value. Sites with a zero value are skipped. Returns 0,
+** the error returned by 'writer', or -1 if the profiler is off.
+*/
+int luaM_profdump (lua_State *L, lua_Writer writer, void *data, int mode) {
+  global_State *g = G(L);
+  MemProf *mp = g->memprof;
+  int i, status = 0;
+  if (mp == NULL)
+    return -1;
+  if (mode == LUA_HPSURVIVED)
+    livesurvivors(g, mp);
+  for (i = 0; i < mp->sizesites && status == 0; i++) {
+    MemSite *s;
+    for (s = mp->sites[i]; s != NULL && status == 0; s = s->next) {
+      lu_mem v = sitevalue(mp, s, mode);
+      if (v > 0) {
+        char line[48];
+        int l = l_sprintf(line, sizeof(line), " " LUA_INTEGER_FMT "\n",
+                          cast(LUAI_UACINT, v));
+        status = writer(L, s->stack, s->len, data);
+        if (status == 0)
+          status = writer(L, line, cast_sizet(l), data);
+      }
+    }
+  }
+  return status;
+}
@@ -0,0 +1,41 @@
+/*
+** $Id: lmemprof.h $
+** Sampling heap profiler
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lmemprof_h
+#define lmemprof_h
+
+
+#include "lgc.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+
+
+/* maximum number of stack frames kept for each sample */
+#define MEMPROFFRAMES	24
+
+
+/*
+** Count one allocation of 'sz' bytes towards the next heap-profiler
+** sample; 'o' is the new object (NULL for other blocks) and 't' its tag.
+** When the profiler is off, 'g->profcount' stays too large to ever reach
+** zero, so the cost is a decrement and a test.
+*/
+#define luaM_profcount(L,g,o,t,sz)  \
+	{ if (l_unlikely(--(g)->profcount <= 0)) luaM_profsample(L, o, t, sz); }
+
+/* check whether object 'o' was sampled (and then tell the profiler) */
+#define luaM_proffree(g,o)  \
+	{ if (l_unlikely(testbit((o)->marked, SAMPLEDBIT))) luaM_profdead(g, o); }
+
+
+LUAI_FUNC int luaM_profstart (lua_State *L, int period);
+LUAI_FUNC void luaM_profstop (global_State *g);
+LUAI_FUNC void luaM_profsample (lua_State *L, GCObject *o, int tt, size_t sz);
+LUAI_FUNC void luaM_profdead (global_State *g, GCObject *o);
+LUAI_FUNC int luaM_profdump (lua_State *L, lua_Writer writer, void *data,
+                             int mode);
+
+#endif
@@ -14,6 +14,7 @@
 #include "lprefix.hpp"
 
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,8 @@
 #include "lauxlib.hpp"
 #include "lualib.hpp"
 
+#include "lthread.hpp"
+
 
 /*
 ** LUA_IGMARK is a mark to ignore all before it when building the
@@ -61,6 +64,12 @@
 */
 static const char *const CLIBS = "_CLIBS";
 
+/*
+** key for table in the registry that keeps the bundles of precompiled
+** modules (see 'package.addbundle')
+*/
+static const char *const BUNDLES = "_BUNDLES";
+
 #define LIB_FAIL	"open"
 
 
@@ -371,6 +380,53 @@ static int gctm (lua_State *L) {
 }
 
 
+/*
+** __clone tag method for CLIBS table: a clone of a state (see
+** 'lua_clonestate') has its own copy of the handles in CLIBS, so it
+** loads each library again, to keep the count of handles of each library
+** balanced with the calls to 'lsys_unloadlib'. (A library that cannot
+** be loaded again is removed from the list of the clone.)
+*/
+static int clonetm (lua_State *L) {
+  lua_Integer n = luaL_len(L, 1);
+  lua_Integer i = 1;
+  while (i <= n) {
+    void *lib;
+    void *plib;
+    lua_rawgeti(L, 1, i);  /* get handle CLIBS[i] */
+    plib = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lib = NULL;
+    while (lua_next(L, 1)) {  /* look for its path */
+      if (lua_type(L, -2) == LUA_TSTRING && lua_touserdata(L, -1) == plib) {
+        lib = lsys_load(L, lua_tostring(L, -2), 0);
+        if (lib == NULL) {  /* cannot load it again? */
+          lua_pop(L, 1);  /* remove error message */
+          lua_pushvalue(L, -2);
+          lua_pushnil(L);
+          lua_rawset(L, 1);  /* CLIBS[path] = nil */
+        }
+        lua_pop(L, 2);  /* pop key and value */
+        break;
+      }
+      lua_pop(L, 1);  /* pop value */
+    }
+    if (lib != NULL)
+      i++;
+    else {  /* remove CLIBS[i] from the list */
+      lua_Integer j;
+      for (j = i; j < n; j++) {
+        lua_rawgeti(L, 1, j + 1);
+        lua_rawseti(L, 1, j);
+      }
+      lua_pushnil(L);
+      lua_rawseti(L, 1, n--);
+    }
+  }
+  return 0;
+}
+
 
 /* error codes for 'lookforfunc' */
 #define ERRLIB		1
@@ -424,6 +480,130 @@ static int ll_loadlib (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Bundles of precompiled modules
+** =======================================================
+*/
+
+/*
+** A bundle (see 'lua_compilebundle') is mapped in memory once, when
+** added, and its modules are then found by 'searcher_bundle' through
+** the index of the bundle, with no file system access. Table BUNDLES
+** keeps a 'Bundle' userdata for each path and the list of paths, in
+** the order they were added:
+** registry.BUNDLES[path] = bundle
+** registry.BUNDLES[#BUNDLES + 1] = path
+*/
+typedef struct Bundle {
+  const char *image;  /* from 'lua_mapfile' (NULL if not mapped) */
+  size_t size;
+} Bundle;
+
+
+/*
+** Map bundle 'path' into 'b'. Returns NULL, or an error message in
+** the stack.
+*/
+static const char *mapbundle (lua_State *L, Bundle *b, const char *path) {
+  const char *msg;
+  b->image = lua_mapfile(path, &b->size);
+  if (b->image == NULL)
+    return lua_pushfstring(L, "cannot map '%s'", path);
+  if ((msg = lua_bundlecheck(b->image, b->size)) != NULL) {
+    lua_unmapfile(b->image);
+    b->image = NULL;
+    return lua_pushfstring(L, "%s: %s", path, msg);
+  }
+  return NULL;
+}
+
+
+/*
+** __gc tag method for BUNDLES table: unmaps all bundles (functions
+** loaded from them keep their own references to the images)
+*/
+static int bundlegctm (lua_State *L) {
+  lua_Integer n = luaL_len(L, 1);
+  for (; n >= 1; n--) {
+    Bundle *b;
+    lua_rawgeti(L, 1, n);  /* get path BUNDLES[n] */
+    lua_rawget(L, 1);  /* get its bundle */
+    b = (Bundle *)lua_touserdata(L, -1);
+    if (b != NULL && b->image != NULL) {
+      lua_unmapfile(b->image);
+      b->image = NULL;
+    }
+    lua_pop(L, 1);  /* pop bundle */
+  }
+  return 0;
+}
+
+
+/*
+** __clone tag method for BUNDLES table: a clone of a state has its own
+** copy of each 'Bundle', so it maps each bundle again. (A bundle that
+** cannot be mapped again is ignored by the searcher.)
+*/
+static int bundleclonetm (lua_State *L) {
+  lua_Integer n = luaL_len(L, 1);
+  lua_Integer i;
+  for (i = 1; i <= n; i++) {
+    Bundle *b;
+    lua_rawgeti(L, 1, i);  /* get path BUNDLES[i] */
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 1);  /* get its bundle */
+    b = (Bundle *)lua_touserdata(L, -1);
+    if (b != NULL && mapbundle(L, b, lua_tostring(L, -2)) != NULL)
+      lua_pop(L, 1);  /* remove error message */
+    lua_pop(L, 2);  /* pop path and bundle */
+  }
+  return 0;
+}
+
+
+static int ll_addbundle (lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  Bundle *b;
+  lua_getfield(L, LUA_REGISTRYINDEX, BUNDLES);
+  if (lua_getfield(L, -1, path) != LUA_TNIL) {  /* already added? */
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pop(L, 1);
+  b = (Bundle *)lua_newuserdatauv(L, sizeof(Bundle), 0);
+  if (mapbundle(L, b, path) != NULL) {  /* error? */
+    luaL_pushfail(L);
+    lua_insert(L, -2);
+    return 2;  /* return fail and error message */
+  }
+  lua_setfield(L, -2, path);  /* BUNDLES[path] = bundle */
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, luaL_len(L, -2) + 1);  /* BUNDLES[#BUNDLES + 1] = path */
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/*
+** create table BUNDLES, setting a finalizer to unmap all bundles when
+** closing state (and a tag method to map them again in clones).
+*/
+static void createbundlestable (lua_State *L) {
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, BUNDLES);
+  lua_createtable(L, 0, 2);  /* create metatable for BUNDLES */
+  lua_pushcfunction(L, bundlegctm);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, bundleclonetm);
+  lua_setfield(L, -2, "__clone");
+  lua_setmetatable(L, -2);
+  lua_pop(L, 1);  /* pop BUNDLES table */
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** 'require' function
@@ -478,6 +658,343 @@ static void pusherrornotfound (lua_State *L, const char *path) {
 }
 
 
+/*
+** {======================================================
+** Process-wide cache of path searches
+** =======================================================
+*/
+
+/*
+** When enabled (see 'luaL_pathcache'), the results of 'searchpath' are
+** kept in a cache shared by all states and indexed by the path and the
+** module name: the file found, or the fact that no candidate was
+** readable. Later searches with the same path and name, in any state,
+** touch no files. The cache does not see files created or removed
+** afterwards unless it is cleared ('luaL_pathcacheclear') or, in mode
+** LUA_PATHCACHEWATCH (only on Linux), it watches the directories of the
+** candidates (or, for a directory that does not exist, the nearest one
+** that does) and empties itself when any of them changes. Searches in
+** paths with relative templates (such as the default './?.lua') are
+** never cached, as their results depend on the current directory,
+** which may change and may differ among hosts. The cache belongs to no
+** state, so its memory comes from 'malloc'; it is emptied when it has
+** LUAI_MAXPATHCACHE entries.
+*/
+
+#if !defined(LUAI_MAXPATHCACHE)
+#define LUAI_MAXPATHCACHE	4096
+#endif
+
+/* number of hash chains */
+#define PCHASHSIZE	1024
+
+/* file names found longer than that are not cached */
+#define PCMAXFILE	LUAL_BUFFERSIZE
+
+
+#if defined(_WIN32)
+#define l_isabsolute(p)	((p)[0] == '\\' || (p)[0] == '/' || \
+  ((p)[0] != '\0' && (p)[1] == ':' && ((p)[2] == '\\' || (p)[2] == '/')))
+#else
+#define l_isabsolute(p)	((p)[0] == '/')
+#endif
+
+
+#if defined(LUA_USE_LINUX)
+#define l_pathwatch
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+typedef struct PEntry {
+  struct PEntry *next;  /* next entry in the same hash chain */
+  unsigned int h;
+  size_t pathlen;
+  size_t namelen;
+  size_t filelen;  /* length of the file found */
+  int found;  /* false if no candidate was readable */
+  char data[1];  /* path, name and file found, each ending with '\0' */
+} PEntry;
+
+
+static struct PathCache {
+  l_smutex lock;  /* protects all fields but 'mode' */
+  PEntry *hash[PCHASHSIZE];
+  size_t n;  /* number of entries */
+  int watch;  /* inotify descriptor, or -1 */
+  l_atomic mode;
+} pcache = { L_SMUTEXINIT, {NULL}, 0, -1, LUA_PATHCACHEOFF };
+
+
+static unsigned int pchash (const char *path, const char *name) {
+  unsigned int h = 2166136261u;  /* FNV-1a */
+  for (; *path != '\0'; path++)
+    h = (h ^ (unsigned char)*path) * 16777619u;
+  h *= 16777619u;  /* hash the '\0' ending the path */
+  for (; *name != '\0'; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h;
+}
+
+
+/* (the cache must be locked) */
+static void pcclear (void) {
+  int i;
+  for (i = 0; i < PCHASHSIZE; i++) {
+    PEntry *e = pcache.hash[i];
+    while (e != NULL) {
+      PEntry *next = e->next;
+      free(e);
+      e = next;
+    }
+    pcache.hash[i] = NULL;
+  }
+  pcache.n = 0;
+}
+
+
+/* (the cache must be locked) */
+static PEntry *pcfind (unsigned int h, const char *path, const char *name) {
+  PEntry *e;
+  size_t pl = strlen(path);
+  size_t nl = strlen(name);
+  for (e = pcache.hash[h % PCHASHSIZE]; e != NULL; e = e->next) {
+    if (e->h == h && e->pathlen == pl && e->namelen == nl &&
+        memcmp(e->data, path, pl) == 0 &&
+        memcmp(e->data + pl + 1, name, nl) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+
+#if defined(l_pathwatch)
+
+#define WATCHEVENTS  \
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+	 IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+** Empty the cache if any watched directory changed. (The cache must
+** be locked.)
+*/
+static void pcdrain (void) {
+  char buff[4096];
+  int changed = 0;
+  if (l_atomicload(&pcache.mode) != LUA_PATHCACHEWATCH) return;
+  while (read(pcache.watch, buff, sizeof(buff)) > 0)
+    changed = 1;
+  if (changed)
+    pcclear();
+}
+
+
+/*
+** Watch the directory of file 'name' (which is changed) or, if that
+** directory does not exist, the nearest one that does, so that its
+** creation is seen.
+*/
+static int watchdir (char *name) {
+  for (;;) {
+    char *slash = strrchr(name, *LUA_DIRSEP);
+    const char *dir = name;
+    if (slash == NULL)  /* relative name with no directory? */
+      dir = ".";
+    else if (slash == name)  /* file in the root directory? */
+      dir = LUA_DIRSEP;
+    else
+      *slash = '\0';  /* remove last component */
+    if (inotify_add_watch(pcache.watch, dir, WATCHEVENTS) >= 0)
+      return 1;
+    if (dir != name || (errno != ENOENT && errno != ENOTDIR))
+      return 0;  /* cannot watch the directory or any of its parents */
+  }
+}
+
+
+/*
+** Watch the directories of all file names in the list 'names'
+** (separated by LUA_PATH_SEP). Returns false if some directory could
+** not be watched. (The cache must be locked.)
+*/
+static int pcwatch (const char *names) {
+  char name[4096];
+  while (*names != '\0') {
+    const char *end = strchr(names, *LUA_PATH_SEP);
+    size_t l = (end != NULL) ? (size_t)(end - names) : strlen(names);
+    if (l >= sizeof(name))
+      return 0;
+    memcpy(name, names, l);
+    name[l] = '\0';
+    if (!watchdir(name))
+      return 0;
+    names += l;
+    if (*names != '\0') names++;  /* skip separator */
+  }
+  return 1;
+}
+
+#else
+
+#define pcdrain()	((void)0)
+#define pcwatch(names)	0
+
+#endif
+
+
+/*
+** Look for path search ('path', 'name') in the cache. Returns 1 and
+** pushes the file found, returns 0 if no file was found, or returns -1
+** if the search is not in the cache.
+*/
+static int pcget (lua_State *L, const char *path, const char *name) {
+  unsigned int h;
+  PEntry *e;
+  luaL_Buffer b;
+  char *p;
+  int res = -1;
+  size_t l = 0;
+  if (l_atomicload(&pcache.mode) == LUA_PATHCACHEOFF)
+    return -1;
+  h = pchash(path, name);
+  p = luaL_buffinitsize(L, &b, PCMAXFILE);  /* no errors under the lock */
+  l_locksm(&pcache.lock);
+  pcdrain();
+  e = pcfind(h, path, name);
+  if (e != NULL) {
+    res = e->found;
+    if (res) {
+      l = e->filelen;
+      memcpy(p, e->data + e->pathlen + e->namelen + 2, l);
+    }
+  }
+  l_unlocksm(&pcache.lock);
+  if (res == 1)
+    luaL_pushresultsize(&b, l);
+  else {
+    luaL_pushresultsize(&b, 0);
+    lua_pop(L, 1);  /* remove empty buffer */
+  }
+  return res;
+}
+
+
+/*
+** Add the result of path search ('path', 'name') to the cache: the
+** file found, or NULL. (In mode LUA_PATHCACHEWATCH, 'pcprepare' must
+** have been called before the candidates were tried.)
+*/
+static void pcset (const char *path, const char *name, const char *file) {
+  size_t pl = strlen(path);
+  size_t nl = strlen(name);
+  size_t fl = (file != NULL) ? strlen(file) : 0;
+  unsigned int h;
+  PEntry *e;
+  if (l_atomicload(&pcache.mode) == LUA_PATHCACHEOFF || fl >= PCMAXFILE)
+    return;
+  e = (PEntry *)malloc(offsetof(PEntry, data) + pl + nl + fl + 3);
+  if (e == NULL)
+    return;  /* just do not cache it */
+  e->h = h = pchash(path, name);
+  e->pathlen = pl;
+  e->namelen = nl;
+  e->filelen = fl;
+  e->found = (file != NULL);
+  memcpy(e->data, path, pl + 1);
+  memcpy(e->data + pl + 1, name, nl + 1);
+  if (file != NULL)
+    memcpy(e->data + pl + nl + 2, file, fl + 1);
+  l_locksm(&pcache.lock);
+  if (l_atomicload(&pcache.mode) == LUA_PATHCACHEOFF ||
+      pcfind(h, path, name) != NULL)
+    free(e);  /* disabled or added by another state meanwhile */
+  else {
+    if (pcache.n >= LUAI_MAXPATHCACHE)
+      pcclear();
+    e->next = pcache.hash[h % PCHASHSIZE];
+    pcache.hash[h % PCHASHSIZE] = e;
+    pcache.n++;
+  }
+  l_unlocksm(&pcache.lock);
+}
+
+
+/*
+** Check whether all templates in 'path' are absolute file names, so
+** that the candidates do not depend on the current directory. (A
+** template starting with the mark counts as relative.)
+*/
+static int pcabsolute (const char *path) {
+  for (;;) {
+    if (!l_isabsolute(path))
+      return 0;
+    path = strchr(path, *LUA_PATH_SEP);
+    if (path == NULL)
+      return 1;
+    path++;  /* skip separator */
+  }
+}
+
+
+/*
+** Prepare to try the candidates in 'names' (separated by LUA_PATH_SEP),
+** watching their directories in mode LUA_PATHCACHEWATCH. Returns false
+** if the result of the search cannot be cached.
+*/
+static int pcprepare (const char *names) {
+  int ok = 1;
+  long mode = l_atomicload(&pcache.mode);
+  if (mode == LUA_PATHCACHEWATCH) {
+    l_locksm(&pcache.lock);
+    ok = (pcache.watch >= 0 && pcwatch(names));
+    l_unlocksm(&pcache.lock);
+  }
+  return (mode != LUA_PATHCACHEOFF && ok);
+}
+
+
+/*
+** Set the mode of the process-wide cache of path searches; a negative
+** 'mode' only queries it. Changing the mode empties the cache. Mode
+** LUA_PATHCACHEWATCH falls back to LUA_PATHCACHEON where directories
+** cannot be watched. Returns the previous mode.
+*/
+LUALIB_API int luaL_pathcache (int mode) {
+  int old;
+  l_locksm(&pcache.lock);
+  old = (int)l_atomicload(&pcache.mode);
+  if (mode >= 0 && mode != old) {
+#if defined(l_pathwatch)
+    if (old == LUA_PATHCACHEWATCH && pcache.watch >= 0)
+      close(pcache.watch);
+    pcache.watch = -1;
+    if (mode == LUA_PATHCACHEWATCH &&
+        (pcache.watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+      mode = LUA_PATHCACHEON;
+#else
+    if (mode == LUA_PATHCACHEWATCH)
+      mode = LUA_PATHCACHEON;
+#endif
+    pcclear();
+    l_atomicstore(&pcache.mode, mode);
+  }
+  l_unlocksm(&pcache.lock);
+  return old;
+}
+
+
+/* empty the process-wide cache of path searches */
+LUALIB_API void luaL_pathcacheclear (void) {
+  l_locksm(&pcache.lock);
+  pcclear();
+  l_unlocksm(&pcache.lock);
+}
+
+/* }====================================================== */
+
+
 static const char *searchpath (lua_State *L, const char *name,
                                              const char *path,
                                              const char *sep,
@@ -486,19 +1003,29 @@ static const char *searchpath (lua_State *L, const char *name,
   char *pathname;  /* path with name inserted */
   char *endpathname;  /* its end */
   const char *filename;
+  int cached, cache;
   /* separator is non-empty and appears in 'name'? */
   if (*sep != '\0' && strchr(name, *sep) != NULL)
     name = luaL_gsub(L, name, sep, dirsep);  /* replace it by 'dirsep' */
+  cache = pcabsolute(path);
+  cached = cache ? pcget(L, path, name) : -1;
+  if (cached == 1)  /* file found by a previous search? */
+    return lua_tostring(L, -1);
   luaL_buffinit(L, &buff);
   /* add path to the buffer, replacing marks ('?') with the file name */
   luaL_addgsub(&buff, path, LUA_PATH_MARK, name);
   luaL_addchar(&buff, '\0');
   pathname = luaL_buffaddr(&buff);  /* writable list of file names */
   endpathname = pathname + luaL_bufflen(&buff) - 1;
-  while ((filename = getnextfilename(&pathname, endpathname)) != NULL) {
-    if (readable(filename))  /* does file exist and is readable? */
+  cache = (cache && cached == -1 && pcprepare(pathname));
+  while (cached == -1 &&
+         (filename = getnextfilename(&pathname, endpathname)) != NULL) {
+    if (readable(filename)) {  /* does file exist and is readable? */
+      if (cache) pcset(path, name, filename);
       return lua_pushstring(L, filename);  /* save and return name */
+    }
   }
+  if (cache) pcset(path, name, NULL);
   luaL_pushresult(&buff);  /* push path to create error message */
   pusherrornotfound(L, lua_tostring(L, -1));  /* create error message */
   return NULL;  /* not found */
@@ -621,6 +1148,43 @@ static int searcher_preload (lua_State *L) {
 }
 
 
+static int searcher_bundle (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  lua_Integer n, i;
+  luaL_Buffer msg;
+  lua_getfield(L, LUA_REGISTRYINDEX, BUNDLES);  /* BUNDLES at index 2 */
+  n = luaL_len(L, 2);
+  for (i = 1; i <= n; i++) {
+    const char *code;
+    size_t len;
+    const Bundle *b;
+    lua_rawgeti(L, 2, i);  /* get path BUNDLES[i] */
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 2);  /* get its bundle */
+    b = (const Bundle *)lua_touserdata(L, -1);
+    lua_pop(L, 1);  /* pop bundle; path stays on the stack */
+    if (b != NULL && b->image != NULL &&
+        (code = lua_bundlefind(b->image, b->size, name, &len)) != NULL) {
+      const char *path = lua_tostring(L, -1);
+      int stat = luaL_loadbufferx(L, code, len, name, "b");
+      return checkload(L, (stat == LUA_OK), path);
+    }
+    lua_pop(L, 1);  /* pop path */
+  }
+  if (n == 0) return 0;  /* no bundles */
+  luaL_buffinit(L, &msg);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 2, i);
+    lua_pushfstring(L, "%sno module '%s' in bundle '%s'",
+                       (i > 1) ? "\n\t" : "", name, lua_tostring(L, -1));
+    lua_remove(L, -2);  /* remove path */
+    luaL_addvalue(&msg);
+  }
+  luaL_pushresult(&msg);
+  return 1;
+}
+
+
 static void findloader (lua_State *L, const char *name) {
   int i;
   luaL_Buffer msg;  /* to build error message */
@@ -689,6 +1253,7 @@ static int ll_require (lua_State *L) {
 
 
 static const luaL_Reg pk_funcs[] = {
+  {"addbundle", ll_addbundle},
   {"loadlib", ll_loadlib},
   {"searchpath", ll_searchpath},
   /* placeholders */
@@ -709,7 +1274,8 @@ static const luaL_Reg ll_funcs[] = {
 
 static void createsearcherstable (lua_State *L) {
   static const lua_CFunction searchers[] =
-    {searcher_preload, searcher_Lua, searcher_C, searcher_Croot, NULL};
+    {searcher_preload, searcher_bundle, searcher_Lua, searcher_C,
+     searcher_Croot, NULL};
   int i;
   /* create 'searchers' table */
   lua_createtable(L, sizeof(searchers)/sizeof(searchers[0]) - 1, 0);
@@ -725,19 +1291,23 @@ static void createsearcherstable (lua_State *L) {
 
 /*
 ** create table CLIBS to keep track of loaded C libraries,
-** setting a finalizer to close all libraries when closing state.
+** setting a finalizer to close all libraries when closing state
+** (and a tag method to load them again in clones of the state).
 */
 static void createclibstable (lua_State *L) {
   luaL_getsubtable(L, LUA_REGISTRYINDEX, CLIBS);  /* create CLIBS table */
-  lua_createtable(L, 0, 1);  /* create metatable for CLIBS */
+  lua_createtable(L, 0, 2);  /* create metatable for CLIBS */
   lua_pushcfunction(L, gctm);
   lua_setfield(L, -2, "__gc");  /* set finalizer for CLIBS table */
+  lua_pushcfunction(L, clonetm);
+  lua_setfield(L, -2, "__clone");  /* set clone method for CLIBS table */
   lua_setmetatable(L, -2);
 }
 
 
 LUAMOD_API int luaopen_package (lua_State *L) {
   createclibstable(L);
+  createbundlestable(L);
   luaL_newlib(L, pk_funcs);  /* create 'package' table */
   createsearcherstable(L);
   /* set paths */
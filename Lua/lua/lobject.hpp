@@ -541,6 +541,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte shared;  /* arrays kept by the shared store (see 'lshare.c') */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -558,6 +559,7 @@ typedef struct Proto {
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
+  TString  *lazy;  /* source of a body not compiled yet (see 'lparser.c') */
   GCObject *gclist;
 } Proto;
 
@@ -986,13 +986,318 @@ static void parlist (LexState *ls) {
 }
 
 
-static void body (LexState *ls, expdesc *e, int ismethod, int line) {
+/*
+** {======================================================================
+** Lazy compilation
+** When 'lua_lazyparse' is on, the body of a function nested in another
+** function is only skimmed: its tokens are kept as text in the field
+** 'lazy' of a stub prototype, and it is compiled when the first closure
+** is made from it (see 'luaD_lazyparse'). (Functions of a main chunk
+** are compiled at once, as their closures are all made when it runs.)
+** Names used by a skimmed body are resolved as variables, so that the
+** stub gets every upvalue the body may use (and maybe a few more) and
+** the enclosing functions see their captured locals as usual.
+** Compile-time constants are not upvalues: the stub keeps their values
+** in 'k' and their names in 'locvars'. 'numparams' of a stub is 1 for
+** methods. Syntax errors in a skimmed body are only raised when it is
+** compiled.
+** =======================================================================
+*/
+
+
+/*
+** Skimming keeps track of the names declared in the body (parameters,
+** locals, loop variables) and of the scope levels opened by 'do',
+** 'then', 'else', 'repeat', and 'function', so that names in scope of
+** a declaration are not resolved. A declaration is only taken into
+** account where it is surely in scope: names of a 'local' statement
+** become active at the next statement keyword, names of a 'for' at its
+** 'do' (and not at the statements of a function in its expressions,
+** which are skimmed at the scope level of the loop); the scope of a
+** 'repeat' closes at its 'until'. Anything else is resolved, which is
+** always safe.
+*/
+
+/* kinds of declaration being skimmed */
+#define SKIMNONE	0	/* none */
+#define SKIMLOCAL	1	/* names of a 'local' statement */
+#define SKIMFOR		2	/* names of a 'for' loop */
+#define SKIMFUNC	3	/* name of a function, before its parameters */
+#define SKIMLOCALFUNC	4	/* name of a local function */
+#define SKIMPARAMS	5	/* parameters */
+
+typedef struct SkimState {
+  int scope;  /* current scope level */
+  int decl;  /* kind of declaration being skimmed */
+  int expectname;  /* true if a name may be declared next */
+  int attrib;  /* true inside an attribute ('<...>') */
+  int method;  /* true if the function being declared is a method */
+} SkimState;
+
+
+static void skimdeclare (LexState *ls, TString *name, int level,
+                         int active) {
+  Dyndata *dyd = ls->dyd;
+  Skimvar *v;
+  luaM_growvector(ls->L, dyd->skimvar.arr, dyd->skimvar.n + 1,
+                  dyd->skimvar.size, Skimvar, MAX_INT, "local variables");
+  v = &dyd->skimvar.arr[dyd->skimvar.n++];
+  v->name = name;
+  v->level = level;
+  v->active = active;
+  v->loop = 0;
+}
+
+
+/* is 'name' surely declared by the body being skimmed? */
+static int skimlocal (LexState *ls, TString *name) {
+  Dyndata *dyd = ls->dyd;
+  int i;
+  for (i = dyd->skimvar.n - 1; i >= 0; i--) {
+    if (dyd->skimvar.arr[i].active && eqstr(dyd->skimvar.arr[i].name, name))
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Activate pending declarations of scope 'level': those of a 'for' if
+** 'loop' is true, those of a 'local' statement otherwise.
+*/
+static void skimactivate (LexState *ls, int level, int loop) {
+  Dyndata *dyd = ls->dyd;
+  int i;
+  for (i = dyd->skimvar.n - 1; i >= 0 && dyd->skimvar.arr[i].level >= level;
+       i--) {
+    Skimvar *v = &dyd->skimvar.arr[i];
+    if (v->level == level && v->loop == loop)
+      v->active = 1;
+  }
+}
+
+
+/* close the current scope, dropping its declarations */
+static void skimclose (LexState *ls, SkimState *ss) {
+  Dyndata *dyd = ls->dyd;
+  ss->scope--;
+  while (dyd->skimvar.n > 0 &&
+         dyd->skimvar.arr[dyd->skimvar.n - 1].level > ss->scope)
+    dyd->skimvar.n--;
+}
+
+
+/*
+** Resolve name 'n', used by the body being skimmed, as 'singlevar' would.
+*/
+static void skimvar (LexState *ls, TString *n) {
+  FuncState *fs = ls->fs;
+  expdesc var;
+  singlevaraux(fs, n, &var, 1);
+  if (var.k == VVOID)  /* global name? */
+    singlevaraux(fs, ls->envn, &var, 1);  /* body uses the environment */
+  else if (var.k == VCONST) {  /* compile-time constant? */
+    Proto *f = fs->f;
+    int oldsize = f->sizek;
+    int i;
+    for (i = 0; i < fs->nk; i++) {
+      if (eqstr(f->locvars[i].varname, n))
+        return;  /* already kept */
+    }
+    luaM_growvector(ls->L, f->k, fs->nk, f->sizek, TValue, MAXARG_Ax,
+                    "constants");
+    while (oldsize < f->sizek)
+      setnilvalue(&f->k[oldsize++]);
+    setobj(ls->L, &f->k[fs->nk], &ls->dyd->actvar.arr[var.u.info].k);
+    luaC_barrier(ls->L, f, &f->k[fs->nk]);
+    fs->nk++;
+    registerlocalvar(ls, fs, n);
+  }
+}
+
+
+/*
+** Account for the current token of a skimmed body; 'prev' is the
+** previous token.
+*/
+static void skimtoken (LexState *ls, SkimState *ss, int prev) {
+  int t = ls->t.token;
+  if (ss->decl == SKIMLOCAL || ss->decl == SKIMFOR) {  /* name list? */
+    if (t == TK_NAME && (ss->expectname || ss->attrib)) {
+      if (!ss->attrib) {  /* not an attribute? */
+        int loop = (ss->decl == SKIMFOR);  /* in scope in the loop body */
+        skimdeclare(ls, ls->t.seminfo.ts, ss->scope + loop, 0);
+        ls->dyd->skimvar.arr[ls->dyd->skimvar.n - 1].loop = loop;
+      }
+      ss->expectname = 0;
+      return;
+    }
+    else if (t == ',' && !ss->expectname && !ss->attrib) {
+      ss->expectname = 1;
+      return;
+    }
+    else if (t == '<' && ss->decl == SKIMLOCAL && !ss->expectname &&
+             !ss->attrib) {
+      ss->attrib = 1;
+      return;
+    }
+    else if (t == '>' && ss->attrib) {
+      ss->attrib = 0;
+      return;
+    }
+    ss->decl = SKIMNONE;  /* end of the list */
+  }
+  switch (t) {
+    case TK_NAME: {
+      TString *n = ls->t.seminfo.ts;
+      if (ss->decl == SKIMPARAMS)
+        skimdeclare(ls, n, ss->scope, 1);
+      else if (ss->decl == SKIMLOCALFUNC) {  /* in scope in its body */
+        skimdeclare(ls, n, ss->scope - 1, 1);
+        ss->decl = SKIMFUNC;
+      }
+      else {
+        if (ss->decl == SKIMFUNC && prev == ':')
+          ss->method = 1;
+        if (prev != '.' && prev != ':' && prev != TK_GOTO &&
+            prev != TK_DBCOLON && !skimlocal(ls, n))
+          skimvar(ls, n);  /* a variable, unless a field or a label */
+      }
+      break;
+    }
+    case '(': {
+      if (ss->decl == SKIMFUNC) {  /* start of parameters? */
+        ss->decl = SKIMPARAMS;
+        if (ss->method)
+          skimdeclare(ls, luaX_newstring(ls, "self", 4), ss->scope, 1);
+        ss->method = 0;
+      }
+      break;
+    }
+    case ')': {
+      if (ss->decl == SKIMPARAMS)
+        ss->decl = SKIMNONE;
+      break;
+    }
+    case TK_FUNCTION: {
+      ss->decl = (prev == TK_LOCAL) ? SKIMLOCALFUNC : SKIMFUNC;
+      ss->method = 0;
+      ss->scope++;
+      break;
+    }
+    case TK_LOCAL: case TK_FOR: {
+      Dyndata *dyd = ls->dyd;
+      skimactivate(ls, ss->scope, 0);  /* previous statement is over */
+      while (dyd->skimvar.n > 0 &&  /* drop unfinished declarations */
+             !dyd->skimvar.arr[dyd->skimvar.n - 1].active)
+        dyd->skimvar.n--;
+      ss->decl = (t == TK_LOCAL) ? SKIMLOCAL : SKIMFOR;
+      ss->expectname = 1;
+      ss->attrib = 0;
+      break;
+    }
+    case TK_DO: {
+      skimactivate(ls, ss->scope, 0);  /* previous statement is over */
+      ss->scope++;
+      skimactivate(ls, ss->scope, 1);  /* variables of a 'for' */
+      break;
+    }
+    case TK_IF: case TK_WHILE: case TK_REPEAT: case TK_RETURN:
+    case TK_BREAK: case TK_GOTO: case TK_DBCOLON: case ';': {
+      skimactivate(ls, ss->scope, 0);  /* previous statement is over */
+      if (t == TK_REPEAT)
+        ss->scope++;
+      break;
+    }
+    case TK_THEN: {
+      ss->scope++;
+      break;
+    }
+    case TK_ELSE: {
+      skimclose(ls, ss);
+      ss->scope++;
+      break;
+    }
+    case TK_ELSEIF: case TK_UNTIL: case TK_END: {
+      skimclose(ls, ss);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Skim a function body ('(' parlist ')' block END), keeping its text
+** in the stub 'fs->f'. Only 'do', 'if', and 'function' open blocks
+** that END closes.
+*/
+static void skimbody (LexState *ls, FuncState *fs, int ismethod, int line) {
+  Proto *f = fs->f;
+  Mbuffer *b = &ls->dyd->body;
+  SkimState ss;
+  int depth = 1;  /* number of ENDs to come */
+  int prev = 0;  /* previous token */
+  int tline = line;  /* line where the text ends */
+  check(ls, '(');
+  luaZ_resetbuffer(b);
+  ls->dyd->skimvar.n = 0;
+  ss.scope = 1;
+  ss.decl = SKIMFUNC;
+  ss.expectname = ss.attrib = 0;
+  ss.method = ismethod;
+  f->numparams = cast_byte(ismethod);
+  for (;;) {
+    switch (ls->t.token) {
+      case TK_EOS: {
+        check_match(ls, TK_END, TK_FUNCTION, line);  /* raise the error */
+        break;
+      }
+      case TK_DO: case TK_IF: case TK_FUNCTION: {
+        depth++;
+        break;
+      }
+      case TK_END: {
+        depth--;
+        break;
+      }
+      default: break;
+    }
+    skimtoken(ls, &ss, prev);
+    luaX_savetoken(ls, b, &tline);
+    if (depth == 0)
+      break;
+    prev = ls->t.token;
+    luaX_next(ls);
+  }
+  lua_assert(ls->dyd->skimvar.n == 0);
+  f->lazy = luaS_newlstr(ls->L, luaZ_buffer(b), luaZ_bufflen(b));
+  luaC_objbarrier(ls->L, f, f->lazy);
+  f->lastlinedefined = ls->linenumber;
+  luaX_next(ls);  /* skip END */
+}
+
+
+static void closestub (LexState *ls) {
+  lua_State *L = ls->L;
+  FuncState *fs = ls->fs;
+  Proto *f = fs->f;
+  leaveblock(fs);
+  lua_assert(fs->bl == NULL && fs->pc == 0);
+  luaM_shrinkvector(L, f->k, f->sizek, fs->nk, TValue);
+  luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
+  luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  ls->fs = fs->prev;
+  luaC_checkGC(L);
+}
+
+/* }====================================================================== */
+
+
+/* compile the body of function 'ls->fs' (already open) */
+static void funcbody (LexState *ls, expdesc *e, int ismethod, int line) {
   /* body ->  '(' parlist ')' block END */
-  FuncState new_fs;
-  BlockCnt bl;
-  new_fs.f = addprototype(ls);
-  new_fs.f->linedefined = line;
-  open_func(ls, &new_fs, &bl);
+  Proto *f = ls->fs->f;
   checknext(ls, '(');
   if (ismethod) {
     new_localvarliteral(ls, "self");  /* create 'self' parameter */
@@ -1001,13 +1306,29 @@ static void body (LexState *ls, expdesc *e, int ismethod, int line) {
   parlist(ls);
   checknext(ls, ')');
   statlist(ls);
-  new_fs.f->lastlinedefined = ls->linenumber;
+  f->lastlinedefined = ls->linenumber;
   check_match(ls, TK_END, TK_FUNCTION, line);
   codeclosure(ls, e);
   close_func(ls);
 }
 
 
+static void body (LexState *ls, expdesc *e, int ismethod, int line) {
+  FuncState new_fs;
+  BlockCnt bl;
+  new_fs.f = addprototype(ls);
+  new_fs.f->linedefined = line;
+  open_func(ls, &new_fs, &bl);
+  if (G(ls->L)->lazyparse && new_fs.prev->prev != NULL) {  /* skim it? */
+    skimbody(ls, &new_fs, ismethod, line);
+    codeclosure(ls, e);
+    closestub(ls);
+  }
+  else
+    funcbody(ls, e, ismethod, line);
+}
+
+
 static int explist (LexState *ls, expdesc *v) {
   /* explist -> expr { ',' expr } */
   int n = 1;  /* at least one expression */
@@ -1964,3 +2285,87 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   return cl;  /* closure is on the stack, too */
 }
 
+
+typedef struct LoadBody {
+  const char *s;
+  size_t size;
+} LoadBody;
+
+
+static const char *getbody (lua_State *L, void *ud, size_t *size) {
+  LoadBody *lb = (LoadBody *)ud;
+  (void)L;  /* not used */
+  if (lb->size == 0) return NULL;
+  *size = lb->size;
+  lb->size = 0;
+  return lb->s;
+}
+
+
+/*
+** Compile the body kept by the stub 'f->p[i]' (see 'skimbody') and put
+** the new prototype in its place. The body is compiled inside a
+** placeholder for the enclosing function, which has the compile-time
+** constants kept by the stub (and keeps the stub alive, as its first
+** function). The upvalues of the stub go first into the new function,
+** so that the body finds them there, in the order used to make the
+** closure.
+*/
+Proto *luaY_lazyparser (lua_State *L, Mbuffer *buff, Dyndata *dyd,
+                        Proto *f, int i) {
+  Proto *stub = f->p[i];
+  LexState lexstate;
+  FuncState outer, new_fs;
+  BlockCnt outerbl, bl;
+  expdesc e;
+  LoadBody lb;
+  ZIO z;
+  int k;
+  LClosure *cl = luaF_newLclosure(L, 0);  /* closure for the placeholder */
+  setclLvalue2s(L, L->top, cl);  /* anchor it */
+  luaD_inctop(L);
+  lexstate.h = luaH_new(L);  /* create table for scanner */
+  sethvalue2s(L, L->top, lexstate.h);  /* anchor it */
+  luaD_inctop(L);
+  outer.f = cl->p = luaF_newproto(L);
+  luaC_objbarrier(L, cl, cl->p);
+  outer.f->p = luaM_newvector(L, 2, Proto *);
+  outer.f->sizep = 2;
+  outer.f->p[0] = stub;  /* anchor the stub */
+  outer.f->p[1] = NULL;
+  luaC_objbarrier(L, outer.f, stub);
+  lexstate.buff = buff;
+  lexstate.dyd = dyd;
+  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  lb.s = getstr(stub->lazy);
+  lb.size = tsslen(stub->lazy);
+  luaZ_init(L, &z, getbody, &lb);
+  luaX_setinput(L, &lexstate, &z, stub->source, zgetc(&z));
+  lexstate.linenumber = lexstate.lastline = stub->linedefined;
+  open_func(&lexstate, &outer, &outerbl);
+  outer.np = 1;  /* the stub */
+  for (k = 0; k < stub->sizek; k++) {  /* compile-time constants */
+    int vidx = new_localvar(&lexstate, stub->locvars[k].varname);
+    Vardesc *var = getlocalvardesc(&outer, vidx);
+    var->vd.kind = RDKCTC;
+    setobj(L, &var->k, &stub->k[k]);
+    outer.nactvar++;
+  }
+  luaX_next(&lexstate);  /* read first token */
+  new_fs.f = addprototype(&lexstate);
+  new_fs.f->linedefined = stub->linedefined;
+  open_func(&lexstate, &new_fs, &bl);
+  for (k = 0; k < stub->sizeupvalues; k++) {
+    Upvaldesc *up = allocupvalue(&new_fs);
+    *up = stub->upvalues[k];
+    luaC_objbarrier(L, new_fs.f, up->name);
+  }
+  funcbody(&lexstate, &e, stub->numparams, stub->linedefined);
+  check(&lexstate, TK_EOS);
+  if (l_unlikely(new_fs.f->sizeupvalues != stub->sizeupvalues))
+    luaX_syntaxerror(&lexstate, "function body does not match its closure");
+  f->p[i] = new_fs.f;
+  luaC_objbarrier(L, f, new_fs.f);
+  L->top -= 2;  /* remove closure and scanner's table */
+  return new_fs.f;
+}
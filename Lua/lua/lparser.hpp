@@ -123,6 +123,15 @@ typedef struct Labellist {
 } Labellist;
 
 
+/* name declared in a body being skimmed (lazy compilation) */
+typedef struct Skimvar {
+  TString *name;
+  int level;  /* scope level of the declaration */
+  int active;  /* false until the declaration is over */
+  int loop;  /* true for the variables of a 'for' */
+} Skimvar;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata {
   struct {  /* list of all active local variables */
@@ -132,6 +141,12 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* names declared in the body being skimmed */
+    Skimvar *arr;
+    int n;
+    int size;
+  } skimvar;
+  Mbuffer body;  /* source of the body being skimmed */
 } Dyndata;
 
 
@@ -165,6 +180,8 @@ typedef struct FuncState {
 LUAI_FUNC int luaY_nvarstack (FuncState *fs);
 LUAI_FUNC LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                                  Dyndata *dyd, const char *name, int firstchar);
+LUAI_FUNC Proto *luaY_lazyparser (lua_State *L, Mbuffer *buff, Dyndata *dyd,
+                                  Proto *f, int i);
 
 
 #endif
@@ -0,0 +1,1046 @@
+/*
+** $Id: lschedlib.c $
+** Scheduler of coroutines, with timers and wakeups from the host
+** See Copyright Notice in lua.h
+*/
+
+#define lschedlib_c
+#define LUA_LIB
+
+#include "lprefix.hpp"
+
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "lauxlib.hpp"
+#include "lualib.hpp"
+#include "lthread.hpp"
+
+
+/*
+** The library keeps a run queue of tasks (coroutines made by
+** 'sched.spawn') and resumes them from C, in batches: each iteration
+** of 'sched.run' takes the wakeups posted by the host, expires the
+** timers of the wheel and then resumes the tasks ready at that point.
+** When no task is ready, the loop sleeps until the next timer or, once
+** the host holds a 'luaL_Waker', blocks on an event (an eventfd watched
+** by epoll on Linux) until that timer or a wakeup posted by the host
+** from any OS thread. The waker and its event are made when the host
+** first asks for one, so a state that never does holds no OS handles.
+*/
+
+
+/* key, in the registry, for the scheduler of a state */
+#define SCHEDKEY	"_SCHED"
+
+/* number of slots (of one millisecond each) of the timer wheel */
+#if !defined(LUAI_SCHEDWHEEL)
+#define LUAI_SCHEDWHEEL		256
+#endif
+
+#define wheelslot(t)	((int)((t) & (LUAI_SCHEDWHEEL - 1)))
+
+/* longest delay, in milliseconds, of a timer (about 30 years) */
+#define MAXDELAY	1e12
+
+
+/*
+** {======================================================
+** Events and time
+** =======================================================
+*/
+
+#if defined(_WIN32)
+
+typedef HANDLE l_event;
+
+#define l_evopen(e)  \
+	((*(e) = CreateEventW(NULL, FALSE, FALSE, NULL)) != NULL)
+#define l_evclose(e)	CloseHandle(*(e))
+#define l_evsignal(e)	SetEvent(*(e))
+#define l_evwait(e,ms)  \
+	WaitForSingleObject(*(e), ((ms) < 0) ? INFINITE : (DWORD)(ms))
+
+#define l_sleepms(ms)	Sleep((DWORD)(ms))
+
+static lua_Integer l_nowms (void) {
+  return (lua_Integer)GetTickCount64();
+}
+
+#else
+
+#include <errno.h>
+#include <time.h>
+
+#if defined(LUA_USE_LINUX)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+typedef struct l_event {
+  int fd;  /* eventfd */
+  int epoll;  /* epoll instance watching 'fd' */
+} l_event;
+
+
+static void l_evclose (l_event *e) {
+  if (e->fd >= 0) close(e->fd);
+  if (e->epoll >= 0) close(e->epoll);
+}
+
+
+static int l_evopen (l_event *e) {
+  struct epoll_event ev;
+  e->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  e->epoll = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.fd = e->fd;
+  if (e->fd >= 0 && e->epoll >= 0 &&
+      epoll_ctl(e->epoll, EPOLL_CTL_ADD, e->fd, &ev) == 0)
+    return 1;
+  l_evclose(e);
+  return 0;
+}
+
+
+static void l_evsignal (l_event *e) {
+  unsigned long long one = 1;
+  ssize_t res = write(e->fd, &one, sizeof(one));
+  (void)res;  /* a full counter already wakes the loop */
+}
+
+
+static void l_evwait (l_event *e, long ms) {
+  struct epoll_event ev;
+  if (epoll_wait(e->epoll, &ev, 1, (int)ms) > 0) {
+    unsigned long long n;
+    ssize_t res = read(e->fd, &n, sizeof(n));  /* reset counter */
+    (void)res;
+  }
+}
+
+#else  /* other POSIX systems: a pipe to itself */
+
+#include <fcntl.h>
+#include <poll.h>
+
+typedef struct l_event {
+  int fd[2];  /* read and write ends of the pipe */
+} l_event;
+
+
+static void l_evclose (l_event *e) {
+  if (e->fd[0] >= 0) close(e->fd[0]);
+  if (e->fd[1] >= 0) close(e->fd[1]);
+}
+
+
+static int l_evopen (l_event *e) {
+  if (pipe(e->fd) == 0) {
+    if (fcntl(e->fd[0], F_SETFL, O_NONBLOCK) == 0 &&
+        fcntl(e->fd[1], F_SETFL, O_NONBLOCK) == 0)
+      return 1;
+    l_evclose(e);
+  }
+  return 0;
+}
+
+
+static void l_evsignal (l_event *e) {
+  char c = 0;
+  ssize_t res = write(e->fd[1], &c, 1);
+  (void)res;  /* a full pipe already wakes the loop */
+}
+
+
+static void l_evwait (l_event *e, long ms) {
+  struct pollfd p;
+  p.fd = e->fd[0];
+  p.events = POLLIN;
+  if (poll(&p, 1, (int)ms) > 0) {
+    char buff[64];
+    while (read(e->fd[0], buff, sizeof(buff)) > 0) { }  /* empty pipe */
+  }
+}
+
+#endif
+
+
+static void l_sleepms (long ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) { }
+}
+
+
+static lua_Integer l_nowms (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Integer)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Wakers: wakeups posted by the host
+** =======================================================
+*/
+
+typedef struct Wakeup {
+  lua_Integer id;  /* task to wake */
+  lua_Integer value;  /* value returned by its 'sched.wait' */
+} Wakeup;
+
+
+/*
+** Shared by the scheduler and the hosts holding it; the last one to
+** release it frees it, so a host may post wakeups (which are ignored)
+** after the state is closed.
+*/
+struct luaL_Waker {
+  l_mutex lock;  /* protects all fields but 'refs' */
+  l_atomic refs;
+  Wakeup *posted;  /* wakeups not yet taken by the scheduler */
+  size_t nposted;
+  size_t sizeposted;
+  int closed;  /* true if the scheduler is gone */
+  int blocked;  /* true if the scheduler waits for 'event' */
+  l_event event;
+};
+
+
+/* create a waker, or return NULL if there is no memory or no event */
+static luaL_Waker *newwaker (void) {
+  luaL_Waker *w = (luaL_Waker *)malloc(sizeof(luaL_Waker));
+  if (w == NULL || !l_evopen(&w->event)) {
+    free(w);
+    return NULL;
+  }
+  l_mutexinit(&w->lock);
+  w->refs = 1;
+  w->posted = NULL;
+  w->nposted = w->sizeposted = 0;
+  w->closed = w->blocked = 0;
+  return w;
+}
+
+
+/*
+** Release a reference to 'w'. A scheduler blocked with only waiting
+** tasks may be waiting for this host alone, so it is woken to check
+** again whether anything else can wake them.
+*/
+LUALIB_API void luaL_releasewaker (luaL_Waker *w) {
+  int last;
+  l_lockm(&w->lock);
+  last = (l_atomicadd(&w->refs, -1) == 1);
+  if (!last && w->blocked) {
+    w->blocked = 0;
+    l_evsignal(&w->event);
+  }
+  l_unlockm(&w->lock);
+  if (last) {  /* last reference? */
+    l_evclose(&w->event);
+    l_mutexfree(&w->lock);
+    free(w->posted);
+    free(w);
+  }
+}
+
+
+/*
+** Post a wakeup for the task 'id', making its 'sched.wait' return
+** 'value' (once it waits, if it is not waiting yet). The event is
+** signaled only when the scheduler is blocked, so a burst of wakeups
+** costs one system call. Returns false if the scheduler is gone or
+** there is no memory for the wakeup.
+*/
+LUALIB_API int luaL_wake (luaL_Waker *w, lua_Integer id,
+                          lua_Integer value) {
+  int res = 0;
+  l_lockm(&w->lock);
+  if (!w->closed) {
+    if (w->nposted == w->sizeposted) {  /* grow list */
+      size_t newsize = (w->sizeposted == 0) ? 16 : w->sizeposted * 2;
+      Wakeup *p = (Wakeup *)realloc(w->posted, newsize * sizeof(Wakeup));
+      if (p != NULL) {
+        w->posted = p;
+        w->sizeposted = newsize;
+      }
+    }
+    if (w->nposted < w->sizeposted) {
+      w->posted[w->nposted].id = id;
+      w->posted[w->nposted++].value = value;
+      if (w->blocked) {
+        w->blocked = 0;
+        l_evsignal(&w->event);
+      }
+      res = 1;
+    }
+  }
+  l_unlockm(&w->lock);
+  return res;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Tasks
+** =======================================================
+*/
+
+/* status of a task */
+#define TFREE		0	/* slot not in use */
+#define TREADY		1	/* in the run queue */
+#define TRUNNING	2
+#define TSLEEPING	3	/* in the timer wheel */
+#define TWAITING	4	/* waiting for 'sched.wake' (maybe in the wheel) */
+
+
+typedef struct Task {
+  lua_State *co;  /* its thread (anchored by the table of threads) */
+  lua_Integer wakeat;  /* time when a timer wakes it */
+  unsigned int gen;  /* generation of the slot, part of task ids */
+  int nargs;  /* number of values for its next resume */
+  int next;  /* next task in the run queue or in the free list */
+  int tnext, tprev;  /* neighbours in a list of the timer wheel */
+  int mhead, mtail;  /* its mailbox (wakeups posted before it waited) */
+  int status;
+  int timed;  /* true if in the timer wheel */
+} Task;
+
+
+/* a value posted by the host to a task not waiting for it yet */
+typedef struct Mail {
+  lua_Integer value;
+  int next;  /* next mail of the same task or in the free list */
+} Mail;
+
+
+/*
+** The scheduler of a state. (Its user value is the table of the
+** threads of the tasks, indexed by slot + 1.)
+*/
+typedef struct Sched {
+  Task *tasks;
+  int sizetasks;
+  int free;  /* first free slot, or -1 */
+  int head, tail;  /* run queue */
+  int nready;  /* number of tasks in the run queue */
+  int nlive;  /* number of tasks not finished */
+  int nwaiting;  /* number of tasks in 'sched.wait' */
+  int ntimers;  /* number of tasks in the timer wheel */
+  int current;  /* slot of running task, or -1 */
+  int stop;  /* true if 'sched.stop' was called */
+  lua_Integer tick;  /* time up to which the wheel was expired */
+  int wheel[LUAI_SCHEDWHEEL];  /* lists of tasks in the timer wheel */
+  Wakeup *taken;  /* wakeups taken from the waker */
+  size_t ntaken;  /* number of them not delivered (for lack of memory) */
+  size_t sizetaken;
+  Mail *mail;  /* nodes of the mailboxes */
+  int sizemail;
+  int freemail;  /* first free node, or -1 */
+  luaL_Waker *waker;  /* NULL until the host asks for one */
+} Sched;
+
+
+/*
+** Ids have the slot in their low 32 bits and its generation (never 0)
+** above, so no id is 0.
+*/
+#define taskid(S,i)  \
+	(((lua_Integer)(S)->tasks[i].gen << 32) | (lua_Integer)(i))
+
+
+static void initsched (Sched *S) {
+  int i;
+  S->tasks = NULL;
+  S->sizetasks = 0;
+  S->free = S->head = S->tail = -1;
+  S->nready = S->nlive = S->nwaiting = S->ntimers = 0;
+  S->current = -1;
+  S->stop = 0;
+  S->tick = l_nowms();
+  for (i = 0; i < LUAI_SCHEDWHEEL; i++)
+    S->wheel[i] = -1;
+  S->taken = NULL;
+  S->ntaken = S->sizetaken = 0;
+  S->mail = NULL;
+  S->sizemail = 0;
+  S->freemail = -1;
+  S->waker = NULL;
+}
+
+
+static Sched *tosched (lua_State *L) {
+  return (Sched *)lua_touserdata(L, lua_upvalueindex(1));
+}
+
+
+/* slot of task 'id', or -1 if it is finished or not a task id */
+static int findtask (Sched *S, lua_Integer id) {
+  lua_Integer i = id & 0xffffffff;
+  if (i < S->sizetasks && S->tasks[i].status != TFREE &&
+      taskid(S, (int)i) == id)
+    return (int)i;
+  return -1;
+}
+
+
+static void enqueue (Sched *S, int i) {
+  S->tasks[i].status = TREADY;
+  S->tasks[i].next = -1;
+  if (S->tail < 0)
+    S->head = i;
+  else
+    S->tasks[S->tail].next = i;
+  S->tail = i;
+  S->nready++;
+}
+
+
+static int dequeue (Sched *S) {
+  int i = S->head;
+  S->head = S->tasks[i].next;
+  if (S->head < 0)
+    S->tail = -1;
+  S->nready--;
+  return i;
+}
+
+
+static void addtimer (Sched *S, int i, lua_Integer at) {
+  Task *t = &S->tasks[i];
+  int *list;
+  if (at <= S->tick)  /* (the wheel was expired up to 'tick') */
+    at = S->tick + 1;
+  list = &S->wheel[wheelslot(at)];
+  t->wakeat = at;
+  t->timed = 1;
+  t->tprev = -1;
+  t->tnext = *list;
+  if (*list >= 0)
+    S->tasks[*list].tprev = i;
+  *list = i;
+  S->ntimers++;
+}
+
+
+static void deltimer (Sched *S, int i) {
+  Task *t = &S->tasks[i];
+  if (t->tprev >= 0)
+    S->tasks[t->tprev].tnext = t->tnext;
+  else
+    S->wheel[wheelslot(t->wakeat)] = t->tnext;
+  if (t->tnext >= 0)
+    S->tasks[t->tnext].tprev = t->tprev;
+  t->timed = 0;
+  S->ntimers--;
+}
+
+
+/* get a free slot, growing the array of tasks if needed */
+static int newslot (lua_State *L, Sched *S) {
+  int i;
+  if (S->free < 0) {
+    void *ud;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    int newsize = (S->sizetasks == 0) ? 16 : S->sizetasks * 2;
+    Task *t;
+    if (S->sizetasks >= INT_MAX / 2)
+      luaL_error(L, "too many tasks");
+    t = (Task *)f(ud, S->tasks, S->sizetasks * sizeof(Task),
+                  newsize * sizeof(Task));
+    if (t == NULL)
+      luaL_error(L, "not enough memory");
+    for (i = newsize - 1; i >= S->sizetasks; i--) {  /* link new slots */
+      t[i].status = TFREE;
+      t[i].gen = 1;  /* (ids are never 0) */
+      t[i].next = S->free;
+      S->free = i;
+    }
+    S->tasks = t;
+    S->sizetasks = newsize;
+  }
+  i = S->free;
+  S->free = S->tasks[i].next;
+  return i;
+}
+
+
+/*
+** Add 'value' to the mailbox of task 'i'. Returns false if there is no
+** memory for it.
+*/
+static int post (Sched *S, int i, lua_Integer value) {
+  Task *t = &S->tasks[i];
+  int m;
+  if (S->freemail < 0) {  /* grow array of nodes */
+    int newsize = (S->sizemail == 0) ? 16 : S->sizemail * 2;
+    Mail *p;
+    if (S->sizemail >= INT_MAX / 2 ||
+        (p = (Mail *)realloc(S->mail, newsize * sizeof(Mail))) == NULL)
+      return 0;
+    for (m = newsize - 1; m >= S->sizemail; m--) {  /* link new nodes */
+      p[m].next = S->freemail;
+      S->freemail = m;
+    }
+    S->mail = p;
+    S->sizemail = newsize;
+  }
+  m = S->freemail;
+  S->freemail = S->mail[m].next;
+  S->mail[m].value = value;
+  S->mail[m].next = -1;
+  if (t->mtail < 0)
+    t->mhead = m;
+  else
+    S->mail[t->mtail].next = m;
+  t->mtail = m;
+  return 1;
+}
+
+
+/* remove the first mail of task 'i' (which has some) */
+static lua_Integer takemail (Sched *S, int i) {
+  Task *t = &S->tasks[i];
+  int m = t->mhead;
+  t->mhead = S->mail[m].next;
+  if (t->mhead < 0)
+    t->mtail = -1;
+  S->mail[m].next = S->freemail;
+  S->freemail = m;
+  return S->mail[m].value;
+}
+
+
+/* free the slot of a finished task (table of threads at 'idx') */
+static void freetask (lua_State *L, Sched *S, int i, int idx) {
+  Task *t = &S->tasks[i];
+  while (t->mhead >= 0)  /* drop its mail */
+    takemail(S, i);
+  lua_pushnil(L);
+  lua_rawseti(L, idx, i + 1);
+  t->co = NULL;
+  t->status = TFREE;
+  if (++t->gen == 0)  /* its id is now stale */
+    t->gen = 1;
+  t->next = S->free;
+  S->free = i;
+  S->nlive--;
+}
+
+
+/*
+** Wake the waiting task 'i' with the value on the top of 'L' (popped)
+** or, if 'L' is NULL, with no value (a timeout).
+*/
+static void wakewaiting (lua_State *L, Sched *S, int i) {
+  Task *t = &S->tasks[i];
+  lua_assert(t->status == TWAITING);
+  if (t->timed)
+    deltimer(S, i);
+  if (L != NULL)
+    lua_xmove(L, t->co, 1);  /* value for 'sched.wait' to return */
+  else
+    lua_pushnil(t->co);
+  t->nargs = 1;
+  S->nwaiting--;
+  enqueue(S, i);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** The loop
+** =======================================================
+*/
+
+/*
+** Take the wakeups posted by the host since the last iteration (as
+** many as fit in the buffer, if it cannot grow) and deliver them: a
+** waiting task is woken and any other one gets the value in its
+** mailbox, so that no wakeup is lost. Wakeups for finished tasks are
+** dropped.
+*/
+static void takewakeups (lua_State *L, Sched *S) {
+  luaL_Waker *w = S->waker;
+  size_t n = S->ntaken;
+  size_t i;
+  if (w == NULL)  /* no host can post wakeups? */
+    return;
+  l_lockm(&w->lock);
+  if (w->nposted > 0) {
+    size_t k;
+    if (n + w->nposted > S->sizetaken) {  /* grow buffer */
+      size_t newsize = (n + w->nposted) * 2;
+      Wakeup *p = (Wakeup *)realloc(S->taken, newsize * sizeof(Wakeup));
+      if (p != NULL) {
+        S->taken = p;
+        S->sizetaken = newsize;
+      }
+    }
+    k = S->sizetaken - n;
+    if (k > w->nposted) k = w->nposted;
+    if (k > 0) {
+      memcpy(S->taken + n, w->posted, k * sizeof(Wakeup));
+      w->nposted -= k;
+      memmove(w->posted, w->posted + k, w->nposted * sizeof(Wakeup));
+      n += k;
+    }
+  }
+  l_unlockm(&w->lock);
+  for (i = 0; i < n; i++) {
+    Wakeup *p = &S->taken[i];
+    int t = findtask(S, p->id);
+    if (t < 0)
+      continue;  /* finished task */
+    if (S->tasks[t].status == TWAITING) {
+      lua_pushinteger(L, p->value);
+      wakewaiting(L, S, t);
+    }
+    else if (!post(S, t, p->value))
+      break;  /* keep the rest for the next iteration */
+  }
+  S->ntaken = n - i;
+  if (S->ntaken > 0)
+    memmove(S->taken, S->taken + i, S->ntaken * sizeof(Wakeup));
+}
+
+
+/* wake the tasks whose timers expired up to time 'now' */
+static void expire (Sched *S, lua_Integer now) {
+  lua_Integer t = S->tick;
+  lua_Integer last = (now - t > LUAI_SCHEDWHEEL) ? t + LUAI_SCHEDWHEEL : now;
+  for (t++; t <= last && S->ntimers > 0; t++) {
+    int i = S->wheel[wheelslot(t)];
+    while (i >= 0) {
+      int next = S->tasks[i].tnext;
+      if (S->tasks[i].wakeat <= now) {
+        if (S->tasks[i].status == TWAITING)
+          wakewaiting(NULL, S, i);  /* timeout */
+        else {  /* sleeping */
+          deltimer(S, i);
+          enqueue(S, i);
+        }
+      }
+      i = next;
+    }
+  }
+  S->tick = now;
+}
+
+
+/*
+** Milliseconds from time 'now' until the next timer (at most the size
+** of the wheel), or -1 if there are no timers.
+*/
+static long nexttimer (Sched *S, lua_Integer now) {
+  lua_Integer t;
+  if (S->ntimers == 0)
+    return -1;
+  for (t = S->tick + 1; t < S->tick + LUAI_SCHEDWHEEL; t++) {
+    int i;
+    for (i = S->wheel[wheelslot(t)]; i >= 0; i = S->tasks[i].tnext) {
+      if (S->tasks[i].wakeat <= t)
+        return (t > now) ? (long)(t - now) : 0;
+    }
+  }
+  return LUAI_SCHEDWHEEL;
+}
+
+
+/*
+** Block until time 'ms' passes, the host posts a wakeup or, if 'ms' is
+** negative, the last host releases the waker. (Without a waker, 'ms'
+** is not negative: 'sched_run' does not block forever.)
+*/
+static void block (Sched *S, long ms) {
+  luaL_Waker *w = S->waker;
+  if (w == NULL) {  /* nothing but a timer can wake the loop */
+    l_sleepms(ms);
+    return;
+  }
+  l_lockm(&w->lock);
+  if (w->nposted > 0 ||  /* already something to take? */
+      (ms < 0 && l_atomicload(&w->refs) == 1)) {  /* or no host left? */
+    l_unlockm(&w->lock);
+    return;
+  }
+  w->blocked = 1;
+  l_unlockm(&w->lock);
+  l_evwait(&w->event, ms);
+  l_lockm(&w->lock);
+  w->blocked = 0;
+  l_unlockm(&w->lock);
+}
+
+
+/*
+** Resume task 'i' (table of threads at index 1). A task that yields
+** without going through the library (e.g., 'coroutine.yield') goes back
+** to the run queue. An error in a task finishes it and is raised again
+** by 'sched.run'.
+*/
+static void resumetask (lua_State *L, Sched *S, int i) {
+  lua_State *co = S->tasks[i].co;
+  int status, nres;
+  S->tasks[i].status = TRUNNING;
+  S->current = i;
+  status = lua_resume(co, L, S->tasks[i].nargs, &nres);
+  S->current = -1;
+  if (status == LUA_YIELD) {
+    lua_pop(co, nres);  /* values yielded are ignored */
+    S->tasks[i].nargs = 0;
+    if (S->tasks[i].status == TRUNNING)  /* plain yield? */
+      enqueue(S, i);
+  }
+  else {
+    freetask(L, S, i, 1);
+    if (status != LUA_OK) {
+      lua_resetthread(co);  /* close its tbc variables */
+      lua_xmove(co, L, 1);  /* move error message */
+      lua_error(L);
+    }
+  }
+}
+
+
+/*
+** Run the tasks until none can run any more: no task is ready or
+** sleeping and, unless the host holds a waker, none is waiting. Each
+** iteration resumes only the tasks ready when it starts, so that tasks
+** yielding in a loop do not starve timers and wakeups. Returns the
+** number of tasks left (the waiting ones, unless stopped).
+*/
+static int sched_run (lua_State *L) {
+  Sched *S = tosched(L);
+  if (S->current >= 0)
+    return luaL_error(L, "cannot run the scheduler from one of its tasks");
+  lua_settop(L, 0);
+  lua_getiuservalue(L, lua_upvalueindex(1), 1);  /* threads at index 1 */
+  S->stop = 0;
+  while (!S->stop) {
+    int n;
+    takewakeups(L, S);
+    expire(S, l_nowms());
+    if (S->nready == 0) {  /* nothing to run now? */
+      long ms = nexttimer(S, l_nowms());
+      if (ms < 0 &&  /* no timers and... */
+          (S->nwaiting == 0 || S->waker == NULL ||
+           l_atomicload(&S->waker->refs) == 1))
+        break;  /* ...nothing can wake the waiting tasks */
+      block(S, ms);
+      continue;
+    }
+    for (n = S->nready; n > 0 && !S->stop; n--)
+      resumetask(L, S, dequeue(S));
+  }
+  lua_pushinteger(L, S->nlive);
+  return 1;
+}
+
+
+static int sched_stop (lua_State *L) {
+  tosched(L)->stop = 1;
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Functions for tasks
+** =======================================================
+*/
+
+/* slot of the running task, which must be 'L' */
+static int checktask (lua_State *L, Sched *S) {
+  if (S->current < 0 || S->tasks[S->current].co != L)
+    luaL_error(L, "not called from a task");
+  return S->current;
+}
+
+
+/* get the delay, in milliseconds, at argument 'arg' */
+static lua_Integer getdelay (lua_State *L, int arg) {
+  lua_Number ms = luaL_checknumber(L, arg);
+  luaL_argcheck(L, ms >= 0, arg, "negative time");
+  if (ms > MAXDELAY)
+    ms = MAXDELAY;
+  return (lua_Integer)l_mathop(ceil)(ms);
+}
+
+
+static int sched_spawn (lua_State *L) {
+  Sched *S = tosched(L);
+  int n = lua_gettop(L);
+  lua_State *co;
+  int i;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  co = lua_newthread(L);
+  i = newslot(L, S);
+  lua_rotate(L, 1, 1);  /* put thread below function and arguments */
+  lua_xmove(L, co, n);  /* move them to the new thread */
+  lua_getiuservalue(L, lua_upvalueindex(1), 1);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, i + 1);  /* anchor thread */
+  S->tasks[i].co = co;
+  S->tasks[i].nargs = n - 1;  /* arguments for the function */
+  S->tasks[i].mhead = S->tasks[i].mtail = -1;
+  S->tasks[i].timed = 0;
+  S->nlive++;
+  enqueue(S, i);
+  lua_pushinteger(L, taskid(S, i));
+  return 1;
+}
+
+
+static int sched_sleep (lua_State *L) {
+  Sched *S = tosched(L);
+  lua_Integer ms = getdelay(L, 1);
+  int i = checktask(L, S);
+  S->tasks[i].status = TSLEEPING;
+  addtimer(S, i, l_nowms() + ms);
+  return lua_yield(L, 0);
+}
+
+
+static int sched_wait (lua_State *L) {
+  Sched *S = tosched(L);
+  int i = checktask(L, S);
+  lua_Integer ms = luaL_opt(L, getdelay, 1, -1);
+  if (S->tasks[i].mhead >= 0) {  /* already woken by the host? */
+    lua_pushinteger(L, takemail(S, i));
+    return 1;
+  }
+  if (ms >= 0)  /* with a timeout? */
+    addtimer(S, i, l_nowms() + ms);
+  S->tasks[i].status = TWAITING;
+  S->nwaiting++;
+  return lua_yield(L, 0);
+}
+
+
+static int sched_yield (lua_State *L) {
+  checktask(L, tosched(L));
+  return lua_yield(L, 0);  /* goes back to the run queue */
+}
+
+
+static int sched_wake (lua_State *L) {
+  Sched *S = tosched(L);
+  int i = findtask(S, luaL_checkinteger(L, 1));
+  if (i < 0 || S->tasks[i].status != TWAITING)
+    lua_pushboolean(L, 0);
+  else {
+    if (lua_isnoneornil(L, 2))
+      lua_pushboolean(L, 1);  /* default value */
+    else
+      lua_pushvalue(L, 2);
+    wakewaiting(L, S, i);
+    lua_pushboolean(L, 1);
+  }
+  return 1;
+}
+
+
+static int sched_self (lua_State *L) {
+  Sched *S = tosched(L);
+  if (S->current >= 0 && S->tasks[S->current].co == L)
+    lua_pushinteger(L, taskid(S, S->current));
+  else
+    luaL_pushfail(L);
+  return 1;
+}
+
+
+static int sched_status (lua_State *L) {
+  static const char *const names[] =
+    {"dead", "ready", "running", "sleeping", "waiting"};
+  Sched *S = tosched(L);
+  int i = findtask(S, luaL_checkinteger(L, 1));
+  lua_pushstring(L, names[(i < 0) ? TFREE : S->tasks[i].status]);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Pending host calls
+** =======================================================
+*/
+
+/* get the scheduler of the state, if the library is open */
+static Sched *getstatesched (lua_State *L) {
+  Sched *S;
+  lua_getfield(L, LUA_REGISTRYINDEX, SCHEDKEY);
+  S = (Sched *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return S;
+}
+
+
+/* id of the task running in 'L', or 0 if 'L' is not running a task */
+LUALIB_API lua_Integer luaL_currenttask (lua_State *L) {
+  Sched *S = getstatesched(L);
+  if (S != NULL && S->current >= 0 && S->tasks[S->current].co == L)
+    return taskid(S, S->current);
+  return 0;
+}
+
+
+/*
+** A C function whose results are not ready (e.g., it started an
+** asynchronous operation of the host) returns 'luaL_pending(L, k, ctx)'
+** to suspend the coroutine running it. In a task, the task waits as in
+** 'sched.wait', so the host completes the call by waking it (usually
+** through 'luaL_wake' with the id from 'luaL_currenttask'); in any
+** other coroutine, the call completes when the coroutine is resumed.
+** Then the continuation 'k' runs with the values of the wakeup (or of
+** the resume) on the top of the stack and returns the results of the
+** call; if 'k' is NULL, those values are the results. As in
+** 'sched.wait', a task woken before the call completes it at once.
+*/
+LUALIB_API int luaL_pending (lua_State *L, lua_KFunction k,
+                             lua_KContext ctx) {
+  Sched *S = getstatesched(L);
+  if (S != NULL && S->current >= 0 && S->tasks[S->current].co == L &&
+      lua_isyieldable(L)) {  /* (else 'lua_yieldk' raises an error) */
+    int i = S->current;
+    if (S->tasks[i].mhead >= 0) {  /* already woken by the host? */
+      lua_pushinteger(L, takemail(S, i));
+      return (k == NULL) ? 1 : k(L, LUA_YIELD, ctx);
+    }
+    S->tasks[i].status = TWAITING;
+    S->nwaiting++;
+  }
+  return lua_yieldk(L, 0, ctx, k);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Library
+** =======================================================
+*/
+
+static int sched_gc (lua_State *L) {
+  Sched *S = (Sched *)lua_touserdata(L, 1);
+  luaL_Waker *w = S->waker;
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  f(ud, S->tasks, S->sizetasks * sizeof(Task), 0);
+  free(S->taken);
+  free(S->mail);
+  initsched(S);  /* (in case it is collected again) */
+  if (w != NULL) {
+    l_lockm(&w->lock);
+    w->closed = 1;  /* hosts cannot post any more */
+    l_unlockm(&w->lock);
+    luaL_releasewaker(w);
+  }
+  return 0;
+}
+
+
+/*
+** __clone tag method: the copy in a clone of a state shares the memory
+** of the template's scheduler, so it starts again with no tasks.
+*/
+static int sched_clone (lua_State *L) {
+  initsched((Sched *)lua_touserdata(L, 1));
+  lua_newtable(L);
+  lua_setiuservalue(L, 1, 1);  /* new table of threads */
+  return 0;
+}
+
+
+/*
+** Get a waker for the scheduler of 'L', to wake its tasks from any OS
+** thread; the host must release it with 'luaL_releasewaker'. The first
+** call creates the waker. Returns NULL if the library was not opened in
+** 'L' or the waker cannot be created.
+*/
+LUALIB_API luaL_Waker *luaL_getwaker (lua_State *L) {
+  Sched *S = getstatesched(L);
+  if (S == NULL)
+    return NULL;
+  if (S->waker == NULL && (S->waker = newwaker()) == NULL)
+    return NULL;
+  l_atomicadd(&S->waker->refs, 1);
+  return S->waker;
+}
+
+
+static const luaL_Reg sched_funcs[] = {
+  {"spawn", sched_spawn},
+  {"run", sched_run},
+  {"stop", sched_stop},
+  {"sleep", sched_sleep},
+  {"wait", sched_wait},
+  {"wake", sched_wake},
+  {"yield", sched_yield},
+  {"self", sched_self},
+  {"status", sched_status},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg sched_meta[] = {
+  {"__gc", sched_gc},
+  {"__clone", sched_clone},
+  {NULL, NULL}
+};
+
+
+/* get the scheduler of the state, creating it if needed */
+static void getsched (lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, SCHEDKEY) == LUA_TNIL) {
+    Sched *S;
+    lua_pop(L, 1);
+    S = (Sched *)lua_newuserdatauv(L, sizeof(Sched), 1);
+    initsched(S);
+    luaL_newlib(L, sched_meta);
+    lua_setmetatable(L, -2);
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);  /* table of threads */
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, SCHEDKEY);
+  }
+}
+
+
+LUAMOD_API int luaopen_sched (lua_State *L) {
+  luaL_newlibtable(L, sched_funcs);
+  getsched(L);
+  luaL_setfuncs(L, sched_funcs, 1);  /* scheduler as upvalue */
+  return 1;
+}
+
+/* }====================================================== */
@@ -0,0 +1,405 @@
+/*
+** $Id: lshare.c $
+** Code of functions shared by all states
+** See Copyright Notice in lua.h
+*/
+
+#define lshare_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.hpp"
+
+#include "lmem.hpp"
+#include "lobject.hpp"
+#include "lshare.hpp"
+#include "lstring.hpp"
+#include "lthread.hpp"
+
+
+#if defined(LUA_USE_POSIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/*
+** When a state shares code (see 'lua_sharecode'), the instructions and
+** line information of the functions it loads go to a process-wide store
+** of immutable blocks, indexed by their contents; functions loaded by
+** any state with the same contents point to the same block, which is
+** freed when its last function is. Constants, nested prototypes and
+** the other debug information refer to objects of each state, so they
+** stay with the state. (Instructions and line information are usually
+** most of the memory of a function.)
+**
+** The store belongs to no state, so its memory comes from 'malloc' and
+** is not counted as Lua memory.
+*/
+
+
+/*
+** A file of precompiled code loaded with 'lua_mapfile' (an "image")
+** lives in memory mapped from the file, so its pages are shared by all
+** processes loading it. Binary chunks in the aligned layout (see
+** 'lua_dumpx') loaded from an image do not copy their code and
+** line information: functions point into the image, which is unmapped
+** when no function uses it.
+*/
+typedef struct MImage {
+  struct MImage *next;
+  char *base;
+  size_t size;
+  int refs;  /* number of arrays using the image, plus one while open */
+  int mapped;  /* true if 'base' is mapped (otherwise it is from 'malloc') */
+} MImage;
+
+
+typedef struct SBlock {
+  struct SBlock *next;  /* next block in the same hash chain */
+  size_t size;  /* size of the contents */
+  unsigned int h;
+  int refs;  /* number of functions using the block */
+} SBlock;
+
+
+/* contents follow the header (which keeps them aligned for any array) */
+#define blockdata(b)	cast_voidp((b) + 1)
+#define datablock(p)	(cast(SBlock *, cast(char *, p) - sizeof(SBlock)))
+
+
+static struct SharedStore {
+  l_smutex lock;
+  SBlock **hash;
+  size_t sizehash;  /* size of 'hash' (a power of 2, or 0) */
+  size_t nblocks;
+  size_t bytes;  /* total size of the contents */
+  size_t refbytes;  /* total size of the contents times their 'refs' */
+  MImage *images;  /* list of images in use */
+} store = { L_SMUTEXINIT, NULL, 0, 0, 0, 0, NULL };
+
+
+#define hashslot(h,size)	((h) & ((size) - 1))
+
+
+static void growstore (void) {
+  size_t i;
+  size_t newsize = (store.sizehash == 0) ? 256 : store.sizehash * 2;
+  SBlock **nh = (SBlock **)calloc(newsize, sizeof(SBlock *));
+  if (nh == NULL)
+    return;  /* keep old (longer) chains */
+  for (i = 0; i < store.sizehash; i++) {
+    SBlock *b = store.hash[i];
+    while (b != NULL) {
+      SBlock *next = b->next;
+      size_t slot = hashslot(b->h, newsize);
+      b->next = nh[slot];
+      nh[slot] = b;
+      b = next;
+    }
+  }
+  free(store.hash);
+  store.hash = nh;
+  store.sizehash = newsize;
+}
+
+
+/*
+** Get a shared block with the contents 'p[0..size-1]', creating it if
+** needed. Returns NULL if there is no memory for it.
+*/
+static void *shareblock (const void *p, size_t size) {
+  unsigned int h = luaS_hash(cast_charp(p), size, 0);
+  SBlock *b;
+  l_locksm(&store.lock);
+  if (store.nblocks >= store.sizehash)
+    growstore();
+  if (store.sizehash == 0) {  /* no memory for the hash? */
+    l_unlocksm(&store.lock);
+    return NULL;
+  }
+  for (b = store.hash[hashslot(h, store.sizehash)]; b != NULL; b = b->next) {
+    if (b->h == h && b->size == size && memcmp(blockdata(b), p, size) == 0)
+      break;
+  }
+  if (b == NULL) {  /* not found? create a new block */
+    b = (SBlock *)malloc(sizeof(SBlock) + size);
+    if (b != NULL) {
+      memcpy(blockdata(b), p, size);
+      b->size = size;
+      b->h = h;
+      b->refs = 0;
+      b->next = store.hash[hashslot(h, store.sizehash)];
+      store.hash[hashslot(h, store.sizehash)] = b;
+      store.nblocks++;
+      store.bytes += size;
+    }
+  }
+  if (b != NULL) {
+    b->refs++;
+    store.refbytes += size;
+  }
+  l_unlocksm(&store.lock);
+  return (b != NULL) ? blockdata(b) : NULL;
+}
+
+
+/*
+** Add a function using the shared block 'p' (a function copied from
+** another one, see 'lclone.c').
+*/
+void luaF_shareref (const void *p) {
+  SBlock *b = datablock(p);
+  l_locksm(&store.lock);
+  b->refs++;
+  store.refbytes += b->size;
+  l_unlocksm(&store.lock);
+}
+
+
+void luaF_unshare (const void *p) {
+  SBlock *b = datablock(p);
+  l_locksm(&store.lock);
+  store.refbytes -= b->size;
+  if (--b->refs == 0) {  /* last function using it? */
+    SBlock **pb = &store.hash[hashslot(b->h, store.sizehash)];
+    while (*pb != b)
+      pb = &(*pb)->next;
+    *pb = b->next;
+    store.nblocks--;
+    store.bytes -= b->size;
+    free(b);
+  }
+  l_unlocksm(&store.lock);
+}
+
+
+/*
+** Move the arrays of 'f' (an array of 'n' elements of type 't') to the
+** shared store, releasing the state's copy. (Arrays in an image are
+** already shared.)
+*/
+#define sharearray(L,f,a,n,t,bit)  \
+  if (!((f)->shared & ((bit) | MAPPEDCODE | MAPPEDLINEINFO)) && (n) > 0) { \
+    t *sa = cast(t *, shareblock((f)->a, sizeof(t) * cast_sizet(n))); \
+    if (sa != NULL) { \
+      luaM_freearray(L, (f)->a, cast_sizet(n)); \
+      (f)->a = sa; \
+      (f)->shared |= (bit); \
+    } }
+
+
+/*
+** Share the code of function 'f' and of all functions nested in it.
+** Shared arrays are never changed again: the code of a function does
+** not change after it is compiled or loaded.
+*/
+void luaF_share (lua_State *L, Proto *f) {
+  int i;
+  sharearray(L, f, code, f->sizecode, Instruction, SHAREDCODE);
+  sharearray(L, f, lineinfo, f->sizelineinfo, ls_byte, SHAREDLINEINFO);
+  sharearray(L, f, abslineinfo, f->sizeabslineinfo, AbsLineInfo,
+             SHAREDABSLINE);
+  for (i = 0; i < f->sizep; i++)
+    luaF_share(L, f->p[i]);
+}
+
+
+/*
+** {======================================================
+** Images
+** =======================================================
+*/
+
+/* image holding address 'p' (called with the lock held) */
+static MImage *findimage (const void *p) {
+  const char *cp = cast_charp(p);
+  MImage *im;
+  for (im = store.images; im != NULL; im = im->next) {
+    if (cp == im->base || (cp > im->base && cp < im->base + im->size))
+      return im;
+  }
+  return NULL;
+}
+
+
+static void freeimage (MImage *im) {
+  MImage **p = &store.images;
+  while (*p != im)
+    p = &(*p)->next;
+  *p = im->next;
+  if (!im->mapped)
+    free(im->base);
+#if defined(LUA_USE_WINDOWS)
+  else
+    UnmapViewOfFile(im->base);
+#elif defined(LUA_USE_POSIX)
+  else
+    munmap(im->base, im->size);
+#endif
+  free(im);
+}
+
+
+/*
+** If 'p' is inside an image, add a user to that image and return 1;
+** otherwise, return 0.
+*/
+int luaF_mapref (const void *p) {
+  MImage *im;
+  l_locksm(&store.lock);
+  im = findimage(p);
+  if (im != NULL)
+    im->refs++;
+  l_unlocksm(&store.lock);
+  return (im != NULL);
+}
+
+
+void luaF_unmapref (const void *p) {
+  MImage *im;
+  l_locksm(&store.lock);
+  im = findimage(p);
+  lua_assert(im != NULL && im->refs > 0);
+  if (--im->refs == 0)
+    freeimage(im);
+  l_unlocksm(&store.lock);
+}
+
+
+/*
+** Map file 'filename' in memory as the contents of image 'im'. Returns
+** 0 if it cannot be mapped (e.g., it is not a regular file).
+*/
+static int mapimage (MImage *im, const char *filename) {
+#if defined(LUA_USE_WINDOWS)
+  LARGE_INTEGER size;
+  HANDLE fm;
+  HANDLE fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fh == INVALID_HANDLE_VALUE)
+    return 0;
+  if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0 ||
+      (unsigned long long)size.QuadPart > (size_t)~(size_t)0) {
+    CloseHandle(fh);
+    return 0;
+  }
+  fm = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(fh);  /* the mapping keeps the file open */
+  if (fm == NULL)
+    return 0;
+  im->base = (char *)MapViewOfFile(fm, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(fm);  /* the view keeps the mapping */
+  im->size = (size_t)size.QuadPart;
+  return (im->base != NULL);
+#elif defined(LUA_USE_POSIX)
+  struct stat st;
+  void *p;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  /* the mapping keeps the file open */
+  if (p == MAP_FAILED)
+    return 0;
+  im->base = (char *)p;
+  im->size = (size_t)st.st_size;
+  return 1;
+#else
+  (void)im; (void)filename;
+  return 0;
+#endif
+}
+
+
+/*
+** Read file 'filename' into memory, for files that cannot be mapped.
+** Returns 0 if it cannot be read.
+*/
+static int readimage (MImage *im, const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  size_t size = 0;
+  size_t n;
+  if (f == NULL)
+    return 0;
+  im->base = NULL;
+  do {  /* read the file in blocks of increasing size */
+    size_t newsize = (size == 0) ? 4096 : size * 2;
+    char *nb = (char *)realloc(im->base, newsize);
+    if (nb == NULL) {
+      free(im->base);
+      fclose(f);
+      return 0;
+    }
+    im->base = nb;
+    n = fread(im->base + size, 1, newsize - size, f);
+    size += n;
+    if (size < newsize) break;
+  } while (n > 0);
+  if (ferror(f)) {
+    free(im->base);
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  im->size = size;
+  return 1;
+}
+
+
+/*
+** Load file 'filename' as an image. Returns its contents and sets
+** '*size' to its size, or returns NULL if the file cannot be read. The
+** image stays in memory until released by 'lua_unmapfile' and by all
+** functions loaded from it.
+*/
+LUA_API const char *lua_mapfile (const char *filename, size_t *size) {
+  MImage *im = (MImage *)malloc(sizeof(MImage));
+  if (im == NULL)
+    return NULL;
+  im->mapped = mapimage(im, filename);
+  if (!im->mapped && !readimage(im, filename)) {
+    free(im);
+    return NULL;
+  }
+  im->refs = 1;
+  l_locksm(&store.lock);
+  im->next = store.images;
+  store.images = im;
+  l_unlocksm(&store.lock);
+  *size = im->size;
+  return im->base;
+}
+
+
+LUA_API void lua_unmapfile (const char *image) {
+  luaF_unmapref(image);
+}
+
+/* }====================================================== */
+
+
+LUA_API size_t lua_sharecodeinfo (int what) {
+  size_t res;
+  l_locksm(&store.lock);
+  switch (what) {
+    case LUA_SCBLOCKS: res = store.nblocks; break;
+    case LUA_SCBYTES: res = store.bytes; break;
+    case LUA_SCSAVED: res = store.refbytes - store.bytes; break;
+    default: res = 0;
+  }
+  l_unlocksm(&store.lock);
+  return res;
+}
+
@@ -0,0 +1,30 @@
+/*
+** $Id: lshare.h $
+** Code of functions shared by all states
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lshare_h
+#define lshare_h
+
+
+#include "lobject.hpp"
+
+
+/* bits in 'Proto.shared' (arrays owned by the shared store) */
+#define SHAREDCODE	1
+#define SHAREDLINEINFO	2
+#define SHAREDABSLINE	4
+
+/* bits in 'Proto.shared' (arrays pointing into an image) */
+#define MAPPEDCODE	8
+#define MAPPEDLINEINFO	16
+
+
+LUAI_FUNC void luaF_share (lua_State *L, Proto *f);
+LUAI_FUNC void luaF_shareref (const void *block);
+LUAI_FUNC void luaF_unshare (const void *block);
+LUAI_FUNC int luaF_mapref (const void *p);
+LUAI_FUNC void luaF_unmapref (const void *p);
+
+#endif
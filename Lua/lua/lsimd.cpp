@@ -0,0 +1,516 @@
+/*
+** $Id: lsimd.c $
+** Vectorized byte kernels for the string libraries and the lexer
+** See Copyright Notice in lua.h
+*/
+
+#define lsimd_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <ctype.h>
+#include <limits.h>
+#include <locale.h>
+#include <string.h>
+
+#include "lsimd.hpp"
+#include "lthread.hpp"
+
+
+/*
+** The vector kernels are plain x86 intrinsics. SSE2 is part of the
+** x86-64 baseline, so it is used unconditionally there; AVX2 is only
+** selected when the CPU (and the OS, through XSAVE) reports support
+** for it at run time. Any other target gets the scalar loops.
+*/
+#if !defined(LUASIMD_DISABLE) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define LUASIMD_HAS_SSE2	1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define l_targetavx2
+#else
+#define l_targetavx2	__attribute__((target("avx2")))
+#endif
+#else
+#define LUASIMD_HAS_SSE2	0
+#endif
+
+
+/*
+** Intrinsics cannot be compiled to MSIL; keep the kernels native when
+** the library is built with /clr.
+*/
+#if defined(_MANAGED)
+#pragma managed(push, off)
+#endif
+
+
+#define ascii_lower(c)	(((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+#define ascii_upper(c)	(((c) >= 'a' && (c) <= 'z') ? (c) - ('a' - 'A') : (c))
+
+
+static void lower_scalar (char *d, const char *s, size_t l) {
+  size_t i;
+  for (i = 0; i < l; i++) {
+    unsigned char c = (unsigned char)s[i];
+    d[i] = (char)ascii_lower(c);
+  }
+}
+
+
+static void upper_scalar (char *d, const char *s, size_t l) {
+  size_t i;
+  for (i = 0; i < l; i++) {
+    unsigned char c = (unsigned char)s[i];
+    d[i] = (char)ascii_upper(c);
+  }
+}
+
+
+static void reverse_scalar (char *d, const char *s, size_t l) {
+  size_t i;
+  for (i = 0; i < l; i++)
+    d[i] = s[l - i - 1];
+}
+
+
+static size_t asciispan_scalar (const char *s, size_t l) {
+  size_t i = 0;
+  while (i < l && (unsigned char)s[i] < 0x80)
+    i++;
+  return i;
+}
+
+
+#define ascii_name(c)  \
+  ((((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z') || \
+   ((c) >= '0' && (c) <= '9') || (c) == '_')
+
+#define ascii_blank(c)	((c) == ' ' || (c) == '\t' || (c) == '\v' || (c) == '\f')
+
+
+static size_t namespan_scalar (const char *s, size_t l) {
+  size_t i = 0;
+  while (i < l && ascii_name((unsigned char)s[i]))
+    i++;
+  return i;
+}
+
+
+static size_t blankspan_scalar (const char *s, size_t l) {
+  size_t i = 0;
+  while (i < l && ascii_blank(s[i]))
+    i++;
+  return i;
+}
+
+
+static size_t breakspan_scalar (const char *s, size_t l, const char *set) {
+  size_t i = 0;
+  while (i < l && s[i] != set[0] && s[i] != set[1] && s[i] != set[2] &&
+                  s[i] != set[3])
+    i++;
+  return i;
+}
+
+
+#if LUASIMD_HAS_SSE2	/* { */
+
+/*
+** Mask of the bytes of 'v' that lie in ['first', 'first' + 25]. The
+** bias moves that range to the bottom of the signed byte range, so a
+** single signed comparison selects it.
+*/
+#define rangemask16(v,first) \
+  _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - (first)))), \
+                 _mm_set1_epi8((char)(0x80 + 26)))
+
+#define rangemask32(v,first) \
+  _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 26)), \
+       _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - (first)))))
+
+
+static void lower_sse2 (char *d, const char *s, size_t l) {
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = rangemask16(v, 'A');
+    _mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(v, _mm_and_si128(m, bit)));
+  }
+  lower_scalar(d + i, s + i, l - i);
+}
+
+
+static void upper_sse2 (char *d, const char *s, size_t l) {
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = rangemask16(v, 'a');
+    _mm_storeu_si128((__m128i *)(d + i), _mm_xor_si128(v, _mm_and_si128(m, bit)));
+  }
+  upper_scalar(d + i, s + i, l - i);
+}
+
+
+/* reverse the 16 bytes of 'v' using only SSE2 shuffles */
+static __m128i reverse16 (__m128i v) {
+  v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));  /* dwords */
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));  /* words... */
+  v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));  /* bytes */
+}
+
+
+static void reverse_sse2 (char *d, const char *s, size_t l) {
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + l - i - 16));
+    _mm_storeu_si128((__m128i *)(d + i), reverse16(v));
+  }
+  reverse_scalar(d + i, s, l - i);
+}
+
+
+/* index of the lowest bit set in 'mask' (not 0) */
+static size_t firstbit (int mask) {
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, (unsigned long)mask);
+  return i;
+#else
+  return (size_t)__builtin_ctz((unsigned int)mask);
+#endif
+}
+
+
+/*
+** The lexer kernels work on 16 bytes at a time: the runs they measure
+** (names, indentation, the text of most strings) are short, so wider
+** vectors would seldom be filled.
+*/
+static size_t namespan_sse2 (const char *s, size_t l) {
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = _mm_or_si128(rangemask16(_mm_or_si128(v, bit), 'a'),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    __m128i d = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    int out = ~_mm_movemask_epi8(_mm_or_si128(m, d)) & 0xFFFF;
+    if (out != 0)
+      return i + firstbit(out);
+  }
+  return i + namespan_scalar(s + i, l - i);
+}
+
+
+static size_t blankspan_sse2 (const char *s, size_t l) {
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\v')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\f'))));
+    int out = ~_mm_movemask_epi8(m) & 0xFFFF;
+    if (out != 0)
+      return i + firstbit(out);
+  }
+  return i + blankspan_scalar(s + i, l - i);
+}
+
+
+static size_t breakspan_sse2 (const char *s, size_t l, const char *set) {
+  const __m128i c0 = _mm_set1_epi8(set[0]);
+  const __m128i c1 = _mm_set1_epi8(set[1]);
+  const __m128i c2 = _mm_set1_epi8(set[2]);
+  const __m128i c3 = _mm_set1_epi8(set[3]);
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, c1)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(v, c3)));
+    int in = _mm_movemask_epi8(m);
+    if (in != 0)
+      return i + firstbit(in);
+  }
+  return i + breakspan_scalar(s + i, l - i, set);
+}
+
+
+static size_t asciispan_sse2 (const char *s, size_t l) {
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    if (_mm_movemask_epi8(v) != 0)  /* some byte with its high bit set? */
+      break;
+  }
+  return i + asciispan_scalar(s + i, l - i);
+}
+
+
+l_targetavx2 static void lower_avx2 (char *d, const char *s, size_t l) {
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i m = rangemask32(v, 'A');
+    _mm256_storeu_si256((__m256i *)(d + i),
+                        _mm256_or_si256(v, _mm256_and_si256(m, bit)));
+  }
+  lower_sse2(d + i, s + i, l - i);
+}
+
+
+l_targetavx2 static void upper_avx2 (char *d, const char *s, size_t l) {
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i m = rangemask32(v, 'a');
+    _mm256_storeu_si256((__m256i *)(d + i),
+                        _mm256_xor_si256(v, _mm256_and_si256(m, bit)));
+  }
+  upper_sse2(d + i, s + i, l - i);
+}
+
+
+l_targetavx2 static void reverse_avx2 (char *d, const char *s, size_t l) {
+  const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                       7, 6, 5, 4, 3, 2, 1, 0,
+                                       15, 14, 13, 12, 11, 10, 9, 8,
+                                       7, 6, 5, 4, 3, 2, 1, 0);
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + l - i - 32));
+    v = _mm256_shuffle_epi8(v, rev);  /* reverse each 128-bit lane... */
+    v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));  /* ...swap */
+    _mm256_storeu_si256((__m256i *)(d + i), v);
+  }
+  reverse_sse2(d + i, s, l - i);
+}
+
+
+l_targetavx2 static size_t asciispan_avx2 (const char *s, size_t l) {
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    if (_mm256_movemask_epi8(v) != 0)
+      break;
+  }
+  return i + asciispan_sse2(s + i, l - i);
+}
+
+
+static int hasavx2 (void) {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return 0;
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return 0;  /* no OSXSAVE or no AVX */
+  if ((_xgetbv(0) & 0x6) != 0x6)
+    return 0;  /* OS does not preserve the YMM registers */
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif			/* } */
+
+
+/*
+** Detected instruction set level; -1 until the first query. It is
+** shared by all states and threads, so it is read and written
+** atomically; concurrent first calls all compute (and store) the same
+** value.
+*/
+static l_atomic simdlevel = -1;
+
+
+LUAI_FUNC int luaSIMD_level (void) {
+  long level = l_atomicload(&simdlevel);
+  if (l_unlikely(level < 0)) {
+#if LUASIMD_HAS_SSE2
+    level = hasavx2() ? LUASIMD_AVX2 : LUASIMD_SSE2;
+#else
+    level = LUASIMD_SCALAR;
+#endif
+    l_atomicstore(&simdlevel, level);
+  }
+  return (int)level;
+}
+
+
+/*
+** Current character-class table of the calling thread, where the C
+** library exposes it. It changes whenever the thread's LC_CTYPE does.
+*/
+#if !defined(l_ctypetable)
+#if defined(_WIN32)
+#define l_ctypetable()	((void *)__pctype_func())
+#elif defined(__GLIBC__)
+#define l_ctypetable()	((void *)*__ctype_b_loc())
+#endif
+#endif
+
+
+#if defined(l_ctypetable)
+
+/* class tables last found to have (or not have) the "C" case mapping */
+static l_atomicp ctable = NULL;
+static l_atomicp othertable = NULL;
+
+
+/* check whether 'tolower'/'toupper' change exactly the ASCII letters */
+static int iscmapping (void) {
+  int c;
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    if (tolower(c) != ascii_lower(c) || toupper(c) != ascii_upper(c))
+      return 0;
+  }
+  return 1;
+}
+
+#endif
+
+
+/*
+** The case kernels implement the "C" locale mapping (only ASCII letters
+** change). They are byte-identical to 'tolower'/'toupper' only under
+** such a mapping; callers must check this first. Querying the locale
+** name costs too much for short strings (the Windows CRT locks and
+** converts it), so where the class table is available the mapping is
+** checked once for each table and the answer is kept with it.
+** Elsewhere, LC_CTYPE must be "C" or "POSIX".
+*/
+LUAI_FUNC int luaSIMD_clocale (void) {
+#if defined(l_ctypetable)
+  void *t = l_ctypetable();
+  if (t == l_atomicloadp(&ctable))
+    return 1;
+  else if (t == l_atomicloadp(&othertable))
+    return 0;
+  else if (iscmapping()) {
+    l_atomicstorep(&ctable, t);
+    return 1;
+  }
+  else {
+    l_atomicstorep(&othertable, t);
+    return 0;
+  }
+#else
+  const char *loc = setlocale(LC_CTYPE, NULL);
+  return (loc != NULL && (strcmp(loc, "C") == 0 || strcmp(loc, "POSIX") == 0));
+#endif
+}
+
+
+LUAI_FUNC void luaSIMD_lower (char *d, const char *s, size_t l) {
+  switch (luaSIMD_level()) {
+#if LUASIMD_HAS_SSE2
+    case LUASIMD_AVX2: lower_avx2(d, s, l); break;
+    case LUASIMD_SSE2: lower_sse2(d, s, l); break;
+#endif
+    default: lower_scalar(d, s, l); break;
+  }
+}
+
+
+LUAI_FUNC void luaSIMD_upper (char *d, const char *s, size_t l) {
+  switch (luaSIMD_level()) {
+#if LUASIMD_HAS_SSE2
+    case LUASIMD_AVX2: upper_avx2(d, s, l); break;
+    case LUASIMD_SSE2: upper_sse2(d, s, l); break;
+#endif
+    default: upper_scalar(d, s, l); break;
+  }
+}
+
+
+LUAI_FUNC void luaSIMD_reverse (char *d, const char *s, size_t l) {
+  switch (luaSIMD_level()) {
+#if LUASIMD_HAS_SSE2
+    case LUASIMD_AVX2: reverse_avx2(d, s, l); break;
+    case LUASIMD_SSE2: reverse_sse2(d, s, l); break;
+#endif
+    default: reverse_scalar(d, s, l); break;
+  }
+}
+
+
+/*
+** Length of the longest prefix of 's' made only of ASCII bytes.
+*/
+LUAI_FUNC size_t luaSIMD_asciispan (const char *s, size_t l) {
+  switch (luaSIMD_level()) {
+#if LUASIMD_HAS_SSE2
+    case LUASIMD_AVX2: return asciispan_avx2(s, l);
+    case LUASIMD_SSE2: return asciispan_sse2(s, l);
+#endif
+    default: return asciispan_scalar(s, l);
+  }
+}
+
+
+/*
+** Length of the longest prefix of 's' made only of ASCII letters,
+** digits, and '_' (the characters of a name, except those a build with
+** 'LUA_UCID' adds).
+*/
+LUAI_FUNC size_t luaSIMD_namespan (const char *s, size_t l) {
+#if LUASIMD_HAS_SSE2
+  if (luaSIMD_level() >= LUASIMD_SSE2)
+    return namespan_sse2(s, l);
+#endif
+  return namespan_scalar(s, l);
+}
+
+
+/*
+** Length of the longest prefix of 's' made only of spaces, tabs,
+** vertical tabs, and form feeds (blanks that do not end a line).
+*/
+LUAI_FUNC size_t luaSIMD_blankspan (const char *s, size_t l) {
+#if LUASIMD_HAS_SSE2
+  if (luaSIMD_level() >= LUASIMD_SSE2)
+    return blankspan_sse2(s, l);
+#endif
+  return blankspan_scalar(s, l);
+}
+
+
+/*
+** Length of the longest prefix of 's' with none of the four bytes in
+** 'set' (repeated bytes make smaller sets).
+*/
+LUAI_FUNC size_t luaSIMD_breakspan (const char *s, size_t l,
+                                    const char *set) {
+#if LUASIMD_HAS_SSE2
+  if (luaSIMD_level() >= LUASIMD_SSE2)
+    return breakspan_sse2(s, l, set);
+#endif
+  return breakspan_scalar(s, l, set);
+}
+
+
+#if defined(_MANAGED)
+#pragma managed(pop)
+#endif
+
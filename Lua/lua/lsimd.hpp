@@ -0,0 +1,39 @@
+/*
+** $Id: lsimd.h $
+** Vectorized byte kernels for the string libraries and the lexer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lsimd_h
+#define lsimd_h
+
+#include <stddef.h>
+
+#include "luaconf.hpp"
+
+
+/*
+** Strings shorter than this are not worth dispatching to a vector
+** kernel; callers keep their original scalar loops for them.
+*/
+#define LUASIMD_MINLEN	32
+
+
+/* instruction set levels, as reported by 'luaSIMD_level' */
+#define LUASIMD_SCALAR	0
+#define LUASIMD_SSE2	1
+#define LUASIMD_AVX2	2
+
+
+LUAI_FUNC int luaSIMD_level (void);
+LUAI_FUNC int luaSIMD_clocale (void);
+LUAI_FUNC void luaSIMD_lower (char *d, const char *s, size_t l);
+LUAI_FUNC void luaSIMD_upper (char *d, const char *s, size_t l);
+LUAI_FUNC void luaSIMD_reverse (char *d, const char *s, size_t l);
+LUAI_FUNC size_t luaSIMD_asciispan (const char *s, size_t l);
+LUAI_FUNC size_t luaSIMD_namespan (const char *s, size_t l);
+LUAI_FUNC size_t luaSIMD_blankspan (const char *s, size_t l);
+LUAI_FUNC size_t luaSIMD_breakspan (const char *s, size_t l,
+                                    const char *set);
+
+#endif
@@ -20,8 +20,11 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcfree.hpp"
+#include "lgcpar.hpp"
 #include "llex.hpp"
 #include "lmem.hpp"
+#include "lmemprof.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
 #include "ltable.hpp"
@@ -106,6 +109,7 @@ CallInfo *luaE_extendCI (lua_State *L) {
   CallInfo *ci;
   lua_assert(L->ci->next == NULL);
   ci = luaM_new(L, CallInfo);
+  luaE_typebytes(G(L), LUA_TTHREAD, sizeof(CallInfo));
   lua_assert(L->ci->next == NULL);
   L->ci->next = ci;
   ci->previous = L->ci;
@@ -126,6 +130,7 @@ void luaE_freeCI (lua_State *L) {
   while ((ci = next) != NULL) {
     next = ci->next;
     luaM_free(L, ci);
+    luaE_typebytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(CallInfo)));
     L->nci--;
   }
 }
@@ -145,6 +150,7 @@ void luaE_shrinkCI (lua_State *L) {
     ci->next = next2;  /* remove next from the list */
     L->nci--;
     luaM_free(L, next);  /* free next */
+    luaE_typebytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(CallInfo)));
     if (next2 == NULL)
       break;  /* no more elements */
     else {
@@ -177,18 +183,20 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
+/*
+** Erase the stack of 'L1' and set its first 'ci' (keeping the rest of
+** its 'ci' list, if any).
+*/
+static void resetstack (lua_State *L1) {
   int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  int n = stacksize(L1) + EXTRA_STACK;
+  for (i = 0; i < n; i++)
+    setnilvalue(s2v(L1->stack + i));  /* erase stack */
   L1->tbclist = L1->stack;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-    setnilvalue(s2v(L1->stack + i));  /* erase new stack */
   L1->top = L1->stack;
-  L1->stack_last = L1->stack + BASIC_STACK_SIZE;
   /* initialize first ci */
   ci = &L1->base_ci;
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = CIST_C;
   ci->func = L1->top;
   ci->u.c.k = NULL;
@@ -200,12 +208,25 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L, int size) {
+  /* initialize stack array */
+  L1->stack = luaM_newvector(L, size + EXTRA_STACK, StackValue);
+  luaE_typebytes(G(L), LUA_TTHREAD,
+                 (size + EXTRA_STACK) * sizeof(StackValue));
+  L1->stack_last = L1->stack + size;
+  L1->base_ci.next = NULL;
+  resetstack(L1);
+}
+
+
 static void freestack (lua_State *L) {
   if (L->stack == NULL)
     return;  /* stack not completely built yet */
   L->ci = &L->base_ci;  /* free the entire 'ci' list */
   luaE_freeCI(L);
   lua_assert(L->nci == 0);
+  luaE_typebytes(G(L), LUA_TTHREAD,
+                 -cast(l_mem, (stacksize(L) + EXTRA_STACK) * sizeof(StackValue)));
   luaM_freearray(L, L->stack, stacksize(L) + EXTRA_STACK);  /* free stack */
 }
 
@@ -231,7 +252,7 @@ static void init_registry (lua_State *L, global_State *g) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_STACK_SIZE);  /* init stack */
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -268,6 +289,9 @@ static void preinit_thread (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaM_profstop(g);  /* no need to track objects being freed */
+  g->maxthreadpool = 0;  /* threads being freed are not kept */
+  luaE_trimthreadpool(L, 0);
   if (!completestate(g))  /* closing a partially built state? */
     luaC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -276,6 +300,8 @@ static void close_state (lua_State *L) {
     luaC_freeallobjects(L);  /* collect all objects */
     luai_userstateclose(L);
   }
+  luaC_bgfreestop(g);  /* wait for pending frees */
+  luaC_parmarkstop(g);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -283,19 +309,53 @@ static void close_state (lua_State *L) {
 }
 
 
+/*
+** Bytes of thread 'L1' counted in 'typebytes[LUA_TTHREAD]' (the thread
+** itself, its stack, and its 'ci' list). Threads in the pool are not
+** counted there.
+*/
+static l_mem threadbytes (lua_State *L1) {
+  return cast(l_mem, sizeof(LX) + L1->nci * sizeof(CallInfo) +
+                     (stacksize(L1) + EXTRA_STACK) * sizeof(StackValue));
+}
+
+
+/*
+** New threads reuse, when possible, dead threads kept by the collector
+** (see 'luaE_freethread'), with their stacks and 'ci' lists; this saves
+** all allocations of a thread.
+*/
 LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g;
   lua_State *L1;
+  StkId stack = NULL;
+  StkId stacklast = NULL;
+  CallInfo *cinext = NULL;
+  unsigned short nci = 0;
   lua_lock(L);
   g = G(L);
   luaC_checkGC(L);
-  /* create new thread */
-  L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  if (g->threadpool != NULL) {  /* is there a dead thread to reuse? */
+    L1 = g->threadpool;
+    g->threadpool = cast(lua_State *, L1->next);
+    g->nthreadpool--;
+    stack = L1->stack;  /* keep its stack and 'ci' list */
+    stacklast = L1->stack_last;
+    cinext = L1->base_ci.next;
+    nci = L1->nci;
+    luaE_typebytes(g, LUA_TTHREAD, threadbytes(L1));  /* live again */
+  }
+  else  /* create new thread */
+    L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
   L1->marked = luaC_white(g);
   L1->tt = LUA_VTHREAD;
   /* link it on list 'allgc' */
   L1->next = g->allgc;
   g->allgc = obj2gco(L1);
+  if (stack == NULL) {  /* new thread? */
+    luaE_typebytes(g, LUA_TTHREAD, sizeof(LX));
+    luaM_profcount(L, g, obj2gco(L1), LUA_VTHREAD, sizeof(LX));
+  }
   /* anchor it on L stack */
   setthvalue2s(L, L->top, L1);
   api_incr_top(L);
@@ -308,19 +368,62 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (stack == NULL)
+    stack_init(L1, L, g->threadstack);  /* init stack */
+  else {  /* reuse stack and 'ci' list */
+    L1->stack = stack;
+    L1->stack_last = stacklast;
+    L1->base_ci.next = cinext;
+    L1->nci = nci;
+    resetstack(L1);
+  }
   lua_unlock(L);
   return L1;
 }
 
 
+static void freethread (lua_State *L, lua_State *L1) {
+  freestack(L1);
+  luaM_free(L, fromstate(L1));
+  luaE_typebytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(LX)));
+}
+
+
+/*
+** Free a dead thread or, while the pool of the state is not full, keep
+** it there for reuse by 'lua_newthread'. Only threads whose stack has
+** the initial size are kept, and none during an emergency collection;
+** the values left in a kept stack are not traversed by the collector
+** and are erased when the thread is reused.
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
-  LX *l = fromstate(L1);
+  global_State *g = G(L);
   luaF_closeupval(L1, L1->stack);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
-  freestack(L1);
-  luaM_free(L, l);
+  if (g->nthreadpool < g->maxthreadpool && !g->gcemergency &&
+      L1->stack != NULL && stacksize(L1) == g->threadstack) {
+    L1->ci = &L1->base_ci;
+    luaE_typebytes(g, LUA_TTHREAD, -threadbytes(L1));  /* not live */
+    L1->next = cast(GCObject *, g->threadpool);
+    g->threadpool = L1;
+    g->nthreadpool++;
+  }
+  else
+    freethread(L, L1);
+}
+
+
+/* free the threads in the pool of the state beyond the first 'n' */
+void luaE_trimthreadpool (lua_State *L, int n) {
+  global_State *g = G(L);
+  while (g->nthreadpool > n) {
+    lua_State *L1 = g->threadpool;
+    g->threadpool = cast(lua_State *, L1->next);
+    g->nthreadpool--;
+    luaE_typebytes(g, LUA_TTHREAD, threadbytes(L1));  /* 'freethread' ... */
+    freethread(L, L1);  /* ...discounts it */
+  }
 }
 
 
@@ -372,6 +475,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->warnf = NULL;
   g->ud_warn = NULL;
   g->mainthread = L;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+  g->maxthreadpool = LUAI_THREADPOOL;
+  g->threadstack = BASIC_STACK_SIZE;
   g->seed = luai_makeseed(L);
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
@@ -382,6 +489,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcfinqueue = 0;
+  g->sharecode = 0;
+  g->lazyparse = 0;
+  g->gcnfin = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -392,12 +503,22 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
+  g->memlimit = 0;  /* no limit */
+  for (i = 0; i < LUA_TOTALTYPES; i++) g->typebytes[i] = 0;
+  g->profcount = MAX_LMEM;  /* heap profiler is off */
+  g->memprof = NULL;
+  g->bgfree = NULL;
+  g->parmark = NULL;
+  g->ephwatch = NULL;
+  luaC_statinit(g);
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
   g->gcstepsize = LUAI_GCSTEPSIZE;
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
+  g->gcadapt = 0;  /* adaptive mode selection is off by default */
+  luaC_adaptreset(g);
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -10,6 +10,7 @@
 #include "lua.hpp"
 
 #include "lobject.hpp"
+#include "lgcstat.hpp"
 #include "ltm.hpp"
 #include "lzio.hpp"
 
@@ -139,6 +140,15 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
+
+/*
+** Default maximum number of dead threads that each state keeps for
+** reuse by 'lua_newthread' (see 'lua_threadpool')
+*/
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		32
+#endif
+
 #define stacksize(th)	cast_int((th)->stack_last - (th)->stack)
 
 
@@ -252,6 +262,13 @@ typedef struct global_State {
   l_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
+  lu_mem memlimit;  /* hard limit for the memory in use (0 if none) */
+  l_mem typebytes[LUA_TOTALTYPES];  /* memory in use by each type */
+  l_mem profcount;  /* allocations until next heap-profiler sample */
+  struct MemProf *memprof;  /* heap profiler (NULL if off) */
+  struct BgFree *bgfree;  /* background freeing (NULL if off) */
+  struct ParMark *parmark;  /* parallel marker (NULL if marking is serial) */
+  struct EphWatch *ephwatch;  /* ephemeron worklist (see 'lgc.c') */
   lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
@@ -265,9 +282,19 @@ typedef struct global_State {
   lu_byte genmajormul;  /* control for major generational collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcfinqueue;  /* true if finalizers wait for 'lua_runfinalizers' */
+  lu_byte sharecode;  /* true if loaded code goes to the shared store */
+  lu_byte lazyparse;  /* true if bodies of nested functions compile lazily */
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+  lu_byte gcadapt;  /* adaptive mode: survival threshold (%), 0 if off */
+  lu_byte gcadsurv;  /* smoothed survival rate of minor collections (%) */
+  lu_byte gcadhist;  /* last generational steps, one bit each (1 = major) */
+  lu_byte gcadsteps;  /* generational steps since entering gen. mode */
+  lu_byte gcadwait;  /* incremental cycles before retrying gen. mode */
+  lu_byte gcadbackoff;  /* next value for 'gcadwait' */
+  lu_mem gcadbase;  /* bytes in use after last generational step */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -277,6 +304,7 @@ typedef struct global_State {
   GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
+  lu_mem gcnfin;  /* number of objects in 'tobefnz' */
   GCObject *fixedgc;  /* list of objects not to be collected */
   /* fields for generational collector */
   GCObject *survival;  /* start of objects that survived one GC cycle */
@@ -289,12 +317,17 @@ typedef struct global_State {
   struct lua_State *twups;  /* list of threads with open upvalues */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
+  struct lua_State *threadpool;  /* dead threads kept for reuse */
+  int nthreadpool;  /* number of threads in 'threadpool' */
+  int maxthreadpool;  /* maximum for 'nthreadpool' */
+  int threadstack;  /* initial stack size of new threads */
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  GCStats gcstats;  /* collector telemetry */
 } global_State;
 
 
@@ -388,8 +421,12 @@ union GCUnion {
 /* actual number of total bytes allocated */
 #define gettotalbytes(g)	cast(lu_mem, (g)->totalbytes + (g)->GCdebt)
 
+/* account 'n' bytes (maybe negative) to the type of objects with tag 't' */
+#define luaE_typebytes(g,t,n)	((g)->typebytes[novariant(t)] += (n))
+
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_trimthreadpool (lua_State *L, int n);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
@@ -24,6 +24,7 @@
 
 #include "lauxlib.hpp"
 #include "lualib.hpp"
+#include "lsimd.hpp"
 
 
 /*
@@ -114,8 +115,12 @@ static int str_reverse (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
-    p[i] = s[l - i - 1];
+  if (l >= LUASIMD_MINLEN)
+    luaSIMD_reverse(p, s, l);
+  else {
+    for (i = 0; i < l; i++)
+      p[i] = s[l - i - 1];
+  }
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -127,8 +132,12 @@ static int str_lower (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = tolower(uchar(s[i]));
+  if (l >= LUASIMD_MINLEN && luaSIMD_clocale())
+    luaSIMD_lower(p, s, l);
+  else {
+    for (i=0; i<l; i++)
+      p[i] = tolower(uchar(s[i]));
+  }
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -140,8 +149,12 @@ static int str_upper (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = toupper(uchar(s[i]));
+  if (l >= LUASIMD_MINLEN && luaSIMD_clocale())
+    luaSIMD_upper(p, s, l);
+  else {
+    for (i=0; i<l; i++)
+      p[i] = toupper(uchar(s[i]));
+  }
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -160,14 +173,30 @@ static int str_rep (lua_State *L) {
     size_t totallen = (size_t)n * l + (size_t)(n - 1) * lsep;
     luaL_Buffer b;
     char *p = luaL_buffinitsize(L, &b, totallen);
-    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-      memcpy(p, s, l * sizeof(char)); p += l;
-      if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-        memcpy(p, sep, lsep * sizeof(char));
-        p += lsep;
+    if (l + lsep < LUASIMD_MINLEN) {  /* short unit: copy it n times */
+      while (n-- > 1) {  /* first n-1 copies (followed by separator) */
+        memcpy(p, s, l * sizeof(char)); p += l;
+        if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
+          memcpy(p, sep, lsep * sizeof(char));
+          p += lsep;
+        }
+      }
+      memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
+    }
+    else {  /* write one unit, then keep doubling the filled prefix */
+      size_t done;
+      memcpy(p, s, l * sizeof(char));
+      done = l;
+      if (n > 1) {
+        memcpy(p + l, sep, lsep * sizeof(char));
+        done += lsep;
+      }
+      while (done < totallen) {
+        size_t chunk = (done <= totallen - done) ? done : totallen - done;
+        memcpy(p + done, p, chunk * sizeof(char));
+        done += chunk;
       }
     }
-    memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
     luaL_pushresultsize(&b, totallen);
   }
   return 1;
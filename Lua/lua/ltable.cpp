@@ -367,8 +367,11 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
 
 
 static void freehash (lua_State *L, Table *t) {
-  if (!isdummy(t))
+  if (!isdummy(t)) {
     luaM_freearray(L, t->node, cast_sizet(sizenode(t)));
+    luaE_typebytes(G(L), LUA_TTABLE,
+                   -cast(l_mem, sizenode(t) * sizeof(Node)));
+  }
 }
 
 
@@ -488,6 +491,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
     t->node = luaM_newvector(L, size, Node);
+    luaE_typebytes(G(L), LUA_TTABLE, size * sizeof(Node));
     for (i = 0; i < (int)size; i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -576,6 +580,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   /* allocation ok; initialize new part of the array */
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
+  luaE_typebytes(G(L), LUA_TTABLE,
+        (cast(l_mem, newasize) - oldasize) * cast(l_mem, sizeof(TValue)));
   t->alimit = newasize;
   for (i = oldasize; i < newasize; i++)  /* clear new slice of the array */
      setempty(&t->array[i]);
@@ -635,6 +641,8 @@ Table *luaH_new (lua_State *L) {
 
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
+  luaE_typebytes(G(L), LUA_TTABLE,
+                 -cast(l_mem, luaH_realasize(t) * sizeof(TValue)));
   luaM_freearray(L, t->array, luaH_realasize(t));
   luaM_free(L, t);
 }
@@ -0,0 +1,147 @@
+/*
+** $Id: lthread.h $
+** Native threads and atomics used by the core
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lthread_h
+#define lthread_h
+
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "llimits.hpp"
+
+
+/*
+** {==================================================================
+** Threads, mutexes and condition variables
+** ===================================================================
+*/
+
+#if defined(_WIN32)
+
+typedef CRITICAL_SECTION l_mutex;
+typedef CONDITION_VARIABLE l_cond;
+typedef HANDLE l_thread;
+
+#define l_mutexinit(m)	InitializeCriticalSection(m)
+#define l_mutexfree(m)	DeleteCriticalSection(m)
+#define l_lockm(m)	EnterCriticalSection(m)
+#define l_unlockm(m)	LeaveCriticalSection(m)
+#define l_condinit(c)	InitializeConditionVariable(c)
+#define l_condfree(c)	((void)0)
+#define l_condwait(c,m)	SleepConditionVariableCS(c, m, INFINITE)
+#define l_condsignal(c)	WakeConditionVariable(c)
+#define l_condbroadcast(c)	WakeAllConditionVariable(c)
+
+/* declare a thread entry point 'f' taking 'ud' */
+#define l_threadproc(f)		DWORD WINAPI f (LPVOID ud)
+#define l_threadret		0
+#define l_threadstart(t,f,ud)  \
+	((*(t) = CreateThread(NULL, 0, f, ud, 0, NULL)) != NULL)
+#define l_threadjoin(t)	(WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#define l_threadyield()	SwitchToThread()
+
+/* mutexes with static storage, usable without initialization */
+typedef SRWLOCK l_smutex;
+#define L_SMUTEXINIT	SRWLOCK_INIT
+#define l_locksm(m)	AcquireSRWLockExclusive(m)
+#define l_unlocksm(m)	ReleaseSRWLockExclusive(m)
+
+#else
+
+typedef pthread_mutex_t l_mutex;
+typedef pthread_cond_t l_cond;
+typedef pthread_t l_thread;
+
+#define l_mutexinit(m)	pthread_mutex_init(m, NULL)
+#define l_mutexfree(m)	pthread_mutex_destroy(m)
+#define l_lockm(m)	pthread_mutex_lock(m)
+#define l_unlockm(m)	pthread_mutex_unlock(m)
+#define l_condinit(c)	pthread_cond_init(c, NULL)
+#define l_condfree(c)	pthread_cond_destroy(c)
+#define l_condwait(c,m)	pthread_cond_wait(c, m)
+#define l_condsignal(c)	pthread_cond_signal(c)
+#define l_condbroadcast(c)	pthread_cond_broadcast(c)
+
+#define l_threadproc(f)		void *f (void *ud)
+#define l_threadret		NULL
+#define l_threadstart(t,f,ud)	(pthread_create(t, NULL, f, ud) == 0)
+#define l_threadjoin(t)	pthread_join(t, NULL)
+#define l_threadyield()	sched_yield()
+
+typedef pthread_mutex_t l_smutex;
+#define L_SMUTEXINIT	PTHREAD_MUTEX_INITIALIZER
+#define l_locksm(m)	pthread_mutex_lock(m)
+#define l_unlocksm(m)	pthread_mutex_unlock(m)
+
+#endif
+
+
+/* number of processors available */
+#if !defined(l_cpucount)
+#if defined(_WIN32)
+#define l_cpucount()	((int)GetActiveProcessorCount(ALL_PROCESSOR_GROUPS))
+#else
+#define l_cpucount()	((int)sysconf(_SC_NPROCESSORS_ONLN))
+#endif
+#endif
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Atomic operations
+** ('l_atomic' counters; 'l_atomicp' pointers; bytes through 'lu_byte *')
+** ===================================================================
+*/
+
+#if defined(_MSC_VER)
+
+typedef volatile long l_atomic;
+typedef void *volatile l_atomicp;
+
+#define l_atomicload(p)		(*(p))
+#define l_atomicstore(p,v)	(*(p) = (v))
+#define l_atomicadd(p,v)	_InterlockedExchangeAdd(p, v)
+#define l_atomiccas(p,o,n)	(_InterlockedCompareExchange(p, n, o) == (o))
+#define l_atomicloadp(p)	(*(p))
+#define l_atomicstorep(p,v)	(*(p) = (v))
+#define l_atomicload8(p)	(*(volatile lu_byte *)(p))
+#define l_atomiccas8(p,o,n)  \
+	(_InterlockedCompareExchange8((volatile char *)(p), (char)(n), (char)(o)) \
+	   == (char)(o))
+#define l_atomicor8(p,v)	_InterlockedOr8((volatile char *)(p), (char)(v))
+#define l_fullfence()		MemoryBarrier()
+
+#else
+
+typedef long l_atomic;
+typedef void *l_atomicp;
+
+#define l_atomicload(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define l_atomicstore(p,v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define l_atomicadd(p,v)	__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST)
+#define l_atomiccas(p,o,n)	__sync_bool_compare_and_swap(p, o, n)
+#define l_atomicloadp(p)	__atomic_load_n(p, __ATOMIC_RELAXED)
+#define l_atomicstorep(p,v)	__atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define l_atomicload8(p)	__atomic_load_n((lu_byte *)(p), __ATOMIC_RELAXED)
+#define l_atomiccas8(p,o,n)	__sync_bool_compare_and_swap((lu_byte *)(p), o, n)
+#define l_atomicor8(p,v)	__atomic_fetch_or((lu_byte *)(p), v, __ATOMIC_RELAXED)
+#define l_fullfence()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif
+
+/* }================================================================== */
+
+#endif
@@ -151,9 +151,12 @@ extern const char lua_ident[];
 ** state manipulation
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
+LUA_API lua_State *(lua_clonestate) (lua_State *from, lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 LUA_API int        (lua_resetthread) (lua_State *L);
+LUA_API int        (lua_threadpool) (lua_State *L, int n);
+LUA_API int        (lua_threadstack) (lua_State *L, int size);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -290,6 +293,12 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
+/* same, optionally in the layout usable in place from an image */
+LUA_API int (lua_dumpx) (lua_State *L, lua_Writer writer, void *data,
+                         int strip, int aligned);
+
+/* compile nested functions when first used ('lua_load' of text chunks) */
+LUA_API int (lua_lazyparse) (lua_State *L, int on);
 
 
 /*
@@ -327,8 +336,90 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCSTEPTIME		12
+#define LUA_GCADAPT		13
+#define LUA_GCMODE		14
+#define LUA_GCBGFREE		15
+#define LUA_GCPARMARK		16
+#define LUA_GCFINQUEUE		17
+#define LUA_GCFINPENDING	18
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
+LUA_API int (lua_gcsteptime) (lua_State *L, lua_Unsigned budget,
+                              lua_Unsigned *work);
+LUA_API int (lua_runfinalizers) (lua_State *L, int max, lua_Unsigned budget);
+
+
+/*
+** memory limit and usage by type
+*/
+
+LUA_API size_t (lua_setmemlimit) (lua_State *L, size_t limit);
+LUA_API size_t (lua_getmemlimit) (lua_State *L);
+LUA_API size_t (lua_memusage) (lua_State *L, int type);
+
+
+/*
+** heap profiler: values reported by 'lua_heapprofdump'
+*/
+#define LUA_HPINUSE		0	/* bytes of sampled objects still alive */
+#define LUA_HPINUSEOBJS		1	/* count of sampled objects still alive */
+#define LUA_HPALLOC		2	/* bytes allocated since start */
+#define LUA_HPALLOCOBJS		3	/* allocations since start */
+#define LUA_HPSURVIVED		4	/* bytes that survived a collection */
+
+LUA_API int (lua_heapprof) (lua_State *L, int period);
+LUA_API int (lua_heapprofdump) (lua_State *L, lua_Writer writer, void *data,
+                                int mode);
+
+
+/*
+** cache of compiled chunks: values reported by 'lua_chunkcacheinfo'
+*/
+#define LUA_CCBUDGET		0	/* memory budget of the process-wide cache */
+#define LUA_CCSIZE		1	/* bytes in the process-wide cache */
+#define LUA_CCCOUNT		2	/* chunks in the process-wide cache */
+#define LUA_CCHITS		3	/* loads served without compiling */
+#define LUA_CCMISSES		4	/* loads that compiled their chunk */
+
+LUA_API int (lua_loadcached) (lua_State *L, const char *buff, size_t sz,
+                              const char *chunkname);
+LUA_API int (lua_chunkcache) (size_t budget, const char *dir);
+LUA_API void (lua_chunkcacheclear) (void);
+LUA_API size_t (lua_chunkcacheinfo) (int what);
+
+
+/*
+** bundles of precompiled modules
+*/
+typedef struct lua_Source {
+  const char *name;  /* module name */
+  const char *buff;  /* source text */
+  size_t size;  /* size of 'buff' */
+  const char *chunkname;  /* name for messages (NULL: module name) */
+} lua_Source;
+
+LUA_API int (lua_compilebundle) (lua_State *L, const lua_Source *sources,
+                                 int n, int nthreads, int strip,
+                                 lua_Writer writer, void *data);
+LUA_API int (lua_loadbundle) (lua_State *L, const char *buff, size_t size);
+LUA_API const char *(lua_bundlecheck) (const char *buff, size_t size);
+LUA_API const char *(lua_bundlefind) (const char *buff, size_t size,
+                                      const char *name, size_t *len);
+
+
+/*
+** code shared among states: values reported by 'lua_sharecodeinfo'
+*/
+#define LUA_SCBLOCKS		0	/* blocks in the shared store */
+#define LUA_SCBYTES		1	/* bytes in the shared store */
+#define LUA_SCSAVED		2	/* bytes not duplicated thanks to sharing */
+
+LUA_API int (lua_sharecode) (lua_State *L, int on);
+LUA_API size_t (lua_sharecodeinfo) (int what);
+
+LUA_API const char *(lua_mapfile) (const char *filename, size_t *size);
+LUA_API void (lua_unmapfile) (const char *image);
 
 
 /*
@@ -417,6 +508,52 @@ LUA_API void (lua_closeslot) (lua_State *L, int idx);
 
 /* }============================================================== */
 
+/*
+** {======================================================================
+** GC telemetry
+** =======================================================================
+*/
+
+/* collector phases reported by 'lua_gcstats' */
+#define LUA_GCPHPROPAGATE	0
+#define LUA_GCPHATOMIC		1
+#define LUA_GCPHSWEEP		2
+#define LUA_GCPHFINALIZE	3
+
+#define LUA_GCPHASES		4
+
+
+typedef struct lua_GCStat {
+  lua_Unsigned seq;	/* sequence number of this record */
+  lua_Unsigned cycle;	/* collection cycle the record belongs to */
+  int phase;		/* one of LUA_GCPH* */
+  int minor;		/* part of a young (minor) collection? */
+  lua_Unsigned start;	/* monotonic start time, in nanoseconds */
+  lua_Unsigned duration;	/* in nanoseconds */
+  lua_Unsigned marked;	/* objects traversed by the marker */
+  lua_Unsigned swept;	/* objects visited by the sweeper */
+  lua_Unsigned finalized;	/* finalizers called */
+  lua_Unsigned freed;	/* bytes released */
+} lua_GCStat;
+
+
+typedef struct lua_GCPhaseTotal {
+  lua_Unsigned count;	/* number of records in this phase */
+  lua_Unsigned duration;	/* total time, in nanoseconds */
+  lua_Unsigned maxduration;	/* longest single record */
+  lua_Unsigned marked;
+  lua_Unsigned swept;
+  lua_Unsigned finalized;
+  lua_Unsigned freed;
+} lua_GCPhaseTotal;
+
+
+LUA_API int (lua_gcstats) (lua_State *L, lua_GCStat *recs, int n,
+                           lua_GCPhaseTotal *totals);
+
+/* }====================================================================== */
+
+
 /*
 ** {======================================================================
 ** Debug API
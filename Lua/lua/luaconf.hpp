@@ -753,12 +753,31 @@
 #define LUA_IDSIZE	60
 
 
+/*
+@@ LUAI_GCSTATSIZE is the number of collector telemetry records kept
+** by each state (see 'lua_gcstats').
+** CHANGE it if you need a longer (or shorter) history.
+*/
+#define LUAI_GCSTATSIZE		64
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
 #define LUAL_BUFFERSIZE   ((int)(16 * sizeof(void*) * sizeof(lua_Number)))
 
 
+/*
+@@ LUAL_POOLCLASSES is the number of size classes (of 16 bytes each)
+** served by the pool allocator (see 'luaL_newstatepool'); larger blocks
+** go to the system allocator.
+@@ LUAL_POOLPAGESIZE is the size of each page the pool allocator gets
+** from the system to carve blocks of one size class.
+*/
+#define LUAL_POOLCLASSES	16
+#define LUAL_POOLPAGESIZE	(16 * 1024)
+
+
 /*
 @@ LUAI_MAXALIGN defines fields that, when used in a union, ensure
 ** maximum alignment for the other items in that union.
@@ -44,6 +44,30 @@ LUAMOD_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUAMOD_API int (luaopen_package) (lua_State *L);
 
+/* process-wide cache of the path searches of 'package' */
+#define LUA_PATHCACHEOFF	0
+#define LUA_PATHCACHEON		1	/* keep results until cleared */
+#define LUA_PATHCACHEWATCH	2	/* also forget them when files change */
+
+LUALIB_API int (luaL_pathcache) (int mode);
+LUALIB_API void (luaL_pathcacheclear) (void);
+
+#define LUA_SCHEDLIBNAME	"sched"
+LUAMOD_API int (luaopen_sched) (lua_State *L);
+
+/* wakeups of the tasks of 'sched' from any OS thread */
+typedef struct luaL_Waker luaL_Waker;
+
+LUALIB_API luaL_Waker *(luaL_getwaker) (lua_State *L);
+LUALIB_API int (luaL_wake) (luaL_Waker *w, lua_Integer id,
+                            lua_Integer value);
+LUALIB_API void (luaL_releasewaker) (luaL_Waker *w);
+
+/* C functions completing after their coroutine is resumed */
+LUALIB_API lua_Integer (luaL_currenttask) (lua_State *L);
+LUALIB_API int (luaL_pending) (lua_State *L, lua_KFunction k,
+                               lua_KContext ctx);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -20,6 +20,7 @@
 #include "lfunc.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
+#include "lshare.hpp"
 #include "lstring.hpp"
 #include "lundump.hpp"
 #include "lzio.hpp"
@@ -34,6 +35,8 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  size_t offset;  /* bytes loaded so far */
+  int aligned;  /* true for the aligned layout (see 'LUAC_FORMATALIGNED') */
 } LoadState;
 
 
@@ -52,6 +55,7 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  S->offset += size;
 }
 
 
@@ -62,6 +66,7 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  S->offset++;
   return cast_byte(b);
 }
 
@@ -141,11 +146,56 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+/*
+** Try to use the next 'size' bytes of the input in place: they must be
+** already in the buffer of the stream, with alignment 'align', and the
+** buffer must be in an image (see 'lua_mapfile'), which gets one more
+** user. Returns NULL if the bytes must be copied.
+*/
+static const void *mapBlock (LoadState *S, size_t size, size_t align) {
+  ZIO *Z = S->Z;
+  const char *p = Z->p;
+  if (size == 0 || Z->n < size || (cast_sizet(p) & (align - 1)) != 0 ||
+      !luaF_mapref(p))
+    return NULL;
+  Z->p += size;
+  Z->n -= size;
+  S->offset += size;
+  return p;
+}
+
+
+/*
+** In the aligned layout, skip the padding before an array of
+** instructions.
+*/
+static void loadAlign (LoadState *S) {
+  if (S->aligned) {
+    size_t n = (0u - S->offset) % sizeof(Instruction);
+    while (n-- > 0) {
+      if (loadByte(S) != 0)
+        error(S, "bad padding");
+    }
+  }
+}
+
+
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
-  f->code = luaM_newvectorchecked(S->L, n, Instruction);
-  f->sizecode = n;
-  loadVector(S, f->code, n);
+  const void *p;
+  loadAlign(S);
+  p = (S->aligned) ? mapBlock(S, sizeof(Instruction) * cast_sizet(n),
+                              sizeof(Instruction)) : NULL;
+  if (p != NULL) {  /* use code in place? */
+    f->code = cast(Instruction *, p);
+    f->sizecode = n;
+    f->shared |= MAPPEDCODE;
+  }
+  else {
+    f->code = luaM_newvectorchecked(S->L, n, Instruction);
+    f->sizecode = n;
+    loadVector(S, f->code, n);
+  }
 }
 
 
@@ -226,10 +276,19 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
+  const void *p;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  p = (S->aligned) ? mapBlock(S, n, 1) : NULL;
+  if (p != NULL) {  /* use line information in place? */
+    f->lineinfo = cast(ls_byte *, p);
+    f->shared |= MAPPEDLINEINFO;
+    f->sizelineinfo = n;
+  }
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
@@ -292,8 +351,11 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != LUAC_VERSION)
     error(S, "version mismatch");
-  if (loadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch");
+  switch (loadByte(S)) {
+    case LUAC_FORMAT: S->aligned = 0; break;
+    case LUAC_FORMATALIGNED: S->aligned = 1; break;
+    default: error(S, "format mismatch");
+  }
   checkliteral(S, LUAC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, lua_Integer);
@@ -319,6 +381,7 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* 1st char already read */
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top, cl);
@@ -26,11 +26,18 @@
 
 #define LUAC_FORMAT	0	/* this is the official format */
 
+/*
+** Official format with each code array aligned (relative to the start of
+** the chunk) to the size of an instruction, with zeros before it; code
+** in this layout can be used in place (see 'lua_mapfile').
+*/
+#define LUAC_FORMATALIGNED	(LUAC_FORMAT + 1)
+
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
-                         void* data, int strip);
+                         void* data, int strip, int aligned);
 
 #endif
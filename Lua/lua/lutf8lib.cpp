@@ -19,6 +19,7 @@
 
 #include "lauxlib.hpp"
 #include "lualib.hpp"
+#include "lsimd.hpp"
 
 
 #define MAXUNICODE	0x10FFFFu
@@ -101,7 +102,15 @@ static int utflen (lua_State *L) {
   luaL_argcheck(L, --posj < (lua_Integer)len, 3,
                    "final position out of bounds");
   while (posi <= posj) {
-    const char *s1 = utf8_decode(s + posi, NULL, !lax);
+    const char *s1;
+    if (posj - posi >= LUASIMD_MINLEN) {  /* skip a run of ascii chars */
+      size_t span = luaSIMD_asciispan(s + posi, (size_t)(posj - posi) + 1);
+      posi += (lua_Integer)span;
+      n += (lua_Integer)span;
+      if (posi > posj)
+        break;
+    }
+    s1 = utf8_decode(s + posi, NULL, !lax);
     if (s1 == NULL) {  /* conversion error? */
       luaL_pushfail(L);  /* return fail ... */
       lua_pushinteger(L, posi + 1);  /* ... and current position */
@@ -1347,6 +1347,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
         pc++;  /* skip extra argument */
         L->top = ra + 1;  /* correct top in case of emergency GC */
+        savepc(L);  /* allocation may be sampled by the heap profiler */
         t = luaH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
         if (b != 0 || c != 0)
@@ -1811,6 +1812,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_CLOSURE) {
         Proto *p = cl->p->p[GETARG_Bx(i)];
+        if (l_unlikely(p->lazy != NULL)) {  /* body not compiled yet? */
+          Protect(p = luaD_lazyparse(L, cl->p, GETARG_Bx(i)));
+          updatestack(ci);  /* stack may have changed */
+        }
         halfProtect(pushclosure(L, p, cl->upvals, base, ra));
         checkGC(L, ra + 1);
         vmbreak;
@@ -0,0 +1,148 @@
+namespace LuaTest;
+
+using Lua;
+
+public class AllocatorTests {
+
+    [Test]
+    public void CanRunOnPoolAllocator() {
+
+        // Create pooled state
+        using var state = LuaState.NewState(LuaLib.All, LuaAllocator.Pool);
+
+        // Run something allocation heavy
+        Assert.That(state.DoString<double>(@"
+            local t = {}
+            for i = 1, 100000 do t[i % 100 + 1] = { i, tostring(i), x = i } end
+            local s = 0
+            for _, v in ipairs(t) do s = s + v[1] end
+            return s"), Is.EqualTo(Enumerable.Range(99901, 100).Sum()));
+
+        // Verify statistics
+        Assert.That(state.GetPoolStats(out var stats), Is.True);
+        Assert.Multiple(() => {
+            Assert.That(stats.Pages, Is.GreaterThan(0));
+            Assert.That(stats.UsedBytes, Is.GreaterThanOrEqualTo(stats.RequestedBytes));
+            Assert.That(stats.UsedBytes + stats.FreeBytes, Is.LessThanOrEqualTo(stats.PageBytes));
+            Assert.That(stats.InternalFragmentation, Is.InRange(0.0, 1.0));
+            Assert.That(stats.ExternalFragmentation, Is.InRange(0.0, 1.0));
+        });
+
+    }
+
+    [Test]
+    public void SystemAllocatorHasNoPoolStats() {
+
+        using var state = LuaState.NewState(LuaLib.All, LuaAllocator.System);
+        Assert.That(state.GetPoolStats(out _), Is.False);
+
+    }
+
+    [Test]
+    public void MemoryLimitRaisesMemoryError() {
+
+        // Create limited state
+        using var state = LuaState.NewState(LuaLib.All, LuaAllocator.System, 4 * 1024 * 1024);
+        Assert.That(state.MemoryLimit, Is.EqualTo(4 * 1024 * 1024));
+
+        Assert.Multiple(() => {
+
+            // Runaway allocation fails cleanly
+            Assert.That(state.DoString("local t = {} for i = 1, 1e8 do t[i] = { i } end"), Is.EqualTo(CallResult.MemoryError));
+            Assert.That(state.MemoryInUse, Is.LessThanOrEqualTo(state.MemoryLimit));
+
+            // State is still usable afterwards
+            Assert.That(state.DoString<double>("local t = {} for i = 1, 100 do t[i] = i end return #t"), Is.EqualTo(100));
+
+        });
+
+    }
+
+    [Test]
+    public void CanQueryMemoryUsageByType() {
+
+        using var state = LuaState.NewState();
+
+        // Allocate a big table and a big string
+        ulong tables = state.MemoryUsage(LuaType.Table);
+        ulong strings = state.MemoryUsage(LuaType.String);
+        Assert.That(state.DoString("big = {} for i = 1, 100000 do big[i] = i end str = ('x'):rep(1000000)"), Is.EqualTo(CallResult.Ok));
+
+        Assert.Multiple(() => {
+            Assert.That(state.MemoryUsage(LuaType.Table) - tables, Is.GreaterThanOrEqualTo(100000 * 16));
+            Assert.That(state.MemoryUsage(LuaType.String) - strings, Is.GreaterThanOrEqualTo(1000000));
+            Assert.That(state.MemoryUsage(LuaType.Thread), Is.GreaterThan(0));
+            Assert.That(state.MemoryUsage(LuaType.Number), Is.EqualTo(0));
+        });
+
+        // Release them
+        Assert.That(state.DoString("big, str = nil"), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+        Assert.That(state.MemoryUsage(LuaType.Table), Is.LessThan(tables + 100000));
+
+    }
+
+    [Test]
+    public void HeapProfilerAttributesAllocationsToLines() {
+
+        using var state = LuaState.NewState();
+
+        // Sample every allocation
+        Assert.That(state.DumpHeapProfile(HeapProfileMode.InUseObjects), Is.Null);
+        Assert.That(state.StartHeapProfiler(1), Is.EqualTo(0));
+        Assert.That(state.DoString("keep = {}\nfor i = 1, 1000 do\n  keep[i] = {}\nend\nfor i = 1, 1000 do local t = {} end"), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+
+        // Find the sites of both loops
+        string inUse = state.DumpHeapProfile(HeapProfileMode.InUseObjects);
+        string allocated = state.DumpHeapProfile(HeapProfileMode.AllocatedObjects);
+        Assert.Multiple(() => {
+            Assert.That(inUse, Does.Contain(":3;table 1000\n"));
+            Assert.That(inUse, Does.Not.Contain(":5;table"));
+            Assert.That(allocated, Does.Contain(":5;table 1000\n"));
+        });
+
+        // Line breaks and ';' in chunk names do not break the format
+        Assert.That(state.DoString("local n = 10; more = {}\r\nfor i = 1, n do\r\n  more[i] = {}\r\nend"), Is.EqualTo(CallResult.Ok));
+        inUse = state.DumpHeapProfile(HeapProfileMode.InUseObjects);
+        Assert.Multiple(() => {
+            Assert.That(inUse, Does.Contain("[string \"local n = 10  more = {} ...\"]:3;table 10\n"));
+            Assert.That(inUse, Does.Not.Contain("\r"));
+        });
+
+        // Stop
+        state.StopHeapProfiler();
+        Assert.That(state.DumpHeapProfile(HeapProfileMode.InUseObjects), Is.Null);
+
+    }
+
+    [Test]
+    public void CanShareCodeAmongStates() {
+
+        // Create states; two of them sharing code
+        const string module = "function f(a, b) local s = 0 for i = a, b do s = s + i * i end return s end";
+        using var plain = LuaState.NewState();
+        using var state1 = LuaState.NewState();
+        using var state2 = LuaState.NewState();
+        state1.ShareCode = true;
+        state2.ShareCode = true;
+        Assert.That(state1.ShareCode, Is.True);
+        ulong saved = LuaState.SharedCodeSavedBytes;
+
+        // Load the same module in all of them
+        foreach (var state in new[] { plain, state1, state2 }) {
+            Assert.That(state.DoString(module), Is.EqualTo(CallResult.Ok));
+            state.GC(GarbageCollectWhat.Collect);
+        }
+
+        // The second sharing state reused the code of the first
+        Assert.Multiple(() => {
+            Assert.That(LuaState.SharedCodeSavedBytes, Is.GreaterThan(saved));
+            Assert.That(LuaState.SharedCodeBytes, Is.GreaterThan(0));
+            Assert.That(state1.MemoryInUse, Is.LessThan(plain.MemoryInUse));
+            Assert.That(state2.DoString<double>("return f(1, 10)"), Is.EqualTo(385));
+        });
+
+    }
+
+}
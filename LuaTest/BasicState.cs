@@ -205,6 +205,112 @@ public class BasicState {
 
     }
 
+    private static MemoryStream CompressedScript(int entries) {
+        var source = new System.Text.StringBuilder("local data = {\n");
+        for (int i = 0; i < entries; i++) {
+            source.Append($"  {{ id = {i}, name = 'item{i}' }},\n");
+        }
+        source.Append("}\nreturn #data, data[#data].id\n");
+        var compressed = new MemoryStream();
+        using (var gzip = new System.IO.Compression.GZipStream(compressed, System.IO.Compression.CompressionMode.Compress, true)) {
+            gzip.Write(System.Text.Encoding.ASCII.GetBytes(source.ToString()));
+        }
+        compressed.Position = 0;
+        return compressed;
+    }
+
+    [Test]
+    public void CanLoadFromNonSeekableStream() {
+
+        // Create state
+        using var state = LuaState.NewState();
+
+        // A decompressing stream has no length and cannot seek
+        using var gzip = new System.IO.Compression.GZipStream(CompressedScript(100000), System.IO.Compression.CompressionMode.Decompress);
+        Assert.That(gzip.CanSeek, Is.False);
+
+        // Load (several MB, in pieces) and run it
+        Assert.That(state.LoadStream(gzip, "data"), Is.EqualTo(CallResult.Ok));
+        state.Call(0, 2);
+        Assert.Multiple(() => {
+            Assert.That(state.GetNumber(-2), Is.EqualTo(100000));
+            Assert.That(state.GetNumber(-1), Is.EqualTo(99999));
+        });
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkLoadLargeStream() {
+
+        using var state = LuaState.NewState();
+        var compressed = CompressedScript(200000);
+
+        for (int i = 0; i < 3; i++) {
+            compressed.Position = 0;
+            using var gzip = new System.IO.Compression.GZipStream(compressed, System.IO.Compression.CompressionMode.Decompress, true);
+            long before = GC.GetTotalAllocatedBytes(true);
+            var watch = System.Diagnostics.Stopwatch.StartNew();
+            Assert.That(state.LoadStream(gzip, "data"), Is.EqualTo(CallResult.Ok));
+            watch.Stop();
+            TestContext.WriteLine($"Load: {watch.Elapsed.TotalMilliseconds:F1} ms, managed allocations: {(GC.GetTotalAllocatedBytes(true) - before) / 1024} KB");
+            state.Pop(1);
+        }
+
+    }
+
+    private static string TokenScript(int entries) {
+        var source = new System.Text.StringBuilder("local t, n = {}, 0\r\n");
+        for (int i = 0; i < entries; i++) {
+            source.Append($"t[{i}] = {{ name_{i % 7} = \"s{i}\", 'q\\t{i}', [[long\n{i}]], 0x{i:X}, {i}.5e-1 }} -- entry {i}\r\n");
+            source.Append($"\t  n = n + #t[{i}][1] + #t[{i}][2] + t[{i}][3] + t[{i}][4] --[==[ ]] {i} ]==]\n");
+        }
+        source.Append("return n, #t");
+        return source.ToString();
+    }
+
+    [Test]
+    public void CanLexTheSameFromBufferAndStream() {
+
+        // Whole buffer (tokens scanned in place) vs stream read in pieces
+        string script = TokenScript(5000);
+        using var state1 = LuaState.NewState();
+        using var state2 = LuaState.NewState();
+        Assert.That(state1.LoadString(script), Is.EqualTo(CallResult.Ok));
+        Assert.That(state2.LoadStream(new MemoryStream(System.Text.Encoding.ASCII.GetBytes(script)), "tokens"), Is.EqualTo(CallResult.Ok));
+        state1.Call(0, 2);
+        state2.Call(0, 2);
+        Assert.Multiple(() => {
+            Assert.That(state1.GetNumber(-1), Is.EqualTo(4999));
+            Assert.That(state1.GetNumber(-2), Is.EqualTo(state2.GetNumber(-2)));
+        });
+
+        // Same error messages, with the same lines
+        string bad = script.Replace("t[4321] = {", "t[4321] = { 12x,");
+        Assert.That(state1.LoadString(bad), Is.EqualTo(CallResult.SyntaxError));
+        Assert.That(state2.LoadStream(new MemoryStream(System.Text.Encoding.ASCII.GetBytes(bad)), "tokens"), Is.EqualTo(CallResult.SyntaxError));
+        string msg1 = state1.GetString(-1), msg2 = state2.GetString(-1);
+        Assert.That(msg1[msg1.IndexOf("]:")..], Is.EqualTo(msg2[msg2.IndexOf("]:")..]));
+        Assert.That(msg1, Does.EndWith(":12965: malformed number near '12x'"));
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkLexDataTable() {
+
+        using var state = LuaState.NewState();
+        string script = TokenScript(100000);
+        byte[] bytes = System.Text.Encoding.ASCII.GetBytes(script);
+
+        for (int i = 0; i < 3; i++) {
+            var watch = System.Diagnostics.Stopwatch.StartNew();
+            Assert.That(state.Load(bytes, "tokens"), Is.EqualTo(CallResult.Ok));
+            watch.Stop();
+            TestContext.WriteLine($"{bytes.Length / 1024} KB: {watch.Elapsed.TotalMilliseconds:F1} ms, {bytes.Length / watch.Elapsed.TotalSeconds / (1 << 20):F1} MB/s");
+            state.Pop(1);
+        }
+
+    }
+
     [Test]
     public void CanTransferFunction() {
 
@@ -277,4 +383,490 @@ public class BasicState {
 
     }
 
+    private static string LargeFunction(int entries) {
+        var source = new System.Text.StringBuilder("local t = {}\n");
+        for (int i = 0; i < entries; i++) {
+            source.Append($"t[{i + 1}] = function(x) return x * {i} + {i * 0.5} end\n");
+        }
+        source.Append("return #t, t[#t](2)\n");
+        return source.ToString();
+    }
+
+    [Test]
+    public void CanRoundTripLargeFunction() {
+
+        using var state1 = LuaState.NewState();
+        using var state2 = LuaState.NewState();
+
+        // Dump a function much larger than the initial dump buffer
+        Assert.That(state1.LoadString(LargeFunction(5000)), Is.EqualTo(CallResult.Ok));
+        Assert.That(state1.Dump(out byte[] luacode), Is.EqualTo(CallResult.Ok));
+        Assert.That(luacode, Has.Length.GreaterThan(1 << 16));
+
+        // Load it elsewhere and dump it again: same bytes
+        Assert.That(state2.Load(luacode, "large"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state2.Dump(out byte[] again), Is.EqualTo(CallResult.Ok));
+        Assert.That(again, Is.EqualTo(luacode));
+
+        // And it runs
+        state2.Call(0, 2);
+        Assert.Multiple(() => {
+            Assert.That(state2.GetNumber(-2), Is.EqualTo(5000));
+            Assert.That(state2.GetNumber(-1), Is.EqualTo(4999 * 2 + 4999 * 0.5));
+        });
+
+        // An empty buffer is an empty chunk
+        Assert.That(state2.Load(Array.Empty<byte>(), "empty"), Is.EqualTo(CallResult.Ok));
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkDumpLoadLargeFunction() {
+
+        using var state = LuaState.NewState();
+        Assert.That(state.LoadString(LargeFunction(50000)), Is.EqualTo(CallResult.Ok));
+
+        for (int i = 0; i < 3; i++) {
+            var watch = System.Diagnostics.Stopwatch.StartNew();
+            Assert.That(state.Dump(out byte[] luacode), Is.EqualTo(CallResult.Ok));
+            double dump = watch.Elapsed.TotalMilliseconds;
+            watch.Restart();
+            Assert.That(state.Load(luacode, "large"), Is.EqualTo(CallResult.Ok));
+            double load = watch.Elapsed.TotalMilliseconds;
+            TestContext.WriteLine($"{luacode.Length / 1024} KB: dump {dump:F1} ms, load {load:F1} ms");
+            state.Pop(1);
+        }
+
+    }
+
+    [Test]
+    public void CanLoadMappedChunk() {
+
+        using var state1 = LuaState.NewState();
+        using var state2 = LuaState.NewState();
+        string path = Path.Combine(Path.GetTempPath(), $"mapped{Environment.ProcessId}.luac");
+
+        // Dump a function in the aligned layout
+        Assert.That(state1.LoadString("local a, b = ... return a * b + 1"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state1.Dump(out byte[] luacode, true, true), Is.EqualTo(CallResult.Ok));
+        File.WriteAllBytes(path, luacode);
+
+        try {
+
+            // Load it in place, and through the regular loader
+            Assert.That(state2.LoadMapped(path), Is.EqualTo(CallResult.Ok));
+            state2.SetGlobal("mapped");
+            Assert.That(state2.Load(luacode, "copied"), Is.EqualTo(CallResult.Ok));
+            state2.SetGlobal("copied");
+            Assert.Multiple(() => {
+                Assert.That(state2.DoString<double>("return mapped(3, 4)"), Is.EqualTo(13));
+                Assert.That(state2.DoString<double>("return copied(3, 4)"), Is.EqualTo(13));
+            });
+
+        } finally {
+            state2.DoString("mapped = nil collectgarbage()");
+            File.Delete(path);
+        }
+
+        // Missing files are reported
+        Assert.That(state2.LoadMapped(path), Is.EqualTo(CallResult.FileError));
+
+    }
+
+    [Test]
+    public void CanCacheCompiledChunks() {
+
+        // Enable the process-wide cache
+        LuaState.ConfigureChunkCache(1 << 20);
+        try {
+
+            using var state1 = LuaState.NewState();
+            using var state2 = LuaState.NewState();
+            var before = LuaState.ChunkCacheStats;
+
+            // First load compiles, the rest are served by the cache
+            for (int i = 1; i <= 10; i++) {
+                Assert.That(state1.DoString<double>("local n = 0 n = n + 1 count = (count or 0) + n return count"), Is.EqualTo(i));
+            }
+            Assert.That(state2.DoString<double>("local n = 0 n = n + 1 count = (count or 0) + n return count"), Is.EqualTo(1));
+            var after = LuaState.ChunkCacheStats;
+            Assert.Multiple(() => {
+                Assert.That(after.Misses - before.Misses, Is.EqualTo(1));
+                Assert.That(after.Hits - before.Hits, Is.EqualTo(10));
+                Assert.That(after.Size, Is.GreaterThan(0));
+                Assert.That(after.Budget, Is.EqualTo(1 << 20));
+            });
+
+            // Syntax errors are reported every time
+            Assert.That(state1.LoadString("return +"), Is.EqualTo(CallResult.SyntaxError));
+            state1.Pop(1);
+            Assert.That(state1.LoadString("return +"), Is.EqualTo(CallResult.SyntaxError));
+            state1.Pop(1);
+
+            // Dropping the cache does not affect results
+            LuaState.ClearChunkCache();
+            Assert.That(LuaState.ChunkCacheStats.Count, Is.EqualTo(0));
+            Assert.That(state2.DoString<double>("local n = 0 n = n + 1 count = (count or 0) + n return count"), Is.EqualTo(2));
+
+        } finally {
+            LuaState.ConfigureChunkCache(0);
+        }
+
+        Assert.That(LuaState.ChunkCacheStats.Budget, Is.EqualTo(0));
+
+    }
+
+    [Test]
+    public void CanCloneState() {
+
+        // Prepare a template
+        using var template = LuaState.NewState();
+        template.DoString(@"
+            local count = 0
+            function counter() count = count + 1 return count end
+            config = { name = 'template', list = { 1, 2, 3 } }
+            config.self = config
+            counter()");
+
+        // Clones start from the template and then go their own way
+        using var clone1 = template.Clone();
+        using var clone2 = template.Clone();
+        Assert.Multiple(() => {
+            Assert.That(clone1.DoString<double>("return counter()"), Is.EqualTo(2));
+            Assert.That(clone1.DoString<double>("return counter()"), Is.EqualTo(3));
+            Assert.That(clone2.DoString<double>("return counter()"), Is.EqualTo(2));
+            Assert.That(template.DoString<double>("return counter()"), Is.EqualTo(2));
+            Assert.That(clone1.DoString<bool>("return config.self == config and #config.list == 3 and string.upper(config.name) == 'TEMPLATE'"), Is.True);
+            Assert.That(clone1.DoString<bool>("return require('string') == string and package.loaded._G == _G"), Is.True);
+        });
+
+        // Coroutines that died by an error are copied as dead ones
+        template.DoString("failed = coroutine.create(function() local t = {} error('boom') end) coroutine.resume(failed)");
+        using (var clone3 = template.Clone()) {
+            Assert.That(clone3.DoString<string>("return coroutine.status(failed)"), Is.EqualTo("dead"));
+            Assert.That(clone3.DoString<string>("return select(2, coroutine.resume(failed))"), Is.EqualTo("cannot resume dead coroutine"));
+        }
+
+        // Copies are finalized only when their originals would be
+        template.DoString(@"
+            local mt = {}
+            late = setmetatable({}, mt)
+            mt.__gc = function() gcs = (gcs or '') .. 'late ' end
+            normal = setmetatable({}, { __gc = function() gcs = (gcs or '') .. 'normal ' end })");
+        using (var clone4 = template.Clone())
+            Assert.That(clone4.DoString<string>("late, normal = nil, nil collectgarbage() collectgarbage() return gcs"), Is.EqualTo("normal "));
+        template.DoString("late, normal = nil, nil");
+
+        // A failing __clone metamethod makes the clone fail
+        template.DoString("refuses = setmetatable({}, { __clone = function() error('refused') end })");
+        var ex = Assert.Throws<InvalidOperationException>(() => template.Clone());
+        Assert.That(ex.Message, Does.Contain("refused"));
+        template.DoString("refuses = nil");
+
+        // Suspended coroutines cannot be cloned
+        template.DoString("co = coroutine.create(function() coroutine.yield() end) coroutine.resume(co)");
+        Assert.Throws<InvalidOperationException>(() => template.Clone());
+
+    }
+
+    [Test]
+    public void CanCompileFunctionsLazily() {
+
+        using var state = LuaState.NewState();
+        state.LazyCompile = true;
+        Assert.That(state.LazyCompile, Is.True);
+
+        // Inner functions compile when first made, and see their upvalues and constants
+        Assert.That(state.DoString(@"
+            local scale <const> = 10
+            local count = 0
+            function make(n)
+              local function inner(x)
+                count = count + 1
+                for i = 1, n do x = x + scale end
+                return x, count
+              end
+              return inner
+            end
+            function broken()
+              return function() x = = 1 end
+            end"), Is.EqualTo(CallResult.Ok));
+        state.DoString("a, b = make(3)(1)");
+        Assert.Multiple(() => {
+            Assert.That(state.DoString<double>("return a"), Is.EqualTo(31));
+            Assert.That(state.DoString<double>("return b"), Is.EqualTo(1));
+        });
+
+        // A syntax error in a skimmed body surfaces when it is compiled
+        Assert.That(state.DoString("ok, msg = pcall(broken)"), Is.EqualTo(CallResult.Ok));
+        Assert.Multiple(() => {
+            Assert.That(state.DoString<bool>("return ok"), Is.False);
+            Assert.That(state.DoString<string>("return msg"), Does.Contain("unexpected symbol near '='"));
+        });
+
+        // Statements of a function in the expressions of a 'for' do not bring its variables into scope
+        Assert.That(state.DoString<double>(@"
+            local i = 5
+            local function outer()
+              return function()
+                local r
+                for i = (function() do end r = i return 1 end)(), 1 do end
+                return r
+              end
+            end
+            return outer()()"), Is.EqualTo(5));
+
+        // Dumps hold compiled bodies
+        Assert.That(state.LoadString("return function() return function() return 42 end end"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state.Dump(out byte[] luacode), Is.EqualTo(CallResult.Ok));
+        using var other = LuaState.NewState();
+        Assert.That(other.Load(luacode, "dumped"), Is.EqualTo(CallResult.Ok));
+        other.Call(0, 1);
+        other.Call(0, 1);
+        Assert.That(other.GetNumber(-1), Is.EqualTo(42));
+
+    }
+
+    private static string[] BundleModules(int count, out string[] sources) {
+        var names = new string[count];
+        sources = new string[count];
+        for (int i = 0; i < count; i++) {
+            names[i] = $"mod.m{i}";
+            sources[i] = $"local M = {{ id = {i} }} function M.twice(x) return 2 * x + M.id end return M";
+        }
+        return names;
+    }
+
+    [Test]
+    public void CanCompileAndLoadBundle() {
+
+        using var builder = LuaState.NewState();
+        using var state = LuaState.NewState();
+        string[] names = BundleModules(200, out string[] sources);
+
+        // The bundle is the same whatever the amount of threads
+        Assert.That(builder.CompileBundle(names, sources, 1, false, out byte[] serial), Is.EqualTo(CallResult.Ok));
+        Assert.That(builder.CompileBundle(names, sources, 0, false, out byte[] bundle), Is.EqualTo(CallResult.Ok));
+        Assert.That(bundle, Is.EqualTo(serial));
+        Assert.That(builder.GetTop(), Is.EqualTo(0));
+
+        // Load every module at once, and make them available to require
+        Assert.That(state.LoadBundle(bundle), Is.EqualTo(CallResult.Ok));
+        state.SetGlobal("bundle");
+        Assert.That(state.DoString("for name, f in pairs(bundle) do package.preload[name] = f end"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state.DoString<double>("return require('mod.m150').twice(5)"), Is.EqualTo(160));
+
+        // The first module that fails is reported
+        sources[120] = "return = 1";
+        sources[170] = "return = 2";
+        Assert.That(builder.CompileBundle(names, sources, 0, true, out _), Is.EqualTo(CallResult.SyntaxError));
+        Assert.That(builder.GetString(-1), Does.Contain("mod.m120"));
+
+        // As are duplicate names and bad bundles
+        Assert.That(builder.CompileBundle(new[] { "a", "a" }, new[] { "return 1", "return 2" }, 0, true, out _), Is.EqualTo(CallResult.RuntimeError));
+        Assert.That(state.LoadBundle(new byte[] { 1, 2, 3 }), Is.EqualTo(CallResult.SyntaxError));
+
+    }
+
+    [Test]
+    public void CanRequireFromBundle() {
+
+        using var state = LuaState.NewState();
+        string[] names = BundleModules(50, out string[] sources);
+        string path = Path.Combine(Path.GetTempPath(), $"modules{Environment.ProcessId}.bundle");
+        Assert.That(state.CompileBundle(names, sources, 0, true, out byte[] bundle), Is.EqualTo(CallResult.Ok));
+        File.WriteAllBytes(path, bundle);
+
+        try {
+
+            // Modules are found in the mapped bundle, ahead of the file system
+            Assert.That(state.DoString<bool>($"return package.addbundle([[{path}]])"), Is.True);
+            Assert.Multiple(() => {
+                Assert.That(state.DoString<double>("return require('mod.m7').twice(1)"), Is.EqualTo(9));
+                Assert.That(state.DoString<string>("return select(2, require('mod.m8'))"), Is.EqualTo(path));
+                Assert.That(state.DoString<string>("return select(2, pcall(require, 'mod.none'))"), Does.Contain("no module 'mod.none' in bundle"));
+            });
+
+            // Clones map the bundle again
+            using var clone = state.Clone();
+            Assert.That(clone.DoString<double>("return require('mod.m9').twice(1)"), Is.EqualTo(11));
+
+        } finally {
+            File.Delete(path);
+        }
+
+        // Files that are not bundles are refused
+        Assert.That(state.DoString<string>("return select(2, package.addbundle('missing.bundle'))"), Does.Contain("cannot map"));
+
+    }
+
+    [Test]
+    public void CanCachePathSearches() {
+
+        string dir = Path.Combine(Path.GetTempPath(), $"paths{Environment.ProcessId}");
+        string file = Path.Combine(dir, "cached.lua");
+        string cwd = Environment.CurrentDirectory;
+        Directory.CreateDirectory(dir);
+        LuaState.PathCache = PathCacheMode.On;
+
+        try {
+
+            using var state1 = LuaState.NewState();
+            using var state2 = LuaState.NewState();
+            string search = $"return (package.searchpath('cached', [[{Path.Combine(dir, "?.lua")}]]))";
+
+            // A failed search is remembered by all states until the cache is cleared
+            Assert.That(state1.DoString<string>(search), Is.Null);
+            File.WriteAllText(file, "return 1");
+            Assert.That(state2.DoString<string>(search), Is.Null);
+            LuaState.ClearPathCache();
+            Assert.That(state2.DoString<string>(search), Is.EqualTo(file));
+
+            // As is a file found
+            File.Delete(file);
+            Assert.That(state1.DoString<string>(search), Is.EqualTo(file));
+
+            // Searches with relative templates depend on the current directory and are never cached
+            string relative = "return (package.searchpath('cached', './?.lua'))";
+            Environment.CurrentDirectory = dir;
+            Assert.That(state1.DoString<string>(relative), Is.Null);
+            File.WriteAllText(file, "return 1");
+            Assert.That(state2.DoString<string>(relative), Is.EqualTo("./cached.lua"));
+            Environment.CurrentDirectory = cwd;
+            Assert.That(state1.DoString<string>(relative), Is.Null);
+            File.Delete(file);
+
+            LuaState.PathCache = PathCacheMode.Off;
+            Assert.That(LuaState.PathCache, Is.EqualTo(PathCacheMode.Off));
+            Assert.That(state1.DoString<string>(search), Is.Null);
+
+        } finally {
+            Environment.CurrentDirectory = cwd;
+            LuaState.PathCache = PathCacheMode.Off;
+            Directory.Delete(dir, true);
+        }
+
+    }
+
+    [Test]
+    public void CanReuseCoroutineThreads() {
+
+        using var state = LuaState.NewState();
+        Assert.That(state.ThreadPoolSize, Is.EqualTo(32));
+        string churn = @"
+            local sum = 0
+            for i = 1, 1000 do
+                local co = coroutine.wrap(function(a) local b = coroutine.yield(a + 1) return a + b end)
+                sum = sum + co(i) + co(1)
+            end
+            return sum";
+
+        // Reused threads start with a clean stack
+        state.GC(GarbageCollectWhat.Collect);
+        ulong threads = state.MemoryUsage(LuaType.Thread);
+        Assert.That(state.DoString<int>(churn), Is.EqualTo(1003000));
+        Assert.That(state.DoString<int>("collectgarbage() return select('#', coroutine.wrap(function(...) return ... end)())"), Is.EqualTo(0));
+
+        // Threads kept in the pool do not count as live threads
+        state.GC(GarbageCollectWhat.Collect);
+        Assert.That(state.MemoryUsage(LuaType.Thread), Is.EqualTo(threads));
+
+        // Smaller stacks still grow as needed
+        state.ThreadStackSize = 0;
+        Assert.That(state.ThreadStackSize, Is.GreaterThan(0));
+        Assert.That(state.DoString<int>("return coroutine.wrap(function() local function f(n) return n == 0 and 0 or 1 + f(n - 1) end return f(500) end)()"), Is.EqualTo(500));
+        state.ThreadPoolSize = 0;
+        Assert.That(state.DoString<int>(churn), Is.EqualTo(1003000));
+
+    }
+
+    [Test]
+    public void CanScheduleTasks() {
+
+        using var state = LuaState.NewState();
+
+        // Timers, yields and wakeups between tasks
+        Assert.That(state.DoString<string>(@"
+            local log = {}
+            local function add(s) log[#log + 1] = tostring(s) end
+            local waiter = sched.spawn(function() add('wait'); add(sched.wait()) end)
+            sched.spawn(function() sched.sleep(20); add('slept') end)
+            sched.spawn(function() sched.yield(); sched.wake(waiter, 'woken') end)
+            sched.spawn(function() add(sched.wait(5)) end)
+            assert(sched.run() == 0)
+            return table.concat(log, ' ')"), Is.EqualTo("wait woken nil slept"));
+
+        // The host wakes a waiting task from another thread; wakeups posted before it waits again are kept
+        long task = (long)state.DoString<double>("return sched.spawn(function() total = sched.wait() + sched.wait() end)");
+        using (var waker = state.GetWaker()) {
+            var host = Task.Run(() => {
+                Thread.Sleep(20);
+                Assert.That(waker.Wake(task, 40), Is.True);
+                Assert.That(waker.Wake(task, 2), Is.True);
+            });
+            Assert.That(state.DoString<int>("return sched.run()"), Is.EqualTo(0));
+            host.Wait();
+        }
+        Assert.That(state.DoString<int>("return total"), Is.EqualTo(42));
+
+        // The host releases its waker without waking the task: the scheduler stops waiting for it
+        state.DoString("sched.spawn(function() sched.wait() end)");
+        var waker2 = state.GetWaker();
+        var releaser = Task.Run(() => {
+            Thread.Sleep(100);
+            waker2.Dispose();
+        });
+        Assert.That(state.DoString<int>("return sched.run()"), Is.EqualTo(1));
+        releaser.Wait();
+
+    }
+
+    [Test]
+    public void CanOpenManyStatesWithScheduler() {
+
+        // States and clones that never ask for a waker hold no event of the scheduler
+        var states = new List<LuaState>();
+        try {
+            for (int i = 0; i < 2000; i++) {
+                var state = LuaState.NewState();
+                states.Add(state);
+                states.Add(state.Clone());
+            }
+            Assert.That(states[states.Count - 1].DoString<int>(@"
+                local n = 0
+                sched.spawn(function() sched.sleep(5); n = n + 1 end)
+                sched.spawn(function() sched.wait(1); n = n + 1 end)
+                assert(sched.run() == 0)
+                return n"), Is.EqualTo(2));
+        }
+        finally {
+            foreach (var state in states)
+                state.Dispose();
+        }
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkCompileBundle() {
+
+        using var state = LuaState.NewState();
+        string[] names = BundleModules(3000, out string[] sources);
+
+        // Serially in the state, then on the thread pool
+        var watch = System.Diagnostics.Stopwatch.StartNew();
+        for (int i = 0; i < names.Length; i++) {
+            Assert.That(state.LoadString(sources[i]), Is.EqualTo(CallResult.Ok));
+            state.Pop(1);
+        }
+        double serial = watch.Elapsed.TotalMilliseconds;
+        watch.Restart();
+        Assert.That(state.CompileBundle(names, sources, 0, true, out byte[] bundle), Is.EqualTo(CallResult.Ok));
+        double parallel = watch.Elapsed.TotalMilliseconds;
+        watch.Restart();
+        Assert.That(state.LoadBundle(bundle), Is.EqualTo(CallResult.Ok));
+        double load = watch.Elapsed.TotalMilliseconds;
+        TestContext.WriteLine($"{names.Length} modules: serial {serial:F1} ms, bundle {parallel:F1} ms, load {load:F1} ms");
+
+    }
+
 }
@@ -189,4 +189,43 @@ public class FunctionTests {
 
     }
 
+    [Test]
+    public void CanSuspendOnPendingDelegate() {
+
+        using var waker = state.GetWaker();
+        var hosts = new List<Task>();
+
+        // Completes on another thread, waking the task that called it
+        state.PushCSharpFunction("fetch", L => {
+            long task = L.CurrentTask;
+            long arg = (long)L.GetNumber(-1);
+            Assert.That(task, Is.Not.EqualTo(0));
+            hosts.Add(Task.Run(() => {
+                Thread.Sleep(10);
+                waker.Wake(task, arg * 2);
+            }));
+            return LuaState.Pending;
+        });
+
+        // The tasks wait for their calls while the loop blocks
+        Assert.That(state.DoString<int>(@"
+            total = 0
+            for i = 1, 3 do sched.spawn(function() total = total + fetch(i) end) end
+            return sched.run()"), Is.EqualTo(0));
+        Assert.That(state.DoString<int>("return total"), Is.EqualTo(12));
+        Task.WaitAll(hosts.ToArray());
+
+        // A task woken before its call completes the call at once
+        state.PushCSharpFunction("ready", L => LuaState.Pending);
+        long early = (long)state.DoString<double>("return sched.spawn(function() sched.yield() result = ready() end)");
+        Assert.That(waker.Wake(early, 7), Is.True);
+        Assert.That(state.DoString<int>("return sched.run()"), Is.EqualTo(0));
+        Assert.That(state.DoString<int>("return result"), Is.EqualTo(7));
+
+        // Outside the scheduler, the resume completes the call
+        state.PushCSharpFunction("suspend", L => LuaState.Pending);
+        Assert.That(state.DoString<int>("local co = coroutine.wrap(function() return suspend() + 1 end) co() return co(41)"), Is.EqualTo(42));
+
+    }
+
 }
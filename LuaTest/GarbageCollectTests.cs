@@ -0,0 +1,290 @@
+namespace LuaTest;
+
+using Lua;
+
+public class GarbageCollectTests {
+
+    [NotNull]
+    LuaState state;
+
+    [SetUp]
+    public void CreateState() {
+        this.state = LuaState.NewState();
+    }
+
+    [TearDown]
+    public void CleanupState() {
+        this.state.Dispose();
+    }
+
+    [Test]
+    public void CanGetCollectorRecords() {
+
+        // Produce some garbage and collect it
+        Assert.That(state.DoString("for i = 1, 10000 do local t = { i } end"), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+
+        // Grab records
+        var records = state.GCRecords();
+
+        Assert.Multiple(() => {
+
+            // Verify we got records in order
+            Assert.That(records, Is.Not.Empty);
+            Assert.That(records.Length, Is.LessThanOrEqualTo(LuaState.GCRecordCapacity));
+            for (int i = 1; i < records.Length; i++) {
+                Assert.That(records[i].Sequence, Is.EqualTo(records[i - 1].Sequence + 1));
+            }
+
+            // Verify the full collection swept and freed memory
+            Assert.That(records.Any(x => x.Phase == GarbageCollectPhase.Sweep && x.Swept > 0 && x.BytesFreed > 0), Is.True);
+            Assert.That(records.Any(x => x.Phase == GarbageCollectPhase.Atomic), Is.True);
+
+        });
+
+    }
+
+    [Test]
+    public void CanCountBytesFreedWhileAllocating() {
+
+        // Finalizers that allocate more than they release, rehashing a table as it grows
+        Assert.That(state.DoString(@"
+            sink = {}
+            local mt = { __gc = function() local t = {} for i = 1, 1000 do t['k' .. i] = i end sink[#sink + 1] = t end }
+            for i = 1, 10 do setmetatable({}, mt) end
+            "), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+
+        // The old parts released by the rehashes are still counted
+        var records = state.GCRecords();
+        Assert.That(records.Any(x => x.Phase == GarbageCollectPhase.Finalize && x.BytesFreed > 0), Is.True);
+
+    }
+
+    [Test]
+    public void CanGetPhaseTotals() {
+
+        // Collect twice
+        state.GC(GarbageCollectWhat.Collect);
+        state.GC(GarbageCollectWhat.Collect);
+
+        // Grab totals
+        var atomic = state.GCPhaseTotal(GarbageCollectPhase.Atomic);
+        var sweep = state.GCPhaseTotal(GarbageCollectPhase.Sweep);
+
+        Assert.Multiple(() => {
+            Assert.That(atomic.Count, Is.GreaterThanOrEqualTo(2));
+            Assert.That(atomic.Marked, Is.GreaterThan(0));
+            Assert.That(sweep.Swept, Is.GreaterThan(0));
+            Assert.That(sweep.MaxDuration, Is.LessThanOrEqualTo(sweep.Duration));
+        });
+
+    }
+
+    [Test]
+    public void CanStepWithTimeBudget() {
+
+        // Produce garbage without letting the collector run
+        state.GC(GarbageCollectWhat.Stop);
+        Assert.That(state.DoString("keep = {} for i = 1, 50000 do local t = { i } if i % 10 == 0 then keep[#keep + 1] = t end end"), Is.EqualTo(CallResult.Ok));
+
+        // Step with a small budget until the cycle finishes
+        int steps = 0;
+        ulong total = 0;
+        bool done = false;
+        while (!done && steps < 100000) {
+            done = state.GCStep(TimeSpan.FromMilliseconds(0.2), out ulong work);
+            total += work;
+            steps++;
+        }
+
+        Assert.Multiple(() => {
+            Assert.That(done, Is.True);
+            Assert.That(total, Is.GreaterThan(0));
+            Assert.That(state.DoString<double>("return #keep"), Is.EqualTo(5000));
+            Assert.That(state.GC(GarbageCollectWhat.StepTime, 1000), Is.EqualTo(0).Or.EqualTo(1));
+        });
+
+    }
+
+    [Test]
+    public void CanSwitchCollectorMode() {
+
+        Assert.Multiple(() => {
+
+            // Switch back and forth
+            Assert.That(state.GCMode, Is.EqualTo(GarbageCollectMode.Incremental));
+            Assert.That(state.GCGenerational(0, 0), Is.EqualTo(GarbageCollectMode.Incremental));
+            Assert.That(state.GCMode, Is.EqualTo(GarbageCollectMode.Generational));
+            Assert.That(state.DoString("for i = 1, 10000 do local t = { i } end"), Is.EqualTo(CallResult.Ok));
+            Assert.That(state.GCIncremental(0, 0, 0), Is.EqualTo(GarbageCollectMode.Generational));
+
+            // Switch through the generic entry point
+            Assert.That(state.GC(GarbageCollectWhat.Generational, 25), Is.EqualTo((int)GarbageCollectMode.Incremental));
+            Assert.That(state.GC(GarbageCollectWhat.Mode), Is.EqualTo((int)GarbageCollectMode.Generational));
+            Assert.That(state.GC(GarbageCollectWhat.Incremental), Is.EqualTo((int)GarbageCollectMode.Generational));
+
+        });
+
+    }
+
+    [Test]
+    public void AdaptivePolicyPicksModeFromSurvival() {
+
+        // Enable the policy
+        Assert.That(state.GCAdaptive(-1), Is.EqualTo(0));
+
+        // Short-lived objects should move the collector to generational mode
+        Assert.That(state.DoString("for i = 1, 1000000 do local t = { i } end"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state.GCMode, Is.EqualTo(GarbageCollectMode.Generational));
+
+        // Building a structure where everything survives should move it back
+        Assert.That(state.DoString("keep = {} for i = 1, 1000000 do keep[i] = { i } end"), Is.EqualTo(CallResult.Ok));
+        Assert.That(state.GCMode, Is.EqualTo(GarbageCollectMode.Incremental));
+
+        // Disable it again
+        Assert.That(state.GCAdaptive(0), Is.GreaterThan(0));
+
+    }
+
+    [Test]
+    public void CanFreeInBackground() {
+
+        // Enable background freeing
+        Assert.That(state.GCBackgroundFree, Is.False);
+        state.GCBackgroundFree = true;
+        Assert.That(state.GCBackgroundFree, Is.True);
+
+        // Allocate and drop a large heap
+        Assert.That(state.DoString("keep = {} for i = 1, 100000 do local t = { i } if i % 10 == 0 then keep[#keep + 1] = t end end"), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+        Assert.That(state.DoString<double>("return #keep"), Is.EqualTo(10000));
+
+        // Disable again
+        state.GCBackgroundFree = false;
+        Assert.That(state.GCBackgroundFree, Is.False);
+
+    }
+
+    [Test]
+    public void PoolAllocatorRejectsBackgroundFree() {
+
+        using var pooled = LuaState.NewState(LuaLib.All, LuaAllocator.Pool);
+        Assert.Throws<InvalidOperationException>(() => pooled.GCBackgroundFree = true);
+
+    }
+
+    [Test]
+    public void CanMarkFullCollectionsInParallel() {
+
+        // Use up to four threads
+        state.GCMarkThreads = 4;
+        Assert.That(state.GCMarkThreads, Is.InRange(1, Math.Min(4, Environment.ProcessorCount)));
+
+        // Build a heap large enough to be marked in parallel, with weak tables and coroutines in it
+        Assert.That(state.DoString(@"
+            root = {} weak = setmetatable({}, { __mode = 'k' })
+            for i = 1, 200000 do
+              local t = { i, tostring(i) }
+              root[i] = function() return t end
+              if i % 10 == 0 then weak[t] = true end
+              if i % 1000 == 0 then root[-i] = coroutine.create(function() return t end) end
+            end
+            "), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+
+        // Everything reachable survived
+        Assert.That(state.DoString<bool>(@"
+            local n = 0 for k in pairs(weak) do n = n + 1 end
+            for i = 1, 200000 do if root[i]()[2] ~= tostring(i) then return false end end
+            return n == 20000 and select(2, coroutine.resume(root[-1000]))[1] == 1000
+            "), Is.True);
+
+        // A metatable that gains a __mode field later makes its tables weak
+        Assert.That(state.DoString<bool>(@"
+            objmt = {} late = setmetatable({}, objmt)
+            for i = 1, 200000 do root[i] = setmetatable({}, objmt) end
+            collectgarbage()
+            objmt.__mode = 'v' late[1] = {}
+            collectgarbage()
+            return late[1] == nil and getmetatable(root[200000]) == objmt
+            "), Is.True);
+
+        // Back to serial marking
+        state.GCMarkThreads = 1;
+        Assert.That(state.GCMarkThreads, Is.EqualTo(1));
+
+    }
+
+    [Test]
+    public void CanQueueFinalizers() {
+
+        // Queue finalizers
+        state.GCFinalizerQueue = true;
+        Assert.That(state.DoString("fin = 0 for i = 1, 100 do setmetatable({}, { __gc = function() fin = fin + 1 end }) end"), Is.EqualTo(CallResult.Ok));
+        state.GC(GarbageCollectWhat.Collect);
+
+        // Nothing ran yet
+        Assert.Multiple(() => {
+            Assert.That(state.PendingFinalizers, Is.EqualTo(100));
+            Assert.That(state.DoString<double>("return fin"), Is.EqualTo(0));
+        });
+
+        // Drain in batches
+        Assert.That(state.RunFinalizers(10), Is.EqualTo(10));
+        Assert.That(state.PendingFinalizers, Is.EqualTo(90));
+        Assert.That(state.RunFinalizers(0, TimeSpan.FromSeconds(10)), Is.EqualTo(90));
+        Assert.Multiple(() => {
+            Assert.That(state.PendingFinalizers, Is.EqualTo(0));
+            Assert.That(state.DoString<double>("return fin"), Is.EqualTo(100));
+        });
+
+    }
+
+    [Test]
+    public void EphemeronChainsConverge() {
+
+        // Chain of keys spread over many weak-keyed caches, anchored at its first key
+        Assert.That(state.DoString(@"
+            caches = {}
+            for i = 1, 50 do caches[i] = setmetatable({}, { __mode = 'k' }) end
+            local keys = {}
+            for i = 1, 20001 do keys[i] = {} end
+            for i = 1, 20000 do caches[i * 7 % 50 + 1][keys[i]] = keys[i + 1] end
+            anchor = keys[1]
+            function count() local n = 0 for _, c in ipairs(caches) do for _ in pairs(c) do n = n + 1 end end return n end
+            "), Is.EqualTo(CallResult.Ok));
+
+        // The whole chain is reachable
+        state.GC(GarbageCollectWhat.Collect);
+        Assert.That(state.DoString<double>("return count()"), Is.EqualTo(20000));
+
+        // And all of it goes with the anchor
+        state.DoString("anchor = nil");
+        state.GC(GarbageCollectWhat.Collect);
+        Assert.That(state.DoString<double>("return count()"), Is.EqualTo(0));
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkEphemeronConvergence() {
+
+        // Time full collections over chains of weak-keyed caches of growing length
+        foreach (int n in new[] { 10000, 50000, 200000 }) {
+            double seconds = state.DoString<double>($@"
+                local caches = {{}}
+                for i = 1, 50 do caches[i] = setmetatable({{}}, {{ __mode = 'k' }}) end
+                local keys = {{}}
+                for i = 1, {n} + 1 do keys[i] = {{}} end
+                for i = 1, {n} do caches[i * 7 % 50 + 1][keys[i]] = keys[i + 1] end
+                local anchor = keys[1]
+                keys = nil
+                collectgarbage()
+                local t = os.clock() for i = 1, 5 do collectgarbage() end
+                return os.clock() - t");
+            TestContext.WriteLine($"{n} chained entries: {seconds * 1000.0 / 5.0:F3} ms/collection");
+        }
+
+    }
+
+}
@@ -0,0 +1,100 @@
+namespace LuaTest;
+
+using Lua;
+
+public class StringTests {
+
+    [NotNull]
+    LuaState state;
+
+    [SetUp]
+    public void CreateState() {
+        this.state = LuaState.NewState();
+        this.state.DoString(@"
+            bytes = {}
+            for i = 0, 255 do bytes[#bytes + 1] = string.char(i) end
+            bytes = table.concat(bytes):rep(3)
+            function perchar(f, s)
+                local t = {}
+                for i = 1, #s do t[i] = f(s:sub(i, i)) end
+                return table.concat(t)
+            end");
+    }
+
+    [TearDown]
+    public void CleanupState() {
+        this.state.Dispose();
+    }
+
+    [Test]
+    public void UpperAndLowerMatchPerCharacter() {
+
+        // Single characters always take the scalar path, so whole-string results must match them byte for byte
+        Assert.Multiple(() => {
+            Assert.That(state.DoString<bool>("for i = 0, 64 do local s = bytes:sub(i + 1) if s:upper() ~= perchar(string.upper, s) then return false end end return true"), Is.True);
+            Assert.That(state.DoString<bool>("for i = 0, 64 do local s = bytes:sub(i + 1) if s:lower() ~= perchar(string.lower, s) then return false end end return true"), Is.True);
+        });
+
+    }
+
+    [Test]
+    public void ReverseMatchesPerCharacter() {
+
+        // Reverse every suffix and compare against a character by character reversal
+        Assert.That(state.DoString<bool>(@"
+            for i = 0, 64 do
+                local s, r = bytes:sub(i + 1), {}
+                for j = #s, 1, -1 do r[#r + 1] = s:sub(j, j) end
+                if s:reverse() ~= table.concat(r) then return false end
+            end
+            return true"), Is.True);
+
+    }
+
+    [Test]
+    public void RepMatchesConcat() {
+
+        // Compare against table.concat for short and long units, with and without separators
+        Assert.That(state.DoString<bool>(@"
+            for n = 0, 9 do
+                for _, sep in ipairs { '', ',', ('-'):rep(40) } do
+                    for _, s in ipairs { '', 'x', ('abc'):rep(15) } do
+                        local t = {}
+                        for i = 1, n do t[i] = s end
+                        if s:rep(n, sep) ~= table.concat(t, sep) then return false end
+                    end
+                end
+            end
+            return true"), Is.True);
+
+    }
+
+    [Test]
+    public void Utf8LenStopsAtInvalidByte() {
+
+        Assert.Multiple(() => {
+
+            // Long ascii and multi-byte runs
+            Assert.That(state.DoString<double>("return utf8.len(('h\\u{E9}llo w\\u{F6}rld '):rep(30))"), Is.EqualTo(360));
+            Assert.That(state.DoString<double>("return utf8.len(('a'):rep(100), 10, 60)"), Is.EqualTo(51));
+
+            // Invalid byte after a long ascii run
+            Assert.That(state.DoString<double>("return select(2, utf8.len(('a'):rep(50) .. '\\xff' .. ('b'):rep(50)))"), Is.EqualTo(51));
+
+        });
+
+    }
+
+    [Test, Explicit("Microbenchmark")]
+    public void BenchmarkStringKernels() {
+
+        // Time the vectorized library functions on a ~1MB string
+        state.DoString("big = ('Hello, World! the quick brown fox '):rep(30000)");
+        foreach (var expr in new[] { "big:upper()", "big:lower()", "big:reverse()", "utf8.len(big)", "('0123456789abcdefghijklmnopqrstuvwxyz'):rep(30000)" }) {
+            double seconds = state.DoString<double>($"local t = os.clock() for i = 1, 200 do local _ = {expr} end return os.clock() - t");
+            TestContext.WriteLine($"{expr}: {seconds * 1000.0 / 200.0:F3} ms/op");
+        }
+
+    }
+
+}